@@ -0,0 +1,229 @@
+#include "bayer.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "helpers.h"
+
+namespace camera
+{
+
+using namespace base::samples::frame;
+
+static const Bayer::Format BAYER_FORMATS[] = {
+    {V4L2_PIX_FMT_SRGGB8, MODE_BAYER_RGGB, 8, false},
+    {V4L2_PIX_FMT_SGRBG8, MODE_BAYER_GRBG, 8, false},
+    {V4L2_PIX_FMT_SBGGR8, MODE_BAYER_BGGR, 8, false},
+    {V4L2_PIX_FMT_SGBRG8, MODE_BAYER_GBRG, 8, false},
+    {V4L2_PIX_FMT_SRGGB10, MODE_BAYER_RGGB, 10, false},
+    {V4L2_PIX_FMT_SGRBG10, MODE_BAYER_GRBG, 10, false},
+    {V4L2_PIX_FMT_SBGGR10, MODE_BAYER_BGGR, 10, false},
+    {V4L2_PIX_FMT_SGBRG10, MODE_BAYER_GBRG, 10, false},
+    {V4L2_PIX_FMT_SRGGB10P, MODE_BAYER_RGGB, 10, true},
+    {V4L2_PIX_FMT_SGRBG10P, MODE_BAYER_GRBG, 10, true},
+    {V4L2_PIX_FMT_SBGGR10P, MODE_BAYER_BGGR, 10, true},
+    {V4L2_PIX_FMT_SGBRG10P, MODE_BAYER_GBRG, 10, true},
+    {V4L2_PIX_FMT_SRGGB12, MODE_BAYER_RGGB, 12, false},
+    {V4L2_PIX_FMT_SGRBG12, MODE_BAYER_GRBG, 12, false},
+    {V4L2_PIX_FMT_SBGGR12, MODE_BAYER_BGGR, 12, false},
+    {V4L2_PIX_FMT_SGBRG12, MODE_BAYER_GBRG, 12, false},
+    {V4L2_PIX_FMT_SRGGB12P, MODE_BAYER_RGGB, 12, true},
+    {V4L2_PIX_FMT_SGRBG12P, MODE_BAYER_GRBG, 12, true},
+    {V4L2_PIX_FMT_SBGGR12P, MODE_BAYER_BGGR, 12, true},
+    {V4L2_PIX_FMT_SGBRG12P, MODE_BAYER_GBRG, 12, true}
+};
+
+static const size_t NUM_BAYER_FORMATS = sizeof(BAYER_FORMATS) / sizeof(BAYER_FORMATS[0]);
+
+Bayer::Format const* Bayer::getFormat(uint32_t pixelformat) {
+    for(size_t i=0; i<NUM_BAYER_FORMATS; ++i) {
+        if(BAYER_FORMATS[i].pixelformat == pixelformat) {
+            return &BAYER_FORMATS[i];
+        }
+    }
+    return NULL;
+}
+
+Bayer::Format const* Bayer::findFormat(frame_mode_t mode, uint8_t depth, bool packed) {
+    for(size_t i=0; i<NUM_BAYER_FORMATS; ++i) {
+        if(BAYER_FORMATS[i].mode == mode && BAYER_FORMATS[i].depth == depth &&
+                BAYER_FORMATS[i].packed == packed) {
+            return &BAYER_FORMATS[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t Bayer::getRowSize(Format const& format, uint32_t width) {
+    if(format.depth == 8) {
+        return width;
+    }
+    if(!format.packed) {
+        return width * 2;
+    }
+    return format.depth == 10 ? (width + 3) / 4 * 5 : (width + 1) / 2 * 3;
+}
+
+void Bayer::copy(const uint8_t* data, Format const& format, uint32_t width,
+        uint32_t height, uint32_t bytesperline, std::vector<uint8_t>& image, 
+        uint32_t row_size) {
+    if(bytesperline == 0) {
+        bytesperline = getRowSize(format, width);
+    }
+    uint32_t pixel_bytes = format.depth == 8 ? width : width * 2;
+    if(row_size == 0) {
+        row_size = pixel_bytes;
+    }
+    image.resize((size_t)row_size * height);
+
+    if(!format.packed) {
+        // The unpacked formats already have the memory layout of the frame.
+        Helpers::copyRows(data, bytesperline, image.data(), row_size, pixel_bytes, height);
+        return;
+    }
+
+    for(uint32_t y=0; y<height; ++y) {
+        uint16_t* out = (uint16_t*)&image[(size_t)y * row_size];
+        if(format.depth == 10) {
+            unpack10(data + (size_t)y * bytesperline, width, out);
+        } else {
+            unpack12(data + (size_t)y * bytesperline, width, out);
+        }
+    }
+}
+
+void Bayer::unpack10(const uint8_t* data, uint32_t width, uint16_t* out) {
+    // Bytes 0-3 contain the upper 8 bits of the pixels 0-3, byte 4 the lower 2 bits.
+    uint32_t x = 0;
+    for(; x + 4 <= width; x += 4, data += 5) {
+        uint8_t low = data[4];
+        out[x] = (uint16_t)(data[0] << 2 | (low & 0x3));
+        out[x+1] = (uint16_t)(data[1] << 2 | (low >> 2 & 0x3));
+        out[x+2] = (uint16_t)(data[2] << 2 | (low >> 4 & 0x3));
+        out[x+3] = (uint16_t)(data[3] << 2 | (low >> 6));
+    }
+    for(uint32_t i=0; x < width; ++x, ++i) {
+        out[x] = (uint16_t)(data[i] << 2 | (data[4] >> (2 * i) & 0x3));
+    }
+}
+
+void Bayer::unpack12(const uint8_t* data, uint32_t width, uint16_t* out) {
+    // Bytes 0 and 1 contain the upper 8 bits of the pixels 0 and 1, byte 2 the lower 4 bits.
+    uint32_t x = 0;
+    for(; x + 2 <= width; x += 2, data += 3) {
+        out[x] = (uint16_t)(data[0] << 4 | (data[2] & 0xF));
+        out[x+1] = (uint16_t)(data[1] << 4 | (data[2] >> 4));
+    }
+    if(x < width) {
+        out[x] = (uint16_t)(data[0] << 4 | (data[2] & 0xF));
+    }
+}
+
+void Bayer::demosaic(const uint8_t* data, Format const& format, uint32_t width,
+        uint32_t height, uint32_t bytesperline, frame_mode_t mode,
+        std::vector<uint8_t>& image, WorkerPool* pool, uint32_t row_size) {
+    assert(format.depth == 8 && width >= 2 && height >= 2);
+    assert(isDemosaicModeSupported(mode));
+    if(row_size == 0) {
+        row_size = width * 3;
+    }
+    image.resize((size_t)row_size * height);
+    DemosaicRows rows(data, format.mode, width, height,
+            bytesperline != 0 ? bytesperline : width, mode == MODE_BGR, image.data(), row_size);
+    if(pool != NULL) {
+        pool->runRowBands(height, rows);
+    } else {
+        rows(0, height);
+    }
+}
+
+Bayer::DemosaicRows::DemosaicRows(const uint8_t* data, frame_mode_t pattern,
+        uint32_t width, uint32_t height, uint32_t bytesperline, bool bgr, uint8_t* image,
+        uint32_t row_size) : mData(data), mWidth(width), mHeight(height), 
+        mBytesPerLine(bytesperline), mImage(image), mRowSize(row_size), 
+        mGreenFirst(pattern == MODE_BAYER_GRBG || pattern == MODE_BAYER_GBRG),
+        mRedInEvenRows(pattern == MODE_BAYER_RGGB || pattern == MODE_BAYER_GRBG), mBGR(bgr) {
+}
+
+/**
+ * Interpolates a single pixel, the neighbours are mirrored at the borders.
+ * 'c' is the output channel of the red or blue pixels of the row.
+ */
+static inline void demosaicPixel(const uint8_t* up, const uint8_t* cur, const uint8_t* down,
+        uint32_t width, uint32_t x, bool green, int c, uint8_t* out) {
+    uint32_t l = x > 0 ? x - 1 : x + 1;
+    uint32_t r = x + 1 < width ? x + 1 : x - 1;
+    if(green) {
+        out[1] = cur[x];
+        out[c] = (uint8_t)((cur[l] + cur[r] + 1) >> 1);
+        out[2-c] = (uint8_t)((up[x] + down[x] + 1) >> 1);
+    } else {
+        out[c] = cur[x];
+        out[1] = (uint8_t)((cur[l] + cur[r] + up[x] + down[x] + 2) >> 2);
+        out[2-c] = (uint8_t)((up[l] + up[r] + down[l] + down[r] + 2) >> 2);
+    }
+}
+
+/**
+ * Interpolates the pixels [x, end) which do not touch the left or right border,
+ * two pixels per iteration so the inner loop has no branches.
+ * C is the output channel of the red or blue pixels of the row, the pixel
+ * at 'x' is green if GREEN_FIRST is set.
+ */
+template<int C, bool GREEN_FIRST>
+static inline void demosaicPairs(const uint8_t* __restrict__ up,
+        const uint8_t* __restrict__ cur, const uint8_t* __restrict__ down,
+        uint32_t x, uint32_t end, uint8_t* __restrict__ out) {
+    const int O = 2 - C;
+    // Offsets of the green and the red/blue pixel of a pair.
+    const int G = GREEN_FIRST ? 0 : 1;
+    const int N = 1 - G;
+    for(; x < end; x += 2, out += 6) {
+        uint32_t xg = x + G, xn = x + N;
+        uint8_t* og = out + 3 * G;
+        uint8_t* on = out + 3 * N;
+        og[1] = cur[xg];
+        og[C] = (uint8_t)((cur[xg-1] + cur[xg+1] + 1) >> 1);
+        og[O] = (uint8_t)((up[xg] + down[xg] + 1) >> 1);
+        on[C] = cur[xn];
+        on[1] = (uint8_t)((cur[xn-1] + cur[xn+1] + up[xn] + down[xn] + 2) >> 2);
+        on[O] = (uint8_t)((up[xn-1] + up[xn+1] + down[xn-1] + down[xn+1] + 2) >> 2);
+    }
+}
+
+void Bayer::DemosaicRows::operator()(uint32_t first_row, uint32_t end_row) const {
+    // Pixels [1, end) are processed in pairs.
+    uint32_t end = 1 + ((mWidth - 2) & ~1u);
+    for(uint32_t y=first_row; y<end_row; ++y) {
+        const uint8_t* cur = mData + (size_t)y * mBytesPerLine;
+        const uint8_t* up = mData + (size_t)(y > 0 ? y - 1 : y + 1) * mBytesPerLine;
+        const uint8_t* down = mData + (size_t)(y + 1 < mHeight ? y + 1 : y - 1) * mBytesPerLine;
+        uint8_t* out = mImage + (size_t)y * mRowSize;
+        bool odd = (y & 1) != 0;
+        bool green_first = mGreenFirst != odd;
+        // Output channel of the red/blue pixels of this row.
+        int c = (mRedInEvenRows != odd) != mBGR ? 0 : 2;
+
+        demosaicPixel(up, cur, down, mWidth, 0, green_first, c, out);
+        // Pixel 1 is green if pixel 0 is not.
+        if(c == 0) {
+            if(green_first) {
+                demosaicPairs<0, false>(up, cur, down, 1, end, out + 3);
+            } else {
+                demosaicPairs<0, true>(up, cur, down, 1, end, out + 3);
+            }
+        } else {
+            if(green_first) {
+                demosaicPairs<2, false>(up, cur, down, 1, end, out + 3);
+            } else {
+                demosaicPairs<2, true>(up, cur, down, 1, end, out + 3);
+            }
+        }
+        for(uint32_t x=end; x<mWidth; ++x) {
+            demosaicPixel(up, cur, down, mWidth, x, green_first == ((x & 1) == 0), c,
+                    out + 3 * x);
+        }
+    }
+}
+
+} // end namespace camera
@@ -0,0 +1,113 @@
+/*
+ * \file    bayer.h
+ *
+ * \brief   Bayer raw formats of machine vision cameras: unpacking and demosaicing.
+ */
+
+#ifndef _CAM_BAYER_H_
+#define _CAM_BAYER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <base/samples/Frame.hpp>
+
+#include "worker_pool.h"
+
+namespace camera
+{
+
+class Bayer {
+ public:
+    /**
+     * Description of a v4l2 Bayer pixel format.
+     */
+    struct Format {
+        uint32_t pixelformat;
+        base::samples::frame::frame_mode_t mode;
+        uint8_t depth; // Significant bits per pixel.
+        bool packed; // MIPI packing: 4 pixels in 5 bytes (10 bit), 2 pixels in 3 bytes (12 bit).
+    };
+
+    /**
+     * Returns the description or NULL if 'pixelformat' is no supported Bayer format.
+     */
+    static Format const* getFormat(uint32_t pixelformat);
+
+    /**
+     * Returns the format with the passed pattern, depth and packing or NULL.
+     */
+    static Format const* findFormat(base::samples::frame::frame_mode_t mode, uint8_t depth,
+            bool packed);
+
+    static bool isBayerMode(base::samples::frame::frame_mode_t mode) {
+        return mode >= base::samples::frame::MODE_BAYER_RGGB &&
+                mode <= base::samples::frame::MODE_BAYER_GBRG;
+    }
+
+    /**
+     * Modes which can be created by demosaic().
+     */
+    static bool isDemosaicModeSupported(base::samples::frame::frame_mode_t mode) {
+        return mode == base::samples::frame::MODE_RGB || mode == base::samples::frame::MODE_BGR;
+    }
+
+    /**
+     * Bytes of one row without padding.
+     */
+    static uint32_t getRowSize(Format const& format, uint32_t width);
+
+    /**
+     * Copies the image into the layout of a base::samples::frame::Frame:
+     * one byte per pixel for the 8 bit formats, otherwise one uint16_t per pixel.
+     * The 10 and 12 bit formats are unpacked if required, row padding is removed.
+     * \param bytesperline Row size of 'data', 0 if the rows are not padded.
+     * \param row_size Row size of 'image', 0 creates tightly packed rows.
+     */
+    static void copy(const uint8_t* data, Format const& format, uint32_t width,
+            uint32_t height, uint32_t bytesperline, std::vector<uint8_t>& image,
+            uint32_t row_size = 0);
+
+    /**
+     * Bilinear demosaicing of an 8 bit Bayer image to RGB or BGR. Every missing
+     * color is the mean of the two or four nearest pixels of that color,
+     * the image is mirrored at its borders. Width and height have to be at least 2.
+     * \param pool Used to process row bands in parallel, may be NULL.
+     * \param row_size Row size of 'image', 0 creates tightly packed rows.
+     */
+    static void demosaic(const uint8_t* data, Format const& format, uint32_t width,
+            uint32_t height, uint32_t bytesperline, base::samples::frame::frame_mode_t mode,
+            std::vector<uint8_t>& image, WorkerPool* pool, uint32_t row_size = 0);
+
+ private:
+    /**
+     * Demosaics the rows [first_row, end_row), see WorkerPool::runRowBands().
+     */
+    struct DemosaicRows {
+        DemosaicRows(const uint8_t* data, base::samples::frame::frame_mode_t pattern,
+                uint32_t width, uint32_t height, uint32_t bytesperline, bool bgr,
+                uint8_t* image, uint32_t row_size);
+
+        void operator()(uint32_t first_row, uint32_t end_row) const;
+
+        const uint8_t* mData;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mBytesPerLine;
+        uint8_t* mImage;
+        uint32_t mRowSize;
+        bool mGreenFirst; // Even rows start with green.
+        bool mRedInEvenRows; // Even rows contain red, otherwise blue.
+        bool mBGR;
+    };
+
+    static void unpack10(const uint8_t* data, uint32_t width, uint16_t* out);
+    static void unpack12(const uint8_t* data, uint32_t width, uint16_t* out);
+};
+
+} // end namespace camera
+
+#endif
@@ -1,27 +1,42 @@
 #include "cam_config.h"
+#include "cam_logging.h"
 
 namespace camera 
 {
  
-CamConfig::CamConfig(std::string const& device) : mFd(0), mCapability(), mCamCtrls(), 
-            mFormat(), mCropcap(), mFormatDescriptions(), mStreamparm(), mmapBuffer(NULL), 
-            mStreamingActivated(false), mConversionRequiredYUYV2RGB(false) {
+CamConfig::CamConfig(std::string const& device) : mDevice(NULL) {
     LOG_DEBUG("CamConfig: constructor");
-    
+    init(new KernelV4L2Device(device));
+}
+
+CamConfig::CamConfig(V4L2Device* device) : mDevice(NULL) {
+    LOG_DEBUG("CamConfig: constructor, injected device");
+    init(device);
+}
+
+void CamConfig::init(V4L2Device* device) {
+    mDevice = device;
     memset(&mCapability, 0, sizeof(struct v4l2_capability));
     memset(&mCropcap, 0, sizeof(struct v4l2_cropcap));
     memset(&mFormat, 0, sizeof(struct v4l2_format));
     memset(&mStreamparm, 0, sizeof(struct v4l2_streamparm));
+    mmapBuffer = NULL;
+    mStreamingActivated = false;
+    mYUYVConversion = Helpers::YUYV_NO_CONVERSION;
+    mJpegDecodeMode = base::samples::frame::MODE_UNDEFINED;
+    mJpegEncoding = false;
+    mBayerDemosaicMode = base::samples::frame::MODE_UNDEFINED;
+    mBayerFormat = NULL;
+    mPreviewFactor = 0;
+    mPreviewConversion = Helpers::YUYV_NO_CONVERSION;
+    mRowPadding = Helpers::DEFAULT_ROW_PADDING;
+    mJpegQuality = JpegEncoder::DEFAULT_QUALITY;
+    mRequestedWidth = 0;
+    mRequestedHeight = 0;
+    mJpegPipeline = NULL;
+    mWorkerPool = NULL;
+    mFramePool = NULL;
 
-    mFd = ::open(device.c_str(),  O_NONBLOCK | O_RDWR);
-    if (mFd <= 0) {
-        LOG_FATAL("Could not open device %s",device.c_str());
-        std::string err_str(strerror(errno));
-        throw std::runtime_error(err_str.insert(0, "Could not open device: "));
-    } else {
-        LOG_DEBUG("File opened, fd: %d",mFd);
-    }
- 
     // Collect all relative and absolute controls which 
     // are only allowed to change in manual-mode (used in readControl()).
     mAutoManualDependentControlIds.insert(V4L2_CID_WHITE_BALANCE_TEMPERATURE);
@@ -32,37 +47,45 @@ CamConfig::CamConfig(std::string const& device) : mFd(0), mCapability(), mCamCtr
     mAutoManualDependentControlIds.insert(V4L2_CID_FOCUS_ABSOLUTE);
     mAutoManualDependentControlIds.insert(V4L2_CID_FOCUS_RELATIVE);
 
-    // Catches CamConfigException (not supported functionalities).
-    // std::runtime error is passed.
+    // The destructor does not run if a constructor throws, the device is owned.
     try {
-        readCapability();
-    } catch (CamConfigException& err) {
-        LOG_ERROR("%s",err.what());
-    }
-    try {
-        // Creates dmesgs: 
-        //[ 6239.025909] uvcvideo: Failed to query (SET_CUR) UVC control 10 on unit 3: -32 (exp. 2).
-        //[ 6239.026564] uvcvideo: Failed to query (SET_CUR) UVC control 4 on unit 1: -32 (exp. 4).
-        //[ 6239.028447] uvcvideo: Failed to query (SET_CUR) UVC control 6 on unit 1: -32 (exp. 2).
-        readControl();
-    } catch (CamConfigException& err) {
-        LOG_ERROR("%s",err.what());
-    }
-    try {
-        readImageFormat();
-    } catch (CamConfigException& err) {
-        LOG_ERROR("%s",err.what());
-    }
-    try {
-        readStreamparm();
-    } catch (CamConfigException& err) {
-        LOG_ERROR("%s",err.what());
+        // Catches CamConfigException (not supported functionalities).
+        // std::runtime error is passed.
+        try {
+            readCapability();
+        } catch (CamConfigException& err) {
+            LOG_ERROR("%s",err.what());
+        }
+        try {
+            // Creates dmesgs: 
+            //[ 6239.025909] uvcvideo: Failed to query (SET_CUR) UVC control 10 on unit 3: -32 (exp. 2).
+            //[ 6239.026564] uvcvideo: Failed to query (SET_CUR) UVC control 4 on unit 1: -32 (exp. 4).
+            //[ 6239.028447] uvcvideo: Failed to query (SET_CUR) UVC control 6 on unit 1: -32 (exp. 2).
+            readControl();
+        } catch (CamConfigException& err) {
+            LOG_ERROR("%s",err.what());
+        }
+        try {
+            readImageFormat();
+        } catch (CamConfigException& err) {
+            LOG_ERROR("%s",err.what());
+        }
+        try {
+            readStreamparm();
+        } catch (CamConfigException& err) {
+            LOG_ERROR("%s",err.what());
+        }
+    } catch (...) {
+        delete mDevice;
+        mDevice = NULL;
+        throw;
     }
 }
 
 CamConfig::~CamConfig() {
     LOG_DEBUG("CamConfig: destructor, close device");
-    close(mFd);
+    delete mJpegPipeline;
+    delete mDevice;
 }
 
 // CAPABILITY
@@ -71,7 +94,7 @@ void CamConfig::readCapability() {
     
     // read camera capabilities
     memset (&mCapability, 0, sizeof (struct v4l2_capability));
-    if (xioctl(mFd, VIDIOC_QUERYCAP, &mCapability) == -1) {
+    if (xioctl(VIDIOC_QUERYCAP, &mCapability) == -1) {
         std::string err_str(strerror(errno));
         if(errno == EINVAL) {
             throw CamConfigException(err_str.insert(0, 
@@ -332,7 +355,7 @@ void CamConfig::readControl(struct v4l2_queryctrl& queryctrl_tmp) {
     unsigned int original_control_id = queryctrl_tmp.id;
 
     // Control-request successful?
-    if (xioctl (mFd, VIDIOC_QUERYCTRL, &queryctrl_tmp) == -1) { // no
+    if (xioctl (VIDIOC_QUERYCTRL, &queryctrl_tmp) == -1) { // no
         // Unknown control, will be ignored.
         if (errno == EINVAL) { 
             LOG_DEBUG("Control %d not available and will be ignored", original_control_id);
@@ -375,7 +398,7 @@ void CamConfig::readControl(struct v4l2_queryctrl& queryctrl_tmp) {
             // Store menu item names if the type of the control is a menu. 
             for (int i = queryctrl_tmp.minimum; i <= queryctrl_tmp.maximum; ++i) {
                 querymenu_tmp.index = (uint32_t)i;
-                if (xioctl (mFd, VIDIOC_QUERYMENU, &querymenu_tmp) == -1) {
+                if (xioctl (VIDIOC_QUERYMENU, &querymenu_tmp) == -1) {
                     std::string err_str(strerror(errno));
                     throw std::runtime_error(err_str.insert(0, 
                         "Could not read menu item: "));
@@ -397,7 +420,7 @@ void CamConfig::readControl(struct v4l2_queryctrl& queryctrl_tmp) {
 
         // Read and store current value.
         try {
-            cam_ctrl.mValue = readControlValue(original_control_id);
+            it->second.mValue = readControlValue(original_control_id);
         } catch(std::runtime_error& e) {
             // Assuming write-only control (id valid, only write operation should work)
             LOG_WARN("Control %s (%d) seems not to be readable: %s", 
@@ -409,7 +432,7 @@ void CamConfig::readControl(struct v4l2_queryctrl& queryctrl_tmp) {
         if (it->second.mWriteable)
         {
             try {
-                writeControlValue(original_control_id, cam_ctrl.mValue, true);
+                writeControlValue(original_control_id, it->second.mValue, true);
             } catch(std::runtime_error& e) {
                 // Assuming read-only control (id valid, only read operation should work)
                 LOG_WARN("Control %s (%d) seems not to be writeable: %s", 
@@ -435,7 +458,7 @@ int32_t CamConfig::readControlValue(uint32_t const id) {
     memset(&control, 0, sizeof(struct v4l2_control));
     control.id = id;
    
-    if (xioctl (mFd, VIDIOC_G_CTRL, &control) == -1) {
+    if (xioctl (VIDIOC_G_CTRL, &control) == -1) {
         std::string err_str(strerror(errno)); 
         throw std::runtime_error(err_str.insert(0, "Could not read control object value: ")); 
     }
@@ -489,7 +512,7 @@ void CamConfig::writeControlValue(uint32_t const id, int32_t value, bool just_wr
         }
     }
 
-    if(xioctl (mFd, VIDIOC_S_CTRL, &control) == -1) {
+    if(xioctl (VIDIOC_S_CTRL, &control) == -1) {
         std::string err_str(strerror(errno));
         
         // ID unknown? Should not happen or data would be out of sync.
@@ -710,7 +733,7 @@ void CamConfig::readImageFormat() {
     // struct v4l2_pix_format should be requested.
     mFormat.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if(xioctl(mFd, VIDIOC_G_FMT, &mFormat) == -1) {
+    if(xioctl(VIDIOC_G_FMT, &mFormat) == -1) {
         std::string err_str(strerror(errno));
         if(errno == EINVAL) {
             throw CamConfigException(err_str.insert(0, 
@@ -730,7 +753,7 @@ void CamConfig::readImageFormat() {
         format_description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         format_description.index = index;
         
-        if(xioctl(mFd, VIDIOC_ENUM_FMT, &format_description) == -1) {
+        if(xioctl(VIDIOC_ENUM_FMT, &format_description) == -1) {
             break;
         }
         mFormatDescriptions.push_back(format_description);
@@ -741,7 +764,7 @@ void CamConfig::readImageFormat() {
      // Read camera crop capabilities.
     memset(&mCropcap, 0, sizeof(struct v4l2_cropcap));
     mCropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (xioctl (mFd, VIDIOC_CROPCAP, &mCropcap) == -1)
+    if (xioctl (VIDIOC_CROPCAP, &mCropcap) == -1)
     {
         std::string err_str(strerror(errno));
         if(errno == EINVAL) {
@@ -770,7 +793,7 @@ void CamConfig::writeImagePixelFormat(uint32_t const width, uint32_t const heigh
         mFormat.fmt.pix.pixelformat = pixelformat;
     
     // Suggest the new format and fill mFormat with the actual one the driver choosed.
-    if(xioctl(mFd, VIDIOC_S_FMT, &mFormat) == -1) {
+    if(xioctl(VIDIOC_S_FMT, &mFormat) == -1) {
         std::stringstream ss;
         std::string err_str = strerror(errno);
         if(errno == EINVAL) {
@@ -846,6 +869,63 @@ bool CamConfig::getImageHeight(uint32_t* height) {
     return true;
 }
 
+bool CamConfig::getOutputImageSize(uint32_t* width, uint32_t* height) {
+    if(mFormat.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return false;
+
+    *width = mFormat.fmt.pix.width;
+    *height = mFormat.fmt.pix.height;
+    if(mJpegDecodeMode != base::samples::frame::MODE_UNDEFINED) {
+        JpegDecoder::getScaledSize(*width, *height, getJpegScaleDenom(), width, height);
+    }
+    return true;
+}
+
+uint8_t CamConfig::getOutputDataDepth() {
+    Bayer::Format const* format = Bayer::getFormat(mFormat.fmt.pix.pixelformat);
+    if(format == NULL || mBayerDemosaicMode != base::samples::frame::MODE_UNDEFINED) {
+        return 8;
+    }
+    return format->depth;
+}
+
+uint32_t CamConfig::getOutputRowSize() {
+    uint32_t width = 0, height = 0;
+    if(!getOutputImageSize(&width, &height)) {
+        return 0;
+    }
+    return Helpers::getPaddedRowSize(width * getOutputPixelSize(), mRowPadding);
+}
+
+uint32_t CamConfig::getOutputPixelSize() {
+    if(mYUYVConversion != Helpers::YUYV_NO_CONVERSION) {
+        return Helpers::getYUYVConversionPixelSize(mYUYVConversion);
+    }
+    if(mJpegDecodeMode != base::samples::frame::MODE_UNDEFINED) {
+        return mJpegDecodeMode == base::samples::frame::MODE_GRAYSCALE ? 1 : 3;
+    }
+    if(mJpegEncoding) {
+        return 0;
+    }
+    if(mBayerDemosaicMode != base::samples::frame::MODE_UNDEFINED) {
+        return 3;
+    }
+    Bayer::Format const* format = Bayer::getFormat(mFormat.fmt.pix.pixelformat);
+    if(format != NULL) {
+        return format->depth == 8 ? 1 : 2;
+    }
+    switch(mFormat.fmt.pix.pixelformat) {
+        case V4L2_PIX_FMT_GREY: return 1;
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY: return 2;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24: return 3;
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32: return 4;
+        default: return 0; // Compressed or unknown, copied as it is.
+    }
+}
+
 bool CamConfig::getImagePixelformat(uint32_t* pixelformat) {
     if(mFormat.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
         return false;
@@ -915,7 +995,8 @@ bool CamConfig::getImageColorspace(uint32_t* colorspace) {
     return true;
 }
 
-uint32_t CamConfig::toV4L2ImageFormat(base::samples::frame::frame_mode_t mode) {
+uint32_t CamConfig::toV4L2ImageFormat(base::samples::frame::frame_mode_t mode,
+        uint32_t requested_width, uint32_t requested_height, uint8_t requested_depth) {
     using namespace base::samples::frame;
     // TODO: Do sth clever with the collected mFormatDescriptions.
     uint32_t v4l2_mode = 0;
@@ -931,11 +1012,37 @@ uint32_t CamConfig::toV4L2ImageFormat(base::samples::frame::frame_mode_t mode) {
     
     // Problem: The few rock image formats cannot cover all the v4l2 formats.
     // And we do not have conversions for most of the camera formats like YUYV or H264.
-    // So for now for frame mode RGB we have to:
-    // 1. Request YUV images. 
-    // 2. Convert the image manually to RBG.
+    // So if the requested mode is not available we:
+    // 1. Request YUV (or MJPEG) images. 
+    // 2. Convert the image manually to the requested mode (RGB, BGR, RGB32, 
+    //    grayscale or UYVY), see Helpers::convertYUYV(), or decode the MJPEG 
+    //    image to RGB, BGR or grayscale.
     // 3. Now the frame helper can compress the image to JPEG.
+    // If JPEG is requested and the camera does not provide MJPEG, the YUYV images
+    // are compressed directly. Cameras which only offer Bayer formats are 
+    // demosaiced to RGB or BGR.
+    mYUYVConversion = Helpers::YUYV_NO_CONVERSION;
+    mJpegDecodeMode = MODE_UNDEFINED;
+    mJpegEncoding = false;
+    mBayerDemosaicMode = MODE_UNDEFINED;
+    mRequestedWidth = requested_width;
+    mRequestedHeight = requested_height;
+
+    if(Bayer::isBayerMode(mode)) {
+        // Unpacked formats are delivered without any conversion.
+        uint8_t depths[] = {requested_depth, 8, 10, 12};
+        for(int i=0; i<4; ++i) {
+            for(int packed=0; packed<2; ++packed) {
+                Bayer::Format const* format = Bayer::findFormat(mode, depths[i], packed != 0);
+                if(format != NULL && isPixelformatAvailable(format->pixelformat)) {
+                    return format->pixelformat;
+                }
+            }
+        }
+        return 0;
+    }
     bool yuyv_available = false;
+    bool mjpeg_available = false;
     std::vector<struct v4l2_fmtdesc>::iterator it = mFormatDescriptions.begin();
     for(; it != mFormatDescriptions.end(); it++) {
         if(it->pixelformat == v4l2_mode) {
@@ -944,14 +1051,52 @@ uint32_t CamConfig::toV4L2ImageFormat(base::samples::frame::frame_mode_t mode) {
         if(it->pixelformat == V4L2_PIX_FMT_YUYV) {
             yuyv_available = true;
         }
+        if(it->pixelformat == V4L2_PIX_FMT_MJPEG) {
+            mjpeg_available = true;
+        }
     }
     
-    // If the requested mode (which is not available) is RGB and the camera got 
-    // the YUYV format, we will use that and do an extra to RGB conversion.
-    if(mode == MODE_RGB && yuyv_available) {
-        mConversionRequiredYUYV2RGB = true;
+    // If the requested mode is not available and the camera got the YUYV format, 
+    // we will use that and do an extra conversion.
+    Helpers::YUYVConversion conversion = Helpers::getYUYVConversion(mode);
+    bool use_yuyv = conversion != Helpers::YUYV_NO_CONVERSION && yuyv_available;
+    bool use_mjpeg = JpegDecoder::isOutputModeSupported(mode) && mjpeg_available;
+    if(use_yuyv && use_mjpeg) {
+        // YUYV is lossless and cheaper to convert, but high resolutions are often
+        // only available with a usable frame rate as MJPEG.
+        float fps_yuyv = getMaxFPS(V4L2_PIX_FMT_YUYV, requested_width, requested_height);
+        float fps_mjpeg = getMaxFPS(V4L2_PIX_FMT_MJPEG, requested_width, requested_height);
+        LOG_DEBUG("Maximal fps for %dx%d, YUYV: %4.1f, MJPEG: %4.1f", 
+                requested_width, requested_height, fps_yuyv, fps_mjpeg);
+        use_yuyv = fps_yuyv >= fps_mjpeg;
+        use_mjpeg = !use_yuyv;
+    }
+
+    if(use_yuyv) {
+        LOG_INFO("Frame mode %d not available, YUYV images will be converted", mode);
+        mYUYVConversion = conversion;
         return V4L2_PIX_FMT_YUYV;
     }
+    if(use_mjpeg) {
+        LOG_INFO("Frame mode %d not available, MJPEG images will be decoded", mode);
+        mJpegDecodeMode = mode;
+        return V4L2_PIX_FMT_MJPEG;
+    }
+    if(mode == MODE_JPEG && yuyv_available) {
+        LOG_INFO("MJPEG not available, YUYV images will be compressed");
+        mJpegEncoding = true;
+        return V4L2_PIX_FMT_YUYV;
+    }
+    if(Bayer::isDemosaicModeSupported(mode)) {
+        for(it = mFormatDescriptions.begin(); it != mFormatDescriptions.end(); it++) {
+            Bayer::Format const* format = Bayer::getFormat(it->pixelformat);
+            if(format != NULL && format->depth == 8) {
+                LOG_INFO("Frame mode %d not available, Bayer images will be demosaiced", mode);
+                mBayerDemosaicMode = mode;
+                return format->pixelformat;
+            }
+        }
+    }
     
     return 0;
 }
@@ -964,7 +1109,7 @@ void CamConfig::readStreamparm() {
 
     mStreamparm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if (xioctl(mFd, VIDIOC_G_PARM, &mStreamparm) == -1) {
+    if (xioctl(VIDIOC_G_PARM, &mStreamparm) == -1) {
         std::string err_str(strerror(errno));
         if(errno == EINVAL) {
             throw CamConfigException(err_str.insert(0, 
@@ -999,7 +1144,7 @@ void CamConfig::writeStreamparm(uint32_t const numerator, uint32_t const denomin
         LOG_DEBUG("denominator is 0");
 
     // Suggest the new stream parameters and fill mStreamparm with the actual one the driver choosed.
-    if(xioctl(mFd, VIDIOC_S_PARM, &mStreamparm) == -1) {
+    if(xioctl(VIDIOC_S_PARM, &mStreamparm) == -1) {
         std::string err_str(strerror(errno));
         if(errno == EINVAL) {
             throw CamConfigException(err_str.insert(0, 
@@ -1104,6 +1249,41 @@ bool CamConfig::hasCapturemodeStreamparm(uint32_t capturemode) {
 // REQUEST IMAGES 
 void CamConfig::initRequesting() {
 
+    // The driver reports the colorspace of the negotiated format.
+    helpers.setColorspace(mFormat.fmt.pix.colorspace);
+    if(mYUYVConversion != Helpers::YUYV_NO_CONVERSION && 
+            mFormat.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+        LOG_WARN("YUYV has not been accepted by the driver, images will not be converted");
+        mYUYVConversion = Helpers::YUYV_NO_CONVERSION;
+    }
+    if(mJpegDecodeMode != base::samples::frame::MODE_UNDEFINED && 
+            mFormat.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG) {
+        LOG_WARN("MJPEG has not been accepted by the driver, images will not be decoded");
+        mJpegDecodeMode = base::samples::frame::MODE_UNDEFINED;
+    }
+    if(mJpegEncoding && mFormat.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+        LOG_WARN("YUYV has not been accepted by the driver, images will not be compressed");
+        mJpegEncoding = false;
+    }
+    mBayerFormat = Bayer::getFormat(mFormat.fmt.pix.pixelformat);
+    if(mBayerDemosaicMode != base::samples::frame::MODE_UNDEFINED && 
+            (mBayerFormat == NULL || mBayerFormat->depth != 8)) {
+        LOG_WARN("8 bit Bayer has not been accepted by the driver, images will not be demosaiced");
+        mBayerDemosaicMode = base::samples::frame::MODE_UNDEFINED;
+    }
+    delete mJpegPipeline;
+    mJpegPipeline = NULL;
+    if(mJpegDecodeMode != base::samples::frame::MODE_UNDEFINED) {
+        mJpegPipeline = new JpegDecodePipeline(mWorkerPool, mJpegDecodeMode, getJpegScaleDenom(),
+                mRowPadding);
+    } else if(mJpegEncoding) {
+        // Cameras deliver limited range YUYV unless they report the JPEG colorspace.
+        mJpegPipeline = new JpegEncodePipeline(mWorkerPool, mFormat.fmt.pix.width, 
+                mFormat.fmt.pix.height, mJpegQuality, 
+                mFormat.fmt.pix.colorspace != V4L2_COLORSPACE_JPEG, 
+                mFormat.fmt.pix.bytesperline);
+    }
+
     // Request buffer.
     struct v4l2_requestbuffers request_buffer;
     memset(&request_buffer, 0, sizeof(struct v4l2_requestbuffers));
@@ -1112,7 +1292,7 @@ void CamConfig::initRequesting() {
     request_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     request_buffer.memory = V4L2_MEMORY_MMAP;
     
-    if(xioctl(mFd, VIDIOC_REQBUFS, &request_buffer) == -1) {
+    if(xioctl(VIDIOC_REQBUFS, &request_buffer) == -1) {
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not request a video buffer: "));
     }
@@ -1124,9 +1304,9 @@ void CamConfig::initRequesting() {
     // Prepare the mmap pointer.
     mmapBuffer = NULL;
     errno = 0;
-    // mmap creates a 'virtual' map of the memory: Maps device memory into the application address space.
+    // Maps device memory into the application address space.
     // So this is actuall the pointer to the image.
-    mmapBuffer = (uint8_t*)mmap(NULL, query_buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, query_buffer.m.offset);
+    mmapBuffer = (uint8_t*)mDevice->mmap(query_buffer.length, query_buffer.m.offset);
     if(mmapBuffer == NULL || mmapBuffer ==  MAP_FAILED) { // mmap() returns the buffer or -1 if an error occurred.
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not query the video buffer: "));
@@ -1135,7 +1315,7 @@ void CamConfig::initRequesting() {
     // IMPORTANT: must to start stream here? or it is enough to start in getBuffer??
     // Start streaming. Streaming must only be started once!
     // Creates dmesgs: restoring control 00000000-0000-0000-0000-000000000001/2/3
-    if(xioctl(mFd, VIDIOC_STREAMON, &(query_buffer.type)) == -1){
+    if(xioctl(VIDIOC_STREAMON, &(query_buffer.type)) == -1){
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not start capturing: "));
     }
@@ -1144,24 +1324,16 @@ void CamConfig::initRequesting() {
 }
 
 bool CamConfig::isImageAvailable(int32_t timeout_ms) {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(mFd, &fds);
-    struct timeval waiting_time;
-    memset(&waiting_time, 0, sizeof(waiting_time));
-    waiting_time.tv_usec = timeout_ms * 1000;
     // Is data available?
     errno = 0;
-    // On timeout select returns 0. Expects mFd + 1, yes.
-    // waiting_time could contain the waiting time left.
-    int ret = select(mFd+1, &fds, NULL, NULL, &waiting_time);
+    int ret = mDevice->waitForBuffer(timeout_ms);
     if(ret == -1) {
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Error waiting for image data: "));
     }
     
     if(ret == 0) {
-        std::cout << "No image availale" << std::endl;
+        CAM_LOG_TRACE("No image available");
         return false;
     }
     
@@ -1173,45 +1345,110 @@ bool CamConfig::isImageAvailable(int32_t timeout_ms) {
     * \param blocking_read Not used, function always waits timeout_ms milliseconds.
     */
 bool CamConfig::getBuffer(std::vector<uint8_t>& buffer, bool blocking_read, int32_t timeout_ms) {
-    
-    struct v4l2_buffer q_buffer = {0};
-    q_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    q_buffer.memory = V4L2_MEMORY_MMAP;
-    q_buffer.index = 0;
-    if(-1 == xioctl(mFd, VIDIOC_QBUF, &q_buffer))
-    {
-        perror("Query Buffer");
+    return readBuffer(buffer, NULL, timeout_ms);
+}
+
+bool CamConfig::getBuffer(std::vector<uint8_t>& buffer, std::vector<uint8_t>& preview,
+        bool blocking_read, int32_t timeout_ms) {
+    return readBuffer(buffer, &preview, timeout_ms);
+}
+
+bool CamConfig::getPreviewSize(uint32_t* width, uint32_t* height) {
+    if(!isPreviewAvailable()) {
         return false;
     }
- 
-    // Wait for an image.
-    // getBuffer is only called if an image is available (using isImageAvailable()).
-    // TODO remove?
-    if(!isImageAvailable(timeout_ms)) {
-        return false;
+    *width = mFormat.fmt.pix.width / mPreviewFactor;
+    *height = mFormat.fmt.pix.height / mPreviewFactor;
+    return true;
+}
+
+uint32_t CamConfig::getPreviewRowSize() {
+    uint32_t width = 0, height = 0;
+    if(!getPreviewSize(&width, &height)) {
+        return 0;
+    }
+    return Helpers::getPaddedRowSize(
+            width * Helpers::getYUYVConversionPixelSize(mPreviewConversion), mRowPadding);
+}
+
+bool CamConfig::isPreviewAvailable() {
+    return mYUYVConversion != Helpers::YUYV_NO_CONVERSION &&
+            Helpers::isDownscaleSupported(mPreviewFactor, mPreviewConversion);
+}
+
+bool CamConfig::readBuffer(std::vector<uint8_t>& buffer, std::vector<uint8_t>* preview, 
+        int32_t timeout_ms) {
+    
+    struct v4l2_buffer q_buffer = {0};
+    if(preview != NULL) {
+        preview->clear();
     }
     
-    // Data available, resize the passed buffer and copy the image.
-    // By default VIDIOC_DQBUF blocks when no buffer is in the outgoing queue. 
-    // When the O_NONBLOCK flag was given to the open() function, VIDIOC_DQBUF returns 
-    // immediately with an EAGAIN error code when no buffer is available.
-    if(xioctl(mFd, VIDIOC_DQBUF, &q_buffer) == -1) {
-        std::string err_str(strerror(errno));
-        throw std::runtime_error(err_str.insert(0, "Error capturing the image: "));
+    if(mJpegPipeline != NULL) {
+        // Keeps the decoder/encoder pipeline filled: While the older images are
+        // processed the next ones are captured. The oldest image is returned.
+        do {
+            if(!captureBuffer(q_buffer, timeout_ms)) {
+                return false;
+            }
+            mJpegPipeline->push(mmapBuffer, q_buffer.bytesused);
+        } while(mJpegPipeline->getNumPending() < mJpegPipeline->getDepth());
+
+        // The buffer receives one of the next decoded images.
+        uint32_t width = 0, height = 0;
+        if(getOutputImageSize(&width, &height)) {
+            reserveBuffer(buffer, (size_t)getOutputRowSize() * height);
+        }
+        return mJpegPipeline->pop(buffer, &width, &height);
+    }
+
+    if(!captureBuffer(q_buffer, timeout_ms)) {
+        return false;
     }
     
-    // Image is available at mmapBuffer now.
-    if(mConversionRequiredYUYV2RGB) {
-        helpers.convertYUYV2RGB(mmapBuffer, q_buffer.length, buffer);
+    // Image is available at mmapBuffer now. The rows of the camera may be 
+    // padded (bytesperline), the rows of the output are padded to mRowPadding.
+    uint32_t width = mFormat.fmt.pix.width;
+    uint32_t height = mFormat.fmt.pix.height;
+    uint32_t bytesperline = mFormat.fmt.pix.bytesperline;
+    uint32_t row_size = getOutputRowSize();
+    reserveBuffer(buffer, (size_t)row_size * height);
+    if(mYUYVConversion != Helpers::YUYV_NO_CONVERSION && preview != NULL && 
+            isPreviewAvailable()) {
+        reserveBuffer(*preview, (size_t)getPreviewRowSize() * (height / mPreviewFactor));
+        helpers.convertYUYV(mmapBuffer, width, height, mYUYVConversion, buffer, 
+                mPreviewFactor, mPreviewConversion, *preview, mWorkerPool, bytesperline,
+                row_size, getPreviewRowSize());
+    } else if(mYUYVConversion != Helpers::YUYV_NO_CONVERSION) {
+        helpers.convertYUYV(mmapBuffer, width, height, mYUYVConversion, buffer, mWorkerPool,
+                bytesperline, row_size);
+    } else if(mBayerDemosaicMode != base::samples::frame::MODE_UNDEFINED) {
+        Bayer::demosaic(mmapBuffer, *mBayerFormat, width, height, bytesperline, 
+                mBayerDemosaicMode, buffer, mWorkerPool, row_size);
+    } else if(mBayerFormat != NULL) {
+        // Unpacks the packed formats, the others are copied as they are.
+        Bayer::copy(mmapBuffer, *mBayerFormat, width, height, bytesperline, buffer, row_size);
+    } else if(row_size != 0) {
+        uint32_t row_bytes = width * getOutputPixelSize();
+        buffer.resize((size_t)row_size * height);
+        Helpers::copyRows(mmapBuffer, bytesperline != 0 ? bytesperline : row_bytes, 
+                buffer.data(), row_size, row_bytes, height);
     } else {
-        buffer.resize(q_buffer.length);
-        memcpy(buffer.data(), mmapBuffer, q_buffer.length);
+        // Compressed, only the used part of the buffer is copied.
+        uint32_t size = q_buffer.bytesused != 0 ? q_buffer.bytesused : q_buffer.length;
+        reserveBuffer(buffer, size);
+        buffer.resize(size);
+        memcpy(buffer.data(), mmapBuffer, size);
     }
     
     return true;
 }
 
 void CamConfig::cleanupRequesting() {
+    // Waits for the running decodes.
+    delete mJpegPipeline;
+    mJpegPipeline = NULL;
+
     if(!mStreamingActivated) {
         LOG_INFO("v4l2 streaming is not active, no cleanup required");
         return;
@@ -1221,14 +1458,14 @@ void CamConfig::cleanupRequesting() {
 	getQueryBuffer(query_buffer);
     
     // Stops streaming.
-    if(xioctl(mFd, VIDIOC_STREAMOFF, &(query_buffer.type)) == -1){
+    if(xioctl(VIDIOC_STREAMOFF, &(query_buffer.type)) == -1){
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not start capturing: "));
     }
     
     // Unmap buffer / device memory.
     errno = 0;
-    if(munmap(mmapBuffer, query_buffer.length) == -1) {
+    if(mDevice->munmap(mmapBuffer, query_buffer.length) == -1) {
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not unmap device memory: "));
     }
@@ -1237,22 +1474,91 @@ void CamConfig::cleanupRequesting() {
     mStreamingActivated = false;
 }
 
+bool CamConfig::captureBuffer(struct v4l2_buffer& q_buffer, int32_t timeout_ms) {
+    memset(&q_buffer, 0, sizeof(q_buffer));
+    q_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    q_buffer.memory = V4L2_MEMORY_MMAP;
+    q_buffer.index = 0;
+    if(-1 == xioctl(VIDIOC_QBUF, &q_buffer))
+    {
+        perror("Query Buffer");
+        return false;
+    }
+ 
+    // Wait for an image.
+    // getBuffer is only called if an image is available (using isImageAvailable()).
+    // TODO remove?
+    if(!isImageAvailable(timeout_ms)) {
+        return false;
+    }
+    
+    // Data available, dequeue the buffer.
+    // By default VIDIOC_DQBUF blocks when no buffer is in the outgoing queue. 
+    // When the O_NONBLOCK flag was given to the open() function, VIDIOC_DQBUF returns 
+    // immediately with an EAGAIN error code when no buffer is available.
+    if(xioctl(VIDIOC_DQBUF, &q_buffer) == -1) {
+        std::string err_str(strerror(errno));
+        throw std::runtime_error(err_str.insert(0, "Error capturing the image: "));
+    }
+    return true;
+}
+
+unsigned int CamConfig::getJpegScaleDenom() {
+    return JpegDecoder::getScaleDenom(mFormat.fmt.pix.width, mFormat.fmt.pix.height, 
+            mRequestedWidth, mRequestedHeight);
+}
+
+float CamConfig::getMaxFPS(uint32_t pixelformat, uint32_t width, uint32_t height) {
+    struct v4l2_frmivalenum frmival;
+    memset(&frmival, 0, sizeof(frmival));
+    frmival.pixel_format = pixelformat;
+    frmival.width = width;
+    frmival.height = height;
+
+    // Fails if the size is not supported for this pixel format.
+    float max_fps = 0;
+    for(; xioctl(VIDIOC_ENUM_FRAMEINTERVALS, &frmival) == 0; frmival.index++) {
+        struct v4l2_fract interval = frmival.discrete;
+        if(frmival.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+            interval = frmival.stepwise.min;
+        }
+        if(interval.numerator != 0 && 
+                interval.denominator / (float)interval.numerator > max_fps) {
+            max_fps = interval.denominator / (float)interval.numerator;
+        }
+        if(frmival.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+            break;
+        }
+    }
+    return max_fps;
+}
+
+bool CamConfig::isPixelformatAvailable(uint32_t pixelformat) {
+    std::vector<struct v4l2_fmtdesc>::iterator it = mFormatDescriptions.begin();
+    for(; it != mFormatDescriptions.end(); it++) {
+        if(it->pixelformat == pixelformat) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void CamConfig::getQueryBuffer(struct v4l2_buffer& query_buffer) {
     memset(&query_buffer, 0, sizeof(query_buffer));
     query_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     query_buffer.memory = V4L2_MEMORY_MMAP;
     query_buffer.index = 0; // Number of the requested buffer: 0 to count-1.
-    if(xioctl(mFd, VIDIOC_QUERYBUF, &query_buffer)) {
+    if(xioctl(VIDIOC_QUERYBUF, &query_buffer)) {
         std::string err_str(strerror(errno));
         throw std::runtime_error(err_str.insert(0, "Could not query the video buffer: "));
     }
 }
 
-int CamConfig::xioctl(int fd, int request, void *arg) {
+int CamConfig::xioctl(unsigned long request, void *arg) {
     int ret;
     errno = 0; // No error.
     do {
-        ret = ioctl (fd, request, arg);
+        ret = mDevice->ioctl(request, arg);
     }
     while (-1 == ret && EINTR == errno);
     return ret;
@@ -43,7 +43,12 @@
 
 #include <base/samples/Frame.hpp>
 
+#include "bayer.h"
+#include "frame_pool.h"
 #include "helpers.h"
+#include "jpeg_codec.h"
+#include "v4l2_device.h"
+#include "worker_pool.h"
 
 namespace camera 
 {
@@ -97,10 +102,16 @@ class CamConfig
      */
     CamConfig(std::string const& device);
 
+    /**
+     * Same as above but talks to 'device' instead of a device node, e.g. to
+     * a FakeV4L2Device. Takes ownership of 'device'.
+     */
+    CamConfig(V4L2Device* device);
+
     ~CamConfig();
 
      inline int getFd() {
-        return mFd;
+        return mDevice->getFd();
      }
 
  public: // CAPABILITY
@@ -234,6 +245,24 @@ class CamConfig
 
     bool getImageHeight(uint32_t* height);
 
+    /**
+     * Size of the images returned by getBuffer(). Differs from the image size
+     * if the MJPEG images are downscaled while decoding.
+     */
+    bool getOutputImageSize(uint32_t* width, uint32_t* height);
+
+    /**
+     * Significant bits per pixel of the images returned by getBuffer(): 10 or 12
+     * if such a Bayer format has been selected, otherwise 8.
+     */
+    uint8_t getOutputDataDepth();
+
+    /**
+     * Bytes per row of the images returned by getBuffer(): the row size of the
+     * output mode padded by setRowPadding(). 0 for compressed images.
+     */
+    uint32_t getOutputRowSize();
+
     bool getImagePixelformat(uint32_t* pixelformat);
 
     bool getImagePixelformatString(std::string* pixelformat_str);
@@ -255,10 +284,20 @@ class CamConfig
     /**
      * Tries to map a rock to a v4l2 mode. Problem is that rock 
      * only supports a few image formats and e.g. no YUYV which is a base raw format
-     * for most of the cameras. So if RGB is requested but not available
-     * YUV will be used and converted to RGB.
+     * for most of the cameras. So if RGB, BGR, RGB32, grayscale or UYVY is 
+     * requested but not available YUYV will be used and converted.
+     * RGB, BGR and grayscale can also be decoded from MJPEG, which is used instead
+     * of YUYV if it offers a higher frame rate for the requested size. If the
+     * captured MJPEG images are larger than requested they are downscaled by 
+     * 1/2, 1/4 or 1/8 while decoding. JPEG is encoded from YUYV if the camera
+     * does not support MJPEG, see setJpegQuality().
+     * For the Bayer modes the format with 'requested_depth' (8, 10 or 12 bits)
+     * is preferred, the packed 10 and 12 bit formats are unpacked to 16 bit pixels.
+     * RGB and BGR are demosaiced from 8 bit Bayer if nothing else is available.
      */
-    uint32_t toV4L2ImageFormat(base::samples::frame::frame_mode_t mode);
+    uint32_t toV4L2ImageFormat(base::samples::frame::frame_mode_t mode,
+            uint32_t requested_width=0, uint32_t requested_height=0, 
+            uint8_t requested_depth=8);
 
  public: // STREAMPARM, not suoported by e-CAM32!
     void readStreamparm();
@@ -317,11 +356,75 @@ class CamConfig
      * \param blocking_read Not used, function always waits timeout_ms milliseconds.
      */
     bool getBuffer(std::vector<uint8_t>& buffer, bool blocking_read, int32_t timeout_ms);
+
+    /**
+     * Same as getBuffer() but additionally fills 'preview' with the downscaled 
+     * image configured by setPreview(), in the same pass over the captured image.
+     * 'preview' is cleared if no preview can be created, see getPreviewSize().
+     */
+    bool getBuffer(std::vector<uint8_t>& buffer, std::vector<uint8_t>& preview, 
+            bool blocking_read, int32_t timeout_ms);
+
+    /**
+     * Preview downscaled by 'factor' (2 or 4, 0 disables it), converted with 
+     * 'conversion'. Only created if the images are converted from YUYV, 
+     * see Helpers::convertYUYV().
+     */
+    inline void setPreview(unsigned int factor, Helpers::YUYVConversion conversion) {
+        mPreviewFactor = factor;
+        mPreviewConversion = conversion;
+    }
+
+    /**
+     * Size of the preview, false if no preview is created for the current format.
+     */
+    bool getPreviewSize(uint32_t* width, uint32_t* height);
+
+    /**
+     * Bytes per row of the preview, 0 if no preview is created.
+     */
+    uint32_t getPreviewRowSize();
+
+    /**
+     * The rows of the uncompressed images returned by getBuffer() are padded to 
+     * a multiple of 'padding' bytes (default Helpers::DEFAULT_ROW_PADDING), 
+     * 1 creates tightly packed rows. The padding of the camera (bytesperline) 
+     * is always removed. Has to be set before initRequesting().
+     */
+    inline void setRowPadding(uint32_t padding) {
+        mRowPadding = padding;
+    }
+
+    /**
+     * Pool used to convert the images in getBuffer() in parallel row bands and
+     * to decode several MJPEG images in parallel. Has to be set before initRequesting().
+     * The pool is not owned, pass NULL to convert within the calling thread.
+     */
+    inline void setWorkerPool(WorkerPool* pool) {
+        mWorkerPool = pool;
+    }
+
+    /**
+     * Quality (0 to 100) used if JPEG images are encoded from YUYV.
+     * Has to be set before initRequesting().
+     */
+    inline void setJpegQuality(int quality) {
+        mJpegQuality = quality;
+    }
+
+    /**
+     * If set the buffers passed to getBuffer() are exchanged with pooled buffers 
+     * whenever their capacity does not suffice, see FramePool::reserve().
+     * The pool is not owned, NULL allocates as required.
+     */
+    inline void setFramePool(FramePool* pool) {
+        mFramePool = pool;
+    }
     
     void cleanupRequesting();
 
  private:
-    int mFd; /// File-descriptor to the camera.
+    V4L2Device* mDevice; /// The camera, owned.
 
     // Capability
     struct v4l2_capability mCapability;
@@ -340,20 +443,77 @@ class CamConfig
     // Points to the image which has been requested via ioctl.
     uint8_t* mmapBuffer;
     bool mStreamingActivated;
-    bool mConversionRequiredYUYV2RGB; // YUVU is not yet supported by Rock.
+    Helpers::YUYVConversion mYUYVConversion; // YUYV is not yet supported by Rock.
+    base::samples::frame::frame_mode_t mJpegDecodeMode; // MODE_UNDEFINED: no decoding.
+    bool mJpegEncoding; // YUYV to JPEG.
+    base::samples::frame::frame_mode_t mBayerDemosaicMode; // MODE_UNDEFINED: no demosaicing.
+    Bayer::Format const* mBayerFormat; // Accepted Bayer format or NULL.
+    unsigned int mPreviewFactor;
+    Helpers::YUYVConversion mPreviewConversion;
+    uint32_t mRowPadding;
+    int mJpegQuality;
+    uint32_t mRequestedWidth;
+    uint32_t mRequestedHeight;
+    JpegPipeline* mJpegPipeline; // Decodes or encodes the images.
     Helpers helpers;
+    WorkerPool* mWorkerPool; // Not owned.
+    FramePool* mFramePool; // Not owned.
 
     CamConfig() {}
+
+    /**
+     * Sets the defaults of all members, takes ownership of 'device' and reads
+     * all camera informations. Used by the constructors, deletes 'device' 
+     * if an exception is thrown.
+     */
+    void init(V4L2Device* device);
     
     /**
      * Used in the request image functions.
      */
     void getQueryBuffer(struct v4l2_buffer& query_buffer);
+
+    /**
+     * Queues the buffer, waits for the image and dequeues the buffer.
+     * Afterwards the image is available at mmapBuffer.
+     */
+    bool captureBuffer(struct v4l2_buffer& q_buffer, int32_t timeout_ms);
+
+    /**
+     * Implements both getBuffer() variants, 'preview' may be NULL.
+     */
+    bool readBuffer(std::vector<uint8_t>& buffer, std::vector<uint8_t>* preview, 
+            int32_t timeout_ms);
+
+    bool isPreviewAvailable();
+
+    /**
+     * Bytes per pixel of the images returned by getBuffer(), 0 if compressed.
+     */
+    uint32_t getOutputPixelSize();
+
+    /**
+     * Prepares 'buffer' for 'size' bytes using the frame pool, if set.
+     */
+    inline void reserveBuffer(std::vector<uint8_t>& buffer, size_t size) {
+        if(mFramePool != NULL) {
+            mFramePool->reserve(buffer, size);
+        }
+    }
+
+    unsigned int getJpegScaleDenom();
+
+    /**
+     * Maximal frame rate of the pixel format for this size, 0 if unsupported.
+     */
+    float getMaxFPS(uint32_t pixelformat, uint32_t width, uint32_t height);
+
+    bool isPixelformatAvailable(uint32_t pixelformat);
     
     /**
      * ioctl calls could be interrupted (EINTR), in this case another call is required.
      */
-    int xioctl(int fd, int request, void *arg);
+    int xioctl(unsigned long request, void *arg);
 
 };
 
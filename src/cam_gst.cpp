@@ -1,4 +1,7 @@
 #include "cam_gst.h"
+#include "cam_logging.h"
+#include <errno.h>
+#include <string.h>
 #include <sys/time.h>
 #include <boost/lexical_cast.hpp>
 
@@ -7,6 +10,154 @@ using namespace base::samples::frame;
 namespace camera 
 {
 
+// GSTFRAMEHANDLE
+GstFrameHandle::GstFrameHandle() : mSample(NULL), mInfo(), mStride(0), mOffset(0) {
+}
+
+GstFrameHandle::GstFrameHandle(GstSample* sample) : mSample(NULL), mInfo(), 
+        mStride(0), mOffset(0) {
+    reset(sample);
+}
+
+GstFrameHandle::GstFrameHandle(GstFrameHandle const& other) : mSample(NULL), mInfo(), 
+        mStride(0), mOffset(0) {
+    if(other.mSample != NULL) {
+        reset(other.mSample);
+    }
+}
+
+GstFrameHandle& GstFrameHandle::operator=(GstFrameHandle const& other) {
+    if(this != &other) {
+        if(other.mSample != NULL) {
+            reset(other.mSample);
+        } else {
+            reset();
+        }
+    }
+    return *this;
+}
+
+GstFrameHandle::~GstFrameHandle() {
+    reset();
+}
+
+void GstFrameHandle::reset() {
+    if(mSample == NULL) {
+        return;
+    }
+    gst_buffer_unmap(gst_sample_get_buffer(mSample), &mInfo);
+    gst_sample_unref(mSample);
+    mSample = NULL;
+    mStride = 0;
+    mOffset = 0;
+}
+
+void GstFrameHandle::reset(GstSample* sample) {
+    // The new reference is taken first, 'sample' may be the current one.
+    GstSample* ref = gst_sample_ref(sample);
+    reset();
+    mSample = ref;
+    map();
+}
+
+void GstFrameHandle::map() {
+    GstBuffer* buffer = gst_sample_get_buffer(mSample);
+    if(buffer == NULL || !gst_buffer_map(buffer, &mInfo, GST_MAP_READ)) {
+        gst_sample_unref(mSample);
+        mSample = NULL;
+        throw CamGstException("Sample buffer could not be mapped.");
+    }
+    // Layout of the first plane: the video meta describes buffers of upstream
+    // pools (e.g. v4l2src) which may differ from the default layout of the caps.
+    GstVideoMeta* meta = gst_buffer_get_video_meta(buffer);
+    if(meta != NULL) {
+        mStride = meta->stride[0];
+        mOffset = meta->offset[0];
+        return;
+    }
+    GstCaps* caps = gst_sample_get_caps(mSample);
+    GstVideoInfo info;
+    gst_video_info_init(&info);
+    if(caps != NULL && gst_video_info_from_caps(&info, caps)) {
+        mStride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+        mOffset = GST_VIDEO_INFO_PLANE_OFFSET(&info, 0);
+    }
+}
+
+const uint8_t* GstFrameHandle::data() const {
+    return mSample != NULL ? mInfo.data : NULL;
+}
+
+size_t GstFrameHandle::size() const {
+    return mSample != NULL ? mInfo.size : 0;
+}
+
+uint32_t GstFrameHandle::stride() const {
+    return mStride;
+}
+
+size_t GstFrameHandle::offset() const {
+    return mOffset;
+}
+
+GstSample* GstFrameHandle::sample() const {
+    return mSample;
+}
+
+/**
+ * Mode of the 'format' field of video/x-raw, MODE_UNDEFINED if unknown.
+ */
+static frame_mode_t fromGstreamerFormat(const char* format)
+{
+    if(strcmp(format, "GRAY8") == 0) return MODE_GRAYSCALE;
+    if(strcmp(format, "RGB") == 0)   return MODE_RGB;
+    if(strcmp(format, "BGR") == 0)   return MODE_BGR;
+    if(strcmp(format, "RGBx") == 0)  return MODE_RGB32;
+    if(strcmp(format, "UYVY") == 0)  return MODE_UYVY;
+    return MODE_UNDEFINED;
+}
+
+bool GstFrameHandle::getFormat(uint32_t* width, uint32_t* height, 
+        frame_mode_t* mode) const {
+    GstCaps* caps = mSample != NULL ? gst_sample_get_caps(mSample) : NULL;
+    if(caps == NULL) {
+        return false;
+    }
+    GstStructure* structure = gst_caps_get_structure(caps, 0);
+    gint w = 0, h = 0;
+    if(structure == NULL || !gst_structure_get_int(structure, "width", &w) ||
+            !gst_structure_get_int(structure, "height", &h)) {
+        return false;
+    }
+    *width = w;
+    *height = h;
+    // Called for every frame, compared without temporary strings.
+    const gchar* media_type = gst_structure_get_name(structure);
+    const gchar* format = gst_structure_get_string(structure, "format");
+    if(strcmp(media_type, "image/jpeg") == 0) {
+        *mode = MODE_JPEG;
+    } else if(strcmp(media_type, "video/x-raw") == 0 && format != NULL) {
+        *mode = fromGstreamerFormat(format);
+    } else {
+        *mode = MODE_UNDEFINED;
+    }
+    return true;
+}
+
+/**
+ * Absolute time for pthread_cond_timedwait() 'timeout' msec from now.
+ */
+static struct timespec getDeadline(int32_t timeout)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec until;
+    int64_t until_usec = (int64_t)now.tv_sec * 1000000 + now.tv_usec + 
+            (int64_t)(timeout > 0 ? timeout : 0) * 1000;
+    until.tv_sec = until_usec / 1000000;
+    until.tv_nsec = (until_usec % 1000000) * 1000;
+    return until;
+}
 
 CamGst::InitGuard::InitGuard() {
             LOG_INFO("Initializing GStreamer");
@@ -21,51 +172,67 @@ CamGst::InitGuard::~InitGuard() {
 // PUBLIC
 CamGst::CamGst(std::string const& device) : mDevice(device), 
         mJpegQuality(DEFAULT_JPEG_QUALITY), 
-        mLoop(NULL),
-        mMainLoopThread(NULL),
+        mContext(NULL),
         mPipeline(NULL),
         mGstPipelineBus(NULL),
-        mPipelineRunning(false),
-        mBuffer(NULL),
-        mBufferSize(0),
-        mNewBuffer(false),
+        mBusWatch(NULL),
+        mPipelineState(PIPELINE_STOPPED),
+        mPrewarmTarget(GST_STATE_PAUSED),
+        mStartCallback(NULL),
+        mStartCallbackData(NULL),
+        mStartRequestTime(0),
+        mStartLatency(-1),
+        mFirstFrameLatency(-1),
+        mLatestSample(NULL),
         mSource(NULL),
-        mSample(NULL),
+        mCapsFilter(NULL),
         mFileDescriptor(-1),
-        mRequestedFrameMode(MODE_UNDEFINED)
+        mRequestedFrameMode(MODE_UNDEFINED),
+        mConvertThreads(DEFAULT_CONVERT_THREADS),
+        mSoftwareResize(false),
+        mWidth(0),
+        mHeight(0),
+        mFps(0),
+        mLastCaps(NULL),
+        mNumCapsChanges(0),
+        mLastCapsChangeTime(0),
+        mRenegotiationGap(-1),
+        mPoolBuffers(DEFAULT_POOL_BUFFERS),
+        mBufferPool(NULL),
+        mNumPoolFrames(0),
+        mSourceQueueBuffers(DEFAULT_SOURCE_QUEUE_BUFFERS),
+        mNumFrames(0),
+        mNumSinkDrops(0),
+        mNumQueueDrops(0),
+        mLatencyTracing(false),
+        mLatencyDumpInterval(0),
+        mLatencyTracer(),
+        mSinkStage(-1),
+        mLatencyDump(NULL)
 {
     LOG_DEBUG("CamGst: constructor");
     // gst_is_initialized() not available (since 0.10.31), 
     // could lead to a gst-mini-unref-warning.
     static InitGuard gInit;
 
-    mLoop = g_main_loop_new (NULL, FALSE);
-    pthread_mutex_init(&mMutexBuffer, NULL);
-    LOG_DEBUG("Starting gst main loop thread");
-    mMainLoopThread = new pthread_t();
-    pthread_create(mMainLoopThread, NULL, mainLoop, (void*)mLoop);
+    pthread_mutex_init(&mStateMutex, NULL);
+    pthread_cond_init(&mStateCond, NULL);
+
+    // The bus messages of all instances are dispatched by one shared thread.
+    mContext = MainLoop::acquire();
 }
 
 CamGst::~CamGst() {
     LOG_DEBUG("CamGst: destructor");
-    if(mBuffer != NULL) {
-        gst_buffer_unref(mBuffer);
-        mBuffer = NULL;
-        mBufferSize = 0; 
-    }
-    if(mSample != NULL) {
-        gst_sample_unref(mSample);
-        mSample = NULL;
-    }
-
     deletePipeline();
-    g_main_loop_quit(mLoop);
-    g_main_loop_unref(mLoop);
-    mLoop = NULL;
-    pthread_mutex_destroy(&mMutexBuffer);
-    pthread_join(*mMainLoopThread, NULL);
-    delete mMainLoopThread;
-    mMainLoopThread = NULL;
+    skipBuffer();
+
+    // Returns after a message callback of this instance which may still run.
+    MainLoop::release();
+    mContext = NULL;
+
+    pthread_cond_destroy(&mStateCond);
+    pthread_mutex_destroy(&mStateMutex);
 }
 
 void CamGst::printElementFactories() {
@@ -99,49 +266,229 @@ void CamGst::createDefaultPipeline(bool check_for_valid_params,
     mJpegQuality = jpeg_quality;
 
     GstElement* source = createDefaultSource(mDevice);
-    GstElement* colorspace  = gst_element_factory_make("ffmpegcolorspace", "colorspace");
-    if(colorspace == NULL) {
-        LOG_WARN_S << "Colorspace convertion element could not be created. Will continue without." << std::endl;
+    GstCaps* caps = createDefaultCaps(width, height, fps, image_mode);
+
+    // Only converts if the camera does not offer the requested format itself,
+    // e.g. YUYV cameras if RGB is requested.
+    GstElement* converter = NULL;
+    if(image_mode != MODE_JPEG && !isFormatNative(source, caps)) {
+        converter = createDefaultConverter();
     }
     
-    GstElement* sink = createDefaultSink();
-    mSource = source;
-
-    if((mPipeline = gst_pipeline_new ("default_pipeline")) == NULL) {
-        deletePipeline();
-        throw CamGstException("Default pipeline could not be created.");    
+    // Decouples the source from the conversion, see setSourceQueue().
+    GstElement* queue = NULL;
+    if(mSourceQueueBuffers > 0) {
+        queue = createOutputQueue("source_queue", mSourceQueueBuffers);
+        if(queue == NULL) {
+            // Nothing has been added to the pipeline yet.
+            gst_object_unref(source);
+            if(converter != NULL) {
+                gst_object_unref(converter);
+            }
+            gst_caps_unref(caps);
+            throw CamGstException("Source queue could not be created.");
+        }
+        g_signal_connect(queue, "overrun", G_CALLBACK(callbackQueueOverrunStatic), this);
     }
-
-    // Add a message handler.
-    if(mGstPipelineBus != NULL) {
-        gst_object_unref (mGstPipelineBus); 
-        mGstPipelineBus = NULL;
+    
+    GstElement* sink = createDefaultSink();
+    // Test sources have no file descriptor.
+    mSource = TestDevice::isTestDevice(mDevice) ? NULL : source;
+
+    createPipeline("default_pipeline");
+    gst_bin_add (GST_BIN (mPipeline), source);
+    GstElement* upstream = source; // Linked to the converter or the capsfilter.
+    std::vector<GstElement*> chain(1, source); // In processing order.
+    if (queue != NULL)
+    {
+        gst_bin_add (GST_BIN (mPipeline), queue);
+        if (!gst_element_link (source, queue)) {
+            deletePipeline();
+            throw CamGstException("Failed to link the source queue");
+        }
+        upstream = queue;
+        chain.push_back(queue);
     }
-    mGstPipelineBus = gst_pipeline_get_bus (GST_PIPELINE (mPipeline));
-    gst_bus_add_watch (mGstPipelineBus, callbackMessagesStatic, this);  
 
-    GstElement* cap = 0;
-   
-    cap = createDefaultCap(width, height, fps, bpp, image_mode); // format
-    if (image_mode == MODE_JPEG)
+    GstElement* cap = createDefaultCap(caps); // Takes the caps.
+    mCapsFilter = cap;
+    if (converter == NULL)
     {
-        gst_bin_add_many (GST_BIN (mPipeline), source,  cap,  sink, (void*)NULL);
-        if (!gst_element_link_many (source,  cap, sink, (void*)NULL)) {
+        gst_bin_add (GST_BIN (mPipeline), cap);
+        if (!gst_element_link_many (upstream, cap, (void*)NULL)) {
             deletePipeline();
-            throw CamGstException("Failed to link jpeg pipeline, try another image mode");
+            throw CamGstException("Failed to link default pipeline, try another image mode");
         }
     }
     else
     {
-        gst_bin_add_many (GST_BIN (mPipeline), source, colorspace, cap, sink, (void*)NULL);
-        if (!gst_element_link_many (source, colorspace, cap, sink, (void*)NULL)) {
+        gst_bin_add_many (GST_BIN (mPipeline), converter, cap, (void*)NULL);
+        if (!gst_element_link_many (upstream, converter, cap, (void*)NULL)) {
             deletePipeline();
-            throw CamGstException("Failed to link default pipeline, try another image mode");
+            throw CamGstException("Failed to link converting pipeline, try another image mode");
+        }
+        chain.push_back(converter);
+    }
+    chain.push_back(cap);
+    GstElement* last = cap;
+    if(mSoftwareResize && image_mode != MODE_JPEG) {
+        // The camera keeps its format, renegotiate() only changes the output caps.
+        GstElement* scale = gst_element_factory_make("videoscale", "resize_scale");
+        GstElement* rate = gst_element_factory_make("videorate", "resize_rate");
+        GstElement* output_cap = createDefaultCap(
+                createDefaultCaps(width, height, fps, image_mode), "output_cap");
+        if(scale == NULL || rate == NULL) {
+            // Only the pipeline frees the elements which have been added.
+            gst_object_unref(output_cap);
+            if(scale != NULL) {
+                gst_object_unref(scale);
+            }
+            if(rate != NULL) {
+                gst_object_unref(rate);
+            }
+            deletePipeline();
+            throw CamGstException("videoscale or videorate could not be created, is gst-plugins-base installed?");
+        }
+        gst_bin_add_many (GST_BIN (mPipeline), scale, rate, output_cap, (void*)NULL);
+        if (!gst_element_link_many (cap, scale, rate, output_cap, (void*)NULL)) {
+            deletePipeline();
+            throw CamGstException("Failed to link the resizing elements");
         }
+        mCapsFilter = output_cap;
+        last = output_cap;
+        chain.push_back(scale);
+        chain.push_back(rate);
+        chain.push_back(output_cap);
+    }
+    linkOutputs(last, sink);
+
+    if(mLatencyTracing) {
+        addLatencyProbes(chain);
     }
     
     // Required to check if the image is a JPEG within getBuffer() (for header adaptions).
     mRequestedFrameMode = image_mode;
+    mWidth = width;
+    mHeight = height;
+    mFps = fps;
+}
+
+void CamGst::createCustomPipeline(std::string const& description, 
+        uint32_t width, uint32_t height, uint32_t fps, frame_mode_t image_mode) {
+    LOG_DEBUG("CamGst: createCustomPipeline");
+    deletePipeline();
+
+    std::string launch = expandPipelineDescription(description, mDevice, width, height, 
+            fps, image_mode);
+    LOG_INFO("Custom pipeline: %s", launch.c_str());
+
+    // Unlinked pads are ghosted, so the bin can be linked to the sink.
+    GError* error = NULL;
+    GstElement* bin = gst_parse_bin_from_description(launch.c_str(), TRUE, &error);
+    if(error != NULL) {
+        std::string err_str(error->message);
+        g_error_free(error);
+        if(bin != NULL) {
+            gst_object_unref(bin);
+        }
+        throw CamGstException(err_str.insert(0, "Custom pipeline could not be parsed: "));
+    }
+    if(bin == NULL) {
+        throw CamGstException("Custom pipeline could not be parsed.");
+    }
+
+    GstElement* sink = createDefaultSink();
+    createPipeline("custom_pipeline");
+    gst_bin_add (GST_BIN (mPipeline), bin);
+    linkOutputs(bin, sink);
+    if(mLatencyTracing) {
+        // Sorted from the sinks to the sources, reversed to the processing order.
+        std::vector<GstElement*> elements;
+        GstIterator* it = gst_bin_iterate_sorted(GST_BIN(bin));
+        GValue item = G_VALUE_INIT;
+        while(gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+            // Stays valid as long as the pipeline.
+            elements.insert(elements.begin(), GST_ELEMENT(g_value_get_object(&item)));
+            g_value_unset(&item);
+        }
+        gst_iterator_free(it);
+        addLatencyProbes(elements);
+    }
+
+    mSource = findV4L2Source(bin);
+    if(mSource == NULL) {
+        LOG_INFO("Custom pipeline contains no v4l2src, no file descriptor available");
+    }
+    mRequestedFrameMode = image_mode;
+    mWidth = width;
+    mHeight = height;
+    mFps = fps;
+}
+
+std::string CamGst::expandPipelineDescription(std::string const& description,
+        std::string const& device, uint32_t width, uint32_t height, uint32_t fps, 
+        frame_mode_t image_mode) {
+    std::map<std::string, std::string> values;
+    values["${device}"] = device;
+    values["${width}"] = boost::lexical_cast<std::string>(width);
+    values["${height}"] = boost::lexical_cast<std::string>(height);
+    values["${fps}"] = boost::lexical_cast<std::string>(fps);
+    if(description.find("${caps}") != std::string::npos) {
+        GstCaps* caps = createDefaultCaps(width, height, fps, image_mode);
+        char* caps_str = gst_caps_to_string(caps);
+        values["${caps}"] = caps_str;
+        g_free(caps_str);
+        gst_caps_unref(caps);
+    }
+
+    std::string expanded = description;
+    std::map<std::string, std::string>::iterator it = values.begin();
+    for(; it != values.end(); ++it) {
+        size_t pos = 0;
+        while((pos = expanded.find(it->first, pos)) != std::string::npos) {
+            expanded.replace(pos, it->first.size(), it->second);
+            pos += it->second.size();
+        }
+    }
+    return expanded;
+}
+
+void CamGst::addOutput(std::string const& name, std::string const& description, 
+        uint32_t max_buffers, bool drop) {
+    LOG_DEBUG("CamGst: addOutput %s: %s", name.c_str(), description.c_str());
+    Output& output = mOutputs[name];
+    output.mDescription = description;
+    output.mMaxBuffers = max_buffers > 0 ? max_buffers : 1;
+    output.mDrop = drop;
+    output.mSink = NULL;
+}
+
+void CamGst::clearOutputs() {
+    mOutputs.clear();
+}
+
+bool CamGst::getOutputFrame(std::string const& name, GstFrameHandle& handle, 
+        int32_t timeout) {
+    CAM_LOG_TRACE("CamGst: getOutputFrame %s", name.c_str());
+    std::map<std::string, Output>::iterator it = mOutputs.find(name);
+    if(it == mOutputs.end() || it->second.mSink == NULL) {
+        LOG_WARN("Output %s is not available", name.c_str());
+        return false;
+    }
+    // The appsink queue of the output holds the samples, pulled in order.
+    GstSample* sample = gst_app_sink_try_pull_sample(GST_APP_SINK(it->second.mSink), 
+            timeout > 0 ? timeout * GST_MSECOND : 0);
+    if(sample == NULL) {
+        return false;
+    }
+    try {
+        handle.reset(sample); // Adds its own reference.
+    } catch(CamGstException& e) {
+        gst_sample_unref(sample);
+        throw;
+    }
+    gst_sample_unref(sample);
+    return true;
 }
 
 void CamGst::deletePipeline() {
@@ -153,128 +500,354 @@ void CamGst::deletePipeline() {
     
     stopPipeline();
 
+    // Messages of the deleted pipeline are not dispatched anymore.
+    if(mBusWatch != NULL) {
+        g_source_destroy(mBusWatch);
+        g_source_unref(mBusWatch);
+        mBusWatch = NULL;
+    }
     gst_object_unref(GST_OBJECT(mGstPipelineBus)); 
     mGstPipelineBus = NULL;
 
+    pthread_mutex_lock(&mStateMutex);
     gst_object_unref(GST_OBJECT(mPipeline));
     mPipeline = NULL;
-    mPipelineRunning = false;
+    pthread_mutex_unlock(&mStateMutex);
+    std::map<std::string, Output>::iterator it = mOutputs.begin();
+    for(; it != mOutputs.end(); ++it) {
+        it->second.mSink = NULL;
+    }
+
+    // The streaming thread is stopped, release the last unread sample.
+    skipBuffer();
+    mCapsFilter = NULL;
+    if(mLastCaps != NULL) {
+        gst_caps_unref(mLastCaps);
+        mLastCaps = NULL;
+    }
+    // Buffers which are still held by handles keep their pool alive.
+    GstBufferPool* pool = mBufferPool.exchange(NULL);
+    if(pool != NULL) {
+        gst_object_unref(pool);
+    }
+    mNumPoolFrames = 0;
+    mNumFrames = 0;
+    mNumSinkDrops = 0;
+    mNumQueueDrops = 0;
+    if(mLatencyDump != NULL) {
+        g_source_destroy(mLatencyDump);
+        g_source_unref(mLatencyDump);
+        mLatencyDump = NULL;
+    }
+    mSinkStage = -1;
+    mLatencyTracer.clear();
+}
+
+CamGst::Statistics CamGst::getStatistics() {
+    Statistics statistics;
+    statistics.mNumFrames = mNumFrames.load(std::memory_order_relaxed);
+    statistics.mNumSinkDrops = mNumSinkDrops.load(std::memory_order_relaxed);
+    statistics.mNumQueueDrops = mNumQueueDrops.load(std::memory_order_relaxed);
+    statistics.mNumPoolFrames = mNumPoolFrames.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+bool CamGst::renegotiate(uint32_t width, uint32_t height, uint32_t fps, int32_t timeout) {
+    LOG_DEBUG("CamGst: renegotiate %dx%d@%d", width, height, fps);
+    if(mCapsFilter == NULL) {
+        LOG_WARN("Only the default pipeline can be renegotiated");
+        return false;
+    }
+    if(!isPipelineRunning()) {
+        LOG_WARN("Pipeline is not running, it can not be renegotiated");
+        return false;
+    }
+    if(fps == 0) {
+        fps = mFps;
+    }
+    // The caps would not change, so no sample with new caps would arrive.
+    if(width == mWidth && height == mHeight && fps == mFps) {
+        LOG_INFO("Pipeline already has %dx%d@%d, nothing to renegotiate", width, height, fps);
+        mRenegotiationGap = 0;
+        return true;
+    }
 
-    mNewBuffer = false;
+    // The capsfilter sends a reconfigure event upstream, v4l2src renegotiates 
+    // the camera format or videoscale/videorate adapt the images.
+    uint32_t num_changes = mNumCapsChanges.load(std::memory_order_acquire);
+    int64_t request_time = getTimeUsec();
+    GstCaps* caps = createDefaultCaps(width, height, fps, mRequestedFrameMode);
+    g_object_set (G_OBJECT (mCapsFilter), "caps", caps, (void*)NULL);
+    gst_caps_unref(caps);
+
+    // Waits for the first sample with the new caps, callbackNewBuffer() and
+    // the error messages signal mStateCond.
+    struct timespec until = getDeadline(timeout);
+    bool timed_out = false;
+    pthread_mutex_lock(&mStateMutex);
+    while(mNumCapsChanges.load(std::memory_order_acquire) == num_changes &&
+            mPipelineState != PIPELINE_ERROR && !timed_out) {
+        if(timeout > 0) {
+            timed_out = pthread_cond_timedwait(&mStateCond, &mStateMutex, &until) == ETIMEDOUT;
+        } else {
+            pthread_cond_wait(&mStateCond, &mStateMutex);
+        }
+    }
+    bool changed = mNumCapsChanges.load(std::memory_order_acquire) != num_changes;
+    bool failed = mPipelineState == PIPELINE_ERROR;
+    pthread_mutex_unlock(&mStateMutex);
+    if(failed) {
+        LOG_ERROR("Renegotiation to %dx%d@%d failed, recreate the pipeline", 
+                width, height, fps);
+        return false;
+    }
+    if(!changed) {
+        LOG_ERROR("No image with the new caps within %d msec", timeout);
+        return false;
+    }
+    mRenegotiationGap = mLastCapsChangeTime.load(std::memory_order_acquire) - request_time;
+    LOG_INFO("Renegotiated to %dx%d@%d, gap %d msec (%.1f frames)", width, height, fps,
+            (int)(mRenegotiationGap / 1000), mRenegotiationGap * fps / 1e6);
+    mWidth = width;
+    mHeight = height;
+    mFps = fps;
+    return true;
 }
 
-// Print GstMessage
 bool CamGst::startPipeline() {
     LOG_DEBUG("CamGst: startPipeline");
+    if(!startPipelineAsync()) {
+        return false;
+    }
+    if(!waitForPipeline(DEFAULT_PIPELINE_TIMEOUT / 1000)) {
+        if(getPipelineState() == PIPELINE_STARTING) {
+            LOG_ERROR("Pipeline could not be started within %d msec. If you wanted to restart the pipeline, try to delete and recreate the pipeline instead", 
+                    DEFAULT_PIPELINE_TIMEOUT / 1000);
+        }
+        return false;
+    }
+    // Tries to set the file descriptor as well.
+    readFileDescriptor();
+    return true;
+}
+
+bool CamGst::startPipelineAsync(StartCallback callback, void* data) {
+    LOG_DEBUG("CamGst: startPipelineAsync");
     if(mPipeline == NULL) {
         LOG_INFO("No pipeline available, can not be started");
         return false;
     }
 
-    if(mPipelineRunning) {
-        LOG_INFO("Pipeline already running, return true");
+    pthread_mutex_lock(&mStateMutex);
+    if(mPipelineState == PIPELINE_RUNNING || mPipelineState == PIPELINE_STARTING) {
+        bool running = mPipelineState == PIPELINE_RUNNING;
+        pthread_mutex_unlock(&mStateMutex);
+        LOG_INFO("Pipeline already running or starting, return true");
+        if(running && callback != NULL) {
+            callback(true, data);
+        } else if(callback != NULL) {
+            LOG_WARN("Pipeline is starting already, the callback is not used");
+        }
         return true;
     }
+    // A pending prewarm is superseded by the start.
+    StartCallback prewarm_callback = mStartCallback;
+    void* prewarm_callback_data = mStartCallbackData;
+    mPipelineState = PIPELINE_STARTING;
+    mStartCallback = callback;
+    mStartCallbackData = data;
+    mStartRequestTime = getTimeUsec();
+    mStartLatency = -1;
+    mFirstFrameLatency.store(-1, std::memory_order_release);
+    pthread_mutex_unlock(&mStateMutex);
+    if(prewarm_callback != NULL) {
+        prewarm_callback(false, prewarm_callback_data);
+    }
 
-    GstState state;
-    GstStateChangeReturn ret_state;
+    // The state changes are completed by callbackMessages() on the GMainLoop thread.
+    GstStateChangeReturn ret_state = gst_element_set_state(mPipeline, GST_STATE_PLAYING);
+    LOG_DEBUG("Set pipeline to playing returned %d", ret_state); 
+    if(ret_state == GST_STATE_CHANGE_FAILURE) {
+        pthread_mutex_lock(&mStateMutex);
+        if(mPipelineState == PIPELINE_STARTING) {
+            mPipelineState = PIPELINE_ERROR;
+        }
+        mStartCallback = NULL;
+        pthread_cond_broadcast(&mStateCond);
+        pthread_mutex_unlock(&mStateMutex);
+        LOG_ERROR("Pipeline could not be started, the state change failed");
+        return false;
+    }
+    return true;
+}
 
-    ret_state = gst_element_set_state(mPipeline, GST_STATE_PLAYING);
-    LOG_DEBUG("Set pipeline to playing returned %d",ret_state); 
+bool CamGst::prewarmPipeline(GstState state, StartCallback callback, void* data) {
+    LOG_DEBUG("CamGst: prewarmPipeline %s", gst_element_state_get_name(state));
+    if(mPipeline == NULL) {
+        LOG_INFO("No pipeline available, can not be prewarmed");
+        return false;
+    }
+    if(state != GST_STATE_READY && state != GST_STATE_PAUSED) {
+        LOG_WARN("Pipelines can only be prewarmed to READY or PAUSED");
+        return false;
+    }
 
-    timeval start, end;
-    gettimeofday(&start, 0);
-    int time_passed_msec = 0;
-    
+    pthread_mutex_lock(&mStateMutex);
+    if(mPipelineState != PIPELINE_STOPPED && mPipelineState != PIPELINE_PREWARMED) {
+        pthread_mutex_unlock(&mStateMutex);
+        LOG_INFO("Pipeline is running or changing its state, it is not prewarmed");
+        return false;
+    }
+    mPipelineState = PIPELINE_PREWARMING;
+    mPrewarmTarget = state;
+    mStartCallback = callback;
+    mStartCallbackData = data;
+    pthread_mutex_unlock(&mStateMutex);
+
+    GstStateChangeReturn ret_state = gst_element_set_state(mPipeline, state);
+    LOG_DEBUG("Set pipeline to %s returned %d", gst_element_state_get_name(state), ret_state); 
     if(ret_state == GST_STATE_CHANGE_ASYNC) {
-        // gst_element_get_state will return immediately (other than written in the gst-docu!)
-        do {
-            ret_state = gst_element_get_state(mPipeline, &state, NULL, DEFAULT_PIPELINE_TIMEOUT);
-            gettimeofday(&end, 0);
-            
-            time_passed_msec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
-            if(time_passed_msec > (int)DEFAULT_PIPELINE_TIMEOUT) {
-                LOG_ERROR("Pipeline could not be started. If you wanted to restart the pipeline, try to delete and recreate the pipeline instead");
-                return false;
-            }
-        } while(ret_state == GST_STATE_CHANGE_ASYNC);
-    } else {
-        ret_state = gst_element_get_state(mPipeline, &state, NULL, DEFAULT_PIPELINE_TIMEOUT);
+        // Completed by callbackMessages() as soon as the pipeline prerolled.
+        return true;
     }
+    // Done already (live sources do not preroll): the state may not even have
+    // changed, so no message would arrive.
+    pthread_mutex_lock(&mStateMutex);
+    if(mPipelineState != PIPELINE_PREWARMING) {
+        pthread_mutex_unlock(&mStateMutex);
+        return ret_state != GST_STATE_CHANGE_FAILURE;
+    }
+    bool success = ret_state != GST_STATE_CHANGE_FAILURE;
+    mPipelineState = success ? PIPELINE_PREWARMED : PIPELINE_ERROR;
+    if(!success) {
+        LOG_ERROR("Pipeline could not be prewarmed, the state change failed");
+    }
+    finishStart(success); // Unlocks mStateMutex.
+    return success;
+}
 
-    mPipelineRunning = (ret_state == GST_STATE_CHANGE_SUCCESS ? true : false);
-
-    if(!mPipelineRunning) {
-        GstMessage *msg;
-        msg = gst_bus_poll (mGstPipelineBus, GST_MESSAGE_ERROR, 0);
-        if (msg) {
-            GError *err = NULL;
-            gst_message_parse_error (msg, &err, NULL);
-            LOG_ERROR("Pipeline could not be started: %s", err->message);
-            g_error_free (err);
-            gst_message_unref (msg);
+bool CamGst::waitForPipeline(int32_t timeout) {
+    struct timespec until = getDeadline(timeout);
+    pthread_mutex_lock(&mStateMutex);
+    while(mPipelineState == PIPELINE_STARTING || mPipelineState == PIPELINE_PREWARMING) {
+        if(timeout > 0) {
+            if(pthread_cond_timedwait(&mStateCond, &mStateMutex, &until) == ETIMEDOUT) {
+                break;
+            }
+        } else {
+            pthread_cond_wait(&mStateCond, &mStateMutex);
         }
     }
+    bool done = mPipelineState == PIPELINE_RUNNING || mPipelineState == PIPELINE_PREWARMED;
+    pthread_mutex_unlock(&mStateMutex);
+    return done;
+}
 
-    // Tries to set the file descriptor as well.
-    readFileDescriptor();
-
-    return mPipelineRunning;
+bool CamGst::restartPipeline(StartCallback callback, void* data) {
+    LOG_DEBUG("CamGst: restartPipeline");
+    stopPipeline();
+    return startPipelineAsync(callback, data);
 }
 
 void CamGst::stopPipeline() {
     LOG_DEBUG("CamGst: stopPipeline");
-    if(!mPipelineRunning) {
+    pthread_mutex_lock(&mStateMutex);
+    PipelineState state = mPipelineState;
+    StartCallback callback = mStartCallback;
+    void* callback_data = mStartCallbackData;
+    mStartCallback = NULL;
+    pthread_mutex_unlock(&mStateMutex);
+    if(state == PIPELINE_STOPPED) {
         LOG_INFO("Pipeline already stopped");
         return;
     }
 
     // Setting to GST_STATE_NULL does not happen asynchronously, wait until stop.
-    GstStateChangeReturn st = gst_element_set_state(mPipeline, GST_STATE_NULL);
-
-    mPipelineRunning = false;
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+
+    pthread_mutex_lock(&mStateMutex);
+    mPipelineState = PIPELINE_STOPPED;
+    pthread_cond_broadcast(&mStateCond);
+    pthread_mutex_unlock(&mStateMutex);
+    // A pending start is aborted.
+    if(callback != NULL) {
+        callback(false, callback_data);
+    }
 
     rmFileDescriptor();
 }
 
+CamGst::PipelineState CamGst::getPipelineState() {
+    pthread_mutex_lock(&mStateMutex);
+    PipelineState state = mPipelineState;
+    pthread_mutex_unlock(&mStateMutex);
+    return state;
+}
+
+int CamGst::getFileDescriptor() {
+    // The fd is only available once an asynchronous start has completed.
+    if(mFileDescriptor == -1 && isPipelineRunning()) {
+        readFileDescriptor();
+    }
+    return mFileDescriptor;
+}
+
+int64_t CamGst::getStartLatency() {
+    pthread_mutex_lock(&mStateMutex);
+    int64_t latency = mStartLatency;
+    pthread_mutex_unlock(&mStateMutex);
+    return latency;
+}
+
 bool CamGst::getBuffer(std::vector<uint8_t>& buffer, bool blocking_read, 
         int32_t timeout) {
-    LOG_DEBUG("CamGst: getBuffer");
+    CAM_LOG_TRACE("CamGst: getBuffer");
+    GstFrameHandle handle;
+    try {
+        if(!getFrame(handle, blocking_read, timeout)) {
+            return false;
+        }
+    } catch(CamGstException& e) {
+        LOG_ERROR_S << "Error while copying frame buffer: " << e.what();
+        return false;
+    }
+    // Copy buffer for return.
+    buffer.resize(handle.size());
+    memcpy(buffer.data(), handle.data(), handle.size());
+    return true;
+}
+
+bool CamGst::getFrame(GstFrameHandle& handle, bool blocking_read, 
+        int32_t timeout) {
+    CAM_LOG_TRACE("CamGst: getFrame");
     struct timeval start, end;
     long mtime=0, seconds=0, useconds=0; 
     if(timeout > 0) {
         gettimeofday(&start, NULL);
     }
     do { 
-        pthread_mutex_lock(&mMutexBuffer);
-        if(mBuffer == NULL || mBufferSize == 0 || mNewBuffer == false) {
-            if(!blocking_read) { // !blocking: unlock and return.
-                pthread_mutex_unlock(&mMutexBuffer);
-                LOG_DEBUG("No image available");
-                return false;
-            } else {
-                pthread_mutex_unlock(&mMutexBuffer);
-                usleep(50); // blocking: wait
+        // Take ownership of the newest sample, the streaming thread is never blocked.
+        GstSample* sample = mLatestSample.exchange(NULL, std::memory_order_acq_rel);
+        if(sample != NULL) {
+            try {
+                handle.reset(sample); // Adds its own reference, no allocation.
+            } catch(CamGstException& e) {
+                gst_sample_unref(sample);
+                throw;
             }
-        } else {
-            // Copy buffer for return.
-            buffer.resize(mBufferSize);
-            GstMapInfo info;
-            GstMapFlags flags = GST_MAP_READ;
-            assert(mSample);
-            gboolean st = gst_buffer_map(mBuffer, &info, flags);
-            if(!st){
-                LOG_ERROR_S << "Error while copying frame buffer";
-                pthread_mutex_unlock(&mMutexBuffer);
-                return false;
+            if(mSinkStage >= 0) {
+                mLatencyTracer.record(mSinkStage + 1, 
+                        GST_BUFFER_PTS(gst_sample_get_buffer(sample)), getTimeUsec());
             }
-            memcpy(&buffer[0], info.data, mBufferSize);
-            gst_buffer_unmap(mBuffer, &info);
-            mNewBuffer = false;
-            pthread_mutex_unlock(&mMutexBuffer);
-            blocking_read = false; // Done, return true.
+            gst_sample_unref(sample);
             return true;
         }
+
+        if(!blocking_read) {
+            CAM_LOG_TRACE("No image available");
+            return false;
+        }
+        usleep(50); // blocking: wait
         
         if(timeout > 0) {
             // Check for timeout.
@@ -292,13 +865,13 @@ bool CamGst::getBuffer(std::vector<uint8_t>& buffer, bool blocking_read,
 }
 
 bool CamGst::skipBuffer() {
-    LOG_DEBUG("CamGst: skipBuffer");
-    bool skipped = false;
-    pthread_mutex_lock(&mMutexBuffer);
-    skipped = mNewBuffer;
-    mNewBuffer = false;
-    pthread_mutex_unlock(&mMutexBuffer);
-    return skipped;
+    CAM_LOG_TRACE("CamGst: skipBuffer");
+    GstSample* sample = mLatestSample.exchange(NULL, std::memory_order_acq_rel);
+    if(sample == NULL) {
+        return false;
+    }
+    gst_sample_unref(sample);
+    return true;
 }
 
 // PRIVATE
@@ -307,6 +880,17 @@ CamGst::CamGst() {}
 
 void CamGst::setCameraParameters(uint32_t* width, uint32_t* height, uint32_t* fps) {
     LOG_DEBUG("CamGst: setCameraParameters");
+    TestDevice test_device;
+    if(test_device.parse(mDevice)) {
+        // videotestsrc creates any size, the URI replaces the camera settings.
+        if(*width == 0)
+            *width = test_device.mWidth;
+        if(*height == 0)
+            *height = test_device.mHeight;
+        if(*fps == 0)
+            *fps = test_device.mFps;
+        return;
+    }
     CamConfig config(mDevice);
 
     // Take the last used values if parameter is 0.
@@ -333,6 +917,9 @@ void CamGst::setCameraParameters(uint32_t* width, uint32_t* height, uint32_t* fp
 
 GstElement* CamGst::createDefaultSource(std::string const& device) {
     LOG_DEBUG("createDefaultSource, device: %s",device.c_str());
+    if(TestDevice::isTestDevice(device)) {
+        return createTestSource(device);
+    }
     GstElement* element = gst_element_factory_make ("v4l2src", "default_source");
     if(element == NULL)
         throw CamGstException("Default source could not be created.");
@@ -342,61 +929,253 @@ GstElement* CamGst::createDefaultSource(std::string const& device) {
     return element;
 }
 
+GstElement* CamGst::createTestSource(std::string const& device) {
+    TestDevice test_device;
+    if(!test_device.parse(device)) {
+        throw CamGstException("Invalid test device " + device + 
+                ", expected test://<width>x<height>@<fps>/<format>");
+    }
+    // The format caps make the bin offer only the native format, see isFormatNative().
+    GError* error = NULL;
+    GstElement* bin = gst_parse_bin_from_description(
+            test_device.getSourceDescription().c_str(), TRUE, &error);
+    if(error != NULL) {
+        std::string err_str(error->message);
+        g_error_free(error);
+        if(bin != NULL) {
+            gst_object_unref(bin);
+        }
+        throw CamGstException(err_str.insert(0, "Test source could not be created: "));
+    }
+    if(bin == NULL) {
+        throw CamGstException("Test source could not be created.");
+    }
+    gst_object_set_name(GST_OBJECT(bin), "default_source");
+    return bin;
+}
+
 static std::string toGstreamerMediaType(frame_mode_t mode)
 {
     switch(mode)
     {
-        case MODE_GRAYSCALE: return "video/x-raw-gray";
-        case MODE_RGB:       return "video/x-raw-rgb";
-        case MODE_UYVY:      return "video/x-raw-yuv";
+        case MODE_UNDEFINED:
+        case MODE_GRAYSCALE:
+        case MODE_RGB:
+        case MODE_BGR:
+        case MODE_RGB32:
+        case MODE_UYVY:      return "video/x-raw";
         case MODE_JPEG:      return "image/jpeg";
         default:
             throw std::runtime_error("does not know the media type for mode " + boost::lexical_cast<std::string>(mode));
     }
 }
 
-static std::string toGstreamerFourCC(frame_mode_t mode)
+/**
+ * Value of the 'format' field of video/x-raw, empty if any format is accepted.
+ */
+static std::string toGstreamerFormat(frame_mode_t mode)
 {
     switch(mode)
     {
-        case MODE_GRAYSCALE: return "";
-        case MODE_RGB:       return "";
+        case MODE_GRAYSCALE: return "GRAY8";
+        case MODE_RGB:       return "RGB";
+        case MODE_BGR:       return "BGR";
+        case MODE_RGB32:     return "RGBx";
         case MODE_UYVY:      return "UYVY";
-        case MODE_JPEG:      return "";
-        default:
-            throw std::runtime_error("does not know the media type for mode " + boost::lexical_cast<std::string>(mode));
+        default:             return "";
+    }
+}
+
+void CamGst::createPipeline(const char* name) {
+    if((mPipeline = gst_pipeline_new (name)) == NULL) {
+        deletePipeline();
+        throw CamGstException("Pipeline could not be created.");    
+    }
+
+    // Add a message handler.
+    if(mGstPipelineBus != NULL) {
+        gst_object_unref (mGstPipelineBus); 
+        mGstPipelineBus = NULL;
     }
+    mGstPipelineBus = gst_pipeline_get_bus (GST_PIPELINE (mPipeline));
+    // gst_bus_add_watch() would use the default context, the watch is attached
+    // to the context of the shared main loop instead.
+    mBusWatch = gst_bus_create_watch (mGstPipelineBus);
+    g_source_set_callback (mBusWatch, (GSourceFunc)callbackMessagesStatic, this, NULL);
+    g_source_attach (mBusWatch, mContext);
 }
 
-// remove format, bb to 24?
-GstElement* CamGst::createDefaultCap(uint32_t const width, uint32_t const height, uint32_t const fps, uint32_t bpp, frame_mode_t image_mode ) {
-    LOG_DEBUG("createDefaultCap, width: %d, height: %d, fps: %d", width, height, fps);
-    GstElement* element = gst_element_factory_make("capsfilter", "default_cap");
+void CamGst::linkOutputs(GstElement* last, GstElement* sink) {
+    if(mOutputs.empty()) {
+        gst_bin_add (GST_BIN (mPipeline), sink);
+        if (!gst_element_link (last, sink)) {
+            deletePipeline();
+            throw CamGstException("Failed to link the sink, does the pipeline end with a source pad?");
+        }
+        return;
+    }
+
+    // Every branch gets its own leaky queue, so a slow consumer of one output 
+    // never stalls the capture or the other outputs.
+    GstElement* tee = gst_element_factory_make("tee", "output_tee");
+    GstElement* queue = createOutputQueue("default_queue", MAX_SINK_BUFFERS);
+    if(tee == NULL || queue == NULL) {
+        deletePipeline();
+        throw CamGstException("Tee or queue could not be created.");
+    }
+    gst_bin_add_many (GST_BIN (mPipeline), tee, queue, sink, (void*)NULL);
+    if (!gst_element_link_many (last, tee, queue, sink, (void*)NULL)) {
+        deletePipeline();
+        throw CamGstException("Failed to link the tee, does the pipeline end with a source pad?");
+    }
+
+    std::map<std::string, Output>::iterator it = mOutputs.begin();
+    for(; it != mOutputs.end(); ++it) {
+        Output& output = it->second;
+        std::string const& name = it->first;
+        // An empty description passes the images unchanged.
+        GError* error = NULL;
+        GstElement* bin = gst_parse_bin_from_description(
+                output.mDescription.empty() ? "identity" : output.mDescription.c_str(), 
+                TRUE, &error);
+        if(error != NULL || bin == NULL) {
+            std::string err_str(error != NULL ? error->message : "unknown error");
+            if(error != NULL) {
+                g_error_free(error);
+            }
+            if(bin != NULL) {
+                gst_object_unref(bin);
+            }
+            deletePipeline();
+            throw CamGstException("Output " + name + " could not be parsed: " + err_str);
+        }
+        GstElement* output_queue = createOutputQueue((name + "_queue").c_str(), 
+                output.mMaxBuffers);
+        GstElement* output_sink = gst_element_factory_make("appsink", name.c_str());
+        if(output_queue == NULL || output_sink == NULL) {
+            deletePipeline();
+            throw CamGstException("Sink of output " + name + " could not be created.");
+        }
+        // Samples are pulled by getOutputFrame(), the appsink is the queue of the output.
+        g_object_set (G_OBJECT (output_sink), 
+                "sync", FALSE, 
+                "max-buffers", output.mMaxBuffers,
+                "drop", output.mDrop ? TRUE : FALSE,
+                "emit-signals", FALSE,
+                (void*)NULL);
+        gst_bin_add_many (GST_BIN (mPipeline), output_queue, bin, output_sink, (void*)NULL);
+        if (!gst_element_link_many (tee, output_queue, bin, output_sink, (void*)NULL)) {
+            deletePipeline();
+            throw CamGstException("Failed to link output " + name);
+        }
+        output.mSink = output_sink;
+        LOG_INFO("Output %s: %s", name.c_str(), output.mDescription.c_str());
+    }
+}
+
+GstElement* CamGst::createOutputQueue(const char* name, uint32_t max_buffers) {
+    GstElement* element = gst_element_factory_make("queue", name);
     if(element == NULL)
-        throw CamGstException("Default cap could not be created.");
+        return NULL;
+    g_object_set (G_OBJECT (element),
+            "leaky", 2, // downstream: drops the oldest buffers
+            "max-size-buffers", max_buffers,
+            "max-size-bytes", 0,
+            "max-size-time", (guint64)0,
+            (void*)NULL);
+    return element;
+}
 
-    std::string media_type("video/x-raw-yuv"), fourcc;
-    if (image_mode != MODE_UNDEFINED)
-    {
-        media_type = toGstreamerMediaType(image_mode);
-        fourcc     = toGstreamerFourCC(image_mode);
+void CamGst::addLatencyProbes(std::vector<GstElement*> const& elements) {
+    mLatencyTracer.clear();
+    for(unsigned int i=0; i<elements.size(); ++i) {
+        gchar* name = gst_element_get_name(elements[i]);
+        LatencyProbe* probe = new LatencyProbe;
+        probe->mCamGst = this;
+        probe->mStage = mLatencyTracer.addStage(name);
+        probe->mFirst = i == 0;
+        g_free(name);
+        GstPad* pad = gst_element_get_static_pad(elements[i], "src");
+        if(pad == NULL) {
+            LOG_WARN("Element %d has no source pad, not traced", i);
+            delete probe;
+            continue;
+        }
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callbackLatencyProbeStatic, 
+                probe, deleteLatencyProbe);
+        gst_object_unref(pad);
     }
-    if (image_mode == MODE_GRAYSCALE) {
-        bpp = 8;
+    mSinkStage = mLatencyTracer.addStage("appsink");
+    mLatencyTracer.addStage("handoff");
+
+    if(mLatencyDumpInterval > 0) {
+        mLatencyDump = g_timeout_source_new_seconds(mLatencyDumpInterval);
+        g_source_set_callback(mLatencyDump, callbackDumpLatencyStatic, this, NULL);
+        g_source_attach(mLatencyDump, mContext);
+    }
+}
+
+void CamGst::traceBuffer(GstBuffer* buffer, LatencyProbe const& probe) {
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if(!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return;
+    }
+    int64_t now = getTimeUsec();
+    int64_t capture_time = -1;
+    GstClock* clock = probe.mFirst ? gst_element_get_clock(mPipeline) : NULL;
+    if(clock != NULL) {
+        // Live sources timestamp the images with the running time of their capture.
+        GstClockTime running_time = gst_clock_get_time(clock) - 
+                gst_element_get_base_time(mPipeline);
+        capture_time = now - ((int64_t)running_time - (int64_t)pts) / 1000;
+        gst_object_unref(clock);
+    }
+    mLatencyTracer.record(probe.mStage, pts, now, capture_time);
+}
+
+GstElement* CamGst::findV4L2Source(GstElement* bin) {
+    GstElement* source = NULL;
+    GstIterator* it = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+    while(source == NULL && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement* element = GST_ELEMENT(g_value_get_object(&item));
+        GstElementFactory* factory = gst_element_get_factory(element);
+        if(factory != NULL && 
+                strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "v4l2src") == 0) {
+            // Stays valid as long as the pipeline.
+            source = element;
+        }
+        g_value_unset(&item);
     }
+    gst_iterator_free(it);
+    return source;
+}
+
+GstCaps* CamGst::createDefaultCaps(uint32_t const width, uint32_t const height, 
+        uint32_t const fps, frame_mode_t image_mode) {
+    std::string media_type = toGstreamerMediaType(image_mode);
+    std::string format = toGstreamerFormat(image_mode);
 
     GstCaps* caps = gst_caps_new_simple (media_type.c_str(),
             "width", G_TYPE_INT, width,
             "height", G_TYPE_INT, height,
             "framerate", GST_TYPE_FRACTION, fps, 1,
-            "bpp", G_TYPE_INT, bpp,
             (void*)NULL);
-    if (!fourcc.empty())
+    if (!format.empty())
     {
         gst_caps_set_simple(caps,
-                "format", G_TYPE_INT, GST_STR_FOURCC (fourcc.c_str()),
+                "format", G_TYPE_STRING, format.c_str(),
                 (void*)NULL);
     }
+    return caps;
+}
+
+GstElement* CamGst::createDefaultCap(GstCaps* caps, const char* name) {
+    GstElement* element = gst_element_factory_make("capsfilter", name);
+    if(element == NULL) {
+        gst_caps_unref(caps);
+        throw CamGstException("Default cap could not be created.");
+    }
 
     char* debug_str = gst_caps_to_string(caps);
     LOG_DEBUG("createDefaultCap: %s", debug_str);
@@ -404,6 +1183,36 @@ GstElement* CamGst::createDefaultCap(uint32_t const width, uint32_t const height
 
     // Set property 'caps' of element 'capsfilter'.
     g_object_set (G_OBJECT (element), "caps", caps, (void*)NULL);
+    gst_caps_unref(caps);
+    return element;
+}
+
+bool CamGst::isFormatNative(GstElement* source, GstCaps* caps) {
+    // The source reports the formats of the device once it is opened (READY).
+    if(gst_element_set_state(source, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        LOG_WARN("Source could not be opened to query its formats, will convert");
+        gst_element_set_state(source, GST_STATE_NULL);
+        return false;
+    }
+    GstPad* pad = gst_element_get_static_pad(source, "src");
+    GstCaps* source_caps = gst_pad_query_caps(pad, NULL);
+    bool native = gst_caps_can_intersect(source_caps, caps);
+    gst_caps_unref(source_caps);
+    gst_object_unref(pad);
+    gst_element_set_state(source, GST_STATE_NULL);
+    LOG_INFO("Requested format is %s by the camera", native ? "offered" : "not offered");
+    return native;
+}
+
+GstElement* CamGst::createDefaultConverter() {
+    GstElement* element = gst_element_factory_make("videoconvert", "default_converter");
+    if(element == NULL)
+        throw CamGstException("videoconvert could not be created, is gst-plugins-base installed?");
+    // Available since GStreamer 1.12.
+    if(g_object_class_find_property(G_OBJECT_GET_CLASS(element), "n-threads")) {
+        LOG_DEBUG("createDefaultConverter: %d threads (0: one per CPU)", mConvertThreads);
+        g_object_set (G_OBJECT (element), "n-threads", mConvertThreads, (void*)NULL);
+    }
     return element;
 }
 
@@ -420,27 +1229,59 @@ GstElement* CamGst::createDefaultEncoder(int32_t const jpeg_quality) {
     return element;
 }
 
-// removes max-buffers and drop?
 GstElement* CamGst::createDefaultSink() {
     LOG_DEBUG("CamGst: createDefaultSink");
     GstElement* element  = gst_element_factory_make("appsink", "default_buffer_sink");
     if(element == NULL)
         throw CamGstException("Default sink could not be created.");
+    // Only the newest image is of interest: the sink queues a single sample
+    // and drops the older one instead of blocking the streaming thread.
     g_object_set (G_OBJECT (element), 
             "sync", FALSE, 
-            //"max_buffers", 8,
-            //"drop", FALSE,
+            "max-buffers", MAX_SINK_BUFFERS,
+            "drop", TRUE,
+            "emit-signals", FALSE,
             (void*)NULL);
-    g_object_set (element, "emit-signals", TRUE, NULL);
 
-    // do after add und link? Disconnecting?
-    g_signal_connect (element, "new-sample",  G_CALLBACK (callbackNewBufferStatic), this);
+    // Direct function calls from the streaming thread, no signal marshalling.
+    GstAppSinkCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.new_sample = callbackNewBufferStatic;
+    gst_app_sink_set_callbacks(GST_APP_SINK(element), &callbacks, this, NULL);
+
+    if(mPoolBuffers > 0) {
+        GstPad* pad = gst_element_get_static_pad(element, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, 
+                callbackAllocationQueryStatic, this, NULL);
+        gst_object_unref(pad);
+    }
     return element;
 }
 
+uint32_t CamGst::getPoolBufferSize(GstCaps* caps) {
+    GstStructure* structure = gst_caps_get_structure(caps, 0);
+    gint width = 0, height = 0;
+    if(structure == NULL || std::string(gst_structure_get_name(structure)) != "video/x-raw" ||
+            !gst_structure_get_int(structure, "width", &width) ||
+            !gst_structure_get_int(structure, "height", &height)) {
+        return 0;
+    }
+    const gchar* format = gst_structure_get_string(structure, "format");
+    uint32_t row_size = 0;
+    switch(format != NULL ? fromGstreamerFormat(format) : MODE_UNDEFINED) {
+        case MODE_GRAYSCALE: row_size = GST_ROUND_UP_4(width); break;
+        case MODE_RGB:
+        case MODE_BGR: row_size = GST_ROUND_UP_4(width * 3); break;
+        case MODE_RGB32: row_size = width * 4; break;
+        case MODE_UYVY: row_size = GST_ROUND_UP_4(width * 2); break;
+        default: return 0;
+    }
+    return row_size * height;
+}
+
 bool CamGst::readFileDescriptor(){
     LOG_DEBUG("CamGst: readFileDescriptor");
-    if(!mPipelineRunning || mSource == NULL) {
+    if(!isPipelineRunning() || mSource == NULL) {
         LOG_WARN("Pipeline is not running or no source available, FD could not be requested.");
         return false;
     }
@@ -457,10 +1298,126 @@ bool CamGst::readFileDescriptor(){
 }
 
 // PRIVATE STATIC 
-void* CamGst::mainLoop(void* ptr) {
+pthread_mutex_t CamGst::MainLoop::sMutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned int CamGst::MainLoop::sNumUsers = 0;
+GMainContext* CamGst::MainLoop::sContext = NULL;
+GMainLoop* CamGst::MainLoop::sLoop = NULL;
+pthread_t CamGst::MainLoop::sThread;
+
+GMainContext* CamGst::MainLoop::acquire() {
+    pthread_mutex_lock(&sMutex);
+    if(sNumUsers == 0) {
+        LOG_DEBUG("Starting gst main loop thread");
+        sContext = g_main_context_new();
+        sLoop = g_main_loop_new(sContext, FALSE);
+        // The loop keeps the context, the thread releases the loop.
+        g_main_context_unref(sContext);
+        pthread_create(&sThread, NULL, run, (void*)sLoop);
+    }
+    sNumUsers++;
+    GMainContext* context = sContext;
+    pthread_mutex_unlock(&sMutex);
+    return context;
+}
+
+/**
+ * Signals the waiting release() from the main loop thread.
+ */
+struct MainLoopBarrier {
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCond;
+    bool mDone;
+};
+
+gboolean CamGst::MainLoop::signalBarrier(gpointer data) {
+    MainLoopBarrier* barrier = (MainLoopBarrier*)data;
+    pthread_mutex_lock(&barrier->mMutex);
+    barrier->mDone = true;
+    pthread_cond_signal(&barrier->mCond);
+    pthread_mutex_unlock(&barrier->mMutex);
+    return FALSE;
+}
+
+void CamGst::MainLoop::release() {
+    pthread_mutex_lock(&sMutex);
+    if(sNumUsers == 0) {
+        pthread_mutex_unlock(&sMutex);
+        return;
+    }
+    bool in_loop = pthread_equal(pthread_self(), sThread);
+    if(in_loop) {
+        LOG_WARN("CamGst released from a message callback, can not wait for it");
+    }
+    sNumUsers--;
+    if(sNumUsers == 0) {
+        pthread_t thread = sThread;
+        if(in_loop) {
+            // The loop returns after the current dispatch.
+            g_main_loop_quit(sLoop);
+            pthread_detach(thread);
+        } else {
+            // A quit before g_main_loop_run() would be lost, the loop quits itself.
+            GSource* quit = g_idle_source_new();
+            g_source_set_priority(quit, G_PRIORITY_DEFAULT);
+            g_source_set_callback(quit, quitLoop, sLoop, NULL);
+            g_source_attach(quit, sContext);
+            g_source_unref(quit);
+        }
+        sLoop = NULL;
+        sContext = NULL;
+        pthread_mutex_unlock(&sMutex);
+        // Joined without the lock: a message callback which is running at the
+        // moment may still need it. A new user starts its own thread meanwhile.
+        if(!in_loop) {
+            pthread_join(thread, NULL);
+        }
+        return;
+    }
+    GMainContext* context = sContext;
+    pthread_mutex_unlock(&sMutex);
+    if(in_loop) {
+        return;
+    }
+
+    // Sources are dispatched one after the other: once the idle source has run,
+    // a message callback which has been running during the release has returned.
+    // It gets the priority of the bus watches, an idle priority would wait
+    // until no message is pending anymore.
+    MainLoopBarrier barrier;
+    pthread_mutex_init(&barrier.mMutex, NULL);
+    pthread_cond_init(&barrier.mCond, NULL);
+    barrier.mDone = false;
+    GSource* idle = g_idle_source_new();
+    g_source_set_priority(idle, G_PRIORITY_DEFAULT);
+    g_source_set_callback(idle, signalBarrier, &barrier, NULL);
+    g_source_attach(idle, context);
+    g_source_unref(idle);
+    pthread_mutex_lock(&barrier.mMutex);
+    while(!barrier.mDone) {
+        pthread_cond_wait(&barrier.mCond, &barrier.mMutex);
+    }
+    pthread_mutex_unlock(&barrier.mMutex);
+    pthread_cond_destroy(&barrier.mCond);
+    pthread_mutex_destroy(&barrier.mMutex);
+}
+
+gboolean CamGst::MainLoop::quitLoop(gpointer data) {
+    g_main_loop_quit((GMainLoop*)data);
+    return FALSE;
+}
+
+unsigned int CamGst::MainLoop::getNumUsers() {
+    pthread_mutex_lock(&sMutex);
+    unsigned int num_users = sNumUsers;
+    pthread_mutex_unlock(&sMutex);
+    return num_users;
+}
+
+void* CamGst::MainLoop::run(void* ptr) {
     LOG_INFO("Start gst main loop");
     GMainLoop* gmain_loop = (GMainLoop*)ptr;
-    g_main_loop_run ((GMainLoop*)gmain_loop);
+    g_main_loop_run (gmain_loop);
+    g_main_loop_unref (gmain_loop);
     LOG_INFO("Stop gst main loop");
     return NULL;
 }
@@ -473,14 +1430,45 @@ gboolean CamGst::callbackMessagesStatic(GstBus* bus, GstMessage* msg, gpointer d
 
 gboolean CamGst::callbackMessages(GstBus* bus, GstMessage* msg, gpointer data)
 {
-    //CamGst* cam_gst = (CamGst*)data;
-    LOG_DEBUG("GStreamer callback message: %s", GST_MESSAGE_TYPE_NAME (msg));
+    CAM_LOG_TRACE("GStreamer callback message: %s", GST_MESSAGE_TYPE_NAME (msg));
 
     switch (GST_MESSAGE_TYPE (msg)) {
 
         case GST_MESSAGE_EOS:
             LOG_INFO("GStreamer end of stream reached.");
-            //cam_gst->deletePipeline();
+        break;
+
+        case GST_MESSAGE_STATE_CHANGED: {
+            GstState old_state, new_state, pending_state;
+            gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+            // Only the pipeline itself completes the start, not its elements.
+            pthread_mutex_lock(&mStateMutex);
+            if(mPipeline == NULL || GST_MESSAGE_SRC (msg) != GST_OBJECT (mPipeline)) {
+                pthread_mutex_unlock(&mStateMutex);
+                break;
+            }
+            LOG_DEBUG("Pipeline state changed from %s to %s", 
+                    gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
+            if(new_state == GST_STATE_PLAYING && mPipelineState == PIPELINE_STARTING) {
+                mPipelineState = PIPELINE_RUNNING;
+                mStartLatency = getTimeUsec() - mStartRequestTime;
+                LOG_INFO("Pipeline running after %d msec", (int)(mStartLatency / 1000));
+                finishStart(true); // Unlocks mStateMutex.
+                break;
+            }
+            if(new_state == mPrewarmTarget && mPipelineState == PIPELINE_PREWARMING) {
+                mPipelineState = PIPELINE_PREWARMED;
+                LOG_INFO("Pipeline prewarmed to %s", gst_element_state_get_name(new_state));
+                finishStart(true); // Unlocks mStateMutex.
+                break;
+            }
+            pthread_mutex_unlock(&mStateMutex);
+        break;
+        }
+
+        case GST_MESSAGE_ASYNC_DONE:
+            // The pipeline prerolled (PAUSED), PLAYING follows as a STATE_CHANGED message.
+            LOG_DEBUG("GStreamer asynchronous state change done");
         break;
 
         case GST_MESSAGE_ERROR: {
@@ -488,11 +1476,19 @@ gboolean CamGst::callbackMessages(GstBus* bus, GstMessage* msg, gpointer data)
             GError *error;
 
             gst_message_parse_error (msg, &error, &debug);
+            LOG_ERROR("GStreamer error message received: %s (%s)", error->message, 
+                    debug != NULL ? debug : "no details");
             g_free (debug);
-
-            LOG_INFO("GStreamer error message received: ", error->message);
             g_error_free (error);
-            //cam_gst->deletePipeline();
+
+            // Any error of the pipeline stops the streaming, delete and recreate it.
+            pthread_mutex_lock(&mStateMutex);
+            if(mPipeline == NULL || mPipelineState == PIPELINE_STOPPED) {
+                pthread_mutex_unlock(&mStateMutex);
+                break;
+            }
+            mPipelineState = PIPELINE_ERROR;
+            finishStart(false); // Unlocks mStateMutex.
         break;
         }
         default: break;
@@ -500,43 +1496,143 @@ gboolean CamGst::callbackMessages(GstBus* bus, GstMessage* msg, gpointer data)
     return true;
 }
 
-void CamGst::callbackNewBufferStatic(GstAppSink* object, CamGst* cam_gst_p) {
-    cam_gst_p->callbackNewBuffer(object, cam_gst_p);
-}   
+void CamGst::finishStart(bool success) {
+    StartCallback callback = mStartCallback;
+    void* callback_data = mStartCallbackData;
+    mStartCallback = NULL;
+    pthread_cond_broadcast(&mStateCond);
+    pthread_mutex_unlock(&mStateMutex);
+    if(callback != NULL) {
+        callback(success, callback_data);
+    }
+}
 
-void CamGst::callbackNewBuffer(GstAppSink* object, CamGst* cam_gst_p) {
-    LOG_DEBUG("CamGst: callbackNewBuffer");
-    pthread_mutex_lock(&mMutexBuffer);
-    //clean up old buffer and sample
-    if(mBuffer != NULL) {
-        LOG_DEBUG("Unref old image buffer");
-        gst_buffer_unref(mBuffer);
-        mBuffer = NULL;
-        mBufferSize = 0; 
-    }
-    if(mSample != NULL) {
-        gst_sample_unref(mSample);
-        mSample = NULL;
+int64_t CamGst::getTimeUsec() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+void CamGst::callbackQueueOverrunStatic(GstElement* queue, gpointer data) {
+    ((CamGst*)data)->mNumQueueDrops.fetch_add(1, std::memory_order_relaxed);
+}
+
+GstPadProbeReturn CamGst::callbackLatencyProbeStatic(GstPad* pad, 
+        GstPadProbeInfo* info, gpointer data) {
+    LatencyProbe* probe = (LatencyProbe*)data;
+    probe->mCamGst->traceBuffer(GST_PAD_PROBE_INFO_BUFFER(info), *probe);
+    return GST_PAD_PROBE_OK;
+}
+
+void CamGst::deleteLatencyProbe(gpointer data) {
+    delete (LatencyProbe*)data;
+}
+
+gboolean CamGst::callbackDumpLatencyStatic(gpointer data) {
+    LOG_INFO("Pipeline latencies:\n%s", ((CamGst*)data)->mLatencyTracer.toString().c_str());
+    return TRUE; // Continues until the pipeline is deleted.
+}
+
+GstPadProbeReturn CamGst::callbackAllocationQueryStatic(GstPad* pad, 
+        GstPadProbeInfo* info, gpointer data) {
+    return ((CamGst*)data)->callbackAllocationQuery(GST_PAD_PROBE_INFO_QUERY(info));
+}
+
+GstPadProbeReturn CamGst::callbackAllocationQuery(GstQuery* query) {
+    if(GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION) {
+        return GST_PAD_PROBE_OK;
+    }
+    GstCaps* caps = NULL;
+    gboolean need_pool = FALSE;
+    gst_query_parse_allocation(query, &caps, &need_pool);
+    uint32_t size = caps != NULL ? getPoolBufferSize(caps) : 0;
+    if(!need_pool || size == 0 || gst_query_get_n_allocation_pools(query) > 0) {
+        // The appsink does not answer the query itself, upstream allocates.
+        return GST_PAD_PROBE_OK;
     }
 
-    //Pull new sample and store buffer
-    mSample = gst_app_sink_pull_sample(object);
-    if(mSample == NULL){
+    GstAllocationParams params;
+    gst_allocation_params_init(&params);
+    params.align = POOL_ALIGNMENT - 1; // Alignment mask.
+    // The buffers keep the image size, the memory is padded to whole blocks.
+    params.padding = (size + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT - size;
+    GstBufferPool* pool = gst_buffer_pool_new();
+    GstStructure* config = gst_buffer_pool_get_config(pool);
+    // min == max: all buffers are allocated when upstream activates the pool.
+    gst_buffer_pool_config_set_params(config, caps, size, mPoolBuffers, mPoolBuffers);
+    gst_buffer_pool_config_set_allocator(config, NULL, &params);
+    if(!gst_buffer_pool_set_config(pool, config)) {
+        LOG_WARN("Buffer pool could not be configured, upstream allocates");
+        gst_object_unref(pool);
+        return GST_PAD_PROBE_OK;
+    }
+    gst_query_add_allocation_pool(query, pool, size, mPoolBuffers, mPoolBuffers);
+    gst_query_add_allocation_param(query, NULL, &params);
+    LOG_DEBUG("Proposed pool of %d buffers with %d bytes", mPoolBuffers, size);
+
+    GstBufferPool* old_pool = mBufferPool.exchange(pool);
+    if(old_pool != NULL) {
+        gst_object_unref(old_pool);
+    }
+    return GST_PAD_PROBE_HANDLED;
+}
+
+GstFlowReturn CamGst::callbackNewBufferStatic(GstAppSink* object, gpointer data) {
+    return ((CamGst*)data)->callbackNewBuffer(object);
+}   
+
+GstFlowReturn CamGst::callbackNewBuffer(GstAppSink* object) {
+    //Pull new sample
+    GstSample* sample = gst_app_sink_pull_sample(object);
+    if(sample == NULL){
         LOG_ERROR_S << "Could not pull sample";
-        return;
+        return GST_FLOW_OK;
     }
-    mBuffer = gst_buffer_ref(gst_sample_get_buffer(mSample));
 
-    if(mBuffer == NULL) { // EOS was received before any buffer
-        mBufferSize = 0;
-        mNewBuffer = false;
+    if(gst_sample_get_buffer(sample) == NULL) { // EOS was received before any buffer
         LOG_WARN("EOS was received before any buffer");
-    } else {
-        mBufferSize = gst_buffer_get_size(mBuffer);
-        mNewBuffer = true;
-        LOG_DEBUG("New image received, size: %d",mBufferSize); 
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+    CAM_LOG_TRACE_EVERY_N(100, "New image received, size: %d", (int)gst_buffer_get_size(gst_sample_get_buffer(sample)));
+    // The caps object only changes with a renegotiation, the pointers are compared.
+    GstCaps* caps = gst_sample_get_caps(sample);
+    if(caps != mLastCaps) {
+        if(mLastCaps != NULL) {
+            gst_caps_unref(mLastCaps);
+        }
+        mLastCaps = caps != NULL ? gst_caps_ref(caps) : NULL;
+        // Wakes up renegotiate(), caps changes are rare enough for the lock.
+        pthread_mutex_lock(&mStateMutex);
+        mLastCapsChangeTime.store(getTimeUsec(), std::memory_order_relaxed);
+        mNumCapsChanges.fetch_add(1, std::memory_order_release);
+        pthread_cond_broadcast(&mStateCond);
+        pthread_mutex_unlock(&mStateMutex);
+    }
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    if(buffer->pool != NULL && buffer->pool == mBufferPool.load(std::memory_order_relaxed)) {
+        mNumPoolFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(mFirstFrameLatency.load(std::memory_order_relaxed) < 0) {
+        // mStartRequestTime is written before the pipeline is set to PLAYING.
+        int64_t expected = -1;
+        mFirstFrameLatency.compare_exchange_strong(expected, 
+                getTimeUsec() - mStartRequestTime, std::memory_order_acq_rel);
+    }
+
+    // Publish the sample. If the consumer did not pick up the previous one 
+    // it is outdated now and gets released.
+    mNumFrames.fetch_add(1, std::memory_order_relaxed);
+    if(mSinkStage >= 0) {
+        mLatencyTracer.record(mSinkStage, GST_BUFFER_PTS(buffer), getTimeUsec());
+    }
+    GstSample* old_sample = mLatestSample.exchange(sample, std::memory_order_acq_rel);
+    if(old_sample != NULL) {
+        mNumSinkDrops.fetch_add(1, std::memory_order_relaxed);
+        CAM_LOG_TRACE("Unref old image sample");
+        gst_sample_unref(old_sample);
     }
-    pthread_mutex_unlock(&mMutexBuffer);
+    return GST_FLOW_OK;
 } 
 } // end namespace camera
 
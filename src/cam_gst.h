@@ -18,6 +18,7 @@
 #include <glib.h>
 #include <gst/app/gstappsink.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
 #include <pthread.h>
 #include <stdio.h>
@@ -25,9 +26,13 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include <atomic>
 #include <iostream>
+#include <map>
 
 #include "cam_config.h"
+#include "latency_tracer.h"
+#include "test_device.h"
 #include <base/samples/Frame.hpp>
 
 namespace camera 
@@ -38,6 +43,95 @@ class CamGstException : public std::runtime_error {
     CamGstException(const std::string& what_arg) : std::runtime_error(what_arg) {}
 };
 
+/**
+ * Read-only handle on an image received by GStreamer.
+ * The GstSample is referenced and its buffer stays mapped as long as any copy
+ * of the handle exists, so the image can be used without copying it.
+ * Every copy holds its own sample reference and read mapping, the reference
+ * count of the sample is the only shared state. So no memory is allocated
+ * when a handle is (re)assigned, as for every frame in CamUsb.
+ */
+class GstFrameHandle {
+ public:
+    GstFrameHandle();
+
+    /**
+     * Adds a reference to the passed sample and maps its buffer for reading.
+     * Throws a CamGstException if the buffer could not be mapped.
+     */
+    explicit GstFrameHandle(GstSample* sample);
+
+    GstFrameHandle(GstFrameHandle const& other);
+
+    GstFrameHandle& operator=(GstFrameHandle const& other);
+
+    ~GstFrameHandle();
+
+    /**
+     * Unmaps the buffer and releases the sample reference.
+     */
+    void reset();
+
+    /**
+     * Releases the current image and refers to 'sample' like the constructor.
+     * Throws a CamGstException if the buffer could not be mapped, the handle
+     * is not valid then.
+     */
+    void reset(GstSample* sample);
+
+    inline bool isValid() const {
+        return mSample != NULL;
+    }
+
+    /**
+     * \return Pointer to the image data or NULL if the handle is not valid.
+     */
+    const uint8_t* data() const;
+
+    /**
+     * \return Size of the image in bytes, 0 if the handle is not valid.
+     */
+    size_t size() const;
+
+    /**
+     * \return Bytes from row to row of a raw image (of the first plane for
+     * planar formats), taken from the GstVideoMeta of the buffer or else 
+     * from the caps. 0 for encoded images and invalid handles.
+     */
+    uint32_t stride() const;
+
+    /**
+     * \return Position of the first row within data(), see stride().
+     */
+    size_t offset() const;
+
+    /**
+     * \return The referenced sample or NULL. The reference is not transferred.
+     */
+    GstSample* sample() const;
+
+    /**
+     * Reads the image size and mode from the caps of the sample.
+     * The mode is MODE_JPEG for image/jpeg, the mode of the raw format for 
+     * video/x-raw and MODE_UNDEFINED for all others (e.g. video/x-h264).
+     * \return False if the handle is not valid or the caps contain no size.
+     */
+    bool getFormat(uint32_t* width, uint32_t* height, 
+            base::samples::frame::frame_mode_t* mode) const;
+
+ private:
+    /**
+     * Maps the buffer of mSample and reads the layout of the first plane,
+     * releases mSample on failure.
+     */
+    void map();
+
+    GstSample* mSample; // Referenced, NULL if the handle is not valid.
+    GstMapInfo mInfo;
+    uint32_t mStride;
+    size_t mOffset;
+};
+
 /**
  * Allows to create a default GStreamer pipeline, which requests images using v4l2src,
  * converts them to jpegs and gives access to the image data.
@@ -53,21 +147,67 @@ class CamGst {
     static const uint32_t DEFAULT_BPP = 24;
     static const uint32_t DEFAULT_JPEG_QUALITY = 85; // 0 to 100
     static const uint32_t DEFAULT_PIPELINE_TIMEOUT = 4000000; // 4 sec.
+    static const uint32_t DEFAULT_CONVERT_THREADS = 0; // One per CPU.
+    static const uint32_t MAX_SINK_BUFFERS = 1; // Older samples are dropped by the appsink.
+    static const int32_t DEFAULT_RENEGOTIATION_TIMEOUT = 2000; // msec
+    static const uint32_t DEFAULT_POOL_BUFFERS = 4; // See setBufferPoolSize().
+    static const uint32_t DEFAULT_SOURCE_QUEUE_BUFFERS = 0; // See setSourceQueue().
+    static const uint32_t POOL_ALIGNMENT = 64; // Bytes, start and allocated size of the pool buffers.
+
+    /**
+     * State of the pipeline, see startPipelineAsync().
+     */
+    enum PipelineState {
+        PIPELINE_STOPPED,    // No pipeline or not started.
+        PIPELINE_PREWARMING, // READY or PAUSED has been requested, see prewarmPipeline().
+        PIPELINE_PREWARMED,
+        PIPELINE_STARTING,   // PLAYING has been requested.
+        PIPELINE_RUNNING,
+        PIPELINE_ERROR       // An error has been received, recreate the pipeline.
+    };
+
+    /**
+     * Counters of the current pipeline, reset by deletePipeline().
+     */
+    struct Statistics {
+        uint64_t mNumFrames;     // Samples received by the default appsink.
+        uint64_t mNumSinkDrops;  // Samples replaced before the consumer picked them up.
+        uint64_t mNumQueueDrops; // Buffers dropped by the source queue, see setSourceQueue().
+        uint64_t mNumPoolFrames; // See getNumPoolFrames().
+    };
+
+    /**
+     * Completion callback of startPipelineAsync() and prewarmPipeline(), 
+     * 'success' is true if the pipeline reached the requested state.
+     */
+    typedef void (*StartCallback)(bool success, void* data);
 
  public:
     /**
-     * Initialize GStreamer and starts the GMainLoop in its own thread.
+     * Initialize GStreamer and registers with the shared GMainLoop thread, 
+     * which is started by the first instance.
      * \param device Only used to configure the GStreamer source (e.g. /dev/video0).
+     * A test device URI like "test://640x480@30/YUY2" uses videotestsrc instead,
+     * see TestDevice.
      * \param cam_config Pointer to a CamConfig object, used to get a valid image size 
      * and fps and for general configurations.
      */
     CamGst(std::string const& device);
 
     /**
-     * Stops the GMainLoop and its thread.
+     * Stops the shared GMainLoop thread if this is the last instance.
+     * Must not be called from a callback of startPipelineAsync().
      */
     ~CamGst();
 
+    /**
+     * Number of CamGst instances sharing the GMainLoop thread, which 
+     * dispatches the bus messages of all pipelines.
+     */
+    static unsigned int getNumMainLoopUsers() {
+        return MainLoop::getNumUsers();
+    }
+
     /**
      * Creates a simple pipeline to write images with the requested format to a buffer.
      * \param check_for_valid_params If set to true the parameters (width, height, fps) are validated.
@@ -80,8 +220,11 @@ class CamGst {
      * all parameters have been validated and set already.\n
      * If set to false the pipeline may not be created if the parameters are not supported by
      * the camera (a CamGstException may be thrown).
-     * \param mode Valid modes: MODE_GRAYSCALE, MODE_RGB, MODE_UYVY, MODE_JPEG. 
-     * If MODE_UNDEFINED is passed the raw image video/x-raw-yuv will be requested.
+     * \param bpp Not used anymore, the GStreamer 1.0 caps are described by their format.
+     * \param mode Valid modes: MODE_GRAYSCALE, MODE_RGB, MODE_BGR, MODE_RGB32, MODE_UYVY, 
+     * MODE_JPEG. If MODE_UNDEFINED is passed any raw format (video/x-raw) is accepted.
+     * A videoconvert element is only inserted if the camera does not offer the
+     * raw format itself, see setConvertThreads().
      * \return If an error occurs a CamGstException is thrown.
      */
     void createDefaultPipeline(bool check_for_valid_params=false,
@@ -92,13 +235,185 @@ class CamGst {
             base::samples::frame::frame_mode_t mode = base::samples::frame::MODE_UNDEFINED,
             uint32_t jpeg_quality = DEFAULT_JPEG_QUALITY);
 
+    /**
+     * Creates the pipeline from a gst_parse_launch() description, e.g. 
+     * "v4l2src device=${device} ! ${caps} ! jpegdec max-errors=-1 ! videoconvert".
+     * The appsink is appended by the driver and must not be part of the description,
+     * so the image handoff (getBuffer(), getFrame()) works like with the default
+     * pipeline. The file descriptor is read from the first v4l2src, if any.
+     * See expandPipelineDescription() for the placeholders.
+     * \param mode Mode of the images which leave the description, used for ${caps}.
+     * \return If an error occurs a CamGstException is thrown.
+     */
+    void createCustomPipeline(std::string const& description,
+            uint32_t width = DEFAULT_WIDTH, 
+            uint32_t height = DEFAULT_HEIGHT, 
+            uint32_t fps = DEFAULT_FPS,
+            base::samples::frame::frame_mode_t mode = base::samples::frame::MODE_UNDEFINED);
+
+    /**
+     * Replaces the placeholders ${device}, ${width}, ${height}, ${fps} and ${caps}
+     * (the caps of createDefaultPipeline(), e.g. video/x-raw with format, size 
+     * and frame rate) within 'description'. Other text is kept unchanged.
+     */
+    static std::string expandPipelineDescription(std::string const& description,
+            std::string const& device, uint32_t width, uint32_t height, uint32_t fps, 
+            base::samples::frame::frame_mode_t mode);
+
+    /**
+     * Number of threads of the videoconvert element, 0 uses one per CPU.
+     * Used with the next createDefaultPipeline() call.
+     */
+    inline void setConvertThreads(uint32_t num_threads) {
+        mConvertThreads = num_threads;
+    }
+
+    /**
+     * If 'max_buffers' is not 0 the next default pipeline decouples the source
+     * from the conversion by "queue leaky=downstream max-size-buffers=<max_buffers>":
+     * the source keeps capturing in its own thread and if the conversion
+     * falls behind (e.g. CPU spikes at high resolutions) the oldest images 
+     * are dropped, so the latency stays bounded by 'max_buffers' frames.
+     * The drops are counted in Statistics::mNumQueueDrops.
+     */
+    inline void setSourceQueue(uint32_t max_buffers) {
+        mSourceQueueBuffers = max_buffers;
+    }
+
+    Statistics getStatistics();
+
+    /**
+     * If enabled the next created pipeline measures the time each image spends
+     * in its stages: buffer probes on the source pads of the elements (of the
+     * default pipeline or of the parsed custom description) record when an 
+     * image leaves them, followed by the stages "appsink" (received by the
+     * appsink) and "handoff" (picked up by getFrame() or getBuffer()).
+     * Images are identified by their timestamp, the latency of the first stage
+     * is measured from the capture (timestamp of a live source). Elements 
+     * which create new timestamps (e.g. videorate) are not measured, the 
+     * following stages are measured from their output.
+     * \param dump_interval If not 0 the histograms are logged every 'dump_interval' sec.
+     */
+    inline void setLatencyTracing(bool enable, uint32_t dump_interval = 0) {
+        mLatencyTracing = enable;
+        mLatencyDumpInterval = dump_interval;
+    }
+
+    /**
+     * Latency histograms of the stages of the current pipeline, empty if the 
+     * tracing is not enabled. See setLatencyTracing().
+     */
+    inline std::vector<LatencyTracer::Stage> getLatencyStages() {
+        return mLatencyTracer.getStages();
+    }
+
+    inline void resetLatencyStages() {
+        mLatencyTracer.reset();
+    }
+
+    /**
+     * Number of buffers of the pool which the default appsink proposes in the
+     * ALLOCATION query, e.g. to videoconvert or videoscale. The buffers are 
+     * allocated once with the size of a frame of the negotiated raw caps, 
+     * start and end of their memory are aligned to POOL_ALIGNMENT (SIMD loads
+     * may read past the image). The streaming does not allocate afterwards.
+     * The count is fixed: a buffer returns to the pool when its last GstFrameHandle
+     * is released, upstream waits if all of them are in use. So the consumer
+     * must hold less than 'num_buffers' - MAX_SINK_BUFFERS - 1 handles at a time.
+     * Sources which push their own buffers (e.g. v4l2src if no conversion is
+     * required) or a tee with several branches may not use the pool.
+     * 0 leaves the allocation to upstream. Used with the next created pipeline.
+     */
+    inline void setBufferPoolSize(uint32_t num_buffers) {
+        mPoolBuffers = num_buffers;
+    }
+
+    /**
+     * Size of the pool buffers for 'caps': the image size with the row padding
+     * of GStreamer (rows of 4 bytes). 0 for encoded images and raw formats 
+     * which are no frame modes.
+     */
+    static uint32_t getPoolBufferSize(GstCaps* caps);
+
+    /**
+     * Number of samples received by the default appsink of the current pipeline
+     * whose buffer came from the proposed pool, see setBufferPoolSize().
+     */
+    inline uint64_t getNumPoolFrames() {
+        return mNumPoolFrames.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Adds a named output to the next created pipeline. With outputs the images
+     * are split by a tee: the default appsink (getBuffer(), getFrame()) keeps
+     * receiving the images of the pipeline, each output gets its own branch
+     * "queue ! <description> ! appsink", e.g. "videoscale ! video/x-raw,width=160,height=120" 
+     * for a preview or "x264enc tune=zerolatency" for an encoder. An empty 
+     * description passes the images unchanged.
+     * \param max_buffers Number of samples queued for the consumer of the output.
+     * \param drop If true the oldest queued sample is dropped if the queue is full,
+     * otherwise the branch blocks until a sample is pulled (the capture and the 
+     * other branches continue, the leaky queue of the branch drops the images).
+     */
+    void addOutput(std::string const& name, std::string const& description, 
+            uint32_t max_buffers = MAX_SINK_BUFFERS, bool drop = true);
+
+    /**
+     * Removes all outputs from the next created pipeline.
+     */
+    void clearOutputs();
+
+    /**
+     * Pulls the next sample of the output 'name' without copying it.
+     * \param timeout Max. time to wait in msec, < 1 only returns a queued sample.
+     * \return False if there is no such output within the pipeline or no 
+     * sample has been received in time.
+     */
+    bool getOutputFrame(std::string const& name, GstFrameHandle& handle, 
+            int32_t timeout=0);
+
+    /**
+     * If set the next default pipeline ends with "videoscale ! videorate ! capsfilter"
+     * for raw modes: the camera keeps its format and renegotiate() changes
+     * the size and frame rate in software. Otherwise renegotiate() lets v4l2src
+     * change the camera format.
+     */
+    inline void setSoftwareResize(bool enable) {
+        mSoftwareResize = enable;
+    }
+
+    /**
+     * Changes the size and frame rate of the running default pipeline without
+     * recreating it, by replacing the caps of its capsfilter. The mode is kept.
+     * Blocks until the first image with the new caps has been received, the
+     * gap is typically a few frames (camera streaming restart) or none
+     * (software resizing), see getRenegotiationGap(). Returns true at once
+     * if the size and frame rate do not change.
+     * \param fps 0 keeps the current frame rate.
+     * \param timeout Max. time to wait for the new caps in msec, < 1 waits without timeout.
+     * \return False if the pipeline is not a running default pipeline, the new 
+     * caps are not supported (the pipeline has to be recreated then) or no 
+     * image has been received in time.
+     */
+    bool renegotiate(uint32_t width, uint32_t height, uint32_t fps = 0,
+            int32_t timeout = DEFAULT_RENEGOTIATION_TIMEOUT);
+
+    /**
+     * Time from the last successful renegotiate() request to the first image
+     * with the new caps in usec, -1 if none.
+     */
+    inline int64_t getRenegotiationGap() {
+        return mRenegotiationGap;
+    }
+
     /**
      * Deletes pipeline, clears buffer.
      */
     void deletePipeline();
 
     /**
-     * Starts current pipeline in another a intern GStreamer thread.
+     * Starts current pipeline in another a intern GStreamer thread and waits
+     * up to DEFAULT_PIPELINE_TIMEOUT until it is running, see startPipelineAsync().
      * Pipeline has to be already created. Restarting may not work, in this case
      * an error message will be printed and false will be returned.
      * \warning Just stopping and starting a pipeline may not work.
@@ -107,6 +422,45 @@ class CamGst {
      */
     bool startPipeline();
 
+    /**
+     * Requests the PLAYING state and returns immediately. The state machine
+     * is driven by the bus messages on the GMainLoop thread: the pipeline is 
+     * PIPELINE_RUNNING as soon as it reached PLAYING, PIPELINE_ERROR if an error
+     * message has been received before.
+     * \param callback Called once with the result, on the GMainLoop thread
+     * (directly if the pipeline is running already, with false if the start 
+     * is aborted by stopPipeline()), possibly after waitForPipeline() returned. 
+     * It must not block or call startPipeline() or waitForPipeline(). 
+     * Not used if the start fails immediately.
+     * \return False if there is no pipeline or the state change failed immediately.
+     */
+    bool startPipelineAsync(StartCallback callback = NULL, void* data = NULL);
+
+    /**
+     * Hot standby: moves the pipeline to READY (device opened) or PAUSED 
+     * (state prepared) and returns immediately, so a later start only has to
+     * switch to PLAYING. Live sources like v4l2src do not preroll: PAUSED 
+     * returns NO_PREROLL, caps are negotiated and buffers allocated only in 
+     * PLAYING. Only non-live sources get that far in PAUSED. Completion is 
+     * reported like with startPipelineAsync(), the state is 
+     * PIPELINE_PREWARMED afterwards.
+     * \return False if there is no pipeline, it is running or the state change failed.
+     */
+    bool prewarmPipeline(GstState state = GST_STATE_PAUSED, 
+            StartCallback callback = NULL, void* data = NULL);
+
+    /**
+     * Waits until a requested start or prewarm has completed.
+     * \param timeout Max. time to wait in msec, < 1 waits without timeout.
+     * \return True if the pipeline is running or prewarmed.
+     */
+    bool waitForPipeline(int32_t timeout);
+
+    /**
+     * Stops the pipeline (synchronously) and starts it again asynchronously.
+     */
+    bool restartPipeline(StartCallback callback = NULL, void* data = NULL);
+
     /**
      * \warning Just stopping and starting a pipeline may not work.
      * You should delete and recreate the pipeline instead!
@@ -126,7 +480,15 @@ class CamGst {
             bool blocking_read=false, int32_t timeout=0);
 
     /**
-     * Just sets mNewBuffer to false.
+     * Same as getBuffer(), but hands out the new image without copying it.
+     * \param handle Will refer to the new image if available. The image stays
+     * valid until the last copy of the handle is released.
+     */
+    bool getFrame(GstFrameHandle& handle,
+            bool blocking_read=false, int32_t timeout=0);
+
+    /**
+     * Drops the pending sample, if any.
      * \return True if a new buffer was available.
      */
     bool skipBuffer();
@@ -142,11 +504,27 @@ class CamGst {
      * True if a new buffer is available.
      */
     inline bool hasNewBuffer() {
-        return mNewBuffer;
+        return mLatestSample.load(std::memory_order_acquire) != NULL;
     }
 
     inline bool isPipelineRunning() {
-        return mPipelineRunning;
+        return getPipelineState() == PIPELINE_RUNNING;
+    }
+
+    PipelineState getPipelineState();
+
+    /**
+     * Time from the start request to the PLAYING state in usec, -1 if the 
+     * last started pipeline is not running yet.
+     */
+    int64_t getStartLatency();
+
+    /**
+     * Time from the start request to the first sample received by the default
+     * appsink in usec, -1 if no sample has been received since the last start.
+     */
+    inline int64_t getFirstFrameLatency() {
+        return mFirstFrameLatency.load(std::memory_order_acquire);
     }
 
     /**
@@ -154,9 +532,7 @@ class CamGst {
      * The pipeline has to be running, otherwise -1 will be returned.
      * \return The fd or -1 if not available.
      */
-    inline int getFileDescriptor() {
-        return mFileDescriptor;
-    }
+    int getFileDescriptor();
 
  private:
     CamGst();
@@ -168,9 +544,73 @@ class CamGst {
      */
     void setCameraParameters(uint32_t* width, uint32_t* height, uint32_t* fps);
 
+    /**
+     * v4l2src or, for a test device URI (see TestDevice), the test source.
+     */
     GstElement* createDefaultSource(std::string const& device);
 
-    GstElement* createDefaultCap(uint32_t const width, uint32_t const height, uint32_t const fps, uint32_t bpp, base::samples::frame::frame_mode_t mode );
+    /**
+     * Bin "videotestsrc is-live=true ! <native format>" with a ghosted source pad.
+     */
+    static GstElement* createTestSource(std::string const& device);
+
+    /**
+     * Creates the empty pipeline 'mPipeline' and adds the message handler to its bus.
+     */
+    void createPipeline(const char* name);
+
+    /**
+     * Adds 'sink' to the pipeline and links it to 'last', which has already 
+     * been added. If outputs have been added a tee and the output branches
+     * are inserted in between.
+     * Deletes the pipeline and throws a CamGstException if linking fails.
+     */
+    void linkOutputs(GstElement* last, GstElement* sink);
+
+    /**
+     * Leaky queue which drops its oldest buffers if more than 'max_buffers' are waiting.
+     * \return NULL if the element could not be created.
+     */
+    static GstElement* createOutputQueue(const char* name, uint32_t max_buffers);
+
+    /**
+     * Adds a latency stage for the source pad of each element (in processing
+     * order) and the stages "appsink" and "handoff", see setLatencyTracing().
+     */
+    void addLatencyProbes(std::vector<GstElement*> const& elements);
+
+    /**
+     * Records the latency of the stage of 'probe' for 'buffer'. The first stage
+     * measures from the capture time: the timestamp in running time of the pipeline.
+     */
+    struct LatencyProbe;
+    void traceBuffer(GstBuffer* buffer, LatencyProbe const& probe);
+
+    /**
+     * Returns the first v4l2src within 'bin' (not referenced) or NULL.
+     */
+    static GstElement* findV4L2Source(GstElement* bin);
+
+    /**
+     * GStreamer 1.0 caps of the requested image, the caller owns the reference.
+     */
+    static GstCaps* createDefaultCaps(uint32_t const width, uint32_t const height, uint32_t const fps, 
+            base::samples::frame::frame_mode_t mode);
+
+    /**
+     * Capsfilter using 'caps', takes the reference.
+     */
+    GstElement* createDefaultCap(GstCaps* caps, const char* name = "default_cap");
+
+    /**
+     * Opens the source for a moment and checks if the device offers 'caps'.
+     */
+    bool isFormatNative(GstElement* source, GstCaps* caps);
+
+    /**
+     * videoconvert using mConvertThreads threads.
+     */
+    GstElement* createDefaultConverter();
 
     /**
      * Currently not used anymore, instead the encoding of the camera base class is used.
@@ -189,11 +629,10 @@ class CamGst {
 
     inline void rmFileDescriptor() {
         mFileDescriptor = -1;
-        std::cout << "FD set back to -1" << std::endl;
+        LOG_DEBUG("FD set back to -1");
     }
 
  private: // STATIC METHODS
-    static void* mainLoop(void* ptr);
 
     /**
      * Calls the method 'callbackMessages()' of the passed (using 'gpointer data') CamGst object.
@@ -201,19 +640,59 @@ class CamGst {
     static gboolean callbackMessagesStatic(GstBus* bus, GstMessage* msg, gpointer data);
 
     /**
-     * Reports GST_MESSAGE_EOS and GST_MESSAGE_ERROR messages.
+     * Completes the state changes of the pipeline (GST_MESSAGE_STATE_CHANGED,
+     * GST_MESSAGE_ERROR) and reports GST_MESSAGE_EOS.
      */
     gboolean callbackMessages(GstBus* bus, GstMessage* msg, gpointer data);
 
     /**
-     * Calls the method 'callbackNewBuffer()' of the passed CamGst object.
+     * Wakes up waitForPipeline(), unlocks mStateMutex and calls the start callback.
      */
-    static void callbackNewBufferStatic(GstAppSink *object, CamGst* cam_gst_p);
+    void finishStart(bool success);
+
+    static int64_t getTimeUsec();
+
+    /**
+     * new_sample callback of the appsink (see gst_app_sink_set_callbacks()), 
+     * calls 'callbackNewBuffer()' of the CamGst object passed as 'data'.
+     */
+    static GstFlowReturn callbackNewBufferStatic(GstAppSink *object, gpointer data);
     
     /**
-     * Copies the received image to 'mBuffer'.
+     * Publishes the received sample in 'mLatestSample'. Never blocks: an older sample
+     * which has not been picked up by the consumer yet is released.
+     */
+    GstFlowReturn callbackNewBuffer(GstAppSink* object);
+
+    /**
+     * "overrun" signal of the source queue, emitted before the queue drops its oldest buffer.
      */
-    void callbackNewBuffer(GstAppSink* object, CamGst* cam_gst_p);
+    static void callbackQueueOverrunStatic(GstElement* queue, gpointer data);
+
+    /**
+     * Buffer probe of a traced pad, records the stage in mLatencyTracer.
+     */
+    static GstPadProbeReturn callbackLatencyProbeStatic(GstPad* pad, 
+            GstPadProbeInfo* info, gpointer data);
+    static void deleteLatencyProbe(gpointer data);
+
+    /**
+     * Logs the latency histograms, timeout source on the shared main loop.
+     */
+    static gboolean callbackDumpLatencyStatic(gpointer data);
+
+    /**
+     * Query probe of the default appsink, calls 'callbackAllocationQuery()'
+     * of the CamGst object passed as 'data'.
+     */
+    static GstPadProbeReturn callbackAllocationQueryStatic(GstPad* pad, 
+            GstPadProbeInfo* info, gpointer data);
+
+    /**
+     * Answers the ALLOCATION query with a new pool of mPoolBuffers buffers,
+     * which replaces 'mBufferPool'. Other queries are passed on.
+     */
+    GstPadProbeReturn callbackAllocationQuery(GstQuery* query);
 
     /**
      * Print element factories for debugging purposes
@@ -223,22 +702,82 @@ class CamGst {
  private:
     std::string mDevice;
     uint32_t mJpegQuality;
-    GMainLoop* mLoop;
-    pthread_t* mMainLoopThread;
+    GMainContext* mContext; // Of the shared main loop.
     GstElement* mPipeline;
     GstBus* mGstPipelineBus;
-    bool mPipelineRunning;
-
-    pthread_mutex_t mMutexBuffer;
-    GstBuffer* mBuffer;
-    uint32_t mBufferSize;
-    GstSample* mSample;
-    bool mNewBuffer;
+    GSource* mBusWatch;
+
+    // Written by the user thread and by callbackMessages() on the GMainLoop thread.
+    pthread_mutex_t mStateMutex;
+    pthread_cond_t mStateCond; // Signaled when a start completes or the caps change.
+    PipelineState mPipelineState;
+    GstState mPrewarmTarget;
+    StartCallback mStartCallback; // Pending start, NULL if none.
+    void* mStartCallbackData;
+    int64_t mStartRequestTime; // usec, see getTimeUsec().
+    int64_t mStartLatency;
+    std::atomic<int64_t> mFirstFrameLatency; // Set by the streaming thread.
+
+    // Single-slot mailbox between the GStreamer streaming thread (producer) and
+    // the consumer. Both sides swap the pointer atomically, ownership of the
+    // referenced sample moves with it. NULL means no new image is available.
+    std::atomic<GstSample*> mLatestSample;
 
     GstElement* mSource; // Used to request the fd.
+    GstElement* mCapsFilter; // Changed by renegotiate(), NULL for custom pipelines.
     int mFileDescriptor; // File descriptor of the pipeline source. -1 if not available.
     
     base::samples::frame::frame_mode_t mRequestedFrameMode;
+    uint32_t mConvertThreads;
+    bool mSoftwareResize;
+    uint32_t mWidth; // Of the current pipeline.
+    uint32_t mHeight;
+    uint32_t mFps;
+
+    // Caps of the last sample, only used by the streaming thread.
+    GstCaps* mLastCaps;
+    std::atomic<uint32_t> mNumCapsChanges;
+    std::atomic<int64_t> mLastCapsChangeTime; // usec
+    int64_t mRenegotiationGap;
+
+    uint32_t mPoolBuffers;
+    // Last proposed pool, replaced with each ALLOCATION query (streaming thread).
+    std::atomic<GstBufferPool*> mBufferPool;
+    std::atomic<uint64_t> mNumPoolFrames;
+
+    uint32_t mSourceQueueBuffers;
+    // Written by the streaming threads, see getStatistics().
+    std::atomic<uint64_t> mNumFrames;
+    std::atomic<uint64_t> mNumSinkDrops;
+    std::atomic<uint64_t> mNumQueueDrops;
+
+    bool mLatencyTracing;
+    uint32_t mLatencyDumpInterval; // sec
+    LatencyTracer mLatencyTracer;
+    // Stage of the appsink (followed by the handoff stage), -1 if the current 
+    // pipeline is not traced.
+    int mSinkStage;
+    GSource* mLatencyDump;
+
+    /**
+     * Data of the buffer probes of the latency stages.
+     */
+    struct LatencyProbe {
+        CamGst* mCamGst;
+        unsigned int mStage;
+        bool mFirst;
+    };
+
+    /**
+     * Branch of the tee, see addOutput().
+     */
+    struct Output {
+        std::string mDescription;
+        uint32_t mMaxBuffers;
+        bool mDrop;
+        GstElement* mSink; // appsink within the current pipeline or NULL.
+    };
+    std::map<std::string, Output> mOutputs;
 
     /**
      * Using GstGuard to making sure that GStreamer is initialized/deinitialized only once, i.e. use
@@ -250,6 +789,38 @@ class CamGst {
         ~InitGuard();
     };
 
+    /**
+     * Process-wide thread which runs a GMainLoop on its own GMainContext and
+     * dispatches the bus messages of all instances. Reference counted: 
+     * started by the first instance and stopped with the last one.
+     */
+    class MainLoop {
+    public:
+        /**
+         * Returns the context, starts the thread if required.
+         */
+        static GMainContext* acquire();
+
+        /**
+         * Stops the thread with the last user, otherwise waits until the 
+         * messages which are dispatched at the moment have been handled.
+         */
+        static void release();
+
+        static unsigned int getNumUsers();
+
+    private:
+        static void* run(void* ptr);
+        static gboolean signalBarrier(gpointer data);
+        static gboolean quitLoop(gpointer data);
+
+        static pthread_mutex_t sMutex;
+        static unsigned int sNumUsers;
+        static GMainContext* sContext;
+        static GMainLoop* sLoop;
+        static pthread_t sThread;
+    };
+
 };
 
 } // end namespace camera
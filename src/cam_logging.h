@@ -0,0 +1,46 @@
+/*
+ * \file    cam_logging.h
+ *  
+ * \brief   Logging macros for the hot paths of the driver.
+ *
+ * \details The per-frame and per-attribute debug output is selected at compile
+ *          time with CAMERA_USB_TRACE_LEVEL:
+ *          0 (default) no trace output, the statements are removed completely
+ *            and their arguments are never evaluated,
+ *          1 only CAM_LOG_TRACE_EVERY_N() is active,
+ *          2 CAM_LOG_TRACE() and CAM_LOG_TRACE_EVERY_N() are active.
+ *          Active trace output is passed to LOG_DEBUG.
+ */
+
+#ifndef _CAM_LOGGING_H_
+#define _CAM_LOGGING_H_
+
+#include <base-logging/Logging.hpp>
+
+#ifndef CAMERA_USB_TRACE_LEVEL
+#define CAMERA_USB_TRACE_LEVEL 0
+#endif
+
+// The disabled variants still compile the arguments (so they do not rot), 
+// but the optimizer removes the dead branch.
+#if CAMERA_USB_TRACE_LEVEL >= 2
+#define CAM_LOG_TRACE(...) LOG_DEBUG(__VA_ARGS__)
+#else
+#define CAM_LOG_TRACE(...) do { if(false) { LOG_DEBUG(__VA_ARGS__); } } while(0)
+#endif
+
+/**
+ * Logs on the first and then on every n-th pass of this statement.
+ * The counter is per statement and not synchronized, so with concurrent 
+ * callers the sampling is approximate.
+ */
+#if CAMERA_USB_TRACE_LEVEL >= 1
+#define CAM_LOG_TRACE_EVERY_N(n, ...) do { \
+        static unsigned int cam_log_trace_counter = 0; \
+        if(cam_log_trace_counter++ % (n) == 0) { LOG_DEBUG(__VA_ARGS__); } \
+    } while(0)
+#else
+#define CAM_LOG_TRACE_EVERY_N(n, ...) do { if(false) { LOG_DEBUG(__VA_ARGS__); } } while(0)
+#endif
+
+#endif
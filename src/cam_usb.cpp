@@ -1,11 +1,22 @@
 #include "cam_usb.h"
+#include "cam_logging.h"
+
+#include <sstream>
 
 namespace camera 
 {
 
 CamUsb::CamUsb(std::string const& device) : CamInterface(), mCamGst(NULL), mCamConfig(NULL),
         mDevice(), mIsOpen(false), mCamInfo(), mMapAttrsCtrlsInt(), mFps(10),
-        mBpp(24), mStartTimeGrabbing(), mReceivedFrameCounter(0),
+        mBpp(24), mStartTimeGrabbing(), mReceivedFrameCounter(0), mBufferTmp(),
+        mWorkerPool(NULL), mWorkerPoolThreads(0), mWorkerPoolCpus(),
+        mJpegQuality(CamGst::DEFAULT_JPEG_QUALITY), mPipelineDescription(), mAsyncStart(false),
+        mPrewarmedPipeline(), mSoftwareResize(false),
+        mTestDevice(TestDevice::isTestDevice(device)), mTestControls(),
+        mPoolBuffers(CamGst::DEFAULT_POOL_BUFFERS),
+        mSourceQueueBuffers(CamGst::DEFAULT_SOURCE_QUEUE_BUFFERS),
+        mPreviewFactor(0), mPreviewMode(base::samples::frame::MODE_UNDEFINED), mPreviewBufferTmp(),
+        mRowPadding(Helpers::DEFAULT_ROW_PADDING), mFramePool(),
         mpCallbackFunction(NULL), mpPassThroughPointer(NULL) {
     LOG_DEBUG("CamUsb: constructor");
     mDevice = device;
@@ -15,6 +26,8 @@ CamUsb::CamUsb(std::string const& device) : CamInterface(), mCamGst(NULL), mCamC
 CamUsb::~CamUsb() {
     LOG_DEBUG("CamUsb: destructor");
     changeCameraMode(CAM_USB_NONE);
+    delete mWorkerPool;
+    mWorkerPool = NULL;
 }
 
 void CamUsb::fastInit(int width, int height) {
@@ -58,7 +71,17 @@ bool CamUsb::open(const CamInfo &cam,const AccessMode mode) {
     changeCameraMode(CAM_USB_V4L2);
     
     mCamInfo = cam; // Assign camera (not allowed in listCameras() as well).
-    if(mCamConfig != NULL) {
+    if(mTestDevice) {
+        // The URI provides the defaults a real camera would report.
+        TestDevice test_device;
+        if(!test_device.parse(mDevice)) {
+            throw std::runtime_error("Malformed test device " + mDevice);
+        }
+        mFps = test_device.mFps;
+        image_size_.width = test_device.mWidth;
+        image_size_.height = test_device.mHeight;
+        mCamInfo.display_name = "videotestsrc " + mDevice;
+    } else if(mCamConfig != NULL) {
         mCamInfo.display_name = mCamConfig->getCapabilityCard(); // Add name, not possible in listCameras().
     }
 
@@ -110,7 +133,7 @@ bool CamUsb::grab(const GrabMode mode, const int buffer_len) {
     bool image_request_started = false;
     switch(mode) {
         case Stop:
-            if(mCamMode == CAM_USB_V4L2) {
+            if(mCamMode == CAM_USB_V4L2 && mCamConfig != NULL) {
                 // Cleanup will only be exectued if initRequesting() has be called previously.
                 mCamConfig->cleanupRequesting();
             }
@@ -118,21 +141,35 @@ bool CamUsb::grab(const GrabMode mode, const int buffer_len) {
             act_grab_mode_ = mode;
             break;
         case SingleFrame: { // v4l2 image requesting
+            if(mTestDevice) {
+                throw std::runtime_error("Test devices only support the GStreamer modes MultiFrame and Continuously!");
+            }
             changeCameraMode(CAM_USB_V4L2);
+            mCamConfig->setWorkerPool(getWorkerPool());
+            mCamConfig->setJpegQuality(mJpegQuality);
+            mCamConfig->setPreview(mPreviewFactor, Helpers::getYUYVConversion(mPreviewMode));
+            mCamConfig->setRowPadding(mRowPadding);
+            mCamConfig->setFramePool(&mFramePool);
             mCamConfig->initRequesting();
             image_request_started = true;
             break;
         }
         case MultiFrame:
         case Continuously: {
-            changeCameraMode(CAM_USB_GST);
-             // If one of the parameters is 0, the current setting of the camera is used.
-            mCamGst->createDefaultPipeline(true,
-                    image_size_.width, image_size_.height,
-                    (uint32_t)mFps, (uint32_t)mBpp,
-                    image_mode_);
+            // A prewarmed pipeline only has to be switched to PLAYING.
+            if(mCamMode != CAM_USB_GST || 
+                    mCamGst->getPipelineState() != CamGst::PIPELINE_PREWARMED ||
+                    mPrewarmedPipeline != getPipelineKey()) {
+                createPipeline();
+            } else {
+                LOG_INFO("Starting the prewarmed pipeline");
+            }
+            mPrewarmedPipeline.clear();
             
-            image_request_started = mCamGst->startPipeline();
+            // Asynchronously the pipeline is started on the GMainLoop thread,
+            // retrieveFrame() waits for the first image.
+            image_request_started = mAsyncStart ? mCamGst->startPipelineAsync() :
+                    mCamGst->startPipeline();
             mReceivedFrameCounter = 0;
             act_grab_mode_ = mode;
             break;
@@ -149,64 +186,328 @@ bool CamUsb::grab(const GrabMode mode, const int buffer_len) {
     return true;
 }                  
 
+bool CamUsb::prewarm(bool paused) {
+    LOG_DEBUG("CamUsb: prewarm");
+    if(act_grab_mode_ != Stop) {
+        LOG_INFO("Stop grabbing before prewarming the pipeline.");
+        return false;
+    }
+    createPipeline();
+    if(!mCamGst->prewarmPipeline(paused ? GST_STATE_PAUSED : GST_STATE_READY) ||
+            !mCamGst->waitForPipeline(CamGst::DEFAULT_PIPELINE_TIMEOUT / 1000)) {
+        LOG_ERROR("Pipeline could not be prewarmed");
+        mCamGst->deletePipeline();
+        return false;
+    }
+    mPrewarmedPipeline = getPipelineKey();
+    return true;
+}
+
 bool CamUsb::retrieveFrame(base::samples::frame::Frame &frame,const int timeout) {
-    LOG_DEBUG("CamUsb: retrieveFrame");
+    return retrieveFrames(frame, NULL, timeout);
+}
+
+bool CamUsb::retrieveFrame(base::samples::frame::Frame &frame, 
+        base::samples::frame::Frame &preview, const int timeout) {
+    return retrieveFrames(frame, &preview, timeout);
+}
+
+bool CamUsb::retrieveFrames(base::samples::frame::Frame& frame, 
+        base::samples::frame::Frame* preview, const int timeout) {
+    CAM_LOG_TRACE("CamUsb: retrieveFrame");
     
     if(mCamMode == CAM_USB_NONE) {
         LOG_INFO("Frame can not be retrieved, current camera mode is %d", mCamMode);
         return false;
     }
     
-    // Buffer will be resized in getBuffer.
-    std::vector<uint8_t> buffer_tmp;
-    
+    // TODO In Frame.hpp getChannelCount() returns 1 for UYVY, should be 2?
+    int depth = 8;
+    if(image_mode_ == base::samples::frame::MODE_UYVY) {
+        depth = 16;
+    } else if(Bayer::isBayerMode(image_mode_)) {
+        depth = image_color_depth_;
+    }
+
     // Either v4l2 calls are used to retrieve single images or the gstreamer pipeline.
     // The initialization/cleanup for both methods happens in the grab() function.
     if(mCamMode == CAM_USB_V4L2) {
+        // Buffer will be resized in getBuffer.
         try {
-            mCamConfig->getBuffer(buffer_tmp, true, timeout);
+            bool received = preview != NULL ? 
+                    mCamConfig->getBuffer(mBufferTmp, mPreviewBufferTmp, true, timeout) :
+                    mCamConfig->getBuffer(mBufferTmp, true, timeout);
+            if(!received) {
+                LOG_ERROR("v4l2: No image received within %d msec.", timeout);
+                return false;
+            }
         } catch(std::runtime_error& e) {
             LOG_ERROR("v4l2: Buffer could not be requested: %s", e.what());
             return false;
         }   
+        uint32_t row_size = mCamConfig->getOutputRowSize();
+        // Only reallocates if required: init() resizes the old buffer, which is
+        // swapped out to receive the next image. The size is not passed for 
+        // uncompressed images because the rows may be padded.
+        mFramePool.reserve(frame.image, mBufferTmp.size());
+        frame.init(image_size_.width, image_size_.height, depth, image_mode_, -1, 
+                row_size != 0 ? 0 : mBufferTmp.size());
+        // The old frame buffer is kept for the next request.
+        frame.image.swap(mBufferTmp);
+        if(row_size != 0) {
+            frame.row_size = row_size;
+        }
     } else if(mCamMode == CAM_USB_GST) {
-        if(!mCamGst->isPipelineRunning()) {
-            LOG_WARN("Frame can not be retrieved, because pipeline is not running.");
+        GstFrameHandle handle;
+        if(!retrieveFrameHandle(handle, timeout)) {
+            LOG_ERROR("Gstreamer: Buffer could not retrieved.");
             return false;
         }
-        bool success = mCamGst->getBuffer(buffer_tmp, true, timeout);
-        if(!success) {
-            LOG_ERROR("Gstreamer: Buffer could not retrieved.");
+        // Images which are still in flight after a renegotiation have the old 
+        // size, so the format of the sample is used. Samples without a size in
+        // their caps are taken to have the current settings.
+        uint32_t width = image_size_.width, height = image_size_.height;
+        base::samples::frame::frame_mode_t mode = image_mode_;
+        if(!handle.getFormat(&width, &height, &mode)) {
+            CAM_LOG_TRACE("No format in the sample caps, the current settings are used");
+            width = image_size_.width;
+            height = image_size_.height;
+            mode = image_mode_;
+        }
+        if(mode == base::samples::frame::MODE_UNDEFINED) {
+            LOG_ERROR("Gstreamer: Received image format is no frame mode");
+            return false;
+        }
+        if(!copyHandleToFrame(handle, width, height, mode, depth, frame)) {
             return false;
         }
     }
     
-    // TODO In Frame.hpp getChannelCount() returns 1 for UYVY, should be 2?
-    int depth = 8;
-    if(image_mode_ == base::samples::frame::MODE_UYVY) {
-        depth = 16;
-    }
-
-    // Only reallocates if required.
-    frame.init(image_size_.width, image_size_.height, depth, image_mode_, -1, buffer_tmp.size());
-    // Can we directly write to the frame buffer?
-    frame.image = buffer_tmp;
     frame.frame_status = base::samples::frame::STATUS_VALID;
     frame.time = base::Time::now();
+
+    // The preview is created together with the v4l2 image.
+    if(preview != NULL) {
+        uint32_t preview_width = 0, preview_height = 0;
+        if(mCamMode == CAM_USB_V4L2 && !mPreviewBufferTmp.empty() &&
+                mCamConfig->getPreviewSize(&preview_width, &preview_height)) {
+            mFramePool.reserve(preview->image, mPreviewBufferTmp.size());
+            preview->init(preview_width, preview_height, 8, mPreviewMode, -1);
+            preview->image.swap(mPreviewBufferTmp);
+            preview->row_size = mCamConfig->getPreviewRowSize();
+            preview->frame_status = base::samples::frame::STATUS_VALID;
+            preview->time = frame.time;
+        } else {
+            CAM_LOG_TRACE("No preview available for this image");
+            preview->frame_status = base::samples::frame::STATUS_INVALID;
+        }
+    }
     
     // Removes the JPEG comment block if required.
     Helpers::removeJpegCommentBlock(frame);
 
+    // Adds the huffman tables which are omitted by many UVC cameras.
+    if(frame.getFrameMode() == base::samples::frame::MODE_JPEG && 
+            !JpegDecoder::hasHuffmanTables(frame.image.data(), frame.image.size())) {
+        mFramePool.reserve(mBufferTmp, frame.image.size() + JpegDecoder::getHuffmanTablesSize());
+        JpegDecoder::insertHuffmanTables(frame.image.data(), frame.image.size(), mBufferTmp);
+        frame.image.swap(mBufferTmp);
+    }
+
     mReceivedFrameCounter++;
     return true;
 }
 
+bool CamUsb::copyHandleToFrame(GstFrameHandle const& handle, uint32_t width, uint32_t height,
+        base::samples::frame::frame_mode_t mode, int depth, base::samples::frame::Frame& frame) {
+    if(mode == base::samples::frame::MODE_JPEG) {
+        // Only reallocates if required.
+        mFramePool.reserve(frame.image, handle.size());
+        frame.init(width, height, depth, mode, -1, handle.size());
+        // Single copy from the GStreamer buffer into the frame.
+        memcpy(frame.image.data(), handle.data(), handle.size());
+        return true;
+    }
+    // The rows are copied from the stride of the GStreamer buffer into padded rows.
+    // The reserved size is an upper bound of the padded image size.
+    uint32_t stride = handle.stride();
+    mFramePool.reserve(frame.image, (size_t)(stride + mRowPadding) * height);
+    frame.init(width, height, depth, mode, -1);
+    uint32_t row_bytes = frame.getPixelSize() * width;
+    uint32_t row_size = Helpers::getPaddedRowSize(row_bytes, mRowPadding);
+    if(height == 0 || stride < row_bytes || handle.size() < handle.offset() + 
+            (size_t)stride * (height - 1) + row_bytes) {
+        LOG_ERROR("Gstreamer: Raw image of %d bytes (stride %d) is too small", 
+                (int)handle.size(), (int)stride);
+        return false;
+    }
+    frame.image.resize((size_t)row_size * height);
+    Helpers::copyRows(handle.data() + handle.offset(), stride, 
+            frame.image.data(), row_size, row_bytes, height);
+    frame.row_size = row_size;
+    return true;
+}
+
+bool CamUsb::retrieveFrameHandle(GstFrameHandle& handle, const int timeout) {
+    CAM_LOG_TRACE("CamUsb: retrieveFrameHandle");
+
+    if(mCamMode != CAM_USB_GST) {
+        LOG_INFO("Frame handles are only available in GStreamer mode, current camera mode is %d", mCamMode);
+        return false;
+    }
+    if(!isPipelineStarted()) {
+        LOG_WARN("Frame can not be retrieved, because pipeline is not running.");
+        return false;
+    }
+    try {
+        return mCamGst->getFrame(handle, true, timeout);
+    } catch(CamGstException& e) {
+        LOG_ERROR("Gstreamer: %s", e.what());
+        return false;
+    }
+}
+
+bool CamUsb::retrieveOutputFrameHandle(std::string const& name, GstFrameHandle& handle, 
+        const int timeout) {
+    CAM_LOG_TRACE("CamUsb: retrieveOutputFrameHandle %s", name.c_str());
+
+    if(mCamMode != CAM_USB_GST || !isPipelineStarted()) {
+        LOG_INFO("Output %s can not be retrieved, the pipeline is not running", name.c_str());
+        return false;
+    }
+    try {
+        return mCamGst->getOutputFrame(name, handle, timeout);
+    } catch(CamGstException& e) {
+        LOG_ERROR("Gstreamer: %s", e.what());
+        return false;
+    }
+}
+
+bool CamUsb::retrieveOutputFrame(std::string const& name, base::samples::frame::Frame& frame, 
+        const int timeout) {
+    GstFrameHandle handle;
+    if(!retrieveOutputFrameHandle(name, handle, timeout)) {
+        return false;
+    }
+    uint32_t width = 0, height = 0;
+    base::samples::frame::frame_mode_t mode = base::samples::frame::MODE_UNDEFINED;
+    if(!handle.getFormat(&width, &height, &mode) || 
+            mode == base::samples::frame::MODE_UNDEFINED) {
+        LOG_ERROR("Output %s has no frame format, use retrieveOutputFrameHandle()", 
+                name.c_str());
+        return false;
+    }
+    int depth = mode == base::samples::frame::MODE_UYVY ? 16 : 8;
+    if(!copyHandleToFrame(handle, width, height, mode, depth, frame)) {
+        return false;
+    }
+    frame.frame_status = base::samples::frame::STATUS_VALID;
+    frame.time = base::Time::now();
+    return true;
+}
+
+bool CamUsb::configureWorkerPool(unsigned int num_threads, std::vector<int> const& cpus) {
+    LOG_DEBUG("CamUsb: configureWorkerPool");
+
+    if(act_grab_mode_ != Stop) {
+        LOG_INFO("Stop grabbing before configuring the worker pool.");
+        return false;
+    }
+
+    if(mCamConfig != NULL) {
+        mCamConfig->setWorkerPool(NULL);
+    }
+    delete mWorkerPool;
+    mWorkerPool = NULL;
+    mWorkerPoolThreads = num_threads;
+    mWorkerPoolCpus = cpus;
+    return true;
+}
+
+void CamUsb::setJpegQuality(uint32_t quality) {
+    LOG_DEBUG("CamUsb: setJpegQuality %d", quality);
+    mJpegQuality = quality > 100 ? 100 : quality;
+}
+
+void CamUsb::setAsyncStart(bool async) {
+    LOG_DEBUG("CamUsb: setAsyncStart %d", (int)async);
+    mAsyncStart = async;
+}
+
+int64_t CamUsb::getFirstFrameLatency() {
+    if(mCamMode != CAM_USB_GST) {
+        return -1;
+    }
+    return mCamGst->getFirstFrameLatency();
+}
+
+void CamUsb::setSoftwareResize(bool enable) {
+    LOG_DEBUG("CamUsb: setSoftwareResize %d", (int)enable);
+    mSoftwareResize = enable;
+}
+
+void CamUsb::setBufferPoolSize(uint32_t num_buffers) {
+    LOG_DEBUG("CamUsb: setBufferPoolSize %d", num_buffers);
+    mPoolBuffers = num_buffers;
+}
+
+void CamUsb::setSourceQueue(uint32_t max_buffers) {
+    LOG_DEBUG("CamUsb: setSourceQueue %d", max_buffers);
+    mSourceQueueBuffers = max_buffers;
+}
+
+bool CamUsb::getPipelineStatistics(CamGst::Statistics& statistics) {
+    if(mCamMode != CAM_USB_GST) {
+        return false;
+    }
+    statistics = mCamGst->getStatistics();
+    return true;
+}
+
+void CamUsb::setPipelineDescription(std::string const& description) {
+    LOG_DEBUG("CamUsb: setPipelineDescription %s", description.c_str());
+    mPipelineDescription = description;
+}
+
+void CamUsb::addOutput(std::string const& name, std::string const& description, 
+        uint32_t max_buffers, bool drop) {
+    LOG_DEBUG("CamUsb: addOutput %s: %s", name.c_str(), description.c_str());
+    OutputConfig& output = mOutputs[name];
+    output.mDescription = description;
+    output.mMaxBuffers = max_buffers;
+    output.mDrop = drop;
+}
+
+void CamUsb::clearOutputs() {
+    mOutputs.clear();
+}
+
+bool CamUsb::setPreview(unsigned int factor, base::samples::frame::frame_mode_t mode) {
+    LOG_DEBUG("CamUsb: setPreview 1/%d, mode %d", factor, mode);
+    if(factor != 0 && !Helpers::isDownscaleSupported(factor, Helpers::getYUYVConversion(mode))) {
+        LOG_WARN("Preview 1/%d with mode %d is not supported", factor, mode);
+        return false;
+    }
+    mPreviewFactor = factor;
+    mPreviewMode = mode;
+    return true;
+}
+
+void CamUsb::setRowPadding(uint32_t padding) {
+    LOG_DEBUG("CamUsb: setRowPadding %d", padding);
+    mRowPadding = padding;
+}
+
+void CamUsb::releaseFrame(base::samples::frame::Frame& frame) {
+    mFramePool.release(frame.image);
+}
+
 bool CamUsb::storeFrame(base::samples::frame::Frame& frame, std::string const& file_name) {
     return Helpers::storeImageToFile(frame.image, file_name);
 }
 
 bool CamUsb::isFrameAvailable() {
-    LOG_DEBUG("CamUsb: isFrameAvailable");
+    CAM_LOG_TRACE("CamUsb: isFrameAvailable");
 
     if(mCamMode == CAM_USB_GST) {
        return mCamGst->hasNewBuffer();
@@ -217,7 +518,7 @@ bool CamUsb::isFrameAvailable() {
 }
 
 int CamUsb::skipFrames() {
-    LOG_DEBUG("CamUsb: skipFrames");
+    CAM_LOG_TRACE("CamUsb: skipFrames");
 
     if(mCamMode == CAM_USB_GST) {
         return mCamGst->skipBuffer() ? 1 : 0;
@@ -236,7 +537,7 @@ bool CamUsb::setIpSettings(const CamInfo &cam, const IPSettings &ip_settings)con
 }
 
 bool CamUsb::setAttrib(const int_attrib::CamAttrib attrib, const int value) {
-    LOG_DEBUG("CamUsb: setAttrib int");
+    CAM_LOG_TRACE("CamUsb: setAttrib int");
     
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("An int attribute can not be set, current mode is %d",mCamMode);
@@ -248,7 +549,7 @@ bool CamUsb::setAttrib(const int_attrib::CamAttrib attrib, const int value) {
         throw std::runtime_error("Unknown attribute!");
     else {
         try {
-            mCamConfig->writeControlValue(it->second, value);
+            writeControlValue(it->second, value);
         } catch(std::runtime_error& e) {
             LOG_ERROR("Set integer attribute %d to %d: %s", attrib, value, e.what());
         }
@@ -258,7 +559,18 @@ bool CamUsb::setAttrib(const int_attrib::CamAttrib attrib, const int value) {
 
 
 bool CamUsb::setAttrib(const double_attrib::CamAttrib attrib, const double value) {
-    LOG_DEBUG("CamUsb: seAttrib double");
+    CAM_LOG_TRACE("CamUsb: seAttrib double");
+
+    // While streaming the running pipeline is renegotiated.
+    if(mCamMode == CAM_USB_GST && act_grab_mode_ != Stop && 
+            (attrib == double_attrib::FrameRate || attrib == double_attrib::StatFrameRate)) {
+        if(value <= 0 || !mCamGst->renegotiate(image_size_.width, image_size_.height, 
+                (uint32_t)value)) {
+            return false;
+        }
+        mFps = value;
+        return true;
+    }
    
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("A double attribute. can not be set, current mode is %d",mCamMode);
@@ -269,6 +581,10 @@ bool CamUsb::setAttrib(const double_attrib::CamAttrib attrib, const double value
 
         case double_attrib::FrameRate:
         case double_attrib::StatFrameRate: {
+            if(mTestDevice) {
+                mFps = value;
+                break;
+            }
             mCamConfig->writeFPS((uint32_t)value);
             float cam_fps_tmp = 0;
             mCamConfig->readFPS(&cam_fps_tmp);
@@ -292,7 +608,7 @@ bool setAttrib(const str_attrib::CamAttrib attrib,const std::string value) {
 }
 
 bool CamUsb::setAttrib(const enum_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: setAttrib enum %i", attrib);
+    CAM_LOG_TRACE("CamUsb: setAttrib enum %i", attrib);
 
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop image requesting before setting an enum attribute.");
@@ -301,47 +617,47 @@ bool CamUsb::setAttrib(const enum_attrib::CamAttrib attrib) {
 
     switch(attrib) {
         case enum_attrib::WhitebalModeToManual: {
-            mCamConfig->writeControlValue(V4L2_CID_AUTO_WHITE_BALANCE, 0);
+            writeControlValue(V4L2_CID_AUTO_WHITE_BALANCE, 0);
             break;
         }
         case enum_attrib::WhitebalModeToAuto: {
-            mCamConfig->writeControlValue(V4L2_CID_AUTO_WHITE_BALANCE, 1);
+            writeControlValue(V4L2_CID_AUTO_WHITE_BALANCE, 1);
             break;
         }
         case enum_attrib::GainModeToManual: {
-            mCamConfig->writeControlValue(V4L2_CID_AUTOGAIN, 0);
+            writeControlValue(V4L2_CID_AUTOGAIN, 0);
             break;
         }
         case enum_attrib::GainModeToAuto: {
-            mCamConfig->writeControlValue(V4L2_CID_AUTOGAIN, 1);
+            writeControlValue(V4L2_CID_AUTOGAIN, 1);
             break;
         }
         case enum_attrib::PowerLineFrequencyDisabled: {
-            mCamConfig->writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_DISABLED);
+            writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_DISABLED);
             break;
         }
         case enum_attrib::PowerLineFrequencyTo50: {
-            mCamConfig->writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_50HZ);
+            writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_50HZ);
             break;
         }
         case enum_attrib::PowerLineFrequencyTo60: {
-            mCamConfig->writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_60HZ);
+            writeControlValue(V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CID_POWER_LINE_FREQUENCY_60HZ);
             break;
         }
         case enum_attrib::ExposureModeToAuto: {
             uint32_t id = V4L2_EXPOSURE_AUTO;
-            if(!mCamConfig->isControlIdValid(id)) {
+            if(!isControlIdValid(id)) {
                 id = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
             }
-            mCamConfig->writeControlValue(id, V4L2_EXPOSURE_AUTO);
+            writeControlValue(id, V4L2_EXPOSURE_AUTO);
             break;
         }
         case enum_attrib::ExposureModeToManual: {
             uint32_t id = V4L2_EXPOSURE_AUTO;
-            if(!mCamConfig->isControlIdValid(id)) {
+            if(!isControlIdValid(id)) {
                 id = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
             }
-            mCamConfig->writeControlValue(id, V4L2_EXPOSURE_MANUAL);
+            writeControlValue(id, V4L2_EXPOSURE_MANUAL);
             break;
         }
         // attribute unknown or not supported (yet)
@@ -353,7 +669,7 @@ bool CamUsb::setAttrib(const enum_attrib::CamAttrib attrib) {
 }
 
 bool CamUsb::isAttribAvail(const int_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: isAttribAvail int");
+    CAM_LOG_TRACE("CamUsb: isAttribAvail int");
 
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop image requesting before checking whether an int attribute is available.");
@@ -364,11 +680,11 @@ bool CamUsb::isAttribAvail(const int_attrib::CamAttrib attrib) {
     if(it == mMapAttrsCtrlsInt.end())
         return false;
     else
-        return mCamConfig->isControlIdWritable(it->second);
+        return isControlIdWritable(it->second);
 }
 
 bool CamUsb::isAttribAvail(const double_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: isAttribAvail double");
+    CAM_LOG_TRACE("CamUsb: isAttribAvail double");
     
     if(mCamMode != CAM_USB_V4L2) {
         if(attrib == double_attrib::FrameRate || attrib == double_attrib::StatFrameRate) { 
@@ -383,6 +699,9 @@ bool CamUsb::isAttribAvail(const double_attrib::CamAttrib attrib) {
 
         case double_attrib::FrameRate:
         case double_attrib::StatFrameRate: {
+            if(mTestDevice) {
+                return true;
+            }
             bool ret = mCamConfig->hasCapabilityStreamparm(V4L2_CAP_TIMEPERFRAME);
             return ret;
         }
@@ -393,7 +712,7 @@ bool CamUsb::isAttribAvail(const double_attrib::CamAttrib attrib) {
 }
         
 bool CamUsb::isAttribAvail(const enum_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb:isAttriAvail enum");
+    CAM_LOG_TRACE("CamUsb: isAttribAvail enum");
     
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop image requesting before checking whether an enum attribute is available.");
@@ -403,21 +722,21 @@ bool CamUsb::isAttribAvail(const enum_attrib::CamAttrib attrib) {
     switch(attrib) {
         case enum_attrib::WhitebalModeToManual:
         case enum_attrib::WhitebalModeToAuto: {
-            return mCamConfig->isControlIdValid(V4L2_CID_AUTO_WHITE_BALANCE);
+            return isControlIdValid(V4L2_CID_AUTO_WHITE_BALANCE);
         }
         case enum_attrib::GainModeToManual:
         case enum_attrib::GainModeToAuto: {
-            return mCamConfig->isControlIdValid(V4L2_CID_AUTOGAIN);
+            return isControlIdValid(V4L2_CID_AUTOGAIN);
         }
         case enum_attrib::PowerLineFrequencyDisabled:
         case enum_attrib::PowerLineFrequencyTo50:
         case enum_attrib::PowerLineFrequencyTo60: {
-            return mCamConfig->isControlIdValid(V4L2_CID_POWER_LINE_FREQUENCY);
+            return isControlIdValid(V4L2_CID_POWER_LINE_FREQUENCY);
         }
         case enum_attrib::ExposureModeToAuto:
         case enum_attrib::ExposureModeToManual: {
-            return mCamConfig->isControlIdValid(V4L2_CID_EXPOSURE_AUTO_PRIORITY) || 
-                mCamConfig->isControlIdValid(V4L2_EXPOSURE_AUTO);
+            return isControlIdValid(V4L2_CID_EXPOSURE_AUTO_PRIORITY) || 
+                isControlIdValid(V4L2_EXPOSURE_AUTO);
         }
         // attribute unknown or not supported (yet)
         default:
@@ -427,7 +746,7 @@ bool CamUsb::isAttribAvail(const enum_attrib::CamAttrib attrib) {
 }
 
 int CamUsb::getAttrib(const int_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: getAttrib int");
+    CAM_LOG_TRACE("CamUsb: getAttrib int");
 
     if(mCamMode != CAM_USB_V4L2) {
         throw std::runtime_error("Stop image requesting before getting an int attribute.");
@@ -438,13 +757,13 @@ int CamUsb::getAttrib(const int_attrib::CamAttrib attrib) {
         throw std::runtime_error("Unknown attribute!");
 
     int32_t value = 0;
-    mCamConfig->getControlValue(it->second, &value);    
+    getControlValue(it->second, &value);    
 
     return value; 
 }
 
 double CamUsb::getAttrib(const double_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: getAttrib double");
+    CAM_LOG_TRACE("CamUsb: getAttrib double");
 
     if(mCamMode != CAM_USB_V4L2) {
         // If FrameRate or StatFrameRate is requested, the current fps are returned if the pipeline is running,
@@ -459,7 +778,9 @@ double CamUsb::getAttrib(const double_attrib::CamAttrib attrib) {
         case double_attrib::FrameRate:
         case double_attrib::StatFrameRate: {
             // Just returns the stored framerate, which has been requested in setAttrib().
-            mCamConfig->readFPS(&mFps);
+            if(!mTestDevice) {
+                mCamConfig->readFPS(&mFps);
+            }
             return mFps;
         }
         default:
@@ -468,7 +789,7 @@ double CamUsb::getAttrib(const double_attrib::CamAttrib attrib) {
 }
 
 bool CamUsb::isAttribSet(const enum_attrib::CamAttrib attrib) {
-    LOG_DEBUG("CamUsb: isAttribSet enum");
+    CAM_LOG_TRACE("CamUsb: isAttribSet enum");
    
     if(mCamMode != CAM_USB_V4L2) {
         throw std::runtime_error("Stop image requesting before check whether a enum attribute is set.");
@@ -478,34 +799,34 @@ bool CamUsb::isAttribSet(const enum_attrib::CamAttrib attrib) {
     int32_t value = 0;
     switch(attrib) {
         case enum_attrib::WhitebalModeToManual: 
-            mCamConfig->getControlValue(V4L2_CID_AUTO_WHITE_BALANCE, &value);
+            getControlValue(V4L2_CID_AUTO_WHITE_BALANCE, &value);
             return value == 0;
         case enum_attrib::WhitebalModeToAuto:
-            mCamConfig->getControlValue(V4L2_CID_AUTO_WHITE_BALANCE, &value);
+            getControlValue(V4L2_CID_AUTO_WHITE_BALANCE, &value);
             return value == 1;
         case enum_attrib::GainModeToManual:
-            mCamConfig->getControlValue(V4L2_CID_AUTOGAIN, &value);
+            getControlValue(V4L2_CID_AUTOGAIN, &value);
             return value == 0;
         case enum_attrib::GainModeToAuto:
-            mCamConfig->getControlValue(V4L2_CID_AUTOGAIN, &value);
+            getControlValue(V4L2_CID_AUTOGAIN, &value);
             return value == 1;
         case enum_attrib::PowerLineFrequencyDisabled:
-            mCamConfig->getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
+            getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
             return value == 0;
         case enum_attrib::PowerLineFrequencyTo50:
-            mCamConfig->getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
+            getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
             return value == 1;
         case enum_attrib::PowerLineFrequencyTo60:
-             mCamConfig->getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
+             getControlValue(V4L2_CID_POWER_LINE_FREQUENCY, &value); 
             return value == 2;
         case enum_attrib::ExposureModeToAuto:
-            if(!mCamConfig->getControlValue(V4L2_CID_EXPOSURE_AUTO_PRIORITY, &value)) {
-                mCamConfig->getControlValue(V4L2_EXPOSURE_AUTO, &value);
+            if(!getControlValue(V4L2_CID_EXPOSURE_AUTO_PRIORITY, &value)) {
+                getControlValue(V4L2_EXPOSURE_AUTO, &value);
             }
             return value == V4L2_EXPOSURE_AUTO;
         case enum_attrib::ExposureModeToManual:
-             if(!mCamConfig->getControlValue(V4L2_CID_EXPOSURE_AUTO_PRIORITY, &value)) {
-                mCamConfig->getControlValue(V4L2_EXPOSURE_AUTO, &value);
+             if(!getControlValue(V4L2_CID_EXPOSURE_AUTO_PRIORITY, &value)) {
+                getControlValue(V4L2_EXPOSURE_AUTO, &value);
             }
             return value == V4L2_EXPOSURE_MANUAL;
         // attribute unknown or not supported (yet)
@@ -515,20 +836,20 @@ bool CamUsb::isAttribSet(const enum_attrib::CamAttrib attrib) {
 }
 
 bool CamUsb::isV4L2AttribAvail(const int control_id, std::string name) {
-    LOG_DEBUG("CamUsb: isV4L2AttribAvail");
+    CAM_LOG_TRACE("CamUsb: isV4L2AttribAvail");
    
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop image requesting before check whether a v4l2 control attribute is available.");
         return false;
     }
 
-    if(!mCamConfig->isControlIdValid(control_id)) {
+    if(!isControlIdValid(control_id)) {
         return false;
     }
 
     if(!name.empty()) {
         std::string control_name;
-        mCamConfig->getControlName(control_id, &control_name);
+        getControlName(control_id, &control_name);
         if(control_name.compare(name) != 0) { // control names differ
             LOG_DEBUG("Control names differ. Passed name: %s, control name: %s", 
                     name.c_str(), control_name.c_str());
@@ -540,7 +861,7 @@ bool CamUsb::isV4L2AttribAvail(const int control_id, std::string name) {
 }
 
 int CamUsb::getV4L2Attrib(const int control_id) {
-    LOG_DEBUG("CamUsb: getV4L2Attrib");
+    CAM_LOG_TRACE("CamUsb: getV4L2Attrib");
    
     if(mCamMode != CAM_USB_V4L2) {
         throw std::runtime_error("Stop image requesting before getting a v4l2 attribute.");
@@ -548,7 +869,7 @@ int CamUsb::getV4L2Attrib(const int control_id) {
 
     int value_tmp = 0;
 
-    if(!mCamConfig->getControlValue(control_id, &value_tmp)) {
+    if(!getControlValue(control_id, &value_tmp)) {
          throw std::runtime_error("Unkown attribute");
     }
 
@@ -556,13 +877,13 @@ int CamUsb::getV4L2Attrib(const int control_id) {
 }
 
 bool CamUsb::setV4L2Attrib(const int control_id, const int value) {
-    LOG_DEBUG("CamUsb: setV4L2Attrib");
+    CAM_LOG_TRACE("CamUsb: setV4L2Attrib");
    
     if(mCamMode != CAM_USB_V4L2) {
         throw std::runtime_error("Stop image requesting before setting a v4l2 attribute.");
     }
  
-    mCamConfig->writeControlValue(control_id, value);
+    writeControlValue(control_id, value);
     return true;
 }
 
@@ -572,6 +893,19 @@ bool CamUsb::setFrameSettings(  const base::samples::frame::frame_size_t size,
                                       const bool resize_frames) {
 
     LOG_DEBUG("CamUsb: setFrameSettings");
+
+    // While streaming the running pipeline is renegotiated.
+    if(mCamMode == CAM_USB_GST && act_grab_mode_ != Stop) {
+        if(mode != image_mode_ || color_depth != image_color_depth_) {
+            LOG_INFO("Stop grabbing before changing the frame mode.");
+            return false;
+        }
+        if(!mCamGst->renegotiate(size.width, size.height)) {
+            return false;
+        }
+        image_size_ = size;
+        return true;
+    }
     
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop the device before setting frame settings.");
@@ -580,9 +914,22 @@ bool CamUsb::setFrameSettings(  const base::samples::frame::frame_size_t size,
 
     LOG_DEBUG("color_depth is set to %d", (int)color_depth);
 
-    // Hack: If RGB is requested and not available on the camera, YUYV will be 
-    // used and internally converted to RGB.
-    uint32_t v4l2_image_format = mCamConfig->toV4L2ImageFormat(mode);
+    // videotestsrc creates any size, the pipeline converts to the requested mode.
+    if(mTestDevice) {
+        if(Bayer::isBayerMode(mode)) {
+            LOG_INFO("Bayer modes are not supported by test devices.");
+            return false;
+        }
+        image_size_ = size;
+        image_mode_ = mode;
+        image_color_depth_ = color_depth;
+        return true;
+    }
+
+    // Hack: If RGB, BGR, RGB32, grayscale or UYVY is requested and not available 
+    // on the camera, YUYV will be used and internally converted (or MJPEG decoded).
+    uint32_t v4l2_image_format = mCamConfig->toV4L2ImageFormat(mode, size.width, size.height,
+            color_depth);
     if(v4l2_image_format == 0) {
         LOG_INFO("Frame mode not available on the camera, using default camera mode.");
         LOG_INFO("v4l2 image requesting will probably support an unexpeted format");
@@ -590,9 +937,9 @@ bool CamUsb::setFrameSettings(  const base::samples::frame::frame_size_t size,
     } else {
         mCamConfig->writeImagePixelFormat(size.width, size.height, v4l2_image_format); // use V4L2_PIX_FMT_YUV420?
     }
+    // Differs from the captured size if MJPEG images are downscaled while decoding.
     uint32_t width = 0, height = 0;
-    mCamConfig->getImageWidth(&width);
-    mCamConfig->getImageHeight(&height);
+    mCamConfig->getOutputImageSize(&width, &height);
 
     base::samples::frame::frame_size_t size_tmp;
     size_tmp.width = (uint16_t)width;
@@ -601,6 +948,10 @@ bool CamUsb::setFrameSettings(  const base::samples::frame::frame_size_t size,
     image_size_ = size_tmp;
     image_mode_ = mode;
     image_color_depth_ = color_depth;
+    // The Bayer frames use the depth of the selected format (8, 10 or 12 bits).
+    if(Bayer::isBayerMode(mode)) {
+        image_color_depth_ = mCamConfig->getOutputDataDepth();
+    }
     return true;
 }
 
@@ -629,7 +980,11 @@ bool CamUsb::setToDefault() {
         return false;
     }
 
-    mCamConfig->setControlValuesToDefault();
+    if(mTestDevice) {
+        mTestControls.setControlValuesToDefault();
+    } else {
+        mCamConfig->setControlValuesToDefault();
+    }
     return true;
 }
 
@@ -639,6 +994,11 @@ bool CamUsb::printCameraInformations() {
         return false;
     }
     printf("\nCAMERA INFORMATIONS\n");
+    if(mTestDevice) {
+        printf("Test device %s\n", mDevice.c_str());
+        mTestControls.listControls();
+        return true;
+    }
     mCamConfig->listCapabilities();
     mCamConfig->listControls();
     mCamConfig->listImageFormat();
@@ -647,7 +1007,7 @@ bool CamUsb::printCameraInformations() {
 }
 
 void CamUsb::getRange(const int_attrib::CamAttrib attrib,int &imin,int &imax) {
-    LOG_DEBUG("CamUsb: getRange");
+    CAM_LOG_TRACE("CamUsb: getRange");
     
     if(mCamMode != CAM_USB_V4L2) {
         LOG_INFO("Stop image requesting before requesting range.");
@@ -657,15 +1017,15 @@ void CamUsb::getRange(const int_attrib::CamAttrib attrib,int &imin,int &imax) {
     std::map<int_attrib::CamAttrib, int>::iterator it = mMapAttrsCtrlsInt.find(attrib);
     if(it != mMapAttrsCtrlsInt.end()) {
         int32_t min = 0, max = 0;
-        mCamConfig->getControlMinimum(it->second, &min);
+        getControlMinimum(it->second, &min);
         imin = min;
-        mCamConfig->getControlMaximum(it->second, &max);
+        getControlMaximum(it->second, &max);
         imax = max;
     }
 }
 
 int CamUsb::getFileDescriptor() const {
-    LOG_DEBUG("CamUsb: getFileDescriptor");
+    CAM_LOG_TRACE("CamUsb: getFileDescriptor");
 
     if(mCamMode != CAM_USB_GST) {
         LOG_INFO("Start pipeline to request the corresponding file descriptor");
@@ -679,7 +1039,7 @@ int CamUsb::getFileDescriptor() const {
     return fd;
 }
 
-void CamUsb::createAttrsCtrlMaps(CamConfig* cam_config) {
+void CamUsb::createAttrsCtrlMaps() {
     LOG_DEBUG("CamUsb: createAttrsCtrlMaps");
     
     typedef std::pair<int_attrib::CamAttrib, int> ac_int;
@@ -691,12 +1051,97 @@ void CamUsb::createAttrsCtrlMaps(CamConfig* cam_config) {
     mMapAttrsCtrlsInt.insert(ac_int(int_attrib::SharpnessValue,V4L2_CID_SHARPNESS));
     mMapAttrsCtrlsInt.insert(ac_int(int_attrib::BacklightCompensation,V4L2_CID_BACKLIGHT_COMPENSATION));
     uint32_t valid_exposure_id = V4L2_CID_EXPOSURE_ABSOLUTE;
-    if(!cam_config->isControlIdValid(valid_exposure_id)) {
+    if(!isControlIdValid(valid_exposure_id)) {
         valid_exposure_id = V4L2_CID_EXPOSURE;
     }
     mMapAttrsCtrlsInt.insert(ac_int(int_attrib::ExposureValue,valid_exposure_id));
 }
 
+void CamUsb::createPipeline() {
+    changeCameraMode(CAM_USB_GST);
+    mCamGst->setSoftwareResize(mSoftwareResize);
+    mCamGst->setBufferPoolSize(mPoolBuffers);
+    mCamGst->setSourceQueue(mSourceQueueBuffers);
+    mCamGst->clearOutputs();
+    std::map<std::string, OutputConfig>::const_iterator it = mOutputs.begin();
+    for(; it != mOutputs.end(); ++it) {
+        mCamGst->addOutput(it->first, it->second.mDescription, 
+                it->second.mMaxBuffers, it->second.mDrop);
+    }
+    if(!mPipelineDescription.empty()) {
+        mCamGst->createCustomPipeline(mPipelineDescription, 
+                image_size_.width, image_size_.height, (uint32_t)mFps, image_mode_);
+    } else {
+        // If one of the parameters is 0, the current setting of the camera is used.
+        mCamGst->createDefaultPipeline(true,
+                image_size_.width, image_size_.height,
+                (uint32_t)mFps, (uint32_t)mBpp,
+                image_mode_, mJpegQuality);
+    }
+}
+
+std::string CamUsb::getPipelineKey() {
+    std::stringstream key;
+    key << image_size_.width << "x" << image_size_.height << "@" << mFps << " " << 
+            image_mode_ << " " << mBpp << " " << mJpegQuality << " " << mSoftwareResize << " " <<
+            mPoolBuffers << " " << mSourceQueueBuffers << " " << mPipelineDescription;
+    std::map<std::string, OutputConfig>::const_iterator it = mOutputs.begin();
+    for(; it != mOutputs.end(); ++it) {
+        key << "|" << it->first << ":" << it->second.mDescription << ":" << 
+                it->second.mMaxBuffers << ":" << it->second.mDrop;
+    }
+    return key.str();
+}
+
+bool CamUsb::isControlIdValid(uint32_t id) {
+    return mTestDevice ? mTestControls.isControlIdValid(id) : mCamConfig->isControlIdValid(id);
+}
+
+bool CamUsb::isControlIdWritable(uint32_t id) {
+    return mTestDevice ? mTestControls.isControlIdWritable(id) :
+            mCamConfig->isControlIdWritable(id);
+}
+
+bool CamUsb::getControlValue(uint32_t id, int32_t* value) {
+    return mTestDevice ? mTestControls.getControlValue(id, value) :
+            mCamConfig->getControlValue(id, value);
+}
+
+void CamUsb::writeControlValue(uint32_t id, int32_t value) {
+    if(mTestDevice) {
+        mTestControls.writeControlValue(id, value);
+    } else {
+        mCamConfig->writeControlValue(id, value);
+    }
+}
+
+bool CamUsb::getControlName(uint32_t id, std::string* name) {
+    return mTestDevice ? mTestControls.getControlName(id, name) :
+            mCamConfig->getControlName(id, name);
+}
+
+bool CamUsb::getControlMinimum(uint32_t id, int32_t* minimum) {
+    return mTestDevice ? mTestControls.getControlMinimum(id, minimum) :
+            mCamConfig->getControlMinimum(id, minimum);
+}
+
+bool CamUsb::getControlMaximum(uint32_t id, int32_t* maximum) {
+    return mTestDevice ? mTestControls.getControlMaximum(id, maximum) :
+            mCamConfig->getControlMaximum(id, maximum);
+}
+
+bool CamUsb::isPipelineStarted() {
+    CamGst::PipelineState state = mCamGst->getPipelineState();
+    return state == CamGst::PIPELINE_RUNNING || state == CamGst::PIPELINE_STARTING;
+}
+
+WorkerPool* CamUsb::getWorkerPool() {
+    if(mWorkerPool == NULL) {
+        mWorkerPool = new WorkerPool(mWorkerPoolThreads, mWorkerPoolCpus);
+    }
+    return mWorkerPool;
+}
+
 void CamUsb::changeCameraMode(enum CAM_USB_MODE cam_usb_mode) {
 
     LOG_DEBUG("Will change camera mode to: %s", camera::ModeTxt[cam_usb_mode].c_str());
@@ -723,9 +1168,12 @@ void CamUsb::changeCameraMode(enum CAM_USB_MODE cam_usb_mode) {
             break;
         case CAM_USB_V4L2:
             LOG_INFO("Camera configuration mode via v4l2 activated");
-            mCamConfig = new CamConfig(mDevice);
+            // The controls of test devices are emulated by mTestControls.
+            if(!mTestDevice) {
+                mCamConfig = new CamConfig(mDevice);
+            }
             mCamMode = CAM_USB_V4L2;
-            createAttrsCtrlMaps(mCamConfig);
+            createAttrsCtrlMaps();
             break;
         case CAM_USB_GST:
             LOG_INFO("Camera image transfer mode via gst activated");
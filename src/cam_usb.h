@@ -23,6 +23,8 @@
 
 #include "cam_gst.h"
 #include "cam_config.h"
+#include "frame_pool.h"
+#include "test_device.h"
 
 namespace camera 
 {
@@ -115,6 +117,172 @@ class CamUsb : public CamInterface {
      */
     virtual bool retrieveFrame(base::samples::frame::Frame &frame,const int timeout=1000);
 
+    /**
+     * Same as retrieveFrame(), additionally 'preview' receives the downscaled 
+     * image configured with setPreview(). Both are created from the same 
+     * captured image in one pass. If no preview can be created (e.g. the image is 
+     * not converted from YUYV) the status of 'preview' is STATUS_INVALID.
+     * \return true if a new image could be requested in 'timeout' msecs.
+     */
+    bool retrieveFrame(base::samples::frame::Frame &frame, base::samples::frame::Frame &preview,
+            const int timeout=1000);
+
+    /**
+     * Zero-copy alternative to retrieveFrame(), only available while GStreamer
+     * is used for the image requesting (MultiFrame or Continuously).
+     * The handle refers to the image within the GStreamer buffer, which stays valid
+     * until the handle is released. In contrast to retrieveFrame() the image 
+     * is passed as it is, e.g. JPEG comment blocks are not removed.
+     * Converted raw images are usually held in a buffer of the pool of the 
+     * pipeline, which gets it back when the handle is released, see setBufferPoolSize().
+     * \return true if a new image could be requested in 'timeout' msecs.
+     */
+    bool retrieveFrameHandle(GstFrameHandle& handle, const int timeout=1000);
+
+    /**
+     * Next image of the output 'name' (see addOutput()) without copying it.
+     * \return true if an image has been received in 'timeout' msecs.
+     */
+    bool retrieveOutputFrameHandle(std::string const& name, GstFrameHandle& handle, 
+            const int timeout=1000);
+
+    /**
+     * Copies the next image of the output 'name' into 'frame'. Size and mode
+     * are taken from the caps of the output, which have to be image/jpeg or
+     * a raw format of the frame modes. Encoded streams (e.g. H.264) are only
+     * available with retrieveOutputFrameHandle().
+     * \return true if an image has been received in 'timeout' msecs.
+     */
+    bool retrieveOutputFrame(std::string const& name, base::samples::frame::Frame& frame, 
+            const int timeout=1000);
+
+    /**
+     * Recreates the worker pool which is used for the image conversions
+     * (e.g. YUYV to RGB in mode SingleFrame). Stop grabbing before.
+     * By default the pool is created with WorkerPool::DEFAULT_NUM_THREADS threads
+     * (at most one per CPU) and no affinity as soon as it is needed.
+     * \param num_threads Number of worker threads, 0 uses the default.
+     * \param cpus If not empty the workers are pinned round robin to these CPUs.
+     * \return false if the camera is grabbing.
+     */
+    bool configureWorkerPool(unsigned int num_threads, 
+            std::vector<int> const& cpus = std::vector<int>());
+
+    /**
+     * Quality (0 to 100) of the JPEG images which are compressed by the driver:
+     * by the GStreamer pipeline or, in mode SingleFrame, from YUYV if the camera 
+     * does not support MJPEG. Used with the next grab() call.
+     */
+    void setJpegQuality(uint32_t quality);
+
+    /**
+     * Processing graph used in the modes MultiFrame and Continuously instead of 
+     * the default pipeline, see CamGst::createCustomPipeline(). The images have
+     * to leave the description in the configured frame mode, e.g. by ending it
+     * with ${caps}. An empty description restores the default pipeline.
+     * Used with the next grab() call.
+     */
+    void setPipelineDescription(std::string const& description);
+
+    /**
+     * If set the frame size and rate are changed in software (videoscale, videorate)
+     * while streaming raw images with the default pipeline, otherwise the camera 
+     * format is renegotiated, see CamGst::setSoftwareResize(). Used with the next grab() call.
+     */
+    void setSoftwareResize(bool enable);
+
+    /**
+     * Number of preallocated buffers which the GStreamer pipeline offers to
+     * the conversion elements, see CamGst::setBufferPoolSize(). Default:
+     * CamGst::DEFAULT_POOL_BUFFERS. Increase it if more frame handles are kept 
+     * at a time. Used with the next grab() call.
+     */
+    void setBufferPoolSize(uint32_t num_buffers);
+
+    /**
+     * Bounds the latency of the default pipeline by a leaky queue of 
+     * 'max_buffers' images between the source and the conversion, 0 disables it.
+     * See CamGst::setSourceQueue(). Used with the next grab() call.
+     */
+    void setSourceQueue(uint32_t max_buffers);
+
+    /**
+     * Counters of the running GStreamer pipeline (received and dropped images).
+     * \return false if GStreamer is not used at the moment.
+     */
+    bool getPipelineStatistics(CamGst::Statistics& statistics);
+
+    /**
+     * If set grab() only requests the start of the GStreamer pipeline and 
+     * returns immediately, the first retrieveFrame() waits for the first image.
+     * Start errors are logged and retrieveFrame() fails. Default: false.
+     */
+    void setAsyncStart(bool async);
+
+    /**
+     * Time from the last grab() in mode MultiFrame or Continuously to the 
+     * first received image in usec, -1 if not available (yet).
+     */
+    int64_t getFirstFrameLatency();
+
+    /**
+     * Creates the GStreamer pipeline with the current settings and parks it
+     * in PAUSED (device opened, state prepared) or READY (device opened). The
+     * camera is a live source, so negotiation and buffer allocation still 
+     * happen in PLAYING, see CamGst::prewarmPipeline(). The next grab() in 
+     * mode MultiFrame or Continuously only switches it to PLAYING if the 
+     * settings have not been changed since, otherwise the pipeline is 
+     * recreated. The device stays opened by GStreamer until grab(Stop) or 
+     * close(). Stop grabbing before.
+     * \return false if the pipeline could not be prewarmed.
+     */
+    bool prewarm(bool paused = true);
+
+    /**
+     * Adds a named output to the GStreamer pipeline, e.g. a downscaled preview
+     * or an encoder branch next to the full resolution images of retrieveFrame().
+     * All outputs share one capture, each has its own queue of 'max_buffers' 
+     * images, see CamGst::addOutput(). Adding an existing name replaces the output.
+     * Used with the next grab() call.
+     */
+    void addOutput(std::string const& name, std::string const& description, 
+            uint32_t max_buffers = CamGst::MAX_SINK_BUFFERS, bool drop = true);
+
+    /**
+     * Removes all outputs, used with the next grab() call.
+     */
+    void clearOutputs();
+
+    /**
+     * Configures the preview of retrieveFrame(frame, preview, timeout): the image
+     * downscaled by 'factor' (2 or 4, box filter) in 'mode' (RGB, BGR, RGB32 or
+     * grayscale). Pass 0 to disable the preview. Only available in mode SingleFrame
+     * if the images are converted from YUYV. Used with the next grab() call.
+     * \return false if factor or mode are not supported.
+     */
+    bool setPreview(unsigned int factor, base::samples::frame::frame_mode_t mode);
+
+    /**
+     * Pads the rows of uncompressed frames to a multiple of 'padding' bytes,
+     * Frame::row_size contains the resulting row size. In V4L2 mode this 
+     * applies to the converted images and the previews, in GStreamer mode 
+     * the raw rows are copied from the stride of the GStreamer buffer into 
+     * padded rows. JPEG images are not affected. Only the pitch is padded,
+     * the start of the image buffer is not aligned. Defaults to 
+     * Helpers::DEFAULT_ROW_PADDING, 1 creates tightly packed rows.
+     * Used with the next grab() call.
+     */
+    void setRowPadding(uint32_t padding);
+
+    /**
+     * Returns the image buffer of a frame which is not needed anymore to the
+     * frame pool of the camera, 'frame.image' is empty afterwards. The pooled
+     * buffers are reused by retrieveFrame(), so a consumer which releases the 
+     * frames it received keeps the capture free of allocations although the 
+     * image sizes vary (e.g. MJPEG). Can be called from any thread.
+     */
+    void releaseFrame(base::samples::frame::Frame& frame);
+
     /**
      * Stores the last retrieved frame to 'file_name'.
      */
@@ -228,6 +396,11 @@ class CamUsb : public CamInterface {
     /**
      * If necessary 'size' will be changed to a valid one. 'mode' should be set to
      * base::samples::frame::MODE_JPEG and 'color_depth' to the bytes per pixel.
+     * For the Bayer modes 'color_depth' selects the bits per pixel (8, 10 or 12),
+     * afterwards getFrameSettings() returns the depth which is actually used.
+     * While grabbing with GStreamer (MultiFrame, Continuously) only the size can
+     * be changed: the running pipeline is renegotiated (CamGst::renegotiate()),
+     * the same applies to the frame rate attribute.
      */
     bool setFrameSettings(const base::samples::frame::frame_size_t size,
                                 const base::samples::frame::frame_mode_t mode,
@@ -350,12 +523,87 @@ class CamUsb : public CamInterface {
     int mBpp;
     timeval mStartTimeGrabbing;
     int mReceivedFrameCounter;
+    // Receives the v4l2 images, swapped with the frame image to avoid a second copy.
+    std::vector<uint8_t> mBufferTmp;
+    // Persistent pool for the image conversions, shared by all CamConfig instances.
+    WorkerPool* mWorkerPool;
+    unsigned int mWorkerPoolThreads;
+    std::vector<int> mWorkerPoolCpus;
+    uint32_t mJpegQuality;
+    std::string mPipelineDescription; // Empty: default pipeline.
+    bool mAsyncStart;
+    // Settings of the prewarmed pipeline (see getPipelineKey()), empty if none.
+    std::string mPrewarmedPipeline;
+    bool mSoftwareResize;
+    // Device URI "test://..." (see TestDevice): no CamConfig, the controls
+    // are emulated and kept while the camera is open.
+    bool mTestDevice;
+    TestControls mTestControls;
+    uint32_t mPoolBuffers;
+    uint32_t mSourceQueueBuffers;
+    struct OutputConfig {
+        std::string mDescription;
+        uint32_t mMaxBuffers;
+        bool mDrop;
+    };
+    std::map<std::string, OutputConfig> mOutputs; // See addOutput().
+    unsigned int mPreviewFactor;
+    base::samples::frame::frame_mode_t mPreviewMode;
+    std::vector<uint8_t> mPreviewBufferTmp;
+    uint32_t mRowPadding;
+    // Buffers of the released frames, reused for the next images.
+    FramePool mFramePool;
     
     // FD driven image receiving (?).
     void (*mpCallbackFunction)(const void* p);
     void* mpPassThroughPointer;
 
-    void createAttrsCtrlMaps(CamConfig* cam_config);
+    void createAttrsCtrlMaps();
+
+    /**
+     * Control access of the configuration mode (CAM_USB_V4L2), forwarded to
+     * CamConfig or, for test devices, to the emulated controls.
+     */
+    bool isControlIdValid(uint32_t id);
+    bool isControlIdWritable(uint32_t id);
+    bool getControlValue(uint32_t id, int32_t* value);
+    void writeControlValue(uint32_t id, int32_t value);
+    bool getControlName(uint32_t id, std::string* name);
+    bool getControlMinimum(uint32_t id, int32_t* minimum);
+    bool getControlMaximum(uint32_t id, int32_t* maximum);
+
+    /**
+     * Implements both retrieveFrame() variants, 'preview' may be NULL.
+     */
+    bool retrieveFrames(base::samples::frame::Frame& frame, 
+            base::samples::frame::Frame* preview, const int timeout);
+
+    /**
+     * Copies the image of 'handle' into 'frame', raw rows are padded to mRowPadding.
+     */
+    bool copyHandleToFrame(GstFrameHandle const& handle, uint32_t width, uint32_t height,
+            base::samples::frame::frame_mode_t mode, int depth, 
+            base::samples::frame::Frame& frame);
+
+    /**
+     * Switches to GStreamer and creates the pipeline with the current settings.
+     */
+    void createPipeline();
+
+    /**
+     * Settings which are used to create the pipeline, as a string.
+     */
+    std::string getPipelineKey();
+
+    /**
+     * True if the pipeline is running or a start has been requested.
+     */
+    bool isPipelineStarted();
+
+    /**
+     * Creates the worker pool if it does not exist yet.
+     */
+    WorkerPool* getWorkerPool();
 };
 
 } // end namespace camera
@@ -0,0 +1,649 @@
+#include "fake_v4l2_device.h"
+#include "cam_logging.h"
+#include "jpeg_codec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <stdexcept>
+
+namespace camera
+{
+
+const uint32_t FakeV4L2Device::MAX_BUFFERS;
+
+// Page size granularity of the buffer offsets, like the kernel uses them.
+static const uint32_t OFFSET_ALIGNMENT = 4096;
+
+FakeV4L2Device::FakeV4L2Device() : mFormats(), mFormat(), mTimeperframe(), mControls(),
+        mLatency(0), mDropInterval(0), mManualClock(false), mTime(0), mBuffers(), mQueuedBuffers(), mDoneBuffers(),
+        mPattern(), mStreaming(false), mStartTime(0), mNextFrame(0), mNumFrames(0),
+        mNumDroppedFrames(0), mDequeueLatency() {
+    pthread_mutex_init(&mMutex, NULL);
+    std::vector<Format> formats;
+    Format format = {V4L2_PIX_FMT_YUYV, 640, 480, 30};
+    formats.push_back(format);
+    format.mWidth = 1280;
+    format.mHeight = 720;
+    formats.push_back(format);
+    format.mPixelformat = V4L2_PIX_FMT_MJPEG;
+    formats.push_back(format);
+    format.mWidth = 640;
+    format.mHeight = 480;
+    formats.push_back(format);
+    setFormats(formats);
+}
+
+FakeV4L2Device::~FakeV4L2Device() {
+    pthread_mutex_destroy(&mMutex);
+}
+
+void FakeV4L2Device::setFormats(std::vector<Format> const& formats) {
+    if(formats.empty()) {
+        throw std::runtime_error("At least one format is required");
+    }
+    for(uint32_t i=0; i<formats.size(); ++i) {
+        if(formats[i].mWidth == 0 || formats[i].mHeight == 0 || formats[i].mMaxFps == 0) {
+            throw std::runtime_error("Formats require a size and a frame rate");
+        }
+    }
+    pthread_mutex_lock(&mMutex);
+    if(!mBuffers.empty()) {
+        pthread_mutex_unlock(&mMutex);
+        throw std::runtime_error("Formats cannot be changed while buffers are requested");
+    }
+    mFormats = formats;
+    fillFormat(formats[0].mPixelformat, formats[0].mWidth, formats[0].mHeight, &mFormat);
+    mTimeperframe.numerator = 1;
+    mTimeperframe.denominator = formats[0].mMaxFps;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void FakeV4L2Device::setLatency(uint32_t usec) {
+    pthread_mutex_lock(&mMutex);
+    mLatency = usec;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void FakeV4L2Device::setDropInterval(uint32_t interval) {
+    pthread_mutex_lock(&mMutex);
+    mDropInterval = interval;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void FakeV4L2Device::setManualClock(bool enable) {
+    pthread_mutex_lock(&mMutex);
+    if(mStreaming) {
+        pthread_mutex_unlock(&mMutex);
+        throw std::runtime_error("The clock cannot be changed while streaming");
+    }
+    mManualClock = enable;
+    mTime = 0;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void FakeV4L2Device::advanceTime(uint32_t usec) {
+    pthread_mutex_lock(&mMutex);
+    if(!mManualClock) {
+        pthread_mutex_unlock(&mMutex);
+        throw std::runtime_error("Time can only be advanced with the manual clock");
+    }
+    mTime += usec;
+    if(mStreaming) {
+        advance(mTime);
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+uint32_t FakeV4L2Device::getNumFrames() {
+    pthread_mutex_lock(&mMutex);
+    uint32_t num = mNumFrames;
+    pthread_mutex_unlock(&mMutex);
+    return num;
+}
+
+uint32_t FakeV4L2Device::getNumDroppedFrames() {
+    pthread_mutex_lock(&mMutex);
+    if(mStreaming) {
+        advance(now());
+    }
+    uint32_t num = mNumDroppedFrames;
+    pthread_mutex_unlock(&mMutex);
+    return num;
+}
+
+LatencyHistogram FakeV4L2Device::getDequeueLatency() {
+    pthread_mutex_lock(&mMutex);
+    LatencyHistogram histogram = mDequeueLatency;
+    pthread_mutex_unlock(&mMutex);
+    return histogram;
+}
+
+int FakeV4L2Device::getFd() const {
+    return -1;
+}
+
+int FakeV4L2Device::ioctl(unsigned long request, void* arg) {
+    pthread_mutex_lock(&mMutex);
+    int ret = -1;
+    switch(request) {
+        case VIDIOC_QUERYCAP: ret = queryCapability((struct v4l2_capability*)arg); break;
+        case VIDIOC_QUERYCTRL: ret = queryControl((struct v4l2_queryctrl*)arg); break;
+        case VIDIOC_QUERYMENU: ret = queryMenu((struct v4l2_querymenu*)arg); break;
+        case VIDIOC_G_CTRL: ret = getControl((struct v4l2_control*)arg); break;
+        case VIDIOC_S_CTRL: ret = setControl((struct v4l2_control*)arg); break;
+        case VIDIOC_ENUM_FMT: ret = enumFormat((struct v4l2_fmtdesc*)arg); break;
+        case VIDIOC_G_FMT: ret = getFormat((struct v4l2_format*)arg); break;
+        case VIDIOC_S_FMT: ret = setFormat((struct v4l2_format*)arg); break;
+        case VIDIOC_G_PARM: ret = getStreamparm((struct v4l2_streamparm*)arg); break;
+        case VIDIOC_S_PARM: ret = setStreamparm((struct v4l2_streamparm*)arg); break;
+        case VIDIOC_ENUM_FRAMEINTERVALS:
+            ret = enumFrameIntervals((struct v4l2_frmivalenum*)arg);
+            break;
+        case VIDIOC_REQBUFS: ret = requestBuffers((struct v4l2_requestbuffers*)arg); break;
+        case VIDIOC_QUERYBUF: ret = queryBuffer((struct v4l2_buffer*)arg); break;
+        case VIDIOC_QBUF: ret = queueBuffer((struct v4l2_buffer*)arg); break;
+        case VIDIOC_DQBUF: ret = dequeueBuffer((struct v4l2_buffer*)arg); break;
+        case VIDIOC_STREAMON: ret = streamOn(); break;
+        case VIDIOC_STREAMOFF: ret = streamOff(); break;
+        default: errno = ENOTTY; break; // Like the kernel for unknown requests.
+    }
+    pthread_mutex_unlock(&mMutex);
+    return ret;
+}
+
+void* FakeV4L2Device::mmap(size_t length, off_t offset) {
+    pthread_mutex_lock(&mMutex);
+    void* addr = MAP_FAILED;
+    for(uint32_t i=0; i<mBuffers.size(); ++i) {
+        if(getOffset(i) == offset && length <= mBuffers[i].mData.size()) {
+            addr = mBuffers[i].mData.data();
+        }
+    }
+    pthread_mutex_unlock(&mMutex);
+    if(addr == MAP_FAILED) {
+        errno = EINVAL;
+    }
+    return addr;
+}
+
+int FakeV4L2Device::munmap(void* addr, size_t length) {
+    // The buffers live until the next VIDIOC_REQBUFS.
+    return 0;
+}
+
+int FakeV4L2Device::waitForBuffer(int32_t timeout_ms) {
+    pthread_mutex_lock(&mMutex);
+    int64_t deadline = now() + (int64_t)timeout_ms * 1000;
+    while(true) {
+        int64_t time = now();
+        if(!mStreaming) {
+            pthread_mutex_unlock(&mMutex);
+            errno = EINVAL;
+            return -1;
+        }
+        advance(time);
+        int64_t next = getNextAvailableTime();
+        if(next >= 0 && next <= time) {
+            pthread_mutex_unlock(&mMutex);
+            return 1;
+        }
+        if(time >= deadline) {
+            pthread_mutex_unlock(&mMutex);
+            return 0;
+        }
+        // Sleeps until the next frame is available or the timeout is reached.
+        int64_t wake = (next < 0 || next > deadline) ? deadline : next;
+        if(mManualClock) {
+            mTime = wake;
+            continue;
+        }
+        pthread_mutex_unlock(&mMutex);
+        struct timespec duration;
+        duration.tv_sec = (wake - time) / 1000000;
+        duration.tv_nsec = ((wake - time) % 1000000) * 1000;
+        nanosleep(&duration, NULL);
+        pthread_mutex_lock(&mMutex);
+    }
+}
+
+int FakeV4L2Device::queryCapability(struct v4l2_capability* cap) {
+    memset(cap, 0, sizeof(struct v4l2_capability));
+    snprintf((char*)cap->driver, sizeof(cap->driver), "fake_v4l2");
+    snprintf((char*)cap->card, sizeof(cap->card), "Fake V4L2 Camera");
+    snprintf((char*)cap->bus_info, sizeof(cap->bus_info), "platform:fake_v4l2");
+    cap->version = 1;
+    cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+    return 0;
+}
+
+int FakeV4L2Device::queryControl(struct v4l2_queryctrl* ctrl) {
+    struct v4l2_queryctrl const* test_ctrl = TestControls::queryControl(ctrl->id);
+    if(test_ctrl == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    *ctrl = *test_ctrl;
+    return 0;
+}
+
+int FakeV4L2Device::queryMenu(struct v4l2_querymenu* menu) {
+    struct v4l2_queryctrl const* ctrl = TestControls::queryControl(menu->id);
+    if(ctrl == NULL || ctrl->type != V4L2_CTRL_TYPE_MENU ||
+            (int32_t)menu->index < ctrl->minimum || (int32_t)menu->index > ctrl->maximum) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf((char*)menu->name, sizeof(menu->name), "%s %u", (const char*)ctrl->name,
+            menu->index);
+    return 0;
+}
+
+int FakeV4L2Device::getControl(struct v4l2_control* control) {
+    if(!mControls.getControlValue(control->id, &control->value)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int FakeV4L2Device::setControl(struct v4l2_control* control) {
+    struct v4l2_queryctrl const* ctrl = TestControls::queryControl(control->id);
+    if(ctrl == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(!mControls.isControlIdWritable(control->id)) {
+        errno = EACCES;
+        return -1;
+    }
+    if(control->value < ctrl->minimum || control->value > ctrl->maximum) {
+        errno = ERANGE;
+        return -1;
+    }
+    mControls.writeControlValue(control->id, control->value);
+    return 0;
+}
+
+int FakeV4L2Device::enumFormat(struct v4l2_fmtdesc* desc) {
+    if(desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Every pixelformat is listed once, in the order of mFormats.
+    std::vector<uint32_t> pixelformats;
+    for(uint32_t i=0; i<mFormats.size(); ++i) {
+        bool listed = false;
+        for(uint32_t j=0; j<pixelformats.size(); ++j) {
+            listed = listed || pixelformats[j] == mFormats[i].mPixelformat;
+        }
+        if(!listed) {
+            pixelformats.push_back(mFormats[i].mPixelformat);
+        }
+    }
+    if(desc->index >= pixelformats.size()) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t pixelformat = pixelformats[desc->index];
+    desc->pixelformat = pixelformat;
+    desc->flags = pixelformat == V4L2_PIX_FMT_MJPEG ? V4L2_FMT_FLAG_COMPRESSED : 0;
+    snprintf((char*)desc->description, sizeof(desc->description), "Fake %c%c%c%c",
+            pixelformat & 0xFF, (pixelformat >> 8) & 0xFF, (pixelformat >> 16) & 0xFF,
+            (pixelformat >> 24) & 0xFF);
+    return 0;
+}
+
+int FakeV4L2Device::getFormat(struct v4l2_format* format) {
+    if(format->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    format->fmt.pix = mFormat;
+    return 0;
+}
+
+int FakeV4L2Device::setFormat(struct v4l2_format* format) {
+    if(format->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(mStreaming) {
+        errno = EBUSY;
+        return -1;
+    }
+    // Like the drivers: unknown pixelformats are replaced by the first one,
+    // the size by the closest one offered.
+    uint32_t pixelformat = mFormats[0].mPixelformat;
+    for(uint32_t i=0; i<mFormats.size(); ++i) {
+        if(mFormats[i].mPixelformat == format->fmt.pix.pixelformat) {
+            pixelformat = format->fmt.pix.pixelformat;
+        }
+    }
+    Format const* best = NULL;
+    int64_t best_distance = 0;
+    for(uint32_t i=0; i<mFormats.size(); ++i) {
+        if(mFormats[i].mPixelformat != pixelformat) {
+            continue;
+        }
+        int64_t dw = (int64_t)mFormats[i].mWidth - format->fmt.pix.width;
+        int64_t dh = (int64_t)mFormats[i].mHeight - format->fmt.pix.height;
+        int64_t distance = (dw < 0 ? -dw : dw) + (dh < 0 ? -dh : dh);
+        if(best == NULL || distance < best_distance) {
+            best = &mFormats[i];
+            best_distance = distance;
+        }
+    }
+    fillFormat(best->mPixelformat, best->mWidth, best->mHeight, &mFormat);
+    // The frame rate is limited by the new format.
+    if(mTimeperframe.denominator > best->mMaxFps * mTimeperframe.numerator) {
+        mTimeperframe.numerator = 1;
+        mTimeperframe.denominator = best->mMaxFps;
+    }
+    format->fmt.pix = mFormat;
+    return 0;
+}
+
+int FakeV4L2Device::getStreamparm(struct v4l2_streamparm* parm) {
+    if(parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&parm->parm, 0, sizeof(parm->parm));
+    parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+    parm->parm.capture.timeperframe = mTimeperframe;
+    parm->parm.capture.readbuffers = mBuffers.size();
+    return 0;
+}
+
+int FakeV4L2Device::setStreamparm(struct v4l2_streamparm* parm) {
+    if(parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(mStreaming) {
+        errno = EBUSY;
+        return -1;
+    }
+    struct v4l2_fract interval = parm->parm.capture.timeperframe;
+    uint32_t max_fps = 0;
+    for(uint32_t i=0; i<mFormats.size(); ++i) {
+        if(mFormats[i].mPixelformat == mFormat.pixelformat &&
+                mFormats[i].mWidth == mFormat.width && mFormats[i].mHeight == mFormat.height) {
+            max_fps = mFormats[i].mMaxFps;
+        }
+    }
+    if(interval.numerator != 0 && interval.denominator != 0) {
+        mTimeperframe = interval;
+        if(mTimeperframe.denominator > max_fps * mTimeperframe.numerator) {
+            mTimeperframe.numerator = 1;
+            mTimeperframe.denominator = max_fps;
+        }
+    }
+    return getStreamparm(parm);
+}
+
+int FakeV4L2Device::enumFrameIntervals(struct v4l2_frmivalenum* frmival) {
+    // One discrete interval per format, its maximal frame rate.
+    if(frmival->index == 0) {
+        for(uint32_t i=0; i<mFormats.size(); ++i) {
+            if(mFormats[i].mPixelformat == frmival->pixel_format &&
+                    mFormats[i].mWidth == frmival->width &&
+                    mFormats[i].mHeight == frmival->height) {
+                frmival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+                frmival->discrete.numerator = 1;
+                frmival->discrete.denominator = mFormats[i].mMaxFps;
+                return 0;
+            }
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int FakeV4L2Device::requestBuffers(struct v4l2_requestbuffers* request) {
+    if(request->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || request->memory != V4L2_MEMORY_MMAP) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(mStreaming) {
+        errno = EBUSY;
+        return -1;
+    }
+    uint32_t count = request->count < MAX_BUFFERS ? request->count : MAX_BUFFERS;
+    mQueuedBuffers.clear();
+    mDoneBuffers.clear();
+    mBuffers.clear();
+    mBuffers.resize(count);
+    for(uint32_t i=0; i<count; ++i) {
+        mBuffers[i].mData.resize(mFormat.sizeimage);
+        mBuffers[i].mQueued = false;
+        mBuffers[i].mBytesused = 0;
+        mBuffers[i].mSequence = 0;
+        mBuffers[i].mCaptureTime = 0;
+    }
+    request->count = count;
+    return 0;
+}
+
+int FakeV4L2Device::queryBuffer(struct v4l2_buffer* buffer) {
+    if(buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buffer->index >= mBuffers.size()) {
+        errno = EINVAL;
+        return -1;
+    }
+    buffer->memory = V4L2_MEMORY_MMAP;
+    buffer->length = mBuffers[buffer->index].mData.size();
+    buffer->m.offset = getOffset(buffer->index);
+    buffer->flags = V4L2_BUF_FLAG_MAPPED | (mBuffers[buffer->index].mQueued ?
+            V4L2_BUF_FLAG_QUEUED : 0);
+    return 0;
+}
+
+int FakeV4L2Device::queueBuffer(struct v4l2_buffer* buffer) {
+    if(buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || buffer->memory != V4L2_MEMORY_MMAP ||
+            buffer->index >= mBuffers.size() || mBuffers[buffer->index].mQueued) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Frames captured before are not filled into this buffer.
+    if(mStreaming) {
+        advance(now());
+    }
+    mBuffers[buffer->index].mQueued = true;
+    mQueuedBuffers.push_back(buffer->index);
+    return 0;
+}
+
+int FakeV4L2Device::dequeueBuffer(struct v4l2_buffer* buffer) {
+    if(buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || !mStreaming) {
+        errno = EINVAL;
+        return -1;
+    }
+    int64_t time = now();
+    advance(time);
+    if(mDoneBuffers.empty() ||
+            mBuffers[mDoneBuffers.front()].mCaptureTime + mLatency > time) {
+        errno = EAGAIN; // Device is opened non-blocking.
+        return -1;
+    }
+    uint32_t index = mDoneBuffers.front();
+    mDoneBuffers.pop_front();
+    Buffer& done = mBuffers[index];
+    done.mQueued = false;
+    buffer->index = index;
+    buffer->memory = V4L2_MEMORY_MMAP;
+    buffer->bytesused = done.mBytesused;
+    buffer->length = done.mData.size();
+    buffer->m.offset = getOffset(index);
+    buffer->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_DONE |
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    buffer->field = V4L2_FIELD_NONE;
+    buffer->sequence = done.mSequence;
+    buffer->timestamp.tv_sec = done.mCaptureTime / 1000000;
+    buffer->timestamp.tv_usec = done.mCaptureTime % 1000000;
+    mNumFrames++;
+    mDequeueLatency.add(time - done.mCaptureTime);
+    return 0;
+}
+
+int FakeV4L2Device::streamOn() {
+    if(mBuffers.empty()) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(mStreaming) {
+        return 0;
+    }
+    // The images do not change, the buffers are filled once.
+    createPattern();
+    for(uint32_t i=0; i<mBuffers.size(); ++i) {
+        size_t size = mPattern.size() < mBuffers[i].mData.size() ?
+                mPattern.size() : mBuffers[i].mData.size();
+        memcpy(mBuffers[i].mData.data(), mPattern.data(), size);
+        mBuffers[i].mBytesused = size;
+    }
+    mStreaming = true;
+    mStartTime = now();
+    mNextFrame = 0;
+    mNumFrames = 0;
+    mNumDroppedFrames = 0;
+    mDequeueLatency.clear();
+    return 0;
+}
+
+int FakeV4L2Device::streamOff() {
+    // All buffers are returned to the application.
+    mStreaming = false;
+    mQueuedBuffers.clear();
+    mDoneBuffers.clear();
+    for(uint32_t i=0; i<mBuffers.size(); ++i) {
+        mBuffers[i].mQueued = false;
+    }
+    return 0;
+}
+
+void FakeV4L2Device::advance(int64_t time) {
+    int64_t period_num = (int64_t)1000000 * mTimeperframe.numerator;
+    int64_t period_den = mTimeperframe.denominator;
+    while(mStartTime + mNextFrame * period_num / period_den <= time) {
+        if(mQueuedBuffers.empty()) {
+            // Nothing to fill, all frames up to now are lost.
+            uint32_t last = (uint32_t)((time - mStartTime) * period_den / period_num);
+            if(last >= mNextFrame) {
+                mNumDroppedFrames += last + 1 - mNextFrame;
+                mNextFrame = last + 1;
+            }
+            return;
+        }
+        uint32_t sequence = mNextFrame++;
+        if(mDropInterval != 0 && (sequence + 1) % mDropInterval == 0) {
+            mNumDroppedFrames++;
+            continue;
+        }
+        uint32_t index = mQueuedBuffers.front();
+        mQueuedBuffers.pop_front();
+        mBuffers[index].mSequence = sequence;
+        mBuffers[index].mCaptureTime = mStartTime + sequence * period_num / period_den;
+        mDoneBuffers.push_back(index);
+    }
+}
+
+int64_t FakeV4L2Device::getNextAvailableTime() {
+    if(!mDoneBuffers.empty()) {
+        return mBuffers[mDoneBuffers.front()].mCaptureTime + mLatency;
+    }
+    if(!mStreaming || mQueuedBuffers.empty() || mDropInterval == 1) {
+        return -1;
+    }
+    uint32_t sequence = mNextFrame;
+    if(mDropInterval != 0 && (sequence + 1) % mDropInterval == 0) {
+        sequence++;
+    }
+    return mStartTime + (int64_t)sequence * 1000000 * mTimeperframe.numerator /
+            mTimeperframe.denominator + mLatency;
+}
+
+void FakeV4L2Device::fillFormat(uint32_t pixelformat, uint32_t width, uint32_t height,
+        struct v4l2_pix_format* pix) {
+    memset(pix, 0, sizeof(struct v4l2_pix_format));
+    pix->pixelformat = pixelformat;
+    pix->width = width;
+    pix->height = height;
+    pix->field = V4L2_FIELD_NONE;
+    pix->colorspace = V4L2_COLORSPACE_SRGB;
+    switch(pixelformat) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY: pix->bytesperline = width * 2; break;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24: pix->bytesperline = width * 3; break;
+        case V4L2_PIX_FMT_MJPEG: pix->bytesperline = 0; break;
+        default: pix->bytesperline = width; break; // GREY and 8 bit Bayer.
+    }
+    if(pixelformat == V4L2_PIX_FMT_MJPEG) {
+        pix->colorspace = V4L2_COLORSPACE_JPEG;
+        pix->sizeimage = width * height * 2; // Upper bound like UVC.
+    } else {
+        pix->sizeimage = pix->bytesperline * height;
+    }
+}
+
+void FakeV4L2Device::createPattern() {
+    uint32_t width = mFormat.width;
+    uint32_t height = mFormat.height;
+    // Horizontal luminance and vertical chrominance gradients.
+    if(mFormat.pixelformat == V4L2_PIX_FMT_YUYV || mFormat.pixelformat == V4L2_PIX_FMT_UYVY ||
+            mFormat.pixelformat == V4L2_PIX_FMT_MJPEG) {
+        bool uyvy = mFormat.pixelformat == V4L2_PIX_FMT_UYVY;
+        mPattern.resize((size_t)width * 2 * height);
+        for(uint32_t y=0; y<height; ++y) {
+            uint8_t* row = mPattern.data() + (size_t)y * width * 2;
+            uint8_t u = 16 + y * 224 / height;
+            uint8_t v = 240 - y * 224 / height;
+            for(uint32_t x=0; x<width; ++x) {
+                uint8_t luma = 16 + x * 219 / width;
+                uint8_t chroma = x % 2 == 0 ? u : v;
+                row[x * 2] = uyvy ? chroma : luma;
+                row[x * 2 + 1] = uyvy ? luma : chroma;
+            }
+        }
+        if(mFormat.pixelformat == V4L2_PIX_FMT_MJPEG) {
+            std::vector<uint8_t> jpeg;
+            JpegEncoder encoder;
+            if(!encoder.encodeYUYV(mPattern.data(), width, height,
+                    JpegEncoder::DEFAULT_QUALITY, true, jpeg)) {
+                LOG_ERROR("Test pattern could not be compressed");
+            }
+            mPattern.swap(jpeg);
+        }
+    } else {
+        mPattern.resize(mFormat.sizeimage);
+        uint32_t pixel_size = mFormat.bytesperline / width;
+        for(uint32_t y=0; y<height; ++y) {
+            uint8_t* row = mPattern.data() + (size_t)y * mFormat.bytesperline;
+            for(uint32_t x=0; x<mFormat.bytesperline; ++x) {
+                uint32_t channel = x % pixel_size;
+                row[x] = channel == 0 ? (x / pixel_size) * 255 / width :
+                        channel == 1 ? y * 255 / height : 128;
+            }
+        }
+    }
+}
+
+uint32_t FakeV4L2Device::getOffset(uint32_t index) {
+    return index * ((mFormat.sizeimage + OFFSET_ALIGNMENT - 1) / OFFSET_ALIGNMENT *
+            OFFSET_ALIGNMENT);
+}
+
+int64_t FakeV4L2Device::now() {
+    if(mManualClock) {
+        return mTime;
+    }
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+} // end namespace camera
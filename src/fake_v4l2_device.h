@@ -0,0 +1,192 @@
+/*
+ * \file    fake_v4l2_device.h
+ *
+ * \brief   In-process v4l2 camera for hardware-free tests and benchmarks of CamConfig.
+ */
+
+#ifndef _CAM_FAKE_V4L2_DEVICE_H_
+#define _CAM_FAKE_V4L2_DEVICE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "latency_tracer.h"
+#include "test_device.h"
+#include "v4l2_device.h"
+
+namespace camera
+{
+
+/**
+ * Emulates a streaming (mmap) v4l2 capture device with the ioctls used by
+ * CamConfig. The controls are the ones of TestControls, the images are
+ * static test patterns (valid JPEGs for MJPEG).
+ *
+ * Timing: After VIDIOC_STREAMON the sensor captures frame n at
+ * start + n / fps. A captured frame is filled into the oldest queued buffer
+ * and can be dequeued 'latency' usec later (the transfer of a real camera).
+ * Frames are lost if no buffer is queued at capture time (the application
+ * is too slow) or if they are dropped on purpose (setDropInterval()).
+ * The lost frames leave gaps in v4l2_buffer.sequence like a real driver.
+ * The sensor only advances when the device is accessed, no thread is used.
+ * With the manual clock (setManualClock()) the numbers of frames, drops and
+ * the latencies are exact instead of depending on the scheduling.
+ * Thread-safe.
+ */
+class FakeV4L2Device : public V4L2Device {
+ public:
+    static const uint32_t MAX_BUFFERS = 32;
+
+    struct Format {
+        uint32_t mPixelformat; // YUYV, UYVY, GREY, RGB3, BGR3 or MJPG.
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mMaxFps;
+    };
+
+    /**
+     * Offers YUYV and MJPG at 640x480 and 1280x720, 30 fps,
+     * the current format is 640x480 YUYV.
+     */
+    FakeV4L2Device();
+
+    ~FakeV4L2Device();
+
+    /**
+     * Replaces the offered formats, the first one becomes the current format.
+     * Not allowed while buffers are requested. Throws std::runtime_error if
+     * the list is empty or a format has no size or frame rate.
+     */
+    void setFormats(std::vector<Format> const& formats);
+
+    /**
+     * Transfer time from capture to the availability of the buffer.
+     */
+    void setLatency(uint32_t usec);
+
+    /**
+     * Drops every 'interval'th captured frame, 0 (default) drops nothing.
+     */
+    void setDropInterval(uint32_t interval);
+
+    /**
+     * Replaces CLOCK_MONOTONIC by a clock which starts at 0 and only advances
+     * by advanceTime() and by waitForBuffer(), which moves it to the time the
+     * next buffer is available (or the timeout) instead of sleeping.
+     * Not allowed while streaming.
+     */
+    void setManualClock(bool enable);
+
+    /**
+     * Moves the manual clock forward, e.g. to emulate a slow application.
+     */
+    void advanceTime(uint32_t usec);
+
+    /**
+     * Captured frames which have been dequeued since VIDIOC_STREAMON.
+     */
+    uint32_t getNumFrames();
+
+    /**
+     * Frames lost since VIDIOC_STREAMON, by setDropInterval() or because no
+     * buffer has been queued.
+     */
+    uint32_t getNumDroppedFrames();
+
+    /**
+     * Time from capture to VIDIOC_DQBUF of the dequeued frames.
+     */
+    LatencyHistogram getDequeueLatency();
+
+    int getFd() const;
+    int ioctl(unsigned long request, void* arg);
+    void* mmap(size_t length, off_t offset);
+    int munmap(void* addr, size_t length);
+    int waitForBuffer(int32_t timeout_ms);
+
+ private:
+    FakeV4L2Device(FakeV4L2Device const&);
+    FakeV4L2Device& operator=(FakeV4L2Device const&);
+
+    struct Buffer {
+        std::vector<uint8_t> mData;
+        bool mQueued; // Queued or done, owned by the driver.
+        uint32_t mBytesused;
+        uint32_t mSequence;
+        int64_t mCaptureTime;
+    };
+
+    // Requests of ioctl(), called with the mutex held.
+    int queryCapability(struct v4l2_capability* cap);
+    int queryControl(struct v4l2_queryctrl* ctrl);
+    int queryMenu(struct v4l2_querymenu* menu);
+    int getControl(struct v4l2_control* control);
+    int setControl(struct v4l2_control* control);
+    int enumFormat(struct v4l2_fmtdesc* desc);
+    int getFormat(struct v4l2_format* format);
+    int setFormat(struct v4l2_format* format);
+    int getStreamparm(struct v4l2_streamparm* parm);
+    int setStreamparm(struct v4l2_streamparm* parm);
+    int enumFrameIntervals(struct v4l2_frmivalenum* frmival);
+    int requestBuffers(struct v4l2_requestbuffers* request);
+    int queryBuffer(struct v4l2_buffer* buffer);
+    int queueBuffer(struct v4l2_buffer* buffer);
+    int dequeueBuffer(struct v4l2_buffer* buffer);
+    int streamOn();
+    int streamOff();
+
+    /**
+     * Captures all frames which are due at 'now'.
+     */
+    void advance(int64_t now);
+
+    /**
+     * Time at which the next frame is available, -1 if none can be captured.
+     */
+    int64_t getNextAvailableTime();
+
+    void fillFormat(uint32_t pixelformat, uint32_t width, uint32_t height,
+            struct v4l2_pix_format* pix);
+
+    /**
+     * Creates the test pattern for the current format.
+     */
+    void createPattern();
+
+    uint32_t getOffset(uint32_t index);
+
+    /**
+     * Current time in usec, called with the mutex held.
+     */
+    int64_t now();
+
+    pthread_mutex_t mMutex;
+    std::vector<Format> mFormats;
+    struct v4l2_pix_format mFormat;
+    struct v4l2_fract mTimeperframe;
+    TestControls mControls;
+    uint32_t mLatency; // usec
+    uint32_t mDropInterval;
+    bool mManualClock;
+    int64_t mTime; // usec, manual clock.
+
+    std::vector<Buffer> mBuffers;
+    std::deque<uint32_t> mQueuedBuffers; // Waiting for a frame.
+    std::deque<uint32_t> mDoneBuffers; // Filled, in the order of capture.
+    std::vector<uint8_t> mPattern;
+    bool mStreaming;
+    int64_t mStartTime; // usec
+    uint32_t mNextFrame; // Sequence number of the next capture.
+    uint32_t mNumFrames;
+    uint32_t mNumDroppedFrames;
+    LatencyHistogram mDequeueLatency;
+};
+
+} // end namespace camera
+
+#endif
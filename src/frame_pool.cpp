@@ -0,0 +1,114 @@
+#include "frame_pool.h"
+
+namespace camera
+{
+
+const unsigned int FramePool::DEFAULT_MAX_BUFFERS;
+const size_t FramePool::MIN_CAPACITY;
+
+FramePool::FramePool(unsigned int max_buffers) : mBuffers(max_buffers), mNumFree(0),
+        mNumAllocations(0) {
+    pthread_mutex_init(&mMutex, NULL);
+}
+
+FramePool::~FramePool() {
+    pthread_mutex_destroy(&mMutex);
+}
+
+void FramePool::reserve(std::vector<uint8_t>& buffer, size_t size) {
+    if(buffer.capacity() >= size) {
+        return;
+    }
+
+    pthread_mutex_lock(&mMutex);
+    int best = -1;
+    for(unsigned int i=0; i<mNumFree; ++i) {
+        size_t capacity = mBuffers[i].capacity();
+        if(capacity >= size && (best < 0 || capacity < mBuffers[best].capacity())) {
+            best = i;
+        }
+    }
+    if(best >= 0) {
+        // The too small buffer takes the place of the borrowed one.
+        buffer.swap(mBuffers[best]);
+        if(mBuffers[best].capacity() == 0) {
+            mNumFree--;
+            mBuffers[best].swap(mBuffers[mNumFree]);
+        }
+        pthread_mutex_unlock(&mMutex);
+        return;
+    }
+    keep(buffer);
+    mNumAllocations++;
+    pthread_mutex_unlock(&mMutex);
+
+    buffer.reserve(getSizeClass(size));
+}
+
+void FramePool::release(std::vector<uint8_t>& buffer) {
+    pthread_mutex_lock(&mMutex);
+    keep(buffer);
+    pthread_mutex_unlock(&mMutex);
+}
+
+void FramePool::clear() {
+    pthread_mutex_lock(&mMutex);
+    for(unsigned int i=0; i<mNumFree; ++i) {
+        std::vector<uint8_t>().swap(mBuffers[i]);
+    }
+    mNumFree = 0;
+    pthread_mutex_unlock(&mMutex);
+}
+
+size_t FramePool::getSizeClass(size_t size) {
+    if(size <= MIN_CAPACITY) {
+        return MIN_CAPACITY;
+    }
+    // Four classes within (power, 2 * power].
+    size_t power = MIN_CAPACITY;
+    while(power * 2 < size) {
+        power *= 2;
+    }
+    size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+unsigned int FramePool::getNumFreeBuffers() {
+    pthread_mutex_lock(&mMutex);
+    unsigned int num_free = mNumFree;
+    pthread_mutex_unlock(&mMutex);
+    return num_free;
+}
+
+uint64_t FramePool::getNumAllocations() {
+    pthread_mutex_lock(&mMutex);
+    uint64_t num_allocations = mNumAllocations;
+    pthread_mutex_unlock(&mMutex);
+    return num_allocations;
+}
+
+// PRIVATE
+void FramePool::keep(std::vector<uint8_t>& buffer) {
+    if(buffer.capacity() == 0) {
+        return;
+    }
+    if(mNumFree < mBuffers.size()) {
+        // Swapped with an empty placeholder.
+        buffer.swap(mBuffers[mNumFree]);
+        mNumFree++;
+        return;
+    }
+    // Full: replaces the smallest buffer if it is smaller than the new one.
+    unsigned int smallest = 0;
+    for(unsigned int i=1; i<mNumFree; ++i) {
+        if(mBuffers[i].capacity() < mBuffers[smallest].capacity()) {
+            smallest = i;
+        }
+    }
+    if(mNumFree > 0 && mBuffers[smallest].capacity() < buffer.capacity()) {
+        buffer.swap(mBuffers[smallest]);
+    }
+    std::vector<uint8_t>().swap(buffer);
+}
+
+} // end namespace camera
@@ -0,0 +1,93 @@
+/*
+ * \file    frame_pool.h
+ *
+ * \brief   Pool of preallocated image buffers which frames borrow and return.
+ */
+
+#ifndef _CAM_FRAME_POOL_H_
+#define _CAM_FRAME_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace camera
+{
+
+/**
+ * Keeps the buffers of released images to reuse them for the next images, so
+ * a steady capture does not allocate even if the image sizes vary (e.g. MJPEG).
+ * Buffers are handed over by swapping std::vectors, their capacities are
+ * rounded up to size classes (four per power of two, at least MIN_CAPACITY)
+ * which bounds the wasted memory to 25%. Thread-safe: images can be released
+ * by the consumer thread while the driver reserves the next ones.
+ */
+class FramePool {
+ public:
+    static const unsigned int DEFAULT_MAX_BUFFERS = 8;
+    static const size_t MIN_CAPACITY = 4096;
+
+    /**
+     * \param max_buffers Number of free buffers kept at most, additional
+     * released buffers are freed.
+     */
+    explicit FramePool(unsigned int max_buffers = DEFAULT_MAX_BUFFERS);
+
+    ~FramePool();
+
+    /**
+     * Ensures that 'buffer' can be resized to 'size' bytes without an allocation.
+     * If its capacity is too small it is exchanged with the smallest fitting
+     * free buffer, the old one is kept by the pool. A new buffer with the
+     * capacity of the size class is only allocated if none fits.
+     * The content of 'buffer' is undefined afterwards, its size is not changed
+     * if the capacity already suffices.
+     */
+    void reserve(std::vector<uint8_t>& buffer, size_t size);
+
+    /**
+     * Returns the buffer to the pool, 'buffer' is empty afterwards. If the pool
+     * is full the smallest buffer is freed.
+     */
+    void release(std::vector<uint8_t>& buffer);
+
+    /**
+     * Frees all buffers kept by the pool.
+     */
+    void clear();
+
+    /**
+     * Capacity used for buffers of 'size' bytes.
+     */
+    static size_t getSizeClass(size_t size);
+
+    unsigned int getNumFreeBuffers();
+
+    /**
+     * Number of buffers allocated by reserve(), stops increasing once the pool
+     * holds buffers for all image sizes in use.
+     */
+    uint64_t getNumAllocations();
+
+ private:
+    FramePool(FramePool const&);
+    FramePool& operator=(FramePool const&);
+
+    /**
+     * Keeps 'buffer' if it has a capacity, mMutex has to be locked.
+     */
+    void keep(std::vector<uint8_t>& buffer);
+
+    pthread_mutex_t mMutex;
+    // The first mNumFree entries are the free buffers, the others are
+    // empty placeholders so storing a buffer does not allocate.
+    std::vector<std::vector<uint8_t> > mBuffers;
+    unsigned int mNumFree;
+    uint64_t mNumAllocations;
+};
+
+} // end namespace camera
+
+#endif
@@ -15,32 +15,173 @@
 #define _CAM_V4L2_HELPERS_H_
 
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <linux/videodev2.h>
 
+#include <base-logging/Logging.hpp>
 #include <base/samples/Frame.hpp>
 
+#include "worker_pool.h"
+
 namespace camera 
 {
 
 class Helpers {
  public:
     /**
-     * Creates YUV2RGB lookup tables.
+     * YCbCr to RGB conversion matrices.
+     */
+    enum YuvMatrix {
+        YUV_BT601 = 0,
+        YUV_BT709 = 1
+    };
+
+    /**
+     * Limited (video) range: Y [16,235], UV [16,240]. Full range: YUV [0,255].
+     */
+    enum YuvRange {
+        YUV_RANGE_LIMITED = 0,
+        YUV_RANGE_FULL = 1
+    };
+
+    /**
+     * Fractional bits of the table entries.
+     */
+    static const int YUV_TABLE_SHIFT = 6;
+
+    /**
+     * Per-channel lookup tables of one matrix/range combination (2.5 KB).
+     * The entries are fixed point values with YUV_TABLE_SHIFT fractional bits,
+     * the rounding offset is already contained in the y table. 
+     * R = (y + v2r) >> shift, G = (y - u2g - v2g) >> shift, B = (y + u2b) >> shift
      */
-    Helpers() {
-        for(int v=0; v<256; ++v) {
-             lookup_v2r[v] = ( (v-128) * 37221 ) >> 15;
+    struct YuvTables {
+        int16_t y[256];
+        int16_t v2r[256];
+        int16_t u2g[256];
+        int16_t v2g[256];
+        int16_t u2b[256];
+    };
+
+    /**
+     * Uses BT.601 limited range, the default of most USB cameras.
+     */
+    Helpers() : mYuvTables(&getYuvTables(YUV_BT601, YUV_RANGE_LIMITED)) {
+    }
+
+    /**
+     * Returns the tables of the passed combination. All tables are created 
+     * once on first use and shared by all Helpers instances.
+     */
+    static YuvTables const& getYuvTables(YuvMatrix matrix, YuvRange range) {
+        static const YuvTables tables[2][2] = {
+            {createYuvTables(YUV_BT601, YUV_RANGE_LIMITED), createYuvTables(YUV_BT601, YUV_RANGE_FULL)},
+            {createYuvTables(YUV_BT709, YUV_RANGE_LIMITED), createYuvTables(YUV_BT709, YUV_RANGE_FULL)}
+        };
+        return tables[matrix][range];
+    }
+
+    void setYuvConversion(YuvMatrix matrix, YuvRange range) {
+        mYuvTables = &getYuvTables(matrix, range);
+    }
+
+    /**
+     * Selects matrix and range from the v4l2 colorspace (v4l2_pix_format.colorspace),
+     * using the default YCbCr encoding and quantization defined for it by v4l2.
+     */
+    void setColorspace(uint32_t v4l2_colorspace) {
+        switch(v4l2_colorspace) {
+            case V4L2_COLORSPACE_JPEG: 
+                setYuvConversion(YUV_BT601, YUV_RANGE_FULL); 
+                break;
+            case V4L2_COLORSPACE_REC709: 
+            case V4L2_COLORSPACE_SMPTE240M:
+                setYuvConversion(YUV_BT709, YUV_RANGE_LIMITED); 
+                break;
+            default: // SMPTE170M, SRGB, 470_SYSTEM_M/BG, ...
+                setYuvConversion(YUV_BT601, YUV_RANGE_LIMITED); 
+                break;
         }
-        
-        for(int u=0; u<256; ++u) {
-            for(int v=0; v<256; ++v) {
-                lookup_uv2g[u][v] = ( ((u-128) * 12975) + ((v-128) * 18949) ) >> 15;
-            }
+    }
+
+    /**
+     * Row pitch multiple of the images created by the driver: each row starts
+     * at a multiple of it relative to the start of the image. The image buffer
+     * itself (the std::vector of Frame) is only aligned by malloc(), so this
+     * is pitch padding and no guarantee about the addresses of the rows.
+     */
+    static const uint32_t DEFAULT_ROW_PADDING = 64;
+
+    /**
+     * Rounds 'row_size' up to a multiple of 'padding', 0 or 1 keeps it.
+     */
+    static uint32_t getPaddedRowSize(uint32_t row_size, uint32_t padding) {
+        if(padding <= 1) {
+            return row_size;
+        }
+        return (row_size + padding - 1) / padding * padding;
+    }
+
+    /**
+     * Copies 'rows' rows of 'row_bytes' bytes between images with different
+     * row sizes (strides), the content of the destination padding is undefined.
+     * A single memcpy() is used if both row sizes are equal.
+     */
+    static void copyRows(const uint8_t* src, uint32_t src_row_size, uint8_t* dst,
+                         uint32_t dst_row_size, uint32_t row_bytes, uint32_t rows) {
+        if(rows == 0) {
+            return;
+        }
+        if(src_row_size == dst_row_size) {
+            memcpy(dst, src, (size_t)(rows - 1) * src_row_size + row_bytes);
+            return;
         }
+        for(uint32_t row=0; row<rows; ++row) {
+            memcpy(dst + (size_t)row * dst_row_size, src + (size_t)row * src_row_size, row_bytes);
+        }
+    }
 
-        for(int u=0; u<256; ++u) {
-             lookup_u2b[u] = ((u-128) * 66883) >> 15;
+    /**
+     * Conversions of YUYV images, used if the camera does not support the
+     * requested frame mode natively but provides YUYV.
+     */
+    enum YUYVConversion {
+        YUYV_NO_CONVERSION = 0,
+        YUYV_TO_RGB,
+        YUYV_TO_BGR,
+        YUYV_TO_RGB32,
+        YUYV_TO_GRAY,
+        YUYV_TO_UYVY
+    };
+
+    /**
+     * Returns the conversion producing the passed frame mode or YUYV_NO_CONVERSION
+     * if the mode cannot be created from YUYV.
+     */
+    static YUYVConversion getYUYVConversion(base::samples::frame::frame_mode_t mode) {
+        using namespace base::samples::frame;
+        switch(mode) {
+            case MODE_RGB: return YUYV_TO_RGB;
+            case MODE_BGR: return YUYV_TO_BGR;
+            case MODE_RGB32: return YUYV_TO_RGB32;
+            case MODE_GRAYSCALE: return YUYV_TO_GRAY;
+            case MODE_UYVY: return YUYV_TO_UYVY;
+            default: return YUYV_NO_CONVERSION;
         }
+    }
 
+    /**
+     * Bytes per pixel of the conversion result.
+     */
+    static uint32_t getYUYVConversionPixelSize(YUYVConversion conversion) {
+        switch(conversion) {
+            case YUYV_TO_RGB: 
+            case YUYV_TO_BGR: return 3;
+            case YUYV_TO_RGB32: return 4;
+            case YUYV_TO_GRAY: return 1;
+            default: return 2;
+        }
     }
 
     /**
@@ -95,7 +236,7 @@ class Helpers {
         return true;
     }
     
-    uint8_t clip(int value) {
+    uint8_t clip(int value) const {
         if(value < 0)
             return 0;
         if(value > 255)
@@ -104,18 +245,12 @@ class Helpers {
     }
 
     void convertYUYVPixel(uint8_t y, uint8_t u, uint8_t v, 
-                          uint8_t& r, uint8_t& g, uint8_t& b) {
-                              
-        int y2 = (int)y;
-
-        int r2 = y2 + lookup_v2r[(int)v]; // ((v2 * 37221) >> 15);
-        int g2 = y2 - lookup_uv2g[(int)u][(int)v];  // (((u2 * 12975) + (v2 * 18949)) >> 15);
-        int b2 = y2 + lookup_u2b[(int)u];      // ((u-128) * 66883) >> 15
-
-        // Cap the values.
-        r = clip(r2);
-        g = clip(g2);
-        b = clip(b2);
+                          uint8_t& r, uint8_t& g, uint8_t& b) const {
+        YuvTables const& t = *mYuvTables;
+        int y2 = t.y[y];
+        r = clip((y2 + t.v2r[v]) >> YUV_TABLE_SHIFT);
+        g = clip((y2 - t.u2g[u] - t.v2g[v]) >> YUV_TABLE_SHIFT);
+        b = clip((y2 + t.u2b[u]) >> YUV_TABLE_SHIFT);
     }
     
     /**
@@ -128,46 +263,379 @@ class Helpers {
      */
     void convertYUYV2RGB(uint8_t* yuyv_data, 
                                 size_t yuyv_data_length, 
-                                std::vector<uint8_t>& rgb_buffer) {
+                                std::vector<uint8_t>& rgb_buffer) const {
         
         assert(yuyv_data_length%4 == 0);
         // YUYV are two bytes per pixel, RGB uses three.
         int rgb_size = (yuyv_data_length / 2) * 3;
         rgb_buffer.resize(rgb_size);
-        std::vector<uint8_t>::iterator it = rgb_buffer.begin();
-        // Piyel 1:  yuv
-        // Pixel 2: y2uv
-        uint8_t* y  = yuyv_data;
-        uint8_t* u  = y + 1;
-        uint8_t* y2 = y + 2;
-        uint8_t* v  = y + 3;
-        uint8_t r,g,b;
-        // y [16,235] uv [16,240]
-        for(unsigned int i=0; i < yuyv_data_length/4 && it != rgb_buffer.end(); ++i, y+=4, u+=4, y2+=4, v+=4) {
-            /*
-            *it = *y  + 1.403 * *v;              it++; // R 38.448 to  
-            *it = *y  - 0.344 * *u - 0.714 * *v; it++; // G
-            *it = *y  + 1.77  * *u;              it++; // B
-            *it = *y2 + 1.403 * *v;              it++; // R2
-            *it = *y2 - 0.344 * *u - 0.714 * *v; it++; // G2
-            *it = *y2 + 1.77  * *u;              it++; // B2
-            */
-            convertYUYVPixel(*y, *u, *v, r, g, b);
-            *it = r; it++;
-            *it = g; it++;
-            *it = b; it++;
-            
-            convertYUYVPixel(*y2, *u, *v, r, g, b);
-            *it = r; it++;
-            *it = g; it++;
-            *it = b; it++;
+        convertYUYV2RGBPixels(yuyv_data, rgb_buffer.data(), yuyv_data_length / 2);
+    }
+
+    /**
+     * Converts an YUYV image to RGB24. The image is split into row bands which are
+     * converted in parallel by the passed worker pool.
+     * \param width Image width in pixels, has to be even.
+     * \param pool Pool to use, if NULL the image is converted by the calling thread.
+     */
+    void convertYUYV2RGB(const uint8_t* yuyv_data, uint32_t width, uint32_t height,
+                         std::vector<uint8_t>& rgb_buffer, WorkerPool* pool) const {
+        convertYUYV(yuyv_data, width, height, YUYV_TO_RGB, rgb_buffer, pool);
+    }
+
+    /**
+     * Converts an YUYV image using the passed conversion, see convertYUYV2RGB().
+     * The buffer is resized to height * row_size.
+     * \param yuyv_row_size Bytes per source row (v4l2 bytesperline), 0 if the rows 
+     * are tightly packed.
+     * \param row_size Bytes per destination row, at least width * 
+     * getYUYVConversionPixelSize(). 0 creates tightly packed rows.
+     */
+    void convertYUYV(const uint8_t* yuyv_data, uint32_t width, uint32_t height,
+                     YUYVConversion conversion, std::vector<uint8_t>& buffer, 
+                     WorkerPool* pool, uint32_t yuyv_row_size = 0, 
+                     uint32_t row_size = 0) const {
+        assert(width%2 == 0);
+        uint32_t pixel_size = getYUYVConversionPixelSize(conversion);
+        yuyv_row_size = yuyv_row_size != 0 ? yuyv_row_size : width * 2;
+        row_size = row_size != 0 ? row_size : width * pixel_size;
+        buffer.resize((size_t)row_size * height);
+        YUYVRows rows(*this, conversion, yuyv_data, yuyv_row_size, buffer.data(), row_size, 
+                width);
+        if(pool != NULL) {
+            pool->runRowBands(height, rows);
+        } else {
+            rows(0, height);
+        }
+    }
+
+    /**
+     * Returns true if a YUYV image can be downscaled by 'factor' into 'conversion',
+     * see convertYUYVDownscaled(). UYVY is not supported.
+     */
+    static bool isDownscaleSupported(unsigned int factor, YUYVConversion conversion) {
+        return (factor == 2 || factor == 4) && conversion != YUYV_NO_CONVERSION && 
+                conversion != YUYV_TO_UYVY;
+    }
+
+    /**
+     * Converts and downscales an YUYV image by 'factor' (2 or 4) in one pass:
+     * the YUV values of each factor x factor block are averaged (box filter)
+     * and converted to a single pixel. Remaining rows and columns are dropped, 
+     * the buffer is resized to (height/factor) rows of 'row_size' bytes.
+     * \param pool Pool to use, if NULL the image is converted by the calling thread.
+     * \param yuyv_row_size, row_size See convertYUYV().
+     */
+    void convertYUYVDownscaled(const uint8_t* yuyv_data, uint32_t width, uint32_t height,
+                               unsigned int factor, YUYVConversion conversion, 
+                               std::vector<uint8_t>& buffer, WorkerPool* pool,
+                               uint32_t yuyv_row_size = 0, uint32_t row_size = 0) const {
+        assert(width%2 == 0 && isDownscaleSupported(factor, conversion));
+        yuyv_row_size = yuyv_row_size != 0 ? yuyv_row_size : width * 2;
+        row_size = row_size != 0 ? row_size : 
+                (width / factor) * getYUYVConversionPixelSize(conversion);
+        buffer.resize((size_t)row_size * (height / factor));
+        YUYVPreviewRows rows(*this, yuyv_data, yuyv_row_size, width, height, 
+                YUYV_NO_CONVERSION, NULL, 0, factor, conversion, buffer.data(), row_size);
+        if(pool != NULL) {
+            pool->runRowBands(height / factor, rows, 4);
+        } else {
+            rows(0, height / factor);
+        }
+    }
+
+    /**
+     * Converts an YUYV image like convertYUYV() and creates a preview downscaled by 
+     * 'preview_factor' like convertYUYVDownscaled() at the same time: every block 
+     * of 'preview_factor' rows is converted and averaged while it is still cached,
+     * so the source image is read from memory only once.
+     * \param yuyv_row_size, row_size, preview_row_size See convertYUYV().
+     */
+    void convertYUYV(const uint8_t* yuyv_data, uint32_t width, uint32_t height,
+                     YUYVConversion conversion, std::vector<uint8_t>& buffer, 
+                     unsigned int preview_factor, YUYVConversion preview_conversion,
+                     std::vector<uint8_t>& preview, WorkerPool* pool, 
+                     uint32_t yuyv_row_size = 0, uint32_t row_size = 0, 
+                     uint32_t preview_row_size = 0) const {
+        assert(width%2 == 0 && isDownscaleSupported(preview_factor, preview_conversion));
+        yuyv_row_size = yuyv_row_size != 0 ? yuyv_row_size : width * 2;
+        row_size = row_size != 0 ? row_size : width * getYUYVConversionPixelSize(conversion);
+        preview_row_size = preview_row_size != 0 ? preview_row_size : 
+                (width / preview_factor) * getYUYVConversionPixelSize(preview_conversion);
+        buffer.resize((size_t)row_size * height);
+        preview.resize((size_t)preview_row_size * (height / preview_factor));
+        YUYVPreviewRows rows(*this, yuyv_data, yuyv_row_size, width, height, conversion, 
+                buffer.data(), row_size, preview_factor, preview_conversion, preview.data(),
+                preview_row_size);
+        uint32_t preview_height = height / preview_factor;
+        if(pool != NULL && preview_height > 0) {
+            pool->runRowBands(preview_height, rows, 4);
+        } else {
+            rows(0, preview_height);
+        }
+    }
+
+    /**
+     * Averages 'num_pixels' blocks of FACTOR x FACTOR YUYV pixels, starting at 
+     * 'yuyv_data' with rows of 'row_size' bytes, and converts them.
+     */
+    template<int FACTOR>
+    void downscaleYUYVPixels(const uint8_t* yuyv_data, size_t row_size, uint8_t* data, 
+                             size_t num_pixels, YUYVConversion conversion) const {
+        switch(conversion) {
+            case YUYV_TO_RGB: 
+                downscaleYUYV2Pixels<FACTOR,0,2,3>(yuyv_data, row_size, data, num_pixels); 
+                break;
+            case YUYV_TO_BGR: 
+                downscaleYUYV2Pixels<FACTOR,2,0,3>(yuyv_data, row_size, data, num_pixels); 
+                break;
+            case YUYV_TO_RGB32: 
+                downscaleYUYV2Pixels<FACTOR,0,2,4>(yuyv_data, row_size, data, num_pixels); 
+                break;
+            case YUYV_TO_GRAY: 
+                downscaleYUYV2Pixels<FACTOR,0,0,1>(yuyv_data, row_size, data, num_pixels); 
+                break;
+            default: 
+                break;
+        }
+    }
+
+    /**
+     * Downscaling kernel, see convertYUYV2ColorPixels(). PIXEL_SIZE 1 creates
+     * grayscale pixels.
+     */
+    template<int FACTOR, int R, int B, int PIXEL_SIZE>
+    void downscaleYUYV2Pixels(const uint8_t* yuyv_data, size_t row_size, uint8_t* data,
+                              size_t num_pixels) const {
+        // Each block contains FACTOR^2 Ys and half as many Us and Vs.
+        const int SHIFT_Y = FACTOR == 2 ? 2 : 4;
+        YuvTables const& t = *mYuvTables;
+        for(size_t i=0; i<num_pixels; ++i, yuyv_data += FACTOR * 2, data += PIXEL_SIZE) {
+            int y = 0, u = 0, v = 0;
+            for(int row=0; row<FACTOR; ++row) {
+                const uint8_t* yuyv = yuyv_data + row * row_size;
+                for(int x=0; x<FACTOR*2; x+=4) {
+                    y += yuyv[x] + yuyv[x+2];
+                    u += yuyv[x+1];
+                    v += yuyv[x+3];
+                }
+            }
+            y = (y + (1 << (SHIFT_Y - 1))) >> SHIFT_Y;
+            if(PIXEL_SIZE == 1) {
+                data[0] = (uint8_t)y;
+                continue;
+            }
+            u = (u + (1 << (SHIFT_Y - 2))) >> (SHIFT_Y - 1);
+            v = (v + (1 << (SHIFT_Y - 2))) >> (SHIFT_Y - 1);
+            int y2 = t.y[y];
+            data[R] = clip((y2 + t.v2r[v]) >> YUV_TABLE_SHIFT);
+            data[1] = clip((y2 - t.u2g[u] - t.v2g[v]) >> YUV_TABLE_SHIFT);
+            data[B] = clip((y2 + t.u2b[u]) >> YUV_TABLE_SHIFT);
+            if(PIXEL_SIZE == 4) {
+                data[3] = 255;
+            }
+        }
+    }
+
+    /**
+     * Converts 'num_pixels' (even) tightly packed YUYV pixels.
+     */
+    void convertYUYVPixels(const uint8_t* yuyv_data, uint8_t* data, size_t num_pixels,
+                           YUYVConversion conversion) const {
+        switch(conversion) {
+            case YUYV_TO_RGB: convertYUYV2ColorPixels<0,2,3>(yuyv_data, data, num_pixels); break;
+            case YUYV_TO_BGR: convertYUYV2ColorPixels<2,0,3>(yuyv_data, data, num_pixels); break;
+            case YUYV_TO_RGB32: convertYUYV2ColorPixels<0,2,4>(yuyv_data, data, num_pixels); break;
+            case YUYV_TO_GRAY: convertYUYV2GrayPixels(yuyv_data, data, num_pixels); break;
+            case YUYV_TO_UYVY: convertYUYV2UYVYPixels(yuyv_data, data, num_pixels); break;
+            default: memcpy(data, yuyv_data, num_pixels * 2); break;
+        }
+    }
+
+    /**
+     * Converts 'num_pixels' (even) YUYV pixels to RGB24.
+     * Pixel 1: yuv
+     * Pixel 2: y2uv
+     */
+    void convertYUYV2RGBPixels(const uint8_t* yuyv_data, uint8_t* rgb_data, 
+                               size_t num_pixels) const {
+        convertYUYV2ColorPixels<0,2,3>(yuyv_data, rgb_data, num_pixels);
+    }
+
+    /**
+     * Color conversion kernel, R and B are the byte offsets of red and blue
+     * within the PIXEL_SIZE bytes of an output pixel. A fourth byte is set to 255.
+     */
+    template<int R, int B, int PIXEL_SIZE>
+    void convertYUYV2ColorPixels(const uint8_t* yuyv_data, uint8_t* data, 
+                                 size_t num_pixels) const {
+        YuvTables const& t = *mYuvTables;
+        const uint8_t* yuyv_end = yuyv_data + num_pixels * 2;
+        for(; yuyv_data < yuyv_end; yuyv_data += 4, data += 2 * PIXEL_SIZE) {
+            // U and V are shared by both pixels.
+            int r_off = t.v2r[yuyv_data[3]];
+            int g_off = -t.u2g[yuyv_data[1]] - t.v2g[yuyv_data[3]];
+            int b_off = t.u2b[yuyv_data[1]];
+            int y1 = t.y[yuyv_data[0]];
+            int y2 = t.y[yuyv_data[2]];
+            data[R] = clip((y1 + r_off) >> YUV_TABLE_SHIFT);
+            data[1] = clip((y1 + g_off) >> YUV_TABLE_SHIFT);
+            data[B] = clip((y1 + b_off) >> YUV_TABLE_SHIFT);
+            data[PIXEL_SIZE + R] = clip((y2 + r_off) >> YUV_TABLE_SHIFT);
+            data[PIXEL_SIZE + 1] = clip((y2 + g_off) >> YUV_TABLE_SHIFT);
+            data[PIXEL_SIZE + B] = clip((y2 + b_off) >> YUV_TABLE_SHIFT);
+            if(PIXEL_SIZE == 4) {
+                data[3] = 255;
+                data[7] = 255;
+            }
+        }
+    }
+
+    /**
+     * Extracts the Y channel, the luma values are copied unchanged.
+     */
+    static void convertYUYV2GrayPixels(const uint8_t* yuyv_data, uint8_t* gray_data,
+                                       size_t num_pixels) {
+        for(size_t i=0; i<num_pixels; ++i) {
+            gray_data[i] = yuyv_data[2*i];
+        }
+    }
+
+    /**
+     * Swaps the bytes of each 16 bit word: Y0 U Y1 V becomes U Y0 V Y1.
+     */
+    static void convertYUYV2UYVYPixels(const uint8_t* yuyv_data, uint8_t* uyvy_data,
+                                       size_t num_pixels) {
+        for(size_t i=0; i<num_pixels; i+=2) {
+            uint32_t word;
+            memcpy(&word, yuyv_data + 2*i, 4);
+            word = ((word & 0x00FF00FF) << 8) | ((word >> 8) & 0x00FF00FF);
+            memcpy(uyvy_data + 2*i, &word, 4);
         }
     }
 
  private:
-    int lookup_v2r[256];
-    int lookup_uv2g[256][256];
-    int lookup_u2b[256];
+    /**
+     * Converts the rows [first_row, end_row) of an YUYV image.
+     */
+    struct YUYVRows {
+        YUYVRows(Helpers const& helpers, YUYVConversion conversion, const uint8_t* yuyv_data, 
+                uint32_t yuyv_row_size, uint8_t* data, uint32_t row_size, uint32_t width) : 
+                mHelpers(helpers), mConversion(conversion), mYUYV(yuyv_data), 
+                mYUYVRowSize(yuyv_row_size), mData(data), mRowSize(row_size), mWidth(width) {}
+
+        void operator()(uint32_t first_row, uint32_t end_row) const {
+            const uint8_t* yuyv = mYUYV + (size_t)first_row * mYUYVRowSize;
+            uint8_t* data = mData + (size_t)first_row * mRowSize;
+            // Without padding the whole band is converted at once.
+            if(mYUYVRowSize == mWidth * 2 && 
+                    mRowSize == mWidth * getYUYVConversionPixelSize(mConversion)) {
+                mHelpers.convertYUYVPixels(yuyv, data, (size_t)(end_row - first_row) * mWidth, 
+                        mConversion);
+                return;
+            }
+            for(uint32_t row=first_row; row<end_row; ++row) {
+                mHelpers.convertYUYVPixels(yuyv, data, mWidth, mConversion);
+                yuyv += mYUYVRowSize;
+                data += mRowSize;
+            }
+        }
+
+        Helpers const& mHelpers;
+        YUYVConversion mConversion;
+        const uint8_t* mYUYV;
+        uint32_t mYUYVRowSize;
+        uint8_t* mData;
+        uint32_t mRowSize;
+        uint32_t mWidth;
+    };
+
+    /**
+     * Converts the preview rows [first_row, end_row) and, if 'data' is set,
+     * the corresponding full resolution rows. The last band also converts
+     * the full resolution rows which are dropped in the preview.
+     */
+    struct YUYVPreviewRows {
+        YUYVPreviewRows(Helpers const& helpers, const uint8_t* yuyv_data, 
+                uint32_t yuyv_row_size, uint32_t width, uint32_t height, 
+                YUYVConversion conversion, uint8_t* data, uint32_t row_size,
+                unsigned int preview_factor, YUYVConversion preview_conversion,
+                uint8_t* preview, uint32_t preview_row_size) : 
+                mHelpers(helpers), mYUYV(yuyv_data), mYUYVRowSize(yuyv_row_size),
+                mWidth(width), mHeight(height), mConversion(conversion), mData(data), 
+                mRowSize(row_size), mPreviewFactor(preview_factor), 
+                mPreviewConversion(preview_conversion), mPreview(preview), 
+                mPreviewRowSize(preview_row_size) {}
+
+        void operator()(uint32_t first_row, uint32_t end_row) const {
+            uint32_t preview_width = mWidth / mPreviewFactor;
+            for(uint32_t row=first_row; row<end_row; ++row) {
+                const uint8_t* yuyv = mYUYV + (size_t)row * mPreviewFactor * mYUYVRowSize;
+                if(mData != NULL) {
+                    convertRows(row * mPreviewFactor, (row + 1) * mPreviewFactor);
+                }
+                uint8_t* preview = mPreview + (size_t)row * mPreviewRowSize;
+                if(mPreviewFactor == 2) {
+                    mHelpers.downscaleYUYVPixels<2>(yuyv, mYUYVRowSize, preview, preview_width,
+                            mPreviewConversion);
+                } else {
+                    mHelpers.downscaleYUYVPixels<4>(yuyv, mYUYVRowSize, preview, preview_width,
+                            mPreviewConversion);
+                }
+            }
+            uint32_t preview_height = mHeight / mPreviewFactor;
+            if(mData != NULL && end_row == preview_height) {
+                convertRows(preview_height * mPreviewFactor, mHeight);
+            }
+        }
+
+        void convertRows(uint32_t first_row, uint32_t end_row) const {
+            for(uint32_t row=first_row; row<end_row; ++row) {
+                mHelpers.convertYUYVPixels(mYUYV + (size_t)row * mYUYVRowSize, 
+                        mData + (size_t)row * mRowSize, mWidth, mConversion);
+            }
+        }
+
+        Helpers const& mHelpers;
+        const uint8_t* mYUYV;
+        uint32_t mYUYVRowSize;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        YUYVConversion mConversion;
+        uint8_t* mData;
+        uint32_t mRowSize;
+        unsigned int mPreviewFactor;
+        YUYVConversion mPreviewConversion;
+        uint8_t* mPreview;
+        uint32_t mPreviewRowSize;
+    };
+
+    static int16_t toFixedPoint(double value) {
+        return (int16_t)floor(value * (1 << YUV_TABLE_SHIFT) + 0.5);
+    }
+
+    static YuvTables createYuvTables(YuvMatrix matrix, YuvRange range) {
+        // Luma weights of red and blue.
+        double kr = matrix == YUV_BT709 ? 0.2126 : 0.299;
+        double kb = matrix == YUV_BT709 ? 0.0722 : 0.114;
+        double kg = 1.0 - kr - kb;
+        double y_scale = range == YUV_RANGE_FULL ? 1.0 : 255.0 / 219.0;
+        double y_offset = range == YUV_RANGE_FULL ? 0.0 : 16.0;
+        double c_scale = range == YUV_RANGE_FULL ? 1.0 : 255.0 / 224.0;
+
+        YuvTables t;
+        for(int i=0; i<256; ++i) {
+            double c = (i - 128) * c_scale;
+            t.y[i] = toFixedPoint((i - y_offset) * y_scale + 0.5); // +0.5: rounding.
+            t.v2r[i] = toFixedPoint(2.0 * (1.0 - kr) * c);
+            t.u2g[i] = toFixedPoint(2.0 * kb * (1.0 - kb) / kg * c);
+            t.v2g[i] = toFixedPoint(2.0 * kr * (1.0 - kr) / kg * c);
+            t.u2b[i] = toFixedPoint(2.0 * (1.0 - kb) * c);
+        }
+        return t;
+    }
+
+    YuvTables const* mYuvTables; // Not owned, see getYuvTables().
 };
 
 } // end namespace camera
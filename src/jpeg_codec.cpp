@@ -0,0 +1,513 @@
+#include "jpeg_codec.h"
+
+#include <string.h>
+
+#include <base-logging/Logging.hpp>
+
+#include "helpers.h"
+
+namespace camera
+{
+
+// Standard huffman tables of the JPEG specification (K.3), stored as a
+// complete DHT segment: luminance DC/AC and chrominance DC/AC.
+static const uint8_t STANDARD_DHT_SEGMENT[] = {
+    0xFF, 0xC4, 0x01, 0xA2,
+    // Luminance DC.
+    0x00,
+    0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // Luminance AC.
+    0x10,
+    0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7D,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+    // Chrominance DC.
+    0x01,
+    0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+    // Chrominance AC.
+    0x11,
+    0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA
+};
+
+/**
+ * Returns the offset of the start of scan marker (FF DA) or 'size' if the
+ * headers could not be parsed. Sets 'has_dht' if a DHT segment has been passed.
+ */
+static size_t findStartOfScan(const uint8_t* jpeg, size_t size, bool* has_dht) {
+    *has_dht = false;
+    if(size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        return size;
+    }
+    size_t pos = 2;
+    while(pos + 4 <= size) {
+        if(jpeg[pos] != 0xFF) {
+            return size;
+        }
+        uint8_t marker = jpeg[pos+1];
+        if(marker == 0xFF) { // Fill byte.
+            pos++;
+            continue;
+        }
+        if(marker == 0xDA) {
+            return pos;
+        }
+        if(marker == 0xC4) {
+            *has_dht = true;
+        }
+        pos += 2 + (jpeg[pos+2] << 8 | jpeg[pos+3]);
+    }
+    return size;
+}
+
+// JPEGERRORMANAGER
+struct jpeg_error_mgr* JpegErrorManager::init(const char* name) {
+    mName = name;
+    jpeg_std_error(&mPub);
+    mPub.error_exit = errorExit;
+    mPub.output_message = outputMessage;
+    return &mPub;
+}
+
+void JpegErrorManager::errorExit(j_common_ptr info) {
+    (*info->err->output_message)(info);
+    JpegErrorManager* error = (JpegErrorManager*)info->err;
+    longjmp(error->mSetjmpBuffer, 1);
+}
+
+void JpegErrorManager::outputMessage(j_common_ptr info) {
+    char buffer[JMSG_LENGTH_MAX];
+    (*info->err->format_message)(info, buffer);
+    LOG_DEBUG("%s: %s", ((JpegErrorManager*)info->err)->mName, buffer);
+}
+
+// JPEGDECODER
+JpegDecoder::JpegDecoder() : mInfo(), mError(), mRows() {
+    mInfo.err = mError.init("JpegDecoder");
+    jpeg_create_decompress(&mInfo);
+}
+
+JpegDecoder::~JpegDecoder() {
+    jpeg_destroy_decompress(&mInfo);
+}
+
+bool JpegDecoder::isOutputModeSupported(base::samples::frame::frame_mode_t mode) {
+    using namespace base::samples::frame;
+    return mode == MODE_RGB || mode == MODE_BGR || mode == MODE_GRAYSCALE;
+}
+
+unsigned int JpegDecoder::getScaleDenom(uint32_t width, uint32_t height,
+        uint32_t requested_width, uint32_t requested_height) {
+    if(requested_width == 0 || requested_height == 0) {
+        return 1;
+    }
+    unsigned int scale_denom = 8;
+    for(; scale_denom > 1; scale_denom /= 2) {
+        uint32_t scaled_width = 0, scaled_height = 0;
+        getScaledSize(width, height, scale_denom, &scaled_width, &scaled_height);
+        if(scaled_width >= requested_width && scaled_height >= requested_height) {
+            break;
+        }
+    }
+    return scale_denom;
+}
+
+void JpegDecoder::getScaledSize(uint32_t width, uint32_t height, unsigned int scale_denom,
+        uint32_t* scaled_width, uint32_t* scaled_height) {
+    // Rounds up like libjpeg.
+    *scaled_width = (width + scale_denom - 1) / scale_denom;
+    *scaled_height = (height + scale_denom - 1) / scale_denom;
+}
+
+bool JpegDecoder::hasHuffmanTables(const uint8_t* jpeg, size_t size) {
+    bool has_dht = false;
+    findStartOfScan(jpeg, size, &has_dht);
+    return has_dht;
+}
+
+size_t JpegDecoder::getHuffmanTablesSize() {
+    return sizeof(STANDARD_DHT_SEGMENT);
+}
+
+void JpegDecoder::insertHuffmanTables(const uint8_t* jpeg, size_t size, std::vector<uint8_t>& out) {
+    bool has_dht = false;
+    size_t sos = findStartOfScan(jpeg, size, &has_dht);
+    if(sos >= size) {
+        // Invalid, passed unchanged to the decoder which reports the error.
+        out.assign(jpeg, jpeg + size);
+        return;
+    }
+    out.resize(size + sizeof(STANDARD_DHT_SEGMENT));
+    memcpy(out.data(), jpeg, sos);
+    memcpy(out.data() + sos, STANDARD_DHT_SEGMENT, sizeof(STANDARD_DHT_SEGMENT));
+    memcpy(out.data() + sos + sizeof(STANDARD_DHT_SEGMENT), jpeg + sos, size - sos);
+}
+
+bool JpegDecoder::decode(const uint8_t* jpeg, size_t size, base::samples::frame::frame_mode_t mode,
+        unsigned int scale_denom, std::vector<uint8_t>& image, uint32_t* width, uint32_t* height,
+        uint32_t row_padding) {
+    using namespace base::samples::frame;
+
+    if(!isOutputModeSupported(mode)) {
+        LOG_ERROR("JpegDecoder: output mode %d is not supported", mode);
+        return false;
+    }
+
+    if(setjmp(mError.mSetjmpBuffer)) {
+        // Returns from JpegErrorManager::errorExit().
+        jpeg_abort_decompress(&mInfo);
+        return false;
+    }
+
+    jpeg_mem_src(&mInfo, (unsigned char*)jpeg, size);
+    jpeg_read_header(&mInfo, TRUE);
+
+    mInfo.scale_num = 1;
+    mInfo.scale_denom = scale_denom;
+    switch(mode) {
+        case MODE_GRAYSCALE: mInfo.out_color_space = JCS_GRAYSCALE; break;
+#ifdef JCS_EXTENSIONS
+        case MODE_BGR: mInfo.out_color_space = JCS_EXT_BGR; break;
+#endif
+        default: mInfo.out_color_space = JCS_RGB; break;
+    }
+
+    jpeg_start_decompress(&mInfo);
+
+    size_t row_size = Helpers::getPaddedRowSize(mInfo.output_width * mInfo.output_components,
+            row_padding);
+    image.resize(row_size * mInfo.output_height);
+    mRows.resize(mInfo.output_height);
+    for(unsigned int i=0; i<mInfo.output_height; ++i) {
+        mRows[i] = image.data() + i * row_size;
+    }
+    while(mInfo.output_scanline < mInfo.output_height) {
+        jpeg_read_scanlines(&mInfo, &mRows[mInfo.output_scanline],
+                mInfo.output_height - mInfo.output_scanline);
+    }
+
+#ifndef JCS_EXTENSIONS
+    if(mode == MODE_BGR) {
+        for(unsigned int row=0; row<mInfo.output_height; ++row) {
+            uint8_t* pixel = mRows[row];
+            for(unsigned int x=0; x<mInfo.output_width; ++x, pixel+=3) {
+                uint8_t tmp = pixel[0];
+                pixel[0] = pixel[2];
+                pixel[2] = tmp;
+            }
+        }
+    }
+#endif
+
+    *width = mInfo.output_width;
+    *height = mInfo.output_height;
+    jpeg_finish_decompress(&mInfo);
+    return true;
+}
+
+// JPEGENCODER
+JpegEncoder::JpegEncoder() : mInfo(), mError(), mDestination() {
+    mInfo.err = mError.init("JpegEncoder");
+    jpeg_create_compress(&mInfo);
+
+    mDestination.mPub.init_destination = Destination::initDestination;
+    mDestination.mPub.empty_output_buffer = Destination::emptyOutputBuffer;
+    mDestination.mPub.term_destination = Destination::termDestination;
+    mDestination.mBuffer = NULL;
+    mInfo.dest = &mDestination.mPub;
+
+    for(int i=0; i<256; ++i) {
+        int y = ((i - 16) * 255 + 219 / 2) / 219;
+        int c = ((i - 128) * 255 + (i < 128 ? -112 : 112)) / 224 + 128;
+        mLutY[i] = y < 0 ? 0 : (y > 255 ? 255 : y);
+        mLutC[i] = c < 0 ? 0 : (c > 255 ? 255 : c);
+    }
+    for(int p=0; p<3; ++p) {
+        mPlaneWidth[p] = 0;
+    }
+}
+
+JpegEncoder::~JpegEncoder() {
+    jpeg_destroy_compress(&mInfo);
+}
+
+bool JpegEncoder::encodeYUYV(const uint8_t* yuyv, uint32_t width, uint32_t height, int quality,
+        bool limited_range, std::vector<uint8_t>& jpeg, uint32_t yuyv_row_size) {
+    if(width % 2 != 0 || width == 0 || height == 0) {
+        LOG_ERROR("JpegEncoder: invalid YUYV image size %dx%d", width, height);
+        return false;
+    }
+
+    // An MCU of 4:2:2 data covers 16x8 pixels: Y 2x1 blocks, U and V one block each.
+    uint32_t padded_width = (width + 2 * DCTSIZE - 1) / (2 * DCTSIZE) * (2 * DCTSIZE);
+    mPlaneWidth[0] = padded_width;
+    mPlaneWidth[1] = mPlaneWidth[2] = padded_width / 2;
+    for(int p=0; p<3; ++p) {
+        mPlanes[p].resize(mPlaneWidth[p] * DCTSIZE);
+        for(int row=0; row<DCTSIZE; ++row) {
+            mRows[p][row] = mPlanes[p].data() + row * mPlaneWidth[p];
+        }
+    }
+    const uint8_t* lut_y = limited_range ? mLutY : NULL;
+    const uint8_t* lut_c = limited_range ? mLutC : NULL;
+
+    if(setjmp(mError.mSetjmpBuffer)) {
+        // Returns from JpegErrorManager::errorExit().
+        jpeg_abort_compress(&mInfo);
+        return false;
+    }
+
+    mDestination.mBuffer = &jpeg;
+    mInfo.image_width = width;
+    mInfo.image_height = height;
+    mInfo.input_components = 3;
+    mInfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&mInfo);
+    jpeg_set_colorspace(&mInfo, JCS_YCbCr);
+    jpeg_set_quality(&mInfo, quality, TRUE);
+    mInfo.raw_data_in = TRUE;
+    mInfo.comp_info[0].h_samp_factor = 2;
+    mInfo.comp_info[0].v_samp_factor = 1;
+    for(int c=1; c<3; ++c) {
+        mInfo.comp_info[c].h_samp_factor = 1;
+        mInfo.comp_info[c].v_samp_factor = 1;
+    }
+
+    jpeg_start_compress(&mInfo, TRUE);
+    JSAMPARRAY planes[3] = {mRows[0], mRows[1], mRows[2]};
+    while(mInfo.next_scanline < mInfo.image_height) {
+        fillPlanes(yuyv, width, height, yuyv_row_size != 0 ? yuyv_row_size : width * 2,
+                mInfo.next_scanline, lut_y, lut_c);
+        jpeg_write_raw_data(&mInfo, planes, DCTSIZE);
+    }
+    jpeg_finish_compress(&mInfo);
+    return true;
+}
+
+// PRIVATE
+void JpegEncoder::Destination::initDestination(j_compress_ptr info) {
+    Destination* dest = (Destination*)info->dest;
+    std::vector<uint8_t>& buffer = *dest->mBuffer;
+    // Uses the whole capacity of the previous image.
+    buffer.resize(buffer.capacity() > 65536 ? buffer.capacity() : 65536);
+    dest->mPub.next_output_byte = buffer.data();
+    dest->mPub.free_in_buffer = buffer.size();
+}
+
+boolean JpegEncoder::Destination::emptyOutputBuffer(j_compress_ptr info) {
+    Destination* dest = (Destination*)info->dest;
+    std::vector<uint8_t>& buffer = *dest->mBuffer;
+    // Called if the buffer is full (free_in_buffer is ignored).
+    size_t used = buffer.size();
+    buffer.resize(used * 2);
+    dest->mPub.next_output_byte = buffer.data() + used;
+    dest->mPub.free_in_buffer = buffer.size() - used;
+    return TRUE;
+}
+
+void JpegEncoder::Destination::termDestination(j_compress_ptr info) {
+    Destination* dest = (Destination*)info->dest;
+    dest->mBuffer->resize(dest->mBuffer->size() - dest->mPub.free_in_buffer);
+}
+
+void JpegEncoder::fillPlanes(const uint8_t* yuyv, uint32_t width, uint32_t height, 
+        uint32_t yuyv_row_size, uint32_t first_row, const uint8_t* lut_y, 
+        const uint8_t* lut_c) {
+    for(uint32_t row=0; row<DCTSIZE; ++row) {
+        uint32_t src_row = first_row + row < height ? first_row + row : height - 1;
+        const uint8_t* src = yuyv + (size_t)src_row * yuyv_row_size;
+        uint8_t* y = mRows[0][row];
+        uint8_t* u = mRows[1][row];
+        uint8_t* v = mRows[2][row];
+        if(lut_y != NULL) {
+            for(uint32_t x=0; x<width/2; ++x, src+=4) {
+                y[2*x] = lut_y[src[0]];
+                y[2*x+1] = lut_y[src[2]];
+                u[x] = lut_c[src[1]];
+                v[x] = lut_c[src[3]];
+            }
+        } else {
+            for(uint32_t x=0; x<width/2; ++x, src+=4) {
+                y[2*x] = src[0];
+                y[2*x+1] = src[2];
+                u[x] = src[1];
+                v[x] = src[3];
+            }
+        }
+        for(uint32_t x=width; x<mPlaneWidth[0]; ++x) {
+            y[x] = y[width-1];
+        }
+        for(uint32_t x=width/2; x<mPlaneWidth[1]; ++x) {
+            u[x] = u[width/2-1];
+            v[x] = v[width/2-1];
+        }
+    }
+}
+
+// JPEGPIPELINE
+JpegPipeline::JpegPipeline(WorkerPool* pool, const char* name) : mPool(pool), mName(name),
+        mSlots(), mFirst(0), mNumPending(0) {
+    pthread_mutex_init(&mMutex, NULL);
+    pthread_cond_init(&mCondDone, NULL);
+}
+
+JpegPipeline::~JpegPipeline() {
+    for(unsigned int i=0; i<mSlots.size(); ++i) {
+        waitFor(mSlots[i]);
+        delete mSlots[i];
+    }
+    mSlots.clear();
+    pthread_cond_destroy(&mCondDone);
+    pthread_mutex_destroy(&mMutex);
+}
+
+bool JpegPipeline::push(const uint8_t* data, size_t size) {
+    if(mNumPending >= mSlots.size()) {
+        LOG_WARN("%s: %d images pending, pop one first", mName, mNumPending);
+        return false;
+    }
+    Slot* slot = mSlots[(mFirst + mNumPending) % mSlots.size()];
+    slot->setInput(data, size);
+    pthread_mutex_lock(&mMutex);
+    slot->mDone = false;
+    pthread_mutex_unlock(&mMutex);
+    mNumPending++;
+
+    if(mPool != NULL) {
+        mPool->post(slot);
+    } else {
+        slot->execute();
+    }
+    return true;
+}
+
+bool JpegPipeline::pop(std::vector<uint8_t>& image, uint32_t* width, uint32_t* height) {
+    if(mNumPending == 0) {
+        return false;
+    }
+    Slot* slot = mSlots[mFirst];
+    waitFor(slot);
+    mFirst = (mFirst + 1) % mSlots.size();
+    mNumPending--;
+
+    if(!slot->mSuccess) {
+        LOG_WARN("%s: image could not be processed", mName);
+        return false;
+    }
+    // The previous buffer of the caller is reused for the next image.
+    image.swap(slot->mOutput);
+    *width = slot->mWidth;
+    *height = slot->mHeight;
+    return true;
+}
+
+// PROTECTED
+void JpegPipeline::Slot::execute() {
+    bool success = process();
+    pthread_mutex_lock(&mPipeline->mMutex);
+    mSuccess = success;
+    mDone = true;
+    pthread_cond_broadcast(&mPipeline->mCondDone);
+    pthread_mutex_unlock(&mPipeline->mMutex);
+}
+
+unsigned int JpegPipeline::getNumSlotsRequired() const {
+    if(mPool != NULL && mPool->getNumThreads() > 1) {
+        return mPool->getNumThreads();
+    }
+    return 1;
+}
+
+void JpegPipeline::addSlot(Slot* slot) {
+    slot->mPipeline = this;
+    mSlots.push_back(slot);
+}
+
+// PRIVATE
+void JpegPipeline::waitFor(Slot* slot) {
+    pthread_mutex_lock(&mMutex);
+    while(!slot->mDone) {
+        pthread_cond_wait(&mCondDone, &mMutex);
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+// JPEGDECODEPIPELINE
+JpegDecodePipeline::JpegDecodePipeline(WorkerPool* pool, base::samples::frame::frame_mode_t mode,
+        unsigned int scale_denom, uint32_t row_padding) : 
+        JpegPipeline(pool, "JpegDecodePipeline") {
+    unsigned int depth = getNumSlotsRequired();
+    for(unsigned int i=0; i<depth; ++i) {
+        addSlot(new DecodeSlot(mode, scale_denom, row_padding));
+    }
+    LOG_DEBUG("JpegDecodePipeline: %d images in flight, scale 1/%d", depth, scale_denom);
+}
+
+void JpegDecodePipeline::DecodeSlot::setInput(const uint8_t* data, size_t size) {
+    if(JpegDecoder::hasHuffmanTables(data, size)) {
+        mJpeg.assign(data, data + size);
+    } else {
+        JpegDecoder::insertHuffmanTables(data, size, mJpeg);
+    }
+}
+
+bool JpegDecodePipeline::DecodeSlot::process() {
+    return mDecoder.decode(mJpeg.data(), mJpeg.size(), mMode, mScaleDenom, mOutput, 
+            &mWidth, &mHeight, mRowPadding);
+}
+
+// JPEGENCODEPIPELINE
+JpegEncodePipeline::JpegEncodePipeline(WorkerPool* pool, uint32_t width, uint32_t height, 
+        int quality, bool limited_range, uint32_t yuyv_row_size) : 
+        JpegPipeline(pool, "JpegEncodePipeline") {
+    unsigned int depth = getNumSlotsRequired();
+    for(unsigned int i=0; i<depth; ++i) {
+        addSlot(new EncodeSlot(width, height, quality, limited_range, yuyv_row_size));
+    }
+    LOG_DEBUG("JpegEncodePipeline: %d images in flight, quality %d", depth, quality);
+}
+
+void JpegEncodePipeline::EncodeSlot::setInput(const uint8_t* data, size_t size) {
+    // The padding of the last row may be missing.
+    size_t image_size = (size_t)mYUYVRowSize * (mImageHeight - 1) + mImageWidth * 2;
+    if(size < image_size) {
+        LOG_WARN("JpegEncodePipeline: %lu bytes received, %lu expected", 
+                (unsigned long)size, (unsigned long)image_size);
+        mYUYV.clear();
+        return;
+    }
+    mYUYV.assign(data, data + image_size);
+}
+
+bool JpegEncodePipeline::EncodeSlot::process() {
+    if(mYUYV.empty()) {
+        return false;
+    }
+    mWidth = mImageWidth;
+    mHeight = mImageHeight;
+    return mEncoder.encodeYUYV(mYUYV.data(), mImageWidth, mImageHeight, mQuality, 
+            mLimitedRange, mOutput, mYUYVRowSize);
+}
+
+} // end namespace camera
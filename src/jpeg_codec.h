@@ -0,0 +1,321 @@
+/*
+ * \file    jpeg_codec.h
+ *
+ * \brief   JPEG decoding and encoding using libjpeg(-turbo).
+ */
+
+#ifndef _CAM_JPEG_CODEC_H_
+#define _CAM_JPEG_CODEC_H_
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include <jpeglib.h>
+
+#include <base/samples/Frame.hpp>
+
+#include "worker_pool.h"
+
+namespace camera
+{
+
+/**
+ * Reports the libjpeg errors: libjpeg calls error_exit() on fatal errors,
+ * which must not return. We jump back into the codec instead of exiting the process.
+ */
+struct JpegErrorManager {
+    struct jpeg_error_mgr mPub;
+    jmp_buf mSetjmpBuffer;
+
+    /**
+     * Installs the handlers, 'name' is used in the log messages.
+     */
+    struct jpeg_error_mgr* init(const char* name);
+
+    static void errorExit(j_common_ptr info);
+    static void outputMessage(j_common_ptr info);
+
+    const char* mName;
+};
+
+/**
+ * Decodes JPEG images (e.g. the frames of MJPEG cameras) to RGB, BGR or
+ * grayscale. Uses the SIMD decoder if libjpeg-turbo is installed.
+ * An instance must not be used by several threads at the same time.
+ */
+class JpegDecoder {
+ public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    /**
+     * Returns true if the mode is supported as output of decode().
+     */
+    static bool isOutputModeSupported(base::samples::frame::frame_mode_t mode);
+
+    /**
+     * Returns the largest of the libjpeg scaling denominators 1, 2, 4 and 8
+     * which keeps the decoded image at least as large as the requested one.
+     * If no size is requested (0) the image will not be scaled.
+     */
+    static unsigned int getScaleDenom(uint32_t width, uint32_t height,
+            uint32_t requested_width, uint32_t requested_height);
+
+    /**
+     * Size of the image decoded with 'scale_denom'.
+     */
+    static void getScaledSize(uint32_t width, uint32_t height, unsigned int scale_denom,
+            uint32_t* scaled_width, uint32_t* scaled_height);
+
+    /**
+     * Many UVC cameras send MJPEG frames without the huffman tables (DHT segment),
+     * expecting the standard tables of the JPEG specification (K.3).
+     * Returns false if no DHT segment is found before the start of scan.
+     */
+    static bool hasHuffmanTables(const uint8_t* jpeg, size_t size);
+
+    /**
+     * Copies the image to 'out' and inserts the standard huffman tables in front
+     * of the start of scan.
+     */
+    static void insertHuffmanTables(const uint8_t* jpeg, size_t size, std::vector<uint8_t>& out);
+
+    /**
+     * Bytes added by insertHuffmanTables().
+     */
+    static size_t getHuffmanTablesSize();
+
+    /**
+     * Decodes the image into 'image' which is resized if required.
+     * \param mode MODE_RGB, MODE_BGR or MODE_GRAYSCALE.
+     * \param scale_denom 1, 2, 4 or 8, the image is downscaled during decoding.
+     * \param row_padding The rows of 'image' are padded to a multiple of it,
+     * see Helpers::getPaddedRowSize().
+     * \return false if the image could not be decoded.
+     */
+    bool decode(const uint8_t* jpeg, size_t size, base::samples::frame::frame_mode_t mode,
+            unsigned int scale_denom, std::vector<uint8_t>& image,
+            uint32_t* width, uint32_t* height, uint32_t row_padding = 1);
+
+ private:
+    JpegDecoder(JpegDecoder const&);
+    JpegDecoder& operator=(JpegDecoder const&);
+
+    struct jpeg_decompress_struct mInfo;
+    JpegErrorManager mError;
+    std::vector<JSAMPROW> mRows;
+};
+
+/**
+ * Compresses YUYV images to JPEG without an RGB intermediate: the Y, U and V
+ * planes are passed to libjpeg as raw 4:2:2 data, so the color conversion and 
+ * the chroma downsampling of the encoder are skipped.
+ * An instance must not be used by several threads at the same time.
+ */
+class JpegEncoder {
+ public:
+    static const int DEFAULT_QUALITY = 85; // 0 to 100
+
+    JpegEncoder();
+    ~JpegEncoder();
+
+    /**
+     * \param width Has to be even.
+     * \param quality 0 to 100.
+     * \param limited_range If set the video range values of the camera
+     * (Y [16,235], UV [16,240]) are expanded to the full range expected by JFIF.
+     * \param jpeg Receives the image, its capacity is reused.
+     * \param yuyv_row_size Bytes per row (v4l2 bytesperline), 0 if the rows are not padded.
+     * \return false if the image could not be compressed.
+     */
+    bool encodeYUYV(const uint8_t* yuyv, uint32_t width, uint32_t height, int quality,
+            bool limited_range, std::vector<uint8_t>& jpeg, uint32_t yuyv_row_size = 0);
+
+ private:
+    /**
+     * Lets libjpeg write directly into a std::vector.
+     */
+    struct Destination {
+        struct jpeg_destination_mgr mPub;
+        std::vector<uint8_t>* mBuffer;
+
+        static void initDestination(j_compress_ptr info);
+        static boolean emptyOutputBuffer(j_compress_ptr info);
+        static void termDestination(j_compress_ptr info);
+    };
+
+    JpegEncoder(JpegEncoder const&);
+    JpegEncoder& operator=(JpegEncoder const&);
+
+    /**
+     * Splits DCTSIZE rows starting at 'first_row' into the planes, the image
+     * is padded to whole MCUs by repeating the last row and column.
+     */
+    void fillPlanes(const uint8_t* yuyv, uint32_t width, uint32_t height, 
+            uint32_t yuyv_row_size, uint32_t first_row, const uint8_t* lut_y, 
+            const uint8_t* lut_c);
+
+    struct jpeg_compress_struct mInfo;
+    JpegErrorManager mError;
+    Destination mDestination;
+    std::vector<uint8_t> mPlanes[3];
+    JSAMPROW mRows[3][DCTSIZE];
+    uint32_t mPlaneWidth[3];
+    uint8_t mLutY[256]; // Limited to full range.
+    uint8_t mLutC[256];
+};
+
+/**
+ * Processes a stream of images on a worker pool. Up to getDepth() images
+ * are processed in parallel while the next ones are captured, the results
+ * are returned in the order in which the images have been pushed.
+ */
+class JpegPipeline {
+ public:
+    /**
+     * Waits for the running jobs.
+     */
+    virtual ~JpegPipeline();
+
+    inline unsigned int getDepth() const {
+        return mSlots.size();
+    }
+
+    inline unsigned int getNumPending() const {
+        return mNumPending;
+    }
+
+    /**
+     * Copies the image and starts processing it.
+     * \return false if already getDepth() images are pending.
+     */
+    bool push(const uint8_t* data, size_t size);
+
+    /**
+     * Waits for the oldest pending image and swaps the result into 'image'.
+     * \return false if no image is pending or the image could not be processed.
+     */
+    bool pop(std::vector<uint8_t>& image, uint32_t* width, uint32_t* height);
+
+ protected:
+    struct Slot : public WorkerPool::Task {
+        Slot() : mPipeline(NULL), mOutput(), mWidth(0), mHeight(0), mDone(true), 
+                mSuccess(false) {}
+        virtual ~Slot() {}
+
+        /**
+         * Copies the input, called by the capturing thread.
+         */
+        virtual void setInput(const uint8_t* data, size_t size) = 0;
+
+        /**
+         * Fills mOutput, mWidth and mHeight, called by a worker.
+         */
+        virtual bool process() = 0;
+
+        void execute();
+
+        JpegPipeline* mPipeline;
+        std::vector<uint8_t> mOutput;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        bool mDone;
+        bool mSuccess;
+    };
+
+    /**
+     * \param pool Used for processing, NULL processes within push().
+     * The pool is not owned and has to outlive the pipeline.
+     */
+    JpegPipeline(WorkerPool* pool, const char* name);
+
+    /**
+     * One slot per worker, so the derived pipelines create the slots 
+     * within their constructors.
+     */
+    unsigned int getNumSlotsRequired() const;
+
+    /**
+     * Takes the ownership.
+     */
+    void addSlot(Slot* slot);
+
+ private:
+    JpegPipeline(JpegPipeline const&);
+    JpegPipeline& operator=(JpegPipeline const&);
+
+    void waitFor(Slot* slot);
+
+    WorkerPool* mPool;
+    const char* mName;
+    std::vector<Slot*> mSlots;
+    unsigned int mFirst; // Oldest pending slot.
+    unsigned int mNumPending;
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCondDone;
+};
+
+/**
+ * Decodes a stream of (MJPEG) images, missing huffman tables are added.
+ */
+class JpegDecodePipeline : public JpegPipeline {
+ public:
+    /**
+     * \param mode, row_padding Output mode and row padding, see JpegDecoder::decode().
+     */
+    JpegDecodePipeline(WorkerPool* pool, base::samples::frame::frame_mode_t mode,
+            unsigned int scale_denom, uint32_t row_padding = 1);
+
+ private:
+    struct DecodeSlot : public Slot {
+        DecodeSlot(base::samples::frame::frame_mode_t mode, unsigned int scale_denom,
+                uint32_t row_padding) : mDecoder(), mJpeg(), mMode(mode), 
+                mScaleDenom(scale_denom), mRowPadding(row_padding) {}
+        void setInput(const uint8_t* data, size_t size);
+        bool process();
+
+        JpegDecoder mDecoder;
+        std::vector<uint8_t> mJpeg;
+        base::samples::frame::frame_mode_t mMode;
+        unsigned int mScaleDenom;
+        uint32_t mRowPadding;
+    };
+};
+
+/**
+ * Compresses a stream of YUYV images of the same size, see JpegEncoder.
+ */
+class JpegEncodePipeline : public JpegPipeline {
+ public:
+    /**
+     * \param yuyv_row_size Bytes per row of the pushed images, 0 if not padded.
+     */
+    JpegEncodePipeline(WorkerPool* pool, uint32_t width, uint32_t height, int quality,
+            bool limited_range, uint32_t yuyv_row_size = 0);
+
+ private:
+    struct EncodeSlot : public Slot {
+        EncodeSlot(uint32_t width, uint32_t height, int quality, bool limited_range,
+                uint32_t yuyv_row_size) : mEncoder(), mYUYV(), mImageWidth(width), 
+                mImageHeight(height), mQuality(quality), mLimitedRange(limited_range),
+                mYUYVRowSize(yuyv_row_size != 0 ? yuyv_row_size : width * 2) {}
+        void setInput(const uint8_t* data, size_t size);
+        bool process();
+
+        JpegEncoder mEncoder;
+        std::vector<uint8_t> mYUYV;
+        uint32_t mImageWidth;
+        uint32_t mImageHeight;
+        int mQuality;
+        bool mLimitedRange;
+        uint32_t mYUYVRowSize;
+    };
+};
+
+} // end namespace camera
+
+#endif
@@ -0,0 +1,171 @@
+#include "latency_tracer.h"
+
+#include <sstream>
+
+namespace camera
+{
+
+const unsigned int LatencyHistogram::NUM_BUCKETS;
+const unsigned int LatencyTracer::MAX_IMAGES_IN_FLIGHT;
+
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+void LatencyHistogram::add(int64_t usec) {
+    if(usec < 0) {
+        usec = 0;
+    }
+    mBuckets[getBucket(usec)]++;
+    if(mCount == 0 || usec < mMin) {
+        mMin = usec;
+    }
+    if(mCount == 0 || usec > mMax) {
+        mMax = usec;
+    }
+    mSum += usec;
+    mCount++;
+}
+
+void LatencyHistogram::clear() {
+    for(unsigned int i=0; i<NUM_BUCKETS; ++i) {
+        mBuckets[i] = 0;
+    }
+    mCount = 0;
+    mMin = 0;
+    mMax = 0;
+    mSum = 0;
+}
+
+int64_t LatencyHistogram::getMin() const {
+    return mMin;
+}
+
+int64_t LatencyHistogram::getMax() const {
+    return mMax;
+}
+
+int64_t LatencyHistogram::getMean() const {
+    return mCount > 0 ? mSum / (int64_t)mCount : 0;
+}
+
+int64_t LatencyHistogram::getPercentile(double p) const {
+    if(mCount == 0) {
+        return 0;
+    }
+    // Number of entries which have to be covered, at least one.
+    uint64_t needed = (uint64_t)(p * mCount + 0.5);
+    if(needed == 0) {
+        needed = 1;
+    }
+    uint64_t covered = 0;
+    for(unsigned int i=0; i+1<NUM_BUCKETS; ++i) {
+        covered += mBuckets[i];
+        if(covered >= needed) {
+            int64_t end = (int64_t)1 << i;
+            return end < mMax ? end : mMax;
+        }
+    }
+    return mMax;
+}
+
+unsigned int LatencyHistogram::getBucket(int64_t usec) {
+    unsigned int bucket = 0;
+    while(usec > 0 && bucket + 1 < NUM_BUCKETS) {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+std::string LatencyHistogram::toString() const {
+    std::stringstream ss;
+    ss << "n=" << mCount << " min=" << getMin() << " mean=" << getMean() <<
+            " p50<=" << getPercentile(0.5) << " p99<=" << getPercentile(0.99) <<
+            " max=" << getMax() << " usec";
+    return ss.str();
+}
+
+LatencyTracer::LatencyTracer() : mStages(), mNumImages(0), mNextImage(0) {
+    pthread_mutex_init(&mMutex, NULL);
+}
+
+LatencyTracer::~LatencyTracer() {
+    pthread_mutex_destroy(&mMutex);
+}
+
+unsigned int LatencyTracer::addStage(std::string const& name) {
+    pthread_mutex_lock(&mMutex);
+    Stage stage;
+    stage.mName = name;
+    mStages.push_back(stage);
+    unsigned int index = mStages.size() - 1;
+    pthread_mutex_unlock(&mMutex);
+    return index;
+}
+
+void LatencyTracer::clear() {
+    pthread_mutex_lock(&mMutex);
+    mStages.clear();
+    mNumImages = 0;
+    mNextImage = 0;
+    pthread_mutex_unlock(&mMutex);
+}
+
+void LatencyTracer::reset() {
+    pthread_mutex_lock(&mMutex);
+    for(unsigned int i=0; i<mStages.size(); ++i) {
+        mStages[i].mHistogram.clear();
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+void LatencyTracer::record(unsigned int stage, uint64_t id, int64_t time, int64_t start_time) {
+    pthread_mutex_lock(&mMutex);
+    if(stage >= mStages.size()) {
+        pthread_mutex_unlock(&mMutex);
+        return;
+    }
+    // The images in flight are few, the newest are searched first.
+    Image* image = NULL;
+    for(unsigned int i=1; i<=mNumImages && image == NULL; ++i) {
+        Image& candidate = mImages[(mNextImage + MAX_IMAGES_IN_FLIGHT - i) % MAX_IMAGES_IN_FLIGHT];
+        if(candidate.mId == id) {
+            image = &candidate;
+        }
+    }
+    if(image != NULL) {
+        mStages[stage].mHistogram.add(time - image->mTime);
+    } else {
+        if(start_time >= 0) {
+            mStages[stage].mHistogram.add(time - start_time);
+        }
+        // Replaces the oldest image if the ring is full.
+        image = &mImages[mNextImage];
+        image->mId = id;
+        mNextImage = (mNextImage + 1) % MAX_IMAGES_IN_FLIGHT;
+        if(mNumImages < MAX_IMAGES_IN_FLIGHT) {
+            mNumImages++;
+        }
+    }
+    image->mTime = time;
+    pthread_mutex_unlock(&mMutex);
+}
+
+std::vector<LatencyTracer::Stage> LatencyTracer::getStages() {
+    pthread_mutex_lock(&mMutex);
+    std::vector<Stage> stages(mStages);
+    pthread_mutex_unlock(&mMutex);
+    return stages;
+}
+
+std::string LatencyTracer::toString() {
+    std::vector<Stage> stages = getStages();
+    std::stringstream ss;
+    for(unsigned int i=0; i<stages.size(); ++i) {
+        ss << stages[i].mName << ": " << stages[i].mHistogram.toString() << std::endl;
+    }
+    return ss.str();
+}
+
+} // end namespace camera
@@ -0,0 +1,150 @@
+/*
+ * \file    latency_tracer.h
+ *
+ * \brief   Latency histograms of the processing stages of the images.
+ */
+
+#ifndef _CAM_LATENCY_TRACER_H_
+#define _CAM_LATENCY_TRACER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace camera
+{
+
+/**
+ * Histogram of latencies in usec with power of two buckets: bucket 0 counts
+ * latencies below 1 usec, bucket i those within [2^(i-1), 2^i), the last
+ * bucket all larger ones. Not thread-safe.
+ */
+class LatencyHistogram {
+ public:
+    static const unsigned int NUM_BUCKETS = 26; // The last regular bucket ends at 16.8 sec.
+
+    LatencyHistogram();
+
+    /**
+     * Adds a latency, negative values (e.g. clock jitter) are counted as 0.
+     */
+    void add(int64_t usec);
+
+    void clear();
+
+    inline uint64_t getCount() const {
+        return mCount;
+    }
+
+    /**
+     * Min., max. and mean latency in usec, 0 if the histogram is empty.
+     */
+    int64_t getMin() const;
+    int64_t getMax() const;
+    int64_t getMean() const;
+
+    /**
+     * Upper bound of the latencies of the fraction 'p' (0 to 1) of the entries,
+     * i.e. the end of the bucket containing the p-quantile, limited by getMax().
+     */
+    int64_t getPercentile(double p) const;
+
+    inline uint64_t getBucketCount(unsigned int bucket) const {
+        return mBuckets[bucket];
+    }
+
+    /**
+     * Index of the bucket counting 'usec'.
+     */
+    static unsigned int getBucket(int64_t usec);
+
+    /**
+     * One line summary: "n=... min=... mean=... p50<=... p99<=... max=... usec".
+     */
+    std::string toString() const;
+
+ private:
+    uint64_t mBuckets[NUM_BUCKETS];
+    uint64_t mCount;
+    int64_t mMin;
+    int64_t mMax;
+    int64_t mSum;
+};
+
+/**
+ * Measures the time each image spends in the stages of a processing chain.
+ * The stages report when an image (identified by e.g. its timestamp) leaves
+ * them, the latency of a stage is the time since the image left the previous
+ * one. The last MAX_IMAGES_IN_FLIGHT images are remembered, so images which
+ * are dropped by a stage do not disturb the measurements of the others.
+ * Thread-safe: the stages may run in different threads.
+ */
+class LatencyTracer {
+ public:
+    static const unsigned int MAX_IMAGES_IN_FLIGHT = 64;
+
+    struct Stage {
+        std::string mName;
+        LatencyHistogram mHistogram;
+    };
+
+    LatencyTracer();
+
+    ~LatencyTracer();
+
+    /**
+     * Appends a stage, stages should be added in processing order.
+     * \return The index which is passed to record().
+     */
+    unsigned int addStage(std::string const& name);
+
+    /**
+     * Removes all stages and the remembered images.
+     */
+    void clear();
+
+    /**
+     * Clears the histograms, the stages are kept.
+     */
+    void reset();
+
+    /**
+     * Image 'id' has left 'stage' at 'time' (usec). The latency is the time
+     * since it left the previous stage. Images which are not known yet enter
+     * the chain here: their latency is 'time' - 'start_time' or not recorded
+     * if 'start_time' is negative.
+     */
+    void record(unsigned int stage, uint64_t id, int64_t time, int64_t start_time = -1);
+
+    /**
+     * Copies of all stages in the order they have been added.
+     */
+    std::vector<Stage> getStages();
+
+    /**
+     * One line per stage, see LatencyHistogram::toString().
+     */
+    std::string toString();
+
+ private:
+    LatencyTracer(LatencyTracer const&);
+    LatencyTracer& operator=(LatencyTracer const&);
+
+    struct Image {
+        uint64_t mId;
+        int64_t mTime; // Of the last stage the image has left.
+    };
+
+    pthread_mutex_t mMutex;
+    std::vector<Stage> mStages;
+    // Ring buffer, mNextImage is the oldest entry once it is full.
+    Image mImages[MAX_IMAGES_IN_FLIGHT];
+    unsigned int mNumImages;
+    unsigned int mNextImage;
+};
+
+} // end namespace camera
+
+#endif
@@ -0,0 +1,800 @@
+#include "camera_usb/cam_usb.h"
+#include "camera_usb/cam_logging.h"
+#include "camera_usb/fake_v4l2_device.h"
+#include "bayer.h"
+#include "helpers.h"
+#include "jpeg_codec.h"
+
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+/**
+ * Small benchmark program for the hot paths of the driver.
+ * Every benchmark is hardware-free unless stated otherwise.
+ */
+
+static double timeUsec() {
+    timeval now;
+    gettimeofday(&now, 0);
+    return now.tv_sec * 1e6 + now.tv_usec;
+}
+
+static void printResult(std::string const& name, double usec_total, int iterations,
+        double bytes_copied_per_frame) {
+    double usec_per_frame = usec_total / iterations;
+    printf("%-24s %10.1f usec/frame %10.2f MB copied/frame %10.2f GB/s\n", name.c_str(),
+            usec_per_frame, bytes_copied_per_frame / 1e6,
+            usec_per_frame > 0 ? bytes_copied_per_frame / (usec_per_frame * 1e3) : 0);
+}
+
+/**
+ * Compares the former handoff of a 1080p RGB GStreamer sample to a Frame
+ * (copy into a temporary buffer, copy into the frame) with the GstFrameHandle
+ * based one (single copy into the frame) and the pure view (no copy).
+ */
+static int benchmarkHandoff(int iterations) {
+    using namespace camera;
+    const uint16_t width = 1920, height = 1080;
+    const size_t size = width * height * 3;
+
+    GstBuffer* gst_buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    std::vector<uint8_t> pattern(size, 0x80);
+    gst_buffer_fill(gst_buffer, 0, pattern.data(), size);
+    GstSample* sample = gst_sample_new(gst_buffer, NULL, NULL, NULL);
+    gst_buffer_unref(gst_buffer);
+
+    base::samples::frame::Frame frame;
+    std::vector<uint8_t> buffer_tmp;
+    uint32_t checksum = 0;
+
+    printf("Handoff of a %dx%d RGB sample (%d iterations)\n", width, height, iterations);
+
+    // Former path: getBuffer() into a temporary vector, assigned to the frame.
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        GstMapInfo info;
+        gst_buffer_map(gst_sample_get_buffer(sample), &info, GST_MAP_READ);
+        buffer_tmp.resize(info.size);
+        memcpy(buffer_tmp.data(), info.data, info.size);
+        gst_buffer_unmap(gst_sample_get_buffer(sample), &info);
+        frame.init(width, height, 8, base::samples::frame::MODE_RGB, -1, buffer_tmp.size());
+        frame.image = buffer_tmp;
+        checksum += frame.image[i % size];
+    }
+    printResult("copy (tmp + frame)", timeUsec() - start, iterations, 2.0 * size);
+
+    // retrieveFrame(): a single copy from the mapped sample into the frame.
+    start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        GstFrameHandle handle(sample);
+        frame.init(width, height, 8, base::samples::frame::MODE_RGB, -1, handle.size());
+        memcpy(frame.image.data(), handle.data(), handle.size());
+        checksum += frame.image[i % size];
+    }
+    printResult("handle (frame)", timeUsec() - start, iterations, size);
+
+    // retrieveFrameHandle(): the consumer works on the mapped sample directly.
+    start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        GstFrameHandle handle(sample);
+        checksum += handle.data()[i % size];
+    }
+    printResult("handle (view)", timeUsec() - start, iterations, 0);
+
+    gst_sample_unref(sample);
+    printf("Checksum %u\n", checksum);
+    return 0;
+}
+
+static unsigned long gLogArgumentEvaluations = 0;
+
+static int countEvaluation(int value) {
+    ++gLogArgumentEvaluations;
+    return value;
+}
+
+/**
+ * Runs the per-frame log statements of the driver in a loop. With the default
+ * CAMERA_USB_TRACE_LEVEL (0) their arguments must never be evaluated and the loop 
+ * has to cost the same as the empty one. For comparison the runtime filtered 
+ * LOG_DEBUG, which was used before, is measured as well.
+ */
+static int benchmarkLogging(int iterations) {
+    const int calls = iterations * 10000;
+    volatile int sink = 0;
+    printf("Per-frame logging, CAMERA_USB_TRACE_LEVEL %d (%d calls)\n", 
+            CAMERA_USB_TRACE_LEVEL, calls);
+
+    double start = timeUsec();
+    for(int i=0; i<calls; ++i) {
+        sink = i;
+    }
+    double usec_empty = timeUsec() - start;
+
+    gLogArgumentEvaluations = 0;
+    start = timeUsec();
+    for(int i=0; i<calls; ++i) {
+        sink = i;
+        CAM_LOG_TRACE("CamUsb: retrieveFrame %d", countEvaluation(i));
+        CAM_LOG_TRACE_EVERY_N(100, "New image received, size: %d", countEvaluation(i));
+    }
+    double usec_trace = timeUsec() - start;
+    unsigned long trace_evaluations = gLogArgumentEvaluations;
+
+    gLogArgumentEvaluations = 0;
+    start = timeUsec();
+    for(int i=0; i<calls; ++i) {
+        sink = i;
+        LOG_DEBUG("CamUsb: retrieveFrame %d", countEvaluation(i));
+    }
+    double usec_debug = timeUsec() - start;
+    unsigned long debug_evaluations = gLogArgumentEvaluations;
+
+    printf("%-24s %10.3f nsec/call\n", "empty loop", usec_empty * 1e3 / calls);
+    printf("%-24s %10.3f nsec/call %10lu argument evaluations\n", "CAM_LOG_TRACE", 
+            usec_trace * 1e3 / calls, trace_evaluations);
+    printf("%-24s %10.3f nsec/call %10lu argument evaluations\n", "LOG_DEBUG", 
+            usec_debug * 1e3 / calls, debug_evaluations);
+    (void)sink;
+
+    if(CAMERA_USB_TRACE_LEVEL == 0 && trace_evaluations != 0) {
+        printf("ERROR: Trace statements have been evaluated at level 0\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * YUYV to RGB conversion of a 4K image, serial and in row bands on worker
+ * pools with 1 to 4 threads, followed by the other YUYV conversions.
+ */
+static int benchmarkConversion(int iterations) {
+    using namespace camera;
+    const uint32_t width = 3840, height = 2160;
+    std::vector<uint8_t> yuyv((size_t)width * height * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 7);
+    }
+    std::vector<uint8_t> rgb;
+    Helpers helpers;
+    printf("YUYV to RGB conversion %dx%d (%d iterations)\n", width, height, iterations);
+
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        helpers.convertYUYV2RGB(yuyv.data(), width, height, rgb, NULL);
+    }
+    double usec_serial = (timeUsec() - start) / iterations;
+    printf("%-24s %10.1f usec/frame %8.1f fps\n", "serial", usec_serial, 1e6 / usec_serial);
+
+    for(unsigned int threads=1; threads<=4; ++threads) {
+        WorkerPool pool(threads);
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            helpers.convertYUYV2RGB(yuyv.data(), width, height, rgb, &pool);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        char name[32];
+        snprintf(name, sizeof(name), "pool, %d threads", threads);
+        printf("%-24s %10.1f usec/frame %8.1f fps %6.2fx\n", name, usec, 1e6 / usec, 
+                usec_serial / usec);
+    }
+
+    // The other targets, serial.
+    const char* names[] = {"serial, BGR", "serial, RGB32", "serial, GRAY", "serial, UYVY"};
+    Helpers::YUYVConversion conversions[] = {Helpers::YUYV_TO_BGR, Helpers::YUYV_TO_RGB32,
+            Helpers::YUYV_TO_GRAY, Helpers::YUYV_TO_UYVY};
+    for(int c=0; c<4; ++c) {
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            helpers.convertYUYV(yuyv.data(), width, height, conversions[c], rgb, NULL);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        printf("%-24s %10.1f usec/frame %8.1f fps\n", names[c], usec, 1e6 / usec);
+    }
+    return 0;
+}
+
+/**
+ * Cost of creating a Helpers instance (done with every CamConfig) and 
+ * its size, the YUV tables are shared and created only once.
+ */
+static int benchmarkTables(int iterations) {
+    using namespace camera;
+    const int instances = iterations * 1000;
+    printf("Helpers construction (%d instances)\n", instances);
+
+    double start = timeUsec();
+    Helpers::getYuvTables(Helpers::YUV_BT601, Helpers::YUV_RANGE_LIMITED);
+    double usec_first = timeUsec() - start;
+
+    uint8_t rgb[6], yuyv[4] = {16, 128, 235, 128};
+    unsigned int checksum = 0;
+    start = timeUsec();
+    for(int i=0; i<instances; ++i) {
+        Helpers* helpers = new Helpers();
+        helpers->convertYUYV2RGBPixels(yuyv, rgb, 2);
+        checksum += rgb[i % 6];
+        delete helpers;
+    }
+    double usec = (timeUsec() - start) / instances;
+    printf("%-24s %10.1f usec\n", "table creation (once)", usec_first);
+    printf("%-24s %10.3f usec/instance %8lu bytes/instance\n", "Helpers", usec, 
+            (unsigned long)sizeof(Helpers));
+    printf("%-24s %10lu bytes\n", "shared tables", 
+            (unsigned long)(4 * sizeof(Helpers::YuvTables)));
+    printf("Checksum %u\n", checksum);
+    return 0;
+}
+
+/**
+ * Compresses a synthetic RGB image with libjpeg, quality 85.
+ */
+static std::vector<uint8_t> createJpeg(uint32_t width, uint32_t height) {
+    std::vector<uint8_t> rgb((size_t)width * height * 3);
+    for(size_t i=0; i<rgb.size(); ++i) {
+        rgb[i] = (uint8_t)((i % (width * 3)) / 7 + (i / (width * 3)) / 3);
+    }
+    struct jpeg_compress_struct info;
+    struct jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_compress(&info);
+    unsigned char* data = NULL;
+    unsigned long size = 0;
+    jpeg_mem_dest(&info, &data, &size);
+    info.image_width = width;
+    info.image_height = height;
+    info.input_components = 3;
+    info.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, 85, TRUE);
+    jpeg_start_compress(&info, TRUE);
+    while(info.next_scanline < info.image_height) {
+        JSAMPROW row = &rgb[(size_t)info.next_scanline * width * 3];
+        jpeg_write_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_compress(&info);
+    std::vector<uint8_t> jpeg(data, data + size);
+    jpeg_destroy_compress(&info);
+    free(data);
+    return jpeg;
+}
+
+/**
+ * MJPEG to RGB decoding of a 1080p image: serial with the scaling factors
+ * and through the decode pipeline on pools with 1 to 4 threads.
+ */
+static int benchmarkMjpeg(int iterations) {
+    using namespace camera;
+    const uint32_t width = 1920, height = 1080;
+    std::vector<uint8_t> jpeg = createJpeg(width, height);
+    std::vector<uint8_t> image;
+    uint32_t out_width = 0, out_height = 0;
+    printf("MJPEG to RGB decoding %dx%d, %lu bytes (%d iterations)\n", width, height, 
+            (unsigned long)jpeg.size(), iterations);
+
+    JpegDecoder decoder;
+    double usec_serial = 0;
+    for(unsigned int denom=1; denom<=8; denom*=2) {
+        double start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            decoder.decode(jpeg.data(), jpeg.size(), base::samples::frame::MODE_RGB, denom,
+                    image, &out_width, &out_height);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        if(denom == 1) {
+            usec_serial = usec;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "serial, 1/%d (%dx%d)", denom, out_width, out_height);
+        printf("%-24s %10.1f usec/frame %8.1f fps\n", name, usec, 1e6 / usec);
+    }
+
+    for(unsigned int threads=1; threads<=4; ++threads) {
+        WorkerPool pool(threads);
+        JpegDecodePipeline pipeline(&pool, base::samples::frame::MODE_RGB, 1);
+        double start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            do {
+                pipeline.push(jpeg.data(), jpeg.size());
+            } while(pipeline.getNumPending() < pipeline.getDepth());
+            pipeline.pop(image, &out_width, &out_height);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        char name[32];
+        snprintf(name, sizeof(name), "pipeline, %d threads", threads);
+        printf("%-24s %10.1f usec/frame %8.1f fps %6.2fx\n", name, usec, 1e6 / usec, 
+                usec_serial / usec);
+    }
+    return 0;
+}
+
+/**
+ * YUYV to JPEG compression of a 720p image: the raw 4:2:2 encoder compared to
+ * the conversion to RGB followed by libjpeg's own color conversion and 
+ * downsampling, and the encode pipeline on pools with 1 to 4 threads.
+ */
+static int benchmarkEncode(int iterations) {
+    using namespace camera;
+    const uint32_t width = 1280, height = 720;
+    const int quality = JpegEncoder::DEFAULT_QUALITY;
+    std::vector<uint8_t> yuyv((size_t)width * height * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i % 2 == 0 ? 16 + (i / 2) % width * 219 / width : 
+                128 + (int)((i / (width * 2)) % 64) - 32);
+    }
+    std::vector<uint8_t> jpeg, rgb;
+    printf("YUYV to JPEG compression %dx%d, quality %d (%d iterations)\n", width, height,
+            quality, iterations);
+
+    JpegEncoder encoder;
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        encoder.encodeYUYV(yuyv.data(), width, height, quality, true, jpeg);
+    }
+    double usec_raw = (timeUsec() - start) / iterations;
+    printf("%-24s %10.1f usec/frame %8.1f fps %10lu bytes\n", "raw YUYV", usec_raw,
+            1e6 / usec_raw, (unsigned long)jpeg.size());
+
+    Helpers helpers;
+    struct jpeg_compress_struct info;
+    struct jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_compress(&info);
+    unsigned char* data = NULL;
+    unsigned long size = 0;
+    start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        helpers.convertYUYV2RGB(yuyv.data(), width, height, rgb, NULL);
+        jpeg_mem_dest(&info, &data, &size);
+        info.image_width = width;
+        info.image_height = height;
+        info.input_components = 3;
+        info.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&info);
+        jpeg_set_quality(&info, quality, TRUE);
+        jpeg_start_compress(&info, TRUE);
+        while(info.next_scanline < info.image_height) {
+            JSAMPROW row = &rgb[(size_t)info.next_scanline * width * 3];
+            jpeg_write_scanlines(&info, &row, 1);
+        }
+        jpeg_finish_compress(&info);
+    }
+    double usec_rgb = (timeUsec() - start) / iterations;
+    printf("%-24s %10.1f usec/frame %8.1f fps %10lu bytes\n", "YUYV to RGB, RGB", usec_rgb,
+            1e6 / usec_rgb, size);
+    jpeg_destroy_compress(&info);
+    free(data);
+
+    for(unsigned int threads=1; threads<=4; ++threads) {
+        WorkerPool pool(threads);
+        JpegEncodePipeline pipeline(&pool, width, height, quality, true);
+        uint32_t out_width = 0, out_height = 0;
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            do {
+                pipeline.push(yuyv.data(), yuyv.size());
+            } while(pipeline.getNumPending() < pipeline.getDepth());
+            pipeline.pop(jpeg, &out_width, &out_height);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        char name[32];
+        snprintf(name, sizeof(name), "pipeline, %d threads", threads);
+        printf("%-24s %10.1f usec/frame %8.1f fps %6.2fx\n", name, usec, 1e6 / usec, 
+                usec_raw / usec);
+    }
+    return 0;
+}
+
+/**
+ * Bayer processing of a 1080p image: the plain copy of the 8 bit formats,
+ * the unpacking of the packed 10 and 12 bit formats and the demosaicing 
+ * to RGB, serial and in row bands on worker pools with 1 to 4 threads.
+ */
+static int benchmarkBayer(int iterations) {
+    using namespace camera;
+    using namespace base::samples::frame;
+    const uint32_t width = 1920, height = 1080;
+    std::vector<uint8_t> raw((size_t)width * height * 2);
+    for(size_t i=0; i<raw.size(); ++i) {
+        raw[i] = (uint8_t)(i * 13 + i / width);
+    }
+    std::vector<uint8_t> image;
+    printf("Bayer processing %dx%d (%d iterations)\n", width, height, iterations);
+
+    const char* names[] = {"copy, 8 bit", "unpack, 10 bit packed", "unpack, 12 bit packed"};
+    Bayer::Format const* formats[] = {Bayer::findFormat(MODE_BAYER_RGGB, 8, false),
+            Bayer::findFormat(MODE_BAYER_RGGB, 10, true), Bayer::findFormat(MODE_BAYER_RGGB, 12, true)};
+    for(int f=0; f<3; ++f) {
+        double start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            Bayer::copy(raw.data(), *formats[f], width, height, 0, image);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        printf("%-24s %10.1f usec/frame %8.1f fps\n", names[f], usec, 1e6 / usec);
+    }
+
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        Bayer::demosaic(raw.data(), *formats[0], width, height, 0, MODE_RGB, image, NULL);
+    }
+    double usec_serial = (timeUsec() - start) / iterations;
+    printf("%-24s %10.1f usec/frame %8.1f fps %8.1f MPixel/s\n", "demosaic, serial", 
+            usec_serial, 1e6 / usec_serial, width * height / usec_serial);
+
+    for(unsigned int threads=1; threads<=4; ++threads) {
+        WorkerPool pool(threads);
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            Bayer::demosaic(raw.data(), *formats[0], width, height, 0, MODE_RGB, image, &pool);
+        }
+        double usec = (timeUsec() - start) / iterations;
+        char name[32];
+        snprintf(name, sizeof(name), "demosaic, %d threads", threads);
+        printf("%-24s %10.1f usec/frame %8.1f fps %6.2fx\n", name, usec, 1e6 / usec, 
+                usec_serial / usec);
+    }
+    return 0;
+}
+
+/**
+ * Full resolution RGB plus an RGB preview of a 1080p YUYV image: the conversion
+ * alone, the conversion followed by a separate downscaling pass over the YUYV 
+ * image and both in a single pass, for the factors 2 and 4.
+ */
+static int benchmarkPreview(int iterations) {
+    using namespace camera;
+    const uint32_t width = 1920, height = 1080;
+    std::vector<uint8_t> yuyv((size_t)width * height * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 7);
+    }
+    std::vector<uint8_t> rgb, preview;
+    Helpers helpers;
+    printf("YUYV to RGB with preview %dx%d (%d iterations)\n", width, height, iterations);
+
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_RGB, rgb, NULL);
+    }
+    double usec = (timeUsec() - start) / iterations;
+    printf("%-24s %10.1f usec/frame %8.1f fps\n", "no preview", usec, 1e6 / usec);
+
+    for(unsigned int factor=2; factor<=4; factor*=2) {
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_RGB, rgb, NULL);
+            helpers.convertYUYVDownscaled(yuyv.data(), width, height, factor, 
+                    Helpers::YUYV_TO_RGB, preview, NULL);
+        }
+        double usec_separate = (timeUsec() - start) / iterations;
+        char name[32];
+        snprintf(name, sizeof(name), "1/%d, two passes", factor);
+        printf("%-24s %10.1f usec/frame %8.1f fps\n", name, usec_separate, 1e6 / usec_separate);
+
+        start = timeUsec();
+        for(int i=0; i<iterations; ++i) {
+            helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_RGB, rgb, 
+                    factor, Helpers::YUYV_TO_RGB, preview, NULL);
+        }
+        usec = (timeUsec() - start) / iterations;
+        snprintf(name, sizeof(name), "1/%d, one pass", factor);
+        printf("%-24s %10.1f usec/frame %8.1f fps %6.2fx\n", name, usec, 1e6 / usec,
+                usec_separate / usec);
+    }
+    return 0;
+}
+
+static double cpuTimeUsec() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + 
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+ * Pulls the sample like CamGst::callbackNewBuffer() and counts it.
+ */
+static GstFlowReturn appsinkNewSample(GstAppSink* sink, gpointer data) {
+    GstSample* sample = gst_app_sink_pull_sample(sink);
+    if(sample != NULL) {
+        (*(int*)data)++;
+        gst_sample_unref(sample);
+    }
+    return GST_FLOW_OK;
+}
+
+/**
+ * Runs 'iterations' VGA frames at 120 fps (not live, as fast as possible) from 
+ * videotestsrc into an appsink which either emits the new-sample signal or
+ * calls the callback registered with gst_app_sink_set_callbacks().
+ */
+static int runAppsink(int iterations, bool signals, double* usec, double* cpu_usec) {
+    char description[256];
+    snprintf(description, sizeof(description), "videotestsrc num-buffers=%d pattern=black ! "
+            "video/x-raw,format=YUY2,width=640,height=480,framerate=120/1 ! "
+            "appsink name=sink sync=false max-buffers=1 drop=true", iterations);
+    GError* error = NULL;
+    GstElement* pipeline = gst_parse_launch(description, &error);
+    if(pipeline == NULL) {
+        printf("Pipeline could not be created: %s\n", error != NULL ? error->message : "");
+        if(error != NULL) {
+            g_error_free(error);
+        }
+        return -1;
+    }
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    int received = 0;
+    if(signals) {
+        g_object_set(G_OBJECT(sink), "emit-signals", TRUE, (void*)NULL);
+        g_signal_connect(sink, "new-sample", G_CALLBACK(appsinkNewSample), &received);
+    } else {
+        GstAppSinkCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.new_sample = appsinkNewSample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, &received, NULL);
+    }
+    gst_object_unref(sink);
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    double start = timeUsec(), cpu_start = cpuTimeUsec();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, 
+            (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    *usec = timeUsec() - start;
+    *cpu_usec = cpuTimeUsec() - cpu_start;
+    if(msg != NULL) {
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return received;
+}
+
+/**
+ * Per-frame overhead of the appsink new-sample signal compared to the
+ * callbacks used by CamGst. Requires the GStreamer base plugins.
+ */
+static int benchmarkAppsink(int iterations) {
+    printf("videotestsrc VGA YUY2 120 fps to appsink (%d frames)\n", iterations);
+    const char* names[] = {"signals", "callbacks"};
+    for(int round=0; round<2; ++round) {
+        // Second round measures, the first one warms up the plugin loading.
+        for(int i=0; i<2; ++i) {
+            double usec = 0, cpu_usec = 0;
+            int received = runAppsink(iterations, i == 0, &usec, &cpu_usec);
+            if(received < 0) {
+                return 1;
+            }
+            if(round == 1) {
+                printf("%-24s %10.1f usec/frame %10.1f cpu usec/frame %6d frames\n", names[i],
+                        usec / iterations, cpu_usec / iterations, received);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Latency of an asynchronous pipeline start: return of startPipelineAsync(),
+ * PLAYING state and first image. Cold starts create the pipeline from NULL 
+ * (creation included), prepared starts use a pipeline prewarmed to PAUSED.
+ * The live videotestsrc does not preroll (like v4l2src), so caps negotiation 
+ * and buffer allocation are measured in both cases.
+ * Requires the GStreamer base plugins.
+ */
+static int benchmarkStart(int iterations) {
+    using namespace camera;
+    printf("Start of videotestsrc VGA RGB 30 fps (%d starts)\n", iterations);
+    CamGst gst("/dev/video0");
+    const char* names[] = {"cold", "prepared (PAUSED, device opened, no preroll)"};
+    for(int warm=0; warm<2; ++warm) {
+        double request_usec = 0, playing_usec = 0, first_frame_usec = 0;
+        for(int i=0; i<iterations; ++i) {
+            double start = timeUsec();
+            gst.createCustomPipeline("videotestsrc is-live=true ! ${caps}", 640, 480, 30, 
+                    base::samples::frame::MODE_RGB);
+            double create_usec = timeUsec() - start;
+            if(warm) {
+                if(!gst.prewarmPipeline(GST_STATE_PAUSED) || !gst.waitForPipeline(4000)) {
+                    std::cout << "Pipeline could not be prewarmed" << std::endl;
+                    return 1;
+                }
+                create_usec = 0;
+            }
+            start = timeUsec();
+            if(!gst.startPipelineAsync()) {
+                return 1;
+            }
+            request_usec += timeUsec() - start;
+            GstFrameHandle handle;
+            if(!gst.waitForPipeline(4000) || !gst.getFrame(handle, true, 4000)) {
+                std::cout << "Pipeline could not be started" << std::endl;
+                return 1;
+            }
+            playing_usec += create_usec + gst.getStartLatency();
+            first_frame_usec += create_usec + gst.getFirstFrameLatency();
+            handle.reset();
+            gst.deletePipeline();
+        }
+        printf("%s\n", names[warm]);
+        printf("  %-22s %10.1f usec\n", "startPipelineAsync", request_usec / iterations);
+        printf("  %-22s %10.1f usec\n", "PLAYING", playing_usec / iterations);
+        printf("  %-22s %10.1f usec\n", "first frame", first_frame_usec / iterations);
+    }
+    return 0;
+}
+
+/**
+ * Per-stage latencies of a converting pipeline, see CamGst::setLatencyTracing().
+ * Requires the GStreamer base plugins.
+ */
+static int benchmarkLatency(int iterations) {
+    using namespace camera;
+    printf("Latencies of videotestsrc 720p YUY2 to RGB 30 fps (%d frames)\n", iterations);
+    CamGst gst("/dev/video0");
+    gst.setLatencyTracing(true);
+    gst.createCustomPipeline("videotestsrc is-live=true ! video/x-raw,format=YUY2 ! "
+            "videoconvert ! ${caps}", 1280, 720, 30, base::samples::frame::MODE_RGB);
+    if(!gst.startPipeline()) {
+        std::cout << "Pipeline could not be started" << std::endl;
+        return 1;
+    }
+    GstFrameHandle handle;
+    for(int i=0; i<iterations; ++i) {
+        if(!gst.getFrame(handle, true, 2000)) {
+            std::cout << "No frame received" << std::endl;
+            return 1;
+        }
+    }
+    std::vector<LatencyTracer::Stage> stages = gst.getLatencyStages();
+    for(unsigned int i=0; i<stages.size(); ++i) {
+        LatencyHistogram const& histogram = stages[i].mHistogram;
+        printf("  %-22s %10.1f usec mean %10.1f usec p99 %8d frames\n", stages[i].mName.c_str(),
+                (double)histogram.getMean(), (double)histogram.getPercentile(0.99), 
+                (int)histogram.getCount());
+    }
+    gst.deletePipeline();
+    return 0;
+}
+
+static void printUsage() {
+    std::cout << "Benchmarks for the camera_usb hot paths." << std::endl;
+    std::cout << "Usage: camera_usb_benchmark <benchmark> [iterations]" << std::endl;
+    std::cout << "Benchmarks:" << std::endl;
+    std::cout << "  handoff   GStreamer sample to Frame handoff at 1080p" << std::endl;
+    std::cout << "  logging   Cost of the per-frame log statements" << std::endl;
+    std::cout << "  convert   YUYV conversions at 4K" << std::endl;
+    std::cout << "  tables    Creation cost of the YUV conversion tables" << std::endl;
+    std::cout << "  mjpeg     MJPEG to RGB decoding at 1080p" << std::endl;
+    std::cout << "  encode    YUYV to JPEG compression at 720p" << std::endl;
+    std::cout << "  bayer     Bayer unpacking and demosaicing at 1080p" << std::endl;
+    std::cout << "  preview   YUYV to RGB with a downscaled preview at 1080p" << std::endl;
+    std::cout << "  appsink   appsink signals vs. callbacks, videotestsrc VGA" << std::endl;
+    std::cout << "  start     Cold/prepared pipeline start and first frame latency, videotestsrc VGA" << std::endl;
+    std::cout << "  latency   Per-stage latencies of a converting pipeline, videotestsrc 720p" << std::endl;
+    std::cout << "  continuous CamUsb grabbing from the test device test://1280x720@30/YUY2" << std::endl;
+    std::cout << "  v4l2      CamConfig capture path on the fake v4l2 device at 720p" << std::endl;
+}
+
+/**
+ * Full CamUsb path (pipeline, handoff, conversion into the Frame) on the
+ * hardware-free test device.
+ */
+static int benchmarkContinuous(int iterations) {
+    using namespace camera;
+    using namespace base::samples::frame;
+    printf("CamUsb test://1280x720@30/YUY2 to RGB, continuous grabbing (%d frames)\n", iterations);
+    CamUsb usb("test://1280x720@30/YUY2");
+    std::vector<CamInfo> cam_infos;
+    usb.listCameras(cam_infos);
+    usb.open(cam_infos[0]);
+    usb.setFrameSettings(frame_size_t(1280, 720), MODE_RGB, 3);
+    if(!usb.grab(Continuously)) {
+        std::cout << "Grabbing could not be started" << std::endl;
+        return 1;
+    }
+    Frame frame;
+    if(!usb.retrieveFrame(frame, 2000)) {
+        std::cout << "No frame received" << std::endl;
+        return 1;
+    }
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        if(!usb.retrieveFrame(frame, 2000)) {
+            std::cout << "No frame received" << std::endl;
+            return 1;
+        }
+    }
+    printResult("continuous", timeUsec() - start, iterations, frame.getNumberOfBytes());
+    usb.grab(Stop);
+    return 0;
+}
+
+/**
+ * v4l2 capture path of CamConfig (dequeue, YUYV to RGB conversion) on the
+ * FakeV4L2Device: 720p at up to 240 fps, 1 ms transfer latency, every 50th
+ * frame dropped. Frames missed while converting show up as extra drops.
+ */
+static int benchmarkFakeV4L2(int iterations) {
+    using namespace camera;
+    printf("CamConfig on FakeV4L2Device 720p YUYV to RGB, 240 fps (%d frames)\n", iterations);
+    FakeV4L2Device* device = new FakeV4L2Device();
+    std::vector<FakeV4L2Device::Format> formats;
+    FakeV4L2Device::Format format = {V4L2_PIX_FMT_YUYV, 1280, 720, 240};
+    formats.push_back(format);
+    device->setFormats(formats);
+    device->setLatency(1000);
+    device->setDropInterval(50);
+    // The time of the sensor is simulated, the frame numbers and latencies are
+    // exact and the measured time is the processing of CamConfig only.
+    device->setManualClock(true);
+
+    CamConfig config(device);
+    config.toV4L2ImageFormat(base::samples::frame::MODE_RGB, 1280, 720);
+    config.writeImagePixelFormat(1280, 720, V4L2_PIX_FMT_YUYV);
+    config.writeFPS(240);
+    config.initRequesting();
+    std::vector<uint8_t> buffer;
+    double start = timeUsec();
+    for(int i=0; i<iterations; ++i) {
+        if(!config.getBuffer(buffer, true, 1000)) {
+            std::cout << "No frame received" << std::endl;
+            return 1;
+        }
+    }
+    printResult("fake_v4l2", timeUsec() - start, iterations, buffer.size());
+    LatencyHistogram latency = device->getDequeueLatency();
+    printf("  %u frames, %u dropped, capture to dequeue %s\n", device->getNumFrames(),
+            device->getNumDroppedFrames(), latency.toString().c_str());
+    config.cleanupRequesting();
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || argc > 3 || strcmp(argv[1], "-h") == 0) {
+        printUsage();
+        return 0;
+    }
+    gst_init(&argc, &argv);
+
+    std::string benchmark = argv[1];
+    int iterations = argc == 3 ? atoi(argv[2]) : 200;
+    if(iterations <= 0) {
+        std::cout << "Invalid number of iterations" << std::endl;
+        return 1;
+    }
+
+    if(benchmark == "handoff") {
+        return benchmarkHandoff(iterations);
+    } else if(benchmark == "logging") {
+        return benchmarkLogging(iterations);
+    } else if(benchmark == "convert") {
+        return benchmarkConversion(iterations);
+    } else if(benchmark == "tables") {
+        return benchmarkTables(iterations);
+    } else if(benchmark == "mjpeg") {
+        return benchmarkMjpeg(iterations);
+    } else if(benchmark == "encode") {
+        return benchmarkEncode(iterations);
+    } else if(benchmark == "bayer") {
+        return benchmarkBayer(iterations);
+    } else if(benchmark == "preview") {
+        return benchmarkPreview(iterations);
+    } else if(benchmark == "appsink") {
+        return benchmarkAppsink(iterations);
+    } else if(benchmark == "start") {
+        return benchmarkStart(iterations);
+    } else if(benchmark == "latency") {
+        return benchmarkLatency(iterations);
+    } else if(benchmark == "continuous") {
+        return benchmarkContinuous(iterations);
+    } else if(benchmark == "v4l2") {
+        return benchmarkFakeV4L2(iterations);
+    }
+
+    printUsage();
+    return 1;
+}
@@ -0,0 +1,177 @@
+#include "test_device.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace camera
+{
+
+const char* const TestDevice::URI_PREFIX = "test://";
+
+TestDevice::TestDevice() : mWidth(640), mHeight(480), mFps(30), mFormat("YUY2") {
+}
+
+bool TestDevice::isTestDevice(std::string const& device) {
+    return device.compare(0, strlen(URI_PREFIX), URI_PREFIX) == 0;
+}
+
+bool TestDevice::parse(std::string const& device) {
+    if(!isTestDevice(device)) {
+        return false;
+    }
+    std::string spec = device.substr(strlen(URI_PREFIX));
+    size_t slash = spec.find('/');
+    if(slash != std::string::npos) {
+        mFormat = spec.substr(slash + 1);
+        spec.erase(slash);
+        if(mFormat.empty()) {
+            return false;
+        }
+    }
+    size_t at = spec.find('@');
+    if(at != std::string::npos) {
+        if(sscanf(spec.c_str() + at + 1, "%u", &mFps) != 1 || mFps == 0) {
+            return false;
+        }
+        spec.erase(at);
+    }
+    if(!spec.empty()) {
+        char rest = 0;
+        if(sscanf(spec.c_str(), "%ux%u%c", &mWidth, &mHeight, &rest) != 2 ||
+                mWidth == 0 || mHeight == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string TestDevice::getSourceDescription() const {
+    if(mFormat == "JPEG" || mFormat == "MJPG") {
+        return "videotestsrc is-live=true ! jpegenc";
+    }
+    return "videotestsrc is-live=true ! video/x-raw,format=" + mFormat;
+}
+
+// Controls of a UVC webcam: id, type, name, minimum, maximum, step, default, flags.
+static const struct v4l2_queryctrl TEST_CONTROLS[] = {
+    {V4L2_CID_BRIGHTNESS, V4L2_CTRL_TYPE_INTEGER, "Brightness", 0, 255, 1, 128, 0, {0, 0}},
+    {V4L2_CID_CONTRAST, V4L2_CTRL_TYPE_INTEGER, "Contrast", 0, 255, 1, 32, 0, {0, 0}},
+    {V4L2_CID_SATURATION, V4L2_CTRL_TYPE_INTEGER, "Saturation", 0, 255, 1, 64, 0, {0, 0}},
+    {V4L2_CID_AUTO_WHITE_BALANCE, V4L2_CTRL_TYPE_BOOLEAN, "White Balance Temperature, Auto",
+            0, 1, 1, 1, 0, {0, 0}},
+    {V4L2_CID_GAIN, V4L2_CTRL_TYPE_INTEGER, "Gain", 0, 255, 1, 0, 0, {0, 0}},
+    {V4L2_CID_AUTOGAIN, V4L2_CTRL_TYPE_BOOLEAN, "Gain, Auto", 0, 1, 1, 1, 0, {0, 0}},
+    {V4L2_CID_POWER_LINE_FREQUENCY, V4L2_CTRL_TYPE_MENU, "Power Line Frequency",
+            0, 2, 1, 2, 0, {0, 0}},
+    {V4L2_CID_WHITE_BALANCE_TEMPERATURE, V4L2_CTRL_TYPE_INTEGER, "White Balance Temperature",
+            2800, 10000, 1, 4500, 0, {0, 0}},
+    {V4L2_CID_SHARPNESS, V4L2_CTRL_TYPE_INTEGER, "Sharpness", 0, 255, 1, 24, 0, {0, 0}},
+    {V4L2_CID_BACKLIGHT_COMPENSATION, V4L2_CTRL_TYPE_INTEGER, "Backlight Compensation",
+            0, 1, 1, 0, 0, {0, 0}},
+    {V4L2_CID_EXPOSURE_AUTO, V4L2_CTRL_TYPE_MENU, "Exposure, Auto", 0, 3, 1, 3, 0, {0, 0}},
+    {V4L2_CID_EXPOSURE_ABSOLUTE, V4L2_CTRL_TYPE_INTEGER, "Exposure (Absolute)",
+            3, 2047, 1, 250, 0, {0, 0}},
+    {V4L2_CID_EXPOSURE_AUTO_PRIORITY, V4L2_CTRL_TYPE_BOOLEAN, "Exposure, Auto Priority",
+            0, 1, 1, 0, 0, {0, 0}}
+};
+
+static const size_t NUM_TEST_CONTROLS = sizeof(TEST_CONTROLS) / sizeof(TEST_CONTROLS[0]);
+
+TestControls::TestControls() : mValues() {
+    setControlValuesToDefault();
+}
+
+bool TestControls::isControlIdValid(uint32_t const id) const {
+    return queryControl(id) != NULL;
+}
+
+bool TestControls::isControlIdWritable(uint32_t const id) const {
+    struct v4l2_queryctrl const* ctrl = queryControl(id);
+    return ctrl != NULL && !(ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY);
+}
+
+bool TestControls::getControlValue(uint32_t const id, int32_t* value) const {
+    std::map<uint32_t, int32_t>::const_iterator it = mValues.find(id);
+    if(it == mValues.end()) {
+        return false;
+    }
+    *value = it->second;
+    return true;
+}
+
+void TestControls::writeControlValue(uint32_t const id, int32_t value) {
+    struct v4l2_queryctrl const* ctrl = queryControl(id);
+    if(ctrl == NULL) {
+        throw std::runtime_error("Passed id unknown");
+    }
+    if(ctrl->flags & V4L2_CTRL_FLAG_READ_ONLY) {
+        std::stringstream ss;
+        ss << "Writing is deactivated for control " << (const char*)ctrl->name << std::endl;
+        throw std::runtime_error(ss.str().c_str());
+    }
+    if(value < ctrl->minimum) {
+        value = ctrl->minimum;
+    }
+    if(value > ctrl->maximum) {
+        value = ctrl->maximum;
+    }
+    mValues[id] = value;
+}
+
+bool TestControls::getControlName(uint32_t const id, std::string* name) const {
+    struct v4l2_queryctrl const* ctrl = queryControl(id);
+    if(ctrl == NULL) {
+        return false;
+    }
+    *name = (const char*)ctrl->name;
+    return true;
+}
+
+bool TestControls::getControlMinimum(uint32_t const id, int32_t* minimum) const {
+    struct v4l2_queryctrl const* ctrl = queryControl(id);
+    if(ctrl == NULL) {
+        return false;
+    }
+    *minimum = ctrl->minimum;
+    return true;
+}
+
+bool TestControls::getControlMaximum(uint32_t const id, int32_t* maximum) const {
+    struct v4l2_queryctrl const* ctrl = queryControl(id);
+    if(ctrl == NULL) {
+        return false;
+    }
+    *maximum = ctrl->maximum;
+    return true;
+}
+
+void TestControls::setControlValuesToDefault() {
+    for(size_t i=0; i<NUM_TEST_CONTROLS; ++i) {
+        mValues[TEST_CONTROLS[i].id] = TEST_CONTROLS[i].default_value;
+    }
+}
+
+struct v4l2_queryctrl const* TestControls::queryControl(uint32_t const id) {
+    for(size_t i=0; i<NUM_TEST_CONTROLS; ++i) {
+        if(TEST_CONTROLS[i].id == id) {
+            return &TEST_CONTROLS[i];
+        }
+    }
+    return NULL;
+}
+
+void TestControls::listControls() const {
+    printf("Controls of the test device\n");
+    for(size_t i=0; i<NUM_TEST_CONTROLS; ++i) {
+        struct v4l2_queryctrl const& ctrl = TEST_CONTROLS[i];
+        int32_t value = 0;
+        getControlValue(ctrl.id, &value);
+        printf("%-34s 0x%08x: %d (%d to %d, default %d)\n", (const char*)ctrl.name, ctrl.id,
+                value, ctrl.minimum, ctrl.maximum, ctrl.default_value);
+    }
+}
+
+} // end namespace camera
@@ -0,0 +1,93 @@
+/*
+ * \file    test_device.h
+ *
+ * \brief   Hardware-free camera: device URI and emulated V4L2 controls.
+ */
+
+#ifndef _CAM_TEST_DEVICE_H_
+#define _CAM_TEST_DEVICE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include <linux/videodev2.h>
+
+namespace camera
+{
+
+/**
+ * Camera described by a device URI "test://<width>x<height>@<fps>/<format>",
+ * e.g. "test://640x480@30/YUY2". Its images are created by videotestsrc
+ * (is-live=true) in the native format, which is a GStreamer raw format
+ * (YUY2, UYVY, RGB, GRAY8, I420, ...) or JPEG (encoded by jpegenc).
+ * All parts are optional: "test://" is a 640x480 YUY2 camera at 30 fps,
+ * "test:///GRAY8" a grayscale one with the default size.
+ */
+struct TestDevice {
+    static const char* const URI_PREFIX; // "test://"
+
+    TestDevice();
+
+    static bool isTestDevice(std::string const& device);
+
+    /**
+     * Parses the URI, the parts which are not contained keep their defaults.
+     * \return false if 'device' is no test URI or malformed.
+     */
+    bool parse(std::string const& device);
+
+    /**
+     * Source part of a pipeline description which creates the images
+     * in the native format, e.g. "videotestsrc is-live=true ! video/x-raw,format=YUY2".
+     */
+    std::string getSourceDescription() const;
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mFps;
+    std::string mFormat;
+};
+
+/**
+ * Control table of a typical UVC webcam which emulates the V4L2 controls
+ * for test devices (brightness, contrast, white balance, gain, exposure, ...).
+ * The methods behave like the ones of CamConfig: values are clamped to
+ * the range of the control, unknown or read-only controls throw a
+ * std::runtime_error when they are written.
+ */
+class TestControls {
+ public:
+    /**
+     * Starts with the default values.
+     */
+    TestControls();
+
+    bool isControlIdValid(uint32_t const id) const;
+    bool isControlIdWritable(uint32_t const id) const;
+    bool getControlValue(uint32_t const id, int32_t* value) const;
+    void writeControlValue(uint32_t const id, int32_t value);
+    bool getControlName(uint32_t const id, std::string* name) const;
+    bool getControlMinimum(uint32_t const id, int32_t* minimum) const;
+    bool getControlMaximum(uint32_t const id, int32_t* maximum) const;
+    void setControlValuesToDefault();
+
+    /**
+     * Description of the control like VIDIOC_QUERYCTRL returns it.
+     * \return NULL if the control does not exist.
+     */
+    static struct v4l2_queryctrl const* queryControl(uint32_t const id);
+
+    /**
+     * Prints the table like CamConfig::listControls().
+     */
+    void listControls() const;
+
+ private:
+    std::map<uint32_t, int32_t> mValues;
+};
+
+} // end namespace camera
+
+#endif
@@ -0,0 +1,63 @@
+#include "v4l2_device.h"
+#include "cam_logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace camera
+{
+
+KernelV4L2Device::KernelV4L2Device(std::string const& device) : mFd(-1) {
+    mFd = ::open(device.c_str(),  O_NONBLOCK | O_RDWR);
+    if (mFd <= 0) {
+        LOG_FATAL("Could not open device %s",device.c_str());
+        std::string err_str(strerror(errno));
+        throw std::runtime_error(err_str.insert(0, "Could not open device: "));
+    } else {
+        LOG_DEBUG("File opened, fd: %d",mFd);
+    }
+}
+
+KernelV4L2Device::~KernelV4L2Device() {
+    close(mFd);
+}
+
+int KernelV4L2Device::getFd() const {
+    return mFd;
+}
+
+int KernelV4L2Device::ioctl(unsigned long request, void* arg) {
+    return ::ioctl(mFd, request, arg);
+}
+
+void* KernelV4L2Device::mmap(size_t length, off_t offset) {
+    // mmap creates a 'virtual' map of the memory: Maps device memory into the application address space.
+    return ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, offset);
+}
+
+int KernelV4L2Device::munmap(void* addr, size_t length) {
+    return ::munmap(addr, length);
+}
+
+int KernelV4L2Device::waitForBuffer(int32_t timeout_ms) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(mFd, &fds);
+    struct timeval waiting_time;
+    memset(&waiting_time, 0, sizeof(waiting_time));
+    waiting_time.tv_sec = timeout_ms / 1000;
+    waiting_time.tv_usec = (timeout_ms % 1000) * 1000;
+    // On timeout select returns 0. Expects mFd + 1, yes.
+    // waiting_time could contain the waiting time left.
+    return select(mFd+1, &fds, NULL, NULL, &waiting_time);
+}
+
+} // end namespace camera
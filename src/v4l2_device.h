@@ -0,0 +1,80 @@
+/*
+ * \file    v4l2_device.h
+ *
+ * \brief   Kernel entry points of the v4l2 path of CamConfig (ioctl, mmap, select).
+ */
+
+#ifndef _CAM_V4L2_DEVICE_H_
+#define _CAM_V4L2_DEVICE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+namespace camera
+{
+
+/**
+ * Everything CamConfig needs from a v4l2 device. The methods behave like the
+ * system calls they replace: failures return -1 (MAP_FAILED for mmap()) and
+ * set errno, so the error handling of CamConfig stays the same for all
+ * implementations.
+ */
+class V4L2Device {
+ public:
+    virtual ~V4L2Device() {}
+
+    /**
+     * File descriptor of the device, -1 if there is none.
+     */
+    virtual int getFd() const = 0;
+
+    /**
+     * ioctl(2) on the device, may fail with EINTR (see CamConfig::xioctl()).
+     */
+    virtual int ioctl(unsigned long request, void* arg) = 0;
+
+    /**
+     * Maps the buffer at 'offset' (v4l2_buffer.m.offset of VIDIOC_QUERYBUF).
+     */
+    virtual void* mmap(size_t length, off_t offset) = 0;
+
+    virtual int munmap(void* addr, size_t length) = 0;
+
+    /**
+     * Waits up to 'timeout_ms' until a buffer can be dequeued, like select(2).
+     * \return 1 if a buffer is available, 0 on timeout, -1 on error.
+     */
+    virtual int waitForBuffer(int32_t timeout_ms) = 0;
+};
+
+/**
+ * The camera device node, e.g. /dev/video0.
+ */
+class KernelV4L2Device : public V4L2Device {
+ public:
+    /**
+     * Opens 'device' non-blocking.
+     * Throws std::runtime_error if the device could not be opened.
+     */
+    KernelV4L2Device(std::string const& device);
+
+    ~KernelV4L2Device();
+
+    int getFd() const;
+    int ioctl(unsigned long request, void* arg);
+    void* mmap(size_t length, off_t offset);
+    int munmap(void* addr, size_t length);
+    int waitForBuffer(int32_t timeout_ms);
+
+ private:
+    KernelV4L2Device(KernelV4L2Device const&);
+    KernelV4L2Device& operator=(KernelV4L2Device const&);
+
+    int mFd;
+};
+
+} // end namespace camera
+
+#endif
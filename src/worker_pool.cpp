@@ -0,0 +1,142 @@
+#include "worker_pool.h"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <base-logging/Logging.hpp>
+
+namespace camera
+{
+
+WorkerPool::WorkerPool(unsigned int num_threads, std::vector<int> const& cpus) :
+        mJobs(), mThreads(), mStop(false) {
+    if(num_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores < 1 ? 1 : (unsigned int)cores;
+        if(num_threads > DEFAULT_NUM_THREADS) {
+            num_threads = DEFAULT_NUM_THREADS;
+        }
+    }
+    LOG_DEBUG("WorkerPool: starting %d worker threads", num_threads);
+
+    pthread_mutex_init(&mMutex, NULL);
+    pthread_cond_init(&mCondWork, NULL);
+    pthread_cond_init(&mCondDone, NULL);
+
+    for(unsigned int i=0; i<num_threads; ++i) {
+        pthread_t thread;
+        int err = pthread_create(&thread, NULL, workerLoop, (void*)this);
+        if(err != 0) {
+            stopWorkers();
+            std::string err_str(strerror(err));
+            throw std::runtime_error(err_str.insert(0, "Could not create worker thread: "));
+        }
+        mThreads.push_back(thread);
+    }
+
+    if(!cpus.empty()) {
+        setAffinity(cpus);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    stopWorkers();
+}
+
+bool WorkerPool::setAffinity(std::vector<int> const& cpus) {
+    bool success = true;
+    for(unsigned int i=0; i<mThreads.size(); ++i) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        if(cpus.empty()) {
+            long cores = sysconf(_SC_NPROCESSORS_CONF);
+            for(long c=0; c<cores && c<CPU_SETSIZE; ++c) {
+                CPU_SET(c, &cpu_set);
+            }
+        } else {
+            CPU_SET(cpus[i % cpus.size()], &cpu_set);
+        }
+        int err = pthread_setaffinity_np(mThreads[i], sizeof(cpu_set_t), &cpu_set);
+        if(err != 0) {
+            LOG_WARN("WorkerPool: affinity of worker %d could not be set: %s", i, strerror(err));
+            success = false;
+        }
+    }
+    return success;
+}
+
+void WorkerPool::run(std::vector<Task*> const& tasks) {
+    if(tasks.empty()) {
+        return;
+    }
+
+    Batch batch;
+    pthread_mutex_lock(&mMutex);
+    batch.mPending = tasks.size();
+    for(unsigned int i=0; i<tasks.size(); ++i) {
+        mJobs.push_back(Job(tasks[i], &batch));
+    }
+    pthread_cond_broadcast(&mCondWork);
+    while(batch.mPending > 0) {
+        pthread_cond_wait(&mCondDone, &mMutex);
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+void WorkerPool::post(Task* task) {
+    pthread_mutex_lock(&mMutex);
+    mJobs.push_back(Job(task, NULL));
+    pthread_cond_signal(&mCondWork);
+    pthread_mutex_unlock(&mMutex);
+}
+
+// PRIVATE
+void WorkerPool::stopWorkers() {
+    pthread_mutex_lock(&mMutex);
+    mStop = true;
+    pthread_cond_broadcast(&mCondWork);
+    pthread_mutex_unlock(&mMutex);
+
+    for(unsigned int i=0; i<mThreads.size(); ++i) {
+        pthread_join(mThreads[i], NULL);
+    }
+    mThreads.clear();
+
+    pthread_cond_destroy(&mCondDone);
+    pthread_cond_destroy(&mCondWork);
+    pthread_mutex_destroy(&mMutex);
+}
+
+void* WorkerPool::workerLoop(void* ptr) {
+    ((WorkerPool*)ptr)->processJobs();
+    return NULL;
+}
+
+void WorkerPool::processJobs() {
+    pthread_mutex_lock(&mMutex);
+    while(true) {
+        while(mJobs.empty() && !mStop) {
+            pthread_cond_wait(&mCondWork, &mMutex);
+        }
+        // Queued jobs are finished before stopping.
+        if(mJobs.empty()) {
+            break;
+        }
+        Job job = mJobs.front();
+        mJobs.pop_front();
+        pthread_mutex_unlock(&mMutex);
+
+        job.mTask->execute();
+
+        pthread_mutex_lock(&mMutex);
+        if(job.mBatch != NULL && --job.mBatch->mPending == 0) {
+            pthread_cond_broadcast(&mCondDone);
+        }
+    }
+    pthread_mutex_unlock(&mMutex);
+}
+
+} // end namespace camera
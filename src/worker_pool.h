@@ -0,0 +1,154 @@
+/*
+ * \file    worker_pool.h
+ *
+ * \brief   Small persistent thread pool used for the image conversions.
+ */
+
+#ifndef _CAM_WORKER_POOL_H_
+#define _CAM_WORKER_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+namespace camera
+{
+
+/**
+ * Fixed number of worker threads waiting for tasks. The threads are created
+ * once and live as long as the pool, so handing out work per frame does not
+ * create any threads. Optionally the workers are pinned to a set of CPUs.
+ */
+class WorkerPool {
+ public:
+    static const unsigned int DEFAULT_NUM_THREADS = 4;
+
+    /**
+     * Unit of work executed by one of the worker threads.
+     */
+    class Task {
+     public:
+        virtual ~Task() {}
+        virtual void execute() = 0;
+    };
+
+    /**
+     * Starts the worker threads.
+     * \param num_threads Number of workers, 0 uses the number of online CPUs
+     * limited to DEFAULT_NUM_THREADS.
+     * \param cpus If not empty worker i is pinned to cpus[i % cpus.size()].
+     * Throws std::runtime_error if a thread could not be created.
+     */
+    WorkerPool(unsigned int num_threads = 0, std::vector<int> const& cpus = std::vector<int>());
+
+    /**
+     * Finishes the queued tasks and joins the workers.
+     */
+    ~WorkerPool();
+
+    inline unsigned int getNumThreads() const {
+        return mThreads.size();
+    }
+
+    /**
+     * Pins worker i to cpus[i % cpus.size()], an empty list allows all CPUs again.
+     * \return false if the affinity could not be set for at least one worker.
+     */
+    bool setAffinity(std::vector<int> const& cpus);
+
+    /**
+     * Executes all passed tasks on the workers and returns as soon as all
+     * of them are finished.
+     */
+    void run(std::vector<Task*> const& tasks);
+
+    /**
+     * Queues the task and returns immediately. The task is not deleted, the caller
+     * has to take care about the synchronization (e.g. the task signals its completion).
+     */
+    void post(Task* task);
+
+    /**
+     * Splits the rows [0, rows) into one band per worker (each band at least
+     * 'min_rows' rows) and calls 'functor(first_row, end_row)' for each band
+     * in parallel. Small images are processed by the calling thread directly.
+     */
+    template<class RowFunctor>
+    void runRowBands(uint32_t rows, RowFunctor const& functor, uint32_t min_rows = 16) {
+        uint32_t num_bands = getNumThreads();
+        if(min_rows > 0 && rows / min_rows < num_bands) {
+            num_bands = rows / min_rows;
+        }
+        if(num_bands <= 1) {
+            functor(0, rows);
+            return;
+        }
+        std::vector<RowBandTask<RowFunctor> > bands;
+        bands.reserve(num_bands);
+        std::vector<Task*> tasks;
+        for(uint32_t i=0; i<num_bands; ++i) {
+            bands.push_back(RowBandTask<RowFunctor>(functor,
+                    (uint64_t)rows * i / num_bands, (uint64_t)rows * (i+1) / num_bands));
+        }
+        for(uint32_t i=0; i<num_bands; ++i) {
+            tasks.push_back(&bands[i]);
+        }
+        run(tasks);
+    }
+
+ private:
+    /**
+     * Counts the unfinished tasks of one run() call.
+     */
+    struct Batch {
+        Batch() : mPending(0) {}
+        unsigned int mPending;
+    };
+
+    struct Job {
+        Job(Task* task, Batch* batch) : mTask(task), mBatch(batch) {}
+        Task* mTask;
+        Batch* mBatch; // NULL for posted tasks.
+    };
+
+    template<class RowFunctor>
+    class RowBandTask : public Task {
+     public:
+        RowBandTask(RowFunctor const& functor, uint32_t first_row, uint32_t end_row) :
+                mFunctor(&functor), mFirstRow(first_row), mEndRow(end_row) {}
+        void execute() {
+            (*mFunctor)(mFirstRow, mEndRow);
+        }
+     private:
+        RowFunctor const* mFunctor;
+        uint32_t mFirstRow;
+        uint32_t mEndRow;
+    };
+
+    WorkerPool(WorkerPool const&);
+    WorkerPool& operator=(WorkerPool const&);
+
+    static void* workerLoop(void* ptr);
+
+    void processJobs();
+
+    /**
+     * Lets the workers finish the queued jobs, joins them and releases the
+     * synchronization primitives.
+     */
+    void stopWorkers();
+
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCondWork;
+    pthread_cond_t mCondDone;
+    std::deque<Job> mJobs;
+    std::vector<pthread_t> mThreads;
+    bool mStop;
+};
+
+} // end namespace camera
+
+#endif
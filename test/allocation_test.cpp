@@ -0,0 +1,162 @@
+/*
+ * \file    allocation_test.cpp
+ *
+ * \brief   Checks that the steady capture of CamUsb does not allocate.
+ *          Own test executable because it replaces the global operator new.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdlib.h>
+
+#include <new>
+
+#include <camera_usb/cam_usb.h>
+
+#if __cplusplus >= 201103L
+#define ALLOCATION_TEST_THROW_BAD_ALLOC
+#define ALLOCATION_TEST_NOTHROW noexcept
+#else
+#define ALLOCATION_TEST_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define ALLOCATION_TEST_NOTHROW throw()
+#endif
+
+/**
+ * Allocations of the calling thread, the GStreamer threads are not counted.
+ */
+static __thread unsigned long tNumAllocations = 0;
+
+static void* countedAlloc(size_t size) {
+    tNumAllocations++;
+    return malloc(size != 0 ? size : 1);
+}
+
+void* operator new(size_t size) ALLOCATION_TEST_THROW_BAD_ALLOC {
+    void* ptr = countedAlloc(size);
+    if(ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) ALLOCATION_TEST_THROW_BAD_ALLOC {
+    void* ptr = countedAlloc(size);
+    if(ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, std::nothrow_t const&) ALLOCATION_TEST_NOTHROW {
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) ALLOCATION_TEST_NOTHROW {
+    return countedAlloc(size);
+}
+
+void operator delete(void* ptr) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::nothrow_t const&) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::nothrow_t const&) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* ptr, size_t) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) ALLOCATION_TEST_NOTHROW {
+    free(ptr);
+}
+#endif
+
+#if defined(__cpp_aligned_new)
+static void* countedAlignedAlloc(size_t size, std::align_val_t alignment) {
+    tNumAllocations++;
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, (size_t)alignment, size != 0 ? size : 1) != 0) {
+        return NULL;
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    void* ptr = countedAlignedAlloc(size, alignment);
+    if(ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    void* ptr = countedAlignedAlloc(size, alignment);
+    if(ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    free(ptr);
+}
+#endif
+
+/**
+ * Counts the allocations of retrieveFrame() once the frame pool and the
+ * frame hold buffers for the image size, for a raw (converted) and a
+ * JPEG test device.
+ */
+static void checkSteadyRetrieveFrame(std::string const& device, 
+        base::samples::frame::frame_mode_t mode) {
+    using namespace base::samples::frame;
+    camera::CamUsb usb(device);
+    std::vector<camera::CamInfo> cam_infos;
+    usb.listCameras(cam_infos);
+    BOOST_REQUIRE(usb.open(cam_infos[0]));
+    BOOST_REQUIRE(usb.setFrameSettings(frame_size_t(320, 240), mode, 3));
+    BOOST_REQUIRE(usb.grab(camera::Continuously));
+
+    Frame frame;
+    const int num_warmup = 10, num_frames = 50;
+    for(int i=0; i<num_warmup; ++i) {
+        BOOST_REQUIRE(usb.retrieveFrame(frame, 2000));
+    }
+    unsigned long num_allocations = tNumAllocations;
+    for(int i=0; i<num_frames; ++i) {
+        BOOST_REQUIRE(usb.retrieveFrame(frame, 2000));
+    }
+    num_allocations = tNumAllocations - num_allocations;
+    BOOST_CHECK_EQUAL(num_allocations, 0u);
+    BOOST_CHECK(usb.grab(camera::Stop));
+}
+
+BOOST_AUTO_TEST_CASE(steady_retrieve_frame_raw_test) {
+    checkSteadyRetrieveFrame("test://320x240@30/YUY2", base::samples::frame::MODE_RGB);
+}
+
+BOOST_AUTO_TEST_CASE(steady_retrieve_frame_jpeg_test) {
+    checkSteadyRetrieveFrame("test://320x240@30/JPEG", base::samples::frame::MODE_JPEG);
+}
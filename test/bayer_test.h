@@ -0,0 +1,169 @@
+/*
+ * \file    bayer_test.h
+ *
+ * \brief   Boost tests for the Bayer formats, no camera required.
+ */
+
+#ifndef _BAYER_TEST_H_
+#define _BAYER_TEST_H_
+
+#include <stdlib.h>
+
+#include <camera_usb/bayer.h>
+#include <camera_usb/worker_pool.h>
+
+/**
+ * Straightforward bilinear demosaicing of a single pixel, used as reference.
+ * Returns 0, 1 or 2 for red, green or blue of the pattern at (x, y).
+ */
+static int bayerColorAt(base::samples::frame::frame_mode_t pattern, uint32_t x, uint32_t y) {
+    using namespace base::samples::frame;
+    const char* colors = pattern == MODE_BAYER_RGGB ? "RGGB" : pattern == MODE_BAYER_GRBG ? "GRBG" :
+            pattern == MODE_BAYER_BGGR ? "BGGR" : "GBRG";
+    char color = colors[(y % 2) * 2 + x % 2];
+    return color == 'R' ? 0 : color == 'G' ? 1 : 2;
+}
+
+static void demosaicReference(std::vector<uint8_t> const& raw, base::samples::frame::frame_mode_t pattern,
+        uint32_t width, uint32_t height, std::vector<uint8_t>& rgb) {
+    rgb.resize(width * height * 3);
+    for(uint32_t y=0; y<height; ++y) {
+        for(uint32_t x=0; x<width; ++x) {
+            for(int channel=0; channel<3; ++channel) {
+                // Mean of the nearest pixels of that color, mirrored at the borders.
+                int sum = 0, count = 0;
+                int distance = bayerColorAt(pattern, x, y) == channel ? 0 : 1;
+                for(int dy=-distance; dy<=distance; ++dy) {
+                    for(int dx=-distance; dx<=distance; ++dx) {
+                        int nx = (int)x + dx, ny = (int)y + dy;
+                        nx = nx < 0 ? 1 : nx >= (int)width ? width - 2 : nx;
+                        ny = ny < 0 ? 1 : ny >= (int)height ? height - 2 : ny;
+                        if(bayerColorAt(pattern, nx, ny) != channel) {
+                            continue;
+                        }
+                        // Green at a green pixel uses the pixel only, at red/blue the 4-neighbours.
+                        if(channel == 1 && distance == 1 && dx != 0 && dy != 0) {
+                            continue;
+                        }
+                        sum += raw[ny * width + nx];
+                        count++;
+                    }
+                }
+                rgb[(y * width + x) * 3 + channel] = (uint8_t)((sum + count / 2) / count);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bayer_formats_test) {
+    using namespace base::samples::frame;
+    using camera::Bayer;
+    Bayer::Format const* format = Bayer::getFormat(V4L2_PIX_FMT_SBGGR8);
+    BOOST_REQUIRE(format != NULL);
+    BOOST_CHECK(format->mode == MODE_BAYER_BGGR && format->depth == 8 && !format->packed);
+    format = Bayer::getFormat(V4L2_PIX_FMT_SGRBG10P);
+    BOOST_REQUIRE(format != NULL);
+    BOOST_CHECK(format->mode == MODE_BAYER_GRBG && format->depth == 10 && format->packed);
+    BOOST_CHECK(Bayer::getFormat(V4L2_PIX_FMT_YUYV) == NULL);
+    BOOST_CHECK(Bayer::findFormat(MODE_BAYER_RGGB, 12, false)->pixelformat == V4L2_PIX_FMT_SRGGB12);
+    BOOST_CHECK(Bayer::findFormat(MODE_BAYER_RGGB, 14, false) == NULL);
+    BOOST_CHECK(Bayer::isBayerMode(MODE_BAYER_GBRG) && !Bayer::isBayerMode(MODE_BAYER));
+}
+
+BOOST_AUTO_TEST_CASE(bayer_unpack_test) {
+    using namespace base::samples::frame;
+    using camera::Bayer;
+    const uint32_t width = 6, height = 2;
+    std::vector<uint16_t> pixels(width * height);
+    for(size_t i=0; i<pixels.size(); ++i) {
+        pixels[i] = (uint16_t)((i * 677 + 3) & 0xFFF);
+    }
+
+    // 10 bit: 6 pixels use 2 groups of 5 bytes, the rows are padded to 12 bytes.
+    std::vector<uint8_t> packed(12 * height, 0);
+    for(uint32_t y=0; y<height; ++y) {
+        for(uint32_t x=0; x<width; ++x) {
+            uint16_t value = pixels[y * width + x] & 0x3FF;
+            uint8_t* group = &packed[y * 12 + x / 4 * 5];
+            group[x % 4] = (uint8_t)(value >> 2);
+            group[4] |= (uint8_t)((value & 0x3) << (2 * (x % 4)));
+        }
+    }
+    std::vector<uint8_t> image;
+    Bayer::copy(packed.data(), *Bayer::findFormat(MODE_BAYER_RGGB, 10, true), width, height, 12, image);
+    BOOST_REQUIRE_EQUAL(image.size(), width * height * 2);
+    const uint16_t* unpacked = (const uint16_t*)image.data();
+    for(size_t i=0; i<pixels.size(); ++i) {
+        BOOST_CHECK_EQUAL(unpacked[i], pixels[i] & 0x3FF);
+    }
+
+    // 12 bit: 2 pixels in 3 bytes, no padding.
+    packed.assign(9 * height, 0);
+    for(uint32_t y=0; y<height; ++y) {
+        for(uint32_t x=0; x<width; ++x) {
+            uint16_t value = pixels[y * width + x];
+            uint8_t* group = &packed[y * 9 + x / 2 * 3];
+            group[x % 2] = (uint8_t)(value >> 4);
+            group[2] |= (uint8_t)((value & 0xF) << (4 * (x % 2)));
+        }
+    }
+    Bayer::copy(packed.data(), *Bayer::findFormat(MODE_BAYER_RGGB, 12, true), width, height, 0, image);
+    unpacked = (const uint16_t*)image.data();
+    for(size_t i=0; i<pixels.size(); ++i) {
+        BOOST_CHECK_EQUAL(unpacked[i], pixels[i]);
+    }
+
+    // Unpacked formats are copied as they are, only the padding is removed.
+    std::vector<uint8_t> raw(16 * height);
+    for(size_t i=0; i<raw.size(); ++i) {
+        raw[i] = (uint8_t)i;
+    }
+    Bayer::copy(raw.data(), *Bayer::findFormat(MODE_BAYER_RGGB, 10, false), width, height, 16, image);
+    BOOST_REQUIRE_EQUAL(image.size(), width * height * 2);
+    BOOST_CHECK(memcmp(image.data(), raw.data(), 12) == 0);
+    BOOST_CHECK(memcmp(image.data() + 12, raw.data() + 16, 12) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(bayer_demosaic_test) {
+    using namespace base::samples::frame;
+    using camera::Bayer;
+    // Odd width and height exercise the borders.
+    const uint32_t width = 37, height = 23;
+    std::vector<uint8_t> raw(width * height);
+    srand(7);
+    for(size_t i=0; i<raw.size(); ++i) {
+        raw[i] = (uint8_t)(rand() % 256);
+    }
+
+    camera::WorkerPool pool(3);
+    frame_mode_t patterns[] = {MODE_BAYER_RGGB, MODE_BAYER_GRBG, MODE_BAYER_BGGR, MODE_BAYER_GBRG};
+    for(int p=0; p<4; ++p) {
+        Bayer::Format const& format = *Bayer::findFormat(patterns[p], 8, false);
+        std::vector<uint8_t> expected, rgb, bgr, rgb_pool;
+        demosaicReference(raw, patterns[p], width, height, expected);
+        Bayer::demosaic(raw.data(), format, width, height, 0, MODE_RGB, rgb, NULL);
+        BOOST_CHECK(rgb == expected);
+        Bayer::demosaic(raw.data(), format, width, height, 0, MODE_BGR, bgr, NULL);
+        BOOST_REQUIRE_EQUAL(bgr.size(), rgb.size());
+        bool swapped = true;
+        for(size_t i=0; i<rgb.size(); i+=3) {
+            swapped &= bgr[i] == rgb[i+2] && bgr[i+1] == rgb[i+1] && bgr[i+2] == rgb[i];
+        }
+        BOOST_CHECK(swapped);
+        Bayer::demosaic(raw.data(), format, width, height, 0, MODE_RGB, rgb_pool, &pool);
+        BOOST_CHECK(rgb_pool == rgb);
+    }
+
+    // Padded rows.
+    const uint32_t stride = 40;
+    std::vector<uint8_t> padded(stride * height, 0xFF), expected, rgb;
+    for(uint32_t y=0; y<height; ++y) {
+        memcpy(&padded[y * stride], &raw[y * width], width);
+    }
+    Bayer::Format const& format = *Bayer::findFormat(MODE_BAYER_BGGR, 8, false);
+    Bayer::demosaic(raw.data(), format, width, height, 0, MODE_RGB, expected, NULL);
+    Bayer::demosaic(padded.data(), format, width, height, stride, MODE_RGB, rgb, NULL);
+    BOOST_CHECK(rgb == expected);
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * \file    fake_v4l2_test.h
+ *
+ * \brief   Boost tests for class CamConfig on the FakeV4L2Device, no camera required.
+ */
+
+#ifndef _FAKE_V4L2_TEST_H_
+#define _FAKE_V4L2_TEST_H_
+
+#include <camera_usb/cam_config.h>
+#include <camera_usb/fake_v4l2_device.h>
+
+#include <errno.h>
+#include <sys/mman.h>
+
+BOOST_AUTO_TEST_CASE(fake_v4l2_config_test) {
+    camera::CamConfig config(new camera::FakeV4L2Device());
+    BOOST_CHECK_EQUAL(config.getCapabilityCard(), "Fake V4L2 Camera");
+    BOOST_CHECK_EQUAL(config.getFd(), -1);
+
+    // Controls of TestControls.
+    int32_t value = 0;
+    BOOST_CHECK(config.isControlIdValid(V4L2_CID_BRIGHTNESS));
+    BOOST_CHECK(config.getControlValue(V4L2_CID_BRIGHTNESS, &value));
+    BOOST_CHECK_EQUAL(value, 128);
+    config.writeControlValue(V4L2_CID_BRIGHTNESS, 1000); // Clamped by CamConfig.
+    BOOST_CHECK_EQUAL(config.readControlValue(V4L2_CID_BRIGHTNESS), 255);
+
+    // The closest size is chosen, RGB is converted from YUYV.
+    uint32_t pixelformat = config.toV4L2ImageFormat(base::samples::frame::MODE_RGB, 1280, 720);
+    BOOST_CHECK_EQUAL(pixelformat, (uint32_t)V4L2_PIX_FMT_YUYV);
+    config.writeImagePixelFormat(1300, 700, pixelformat);
+    uint32_t width = 0, height = 0;
+    BOOST_CHECK(config.getOutputImageSize(&width, &height));
+    BOOST_CHECK_EQUAL(width, 1280u);
+    BOOST_CHECK_EQUAL(height, 720u);
+
+    float fps = 0;
+    config.writeFPS(15);
+    BOOST_CHECK(config.readFPS(&fps));
+    BOOST_CHECK_EQUAL(fps, 15);
+    config.writeFPS(100); // Limited to the maximum of the format.
+    BOOST_CHECK(config.readFPS(&fps));
+    BOOST_CHECK_EQUAL(fps, 30);
+}
+
+BOOST_AUTO_TEST_CASE(fake_v4l2_formats_test) {
+    camera::FakeV4L2Device device;
+    std::vector<camera::FakeV4L2Device::Format> formats;
+    BOOST_CHECK_THROW(device.setFormats(formats), std::runtime_error);
+    camera::FakeV4L2Device::Format format = {V4L2_PIX_FMT_YUYV, 320, 240, 0};
+    formats.push_back(format);
+    BOOST_CHECK_THROW(device.setFormats(formats), std::runtime_error);
+    formats[0].mMaxFps = 30;
+    formats[0].mWidth = 0;
+    BOOST_CHECK_THROW(device.setFormats(formats), std::runtime_error);
+    formats[0].mWidth = 320;
+    formats[0].mHeight = 0;
+    BOOST_CHECK_THROW(device.setFormats(formats), std::runtime_error);
+    formats[0].mHeight = 240;
+    BOOST_CHECK_NO_THROW(device.setFormats(formats));
+}
+
+BOOST_AUTO_TEST_CASE(fake_v4l2_capture_test) {
+    camera::FakeV4L2Device* device = new camera::FakeV4L2Device();
+    std::vector<camera::FakeV4L2Device::Format> formats;
+    camera::FakeV4L2Device::Format format = {V4L2_PIX_FMT_YUYV, 320, 240, 200};
+    formats.push_back(format);
+    device->setFormats(formats);
+    device->setLatency(2000);
+    device->setDropInterval(4);
+    device->setManualClock(true);
+
+    camera::CamConfig config(device);
+    config.toV4L2ImageFormat(base::samples::frame::MODE_RGB, 320, 240);
+    config.writeImagePixelFormat(320, 240, V4L2_PIX_FMT_YUYV);
+    config.writeFPS(200);
+    config.setRowPadding(1);
+    config.initRequesting();
+
+    std::vector<uint8_t> buffer;
+    for(int i=0; i<20; ++i) {
+        BOOST_REQUIRE(config.getBuffer(buffer, true, 1000));
+    }
+    BOOST_CHECK_EQUAL(buffer.size(), 320u * 240 * 3);
+    BOOST_CHECK_EQUAL(device->getNumFrames(), 20u);
+    // Frame 0 is captured at STREAMON before the buffer is queued, frames 3, 7, 
+    // ..., 23 are dropped by the interval. The 20th frame is frame 26.
+    BOOST_CHECK_EQUAL(device->getNumDroppedFrames(), 7u);
+
+    // Every frame is dequeued as soon as the transfer is done.
+    camera::LatencyHistogram latency = device->getDequeueLatency();
+    BOOST_CHECK_EQUAL(latency.getCount(), 20u);
+    BOOST_CHECK_EQUAL(latency.getMin(), 2000);
+    BOOST_CHECK_EQUAL(latency.getMax(), 2000);
+
+    // A slow application misses the frames captured while no buffer is queued:
+    // frames 27 and 28 at 135 and 140 msec.
+    device->advanceTime(12000);
+    BOOST_CHECK_EQUAL(device->getNumDroppedFrames(), 9u);
+    BOOST_REQUIRE(config.getBuffer(buffer, true, 1000));
+    BOOST_CHECK_EQUAL(device->getNumFrames(), 21u);
+
+    // Nothing is captured while every frame is dropped: the timeout is reached
+    // after the 10 frames within the 50 msec.
+    device->setDropInterval(1);
+    BOOST_CHECK(!config.getBuffer(buffer, true, 50));
+    BOOST_CHECK_EQUAL(device->getNumFrames(), 21u);
+    BOOST_CHECK_EQUAL(device->getNumDroppedFrames(), 19u);
+    config.cleanupRequesting();
+}
+
+/**
+ * Fails every ioctl with an io-error and reports its deletion.
+ */
+class FailingV4L2Device : public camera::V4L2Device {
+ public:
+    FailingV4L2Device(bool* deleted) : mDeleted(deleted) {}
+    ~FailingV4L2Device() { *mDeleted = true; }
+    int getFd() const { return -1; }
+    int ioctl(unsigned long request, void* arg) { errno = EIO; return -1; }
+    void* mmap(size_t length, off_t offset) { errno = EIO; return MAP_FAILED; }
+    int munmap(void* addr, size_t length) { return 0; }
+    int waitForBuffer(int32_t timeout_ms) { errno = EIO; return -1; }
+
+ private:
+    bool* mDeleted;
+};
+
+BOOST_AUTO_TEST_CASE(fake_v4l2_failing_device_test) {
+    // The constructor throws, the device is deleted anyway.
+    bool deleted = false;
+    BOOST_CHECK_THROW(camera::CamConfig config(new FailingV4L2Device(&deleted)), 
+            std::runtime_error);
+    BOOST_CHECK(deleted);
+}
+
+BOOST_AUTO_TEST_CASE(fake_v4l2_mjpeg_test) {
+    camera::FakeV4L2Device* device = new camera::FakeV4L2Device();
+    std::vector<camera::FakeV4L2Device::Format> formats;
+    camera::FakeV4L2Device::Format format = {V4L2_PIX_FMT_MJPEG, 640, 480, 60};
+    formats.push_back(format);
+    device->setFormats(formats);
+
+    // Without YUYV the RGB images are decoded from the test pattern.
+    camera::CamConfig config(device);
+    uint32_t pixelformat = config.toV4L2ImageFormat(base::samples::frame::MODE_RGB, 640, 480);
+    BOOST_CHECK_EQUAL(pixelformat, (uint32_t)V4L2_PIX_FMT_MJPEG);
+    config.writeImagePixelFormat(640, 480, pixelformat);
+    config.setRowPadding(1);
+    config.initRequesting();
+    std::vector<uint8_t> buffer;
+    for(int i=0; i<5; ++i) {
+        BOOST_REQUIRE(config.getBuffer(buffer, true, 1000));
+    }
+    BOOST_CHECK_EQUAL(buffer.size(), 640u * 480 * 3);
+    config.cleanupRequesting();
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * \file    frame_pool_test.h
+ *
+ * \brief   Boost tests for the frame pool, no camera required.
+ */
+
+#ifndef _FRAME_POOL_TEST_H_
+#define _FRAME_POOL_TEST_H_
+
+#include <base/samples/Frame.hpp>
+
+#include <camera_usb/frame_pool.h>
+
+BOOST_AUTO_TEST_CASE(frame_pool_size_class_test) {
+    using camera::FramePool;
+    BOOST_CHECK_EQUAL(FramePool::getSizeClass(1), FramePool::MIN_CAPACITY);
+    BOOST_CHECK_EQUAL(FramePool::getSizeClass(4096), 4096u);
+    BOOST_CHECK_EQUAL(FramePool::getSizeClass(4097), 5120u);
+    BOOST_CHECK_EQUAL(FramePool::getSizeClass(8192), 8192u);
+    BOOST_CHECK_EQUAL(FramePool::getSizeClass(1920 * 1080 * 3), 6291456u);
+
+    FramePool pool(2);
+    std::vector<uint8_t> a, b, c;
+    pool.reserve(a, 10000);
+    BOOST_CHECK_EQUAL(a.capacity(), FramePool::getSizeClass(10000));
+    pool.reserve(b, 50000);
+    pool.reserve(c, 20000);
+    pool.release(a);
+    pool.release(b);
+    BOOST_CHECK(a.empty() && b.empty());
+    BOOST_CHECK_EQUAL(pool.getNumFreeBuffers(), 2u);
+    // Full, the smallest buffer is replaced.
+    pool.release(c);
+    BOOST_CHECK_EQUAL(pool.getNumFreeBuffers(), 2u);
+
+    // The smallest fitting buffer is borrowed, the too small one is kept.
+    std::vector<uint8_t> d(100);
+    pool.reserve(d, 15000);
+    BOOST_CHECK_EQUAL(d.capacity(), FramePool::getSizeClass(20000));
+    BOOST_CHECK_EQUAL(pool.getNumFreeBuffers(), 2u);
+    BOOST_CHECK_EQUAL(pool.getNumAllocations(), 3u);
+    pool.clear();
+    BOOST_CHECK_EQUAL(pool.getNumFreeBuffers(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(frame_pool_steady_state_test) {
+    using namespace base::samples::frame;
+    // Images of varying size (e.g. MJPEG) are swapped into the frames, the
+    // consumer holds two frames and releases the older one. The pool stops
+    // allocating once it holds buffers for all size classes in use, the
+    // allocations of CamUsb::retrieveFrame() are checked by allocation_test.cpp.
+    camera::FramePool pool;
+    std::vector<uint8_t> buffer;
+    Frame frames[3];
+    unsigned int seed = 1;
+    uint64_t num_allocations = 0;
+    const int num_warmup = 100, num_images = 300;
+    for(int i=0; i<num_images; ++i) {
+        if(i == num_warmup) {
+            num_allocations = pool.getNumAllocations();
+        }
+        seed = seed * 1103515245 + 12345;
+        size_t size = 20000 + (seed >> 8) % 60000;
+        pool.reserve(buffer, size);
+        buffer.resize(size);
+        buffer[0] = 0xFF;
+
+        Frame& frame = frames[i % 3];
+        pool.reserve(frame.image, buffer.size());
+        frame.init(640, 480, 8, MODE_JPEG, -1, buffer.size());
+        frame.image.swap(buffer);
+        pool.release(frames[(i + 1) % 3].image);
+    }
+    BOOST_CHECK_EQUAL(pool.getNumAllocations(), num_allocations);
+    BOOST_CHECK_LE(pool.getNumAllocations(), 8u);
+}
+
+#endif
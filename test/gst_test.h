@@ -14,6 +14,7 @@
 #ifndef _GST_TEST_H_
 #define _GST_TEST_H_
 
+#include <dirent.h>
 #include <stdio.h>
 
 extern "C" {
@@ -25,6 +26,39 @@ extern "C" {
 #include "camera_usb/cam_gst.h"
 #include <camera_usb/helpers.h>
 
+BOOST_AUTO_TEST_CASE(frame_handle_test) {
+    gst_init(NULL, NULL);
+    GstCaps* caps = gst_caps_from_string("video/x-raw,format=RGB,width=322,height=240");
+    GstBuffer* buffer = gst_buffer_new_allocate(NULL, 968 * 240, NULL);
+    GstSample* sample = gst_sample_new(buffer, caps, NULL, NULL);
+    gst_buffer_unref(buffer);
+    gst_caps_unref(caps);
+
+    // Every copy holds its own reference and mapping.
+    camera::GstFrameHandle handle(sample);
+    camera::GstFrameHandle copy(handle);
+    handle.reset();
+    BOOST_CHECK(!handle.isValid());
+    BOOST_CHECK(handle.data() == NULL);
+    BOOST_CHECK(copy.isValid());
+    BOOST_CHECK_EQUAL(copy.size(), 968u * 240);
+    BOOST_CHECK_EQUAL(copy.stride(), 968u);
+
+    // Reassigning the same sample keeps it alive.
+    copy.reset(copy.sample());
+    handle = copy;
+    copy = copy;
+    BOOST_CHECK(handle.data() == copy.data());
+    uint32_t width = 0, height = 0;
+    base::samples::frame::frame_mode_t mode = base::samples::frame::MODE_UNDEFINED;
+    BOOST_CHECK(handle.getFormat(&width, &height, &mode));
+    BOOST_CHECK_EQUAL(width, 322u);
+    BOOST_CHECK_EQUAL(mode, base::samples::frame::MODE_RGB);
+    handle.reset();
+    copy.reset();
+    gst_sample_unref(sample);
+}
+
 BOOST_AUTO_TEST_CASE(default_pipeline_test) {
     camera::CamGst gst("/dev/video0");
     BOOST_CHECK(gst.startPipeline() == false);
@@ -112,4 +146,334 @@ BOOST_AUTO_TEST_CASE(request_image_test) {
             img_received << std::endl;
 }
 
+BOOST_AUTO_TEST_CASE(raw_pipeline_test) {
+    // The test source delivers YUY2 like most cameras, so RGB is converted 
+    // and UYVY passed as it is.
+    camera::CamGst gst("test://640x480@30/YUY2");
+    std::vector<uint8_t> buffer;
+    const uint32_t width = 640, height = 480;
+    
+    base::samples::frame::frame_mode_t modes[] = {base::samples::frame::MODE_RGB,
+            base::samples::frame::MODE_GRAYSCALE, base::samples::frame::MODE_UYVY};
+    uint32_t pixel_sizes[] = {3, 1, 2};
+    for(int m=0; m<3; ++m) {
+        std::cout << "Create raw pipeline, mode " << modes[m] << std::endl;
+        try {
+            gst.createDefaultPipeline(true, width, height, 0, 
+                    camera::CamGst::DEFAULT_BPP, modes[m]);
+        } catch (std::runtime_error &e) {
+            BOOST_ERROR(e.what());
+            continue;
+        }
+        BOOST_CHECK(gst.startPipeline() == true);
+        if(gst.getBuffer(buffer, true, 2000)) {
+            // The rows may be padded to 4 bytes.
+            BOOST_CHECK(buffer.size() >= width * height * pixel_sizes[m]);
+        } else {
+            BOOST_ERROR("No raw image received");
+        }
+        gst.deletePipeline();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(custom_pipeline_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("/dev/video0");
+    std::string launch = camera::CamGst::expandPipelineDescription(
+            "v4l2src device=${device} ! ${caps} ! videoflip ! ${caps}", "/dev/video1", 
+            320, 240, 30, MODE_RGB);
+    std::cout << "Expanded pipeline: " << launch << std::endl;
+    BOOST_CHECK(launch.find("v4l2src device=/dev/video1 ! video/x-raw") == 0);
+    BOOST_CHECK(launch.find("format=(string)RGB") != std::string::npos);
+    BOOST_CHECK(launch.find("width=(int)320") != std::string::npos);
+    BOOST_CHECK(launch.find("${") == std::string::npos);
+
+    // The test source does not require a camera.
+    try {
+        gst.createCustomPipeline("videotestsrc ! ${caps}", 320, 240, 30, MODE_RGB);
+    } catch (std::runtime_error &e) {
+        BOOST_FAIL(e.what());
+    }
+    BOOST_CHECK(gst.startPipeline() == true);
+    std::vector<uint8_t> buffer;
+    BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+    BOOST_CHECK_EQUAL(buffer.size(), 320 * 240 * 3);
+    gst.deletePipeline();
+
+    BOOST_CHECK_THROW(gst.createCustomPipeline("videotestsrc ! no_such_element"), 
+            std::runtime_error);
+}
+
+static void startCallback(bool success, void* data) {
+    *(volatile int*)data = success ? 1 : 0;
+}
+
+/**
+ * The callback may run after waitForPipeline() returned.
+ */
+static int waitForCallback(volatile int& result) {
+    for(int i=0; i<200 && result == -1; ++i) {
+        usleep(10000);
+    }
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(async_start_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("/dev/video0");
+    BOOST_CHECK(gst.startPipelineAsync() == false);
+    gst.createCustomPipeline("videotestsrc is-live=true ! ${caps}", 320, 240, 30, MODE_RGB);
+    BOOST_CHECK_EQUAL(gst.getFirstFrameLatency(), -1);
+
+    volatile int result = -1;
+    BOOST_CHECK(gst.startPipelineAsync(startCallback, (void*)&result));
+    BOOST_CHECK(gst.waitForPipeline(2000));
+    BOOST_CHECK_EQUAL(gst.getPipelineState(), camera::CamGst::PIPELINE_RUNNING);
+    BOOST_CHECK_EQUAL(waitForCallback(result), 1);
+    BOOST_CHECK(gst.getStartLatency() >= 0);
+
+    camera::GstFrameHandle handle;
+    BOOST_CHECK(gst.getFrame(handle, true, 2000));
+    BOOST_CHECK(gst.getFirstFrameLatency() >= gst.getStartLatency());
+    std::cout << "Start latency " << gst.getStartLatency() << " usec, first frame " << 
+            gst.getFirstFrameLatency() << " usec" << std::endl;
+
+    // Restart: the latencies are measured again.
+    result = -1;
+    BOOST_CHECK(gst.restartPipeline(startCallback, (void*)&result));
+    BOOST_CHECK(gst.waitForPipeline(2000));
+    BOOST_CHECK_EQUAL(waitForCallback(result), 1);
+    gst.deletePipeline();
+    BOOST_CHECK_EQUAL(gst.getPipelineState(), camera::CamGst::PIPELINE_STOPPED);
+
+    // An element which can not be started reports the error.
+    gst.createCustomPipeline("filesrc location=/no/such/file ! jpegdec ! ${caps}", 
+            320, 240, 30, MODE_RGB);
+    gst.startPipelineAsync();
+    BOOST_CHECK(gst.waitForPipeline(2000) == false);
+    BOOST_CHECK(gst.getPipelineState() != camera::CamGst::PIPELINE_RUNNING);
+    gst.deletePipeline();
+}
+
+BOOST_AUTO_TEST_CASE(prewarm_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("/dev/video0");
+    BOOST_CHECK(gst.prewarmPipeline() == false);
+    gst.createCustomPipeline("videotestsrc ! ${caps}", 320, 240, 30, MODE_RGB);
+    BOOST_CHECK(gst.prewarmPipeline(GST_STATE_PLAYING) == false);
+    BOOST_CHECK(gst.prewarmPipeline(GST_STATE_READY));
+    BOOST_CHECK(gst.waitForPipeline(2000));
+    // Prewarming again is possible, e.g. from READY to PAUSED.
+    BOOST_CHECK(gst.prewarmPipeline(GST_STATE_PAUSED));
+    BOOST_CHECK(gst.waitForPipeline(2000));
+    BOOST_CHECK_EQUAL(gst.getPipelineState(), camera::CamGst::PIPELINE_PREWARMED);
+
+    BOOST_CHECK(gst.startPipeline());
+    BOOST_CHECK(gst.prewarmPipeline() == false);
+    std::vector<uint8_t> buffer;
+    BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+    BOOST_CHECK_EQUAL(buffer.size(), 320 * 240 * 3);
+    std::cout << "Prewarmed start latency " << gst.getStartLatency() << " usec, first frame " << 
+            gst.getFirstFrameLatency() << " usec" << std::endl;
+    gst.deletePipeline();
+}
+
+static int countThreads() {
+    int num_threads = 0;
+    DIR* dir = opendir("/proc/self/task");
+    while(dir != NULL && readdir(dir) != NULL) {
+        num_threads++;
+    }
+    if(dir != NULL) {
+        closedir(dir);
+    }
+    return num_threads - 2; // . and ..
+}
+
+BOOST_AUTO_TEST_CASE(shared_main_loop_test) {
+    using base::samples::frame::MODE_RGB;
+    BOOST_CHECK_EQUAL(camera::CamGst::getNumMainLoopUsers(), 0u);
+    int num_threads = countThreads();
+
+    // Mode switches of CamUsb create and delete instances.
+    for(int i=0; i<100; ++i) {
+        camera::CamGst gst("/dev/video0");
+    }
+    BOOST_CHECK_EQUAL(countThreads(), num_threads);
+
+    camera::CamGst gst1("/dev/video0"), gst2("/dev/video1"), gst3("/dev/video2");
+    BOOST_CHECK_EQUAL(camera::CamGst::getNumMainLoopUsers(), 3u);
+    BOOST_CHECK_EQUAL(countThreads(), num_threads + 1);
+
+    // The bus messages of both pipelines are dispatched by the shared thread.
+    gst1.createCustomPipeline("videotestsrc ! ${caps}", 320, 240, 30, MODE_RGB);
+    gst2.createCustomPipeline("videotestsrc ! ${caps}", 160, 120, 30, MODE_RGB);
+    BOOST_CHECK(gst1.startPipeline());
+    BOOST_CHECK(gst2.startPipeline());
+}
+
+BOOST_AUTO_TEST_CASE(renegotiate_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("test://640x480@30/YUY2");
+    // Custom pipelines can not be renegotiated.
+    gst.createCustomPipeline("videotestsrc ! ${caps}", 320, 240, 30, MODE_RGB);
+    BOOST_CHECK(gst.startPipeline());
+    BOOST_CHECK(gst.renegotiate(160, 120) == false);
+    gst.deletePipeline();
+
+    for(int software=0; software<2; ++software) {
+        gst.setSoftwareResize(software != 0);
+        try {
+            gst.createDefaultPipeline(true, 640, 480, 30, camera::CamGst::DEFAULT_BPP, MODE_RGB);
+        } catch (std::runtime_error &e) {
+            BOOST_FAIL(e.what());
+        }
+        BOOST_CHECK(gst.startPipeline());
+        std::vector<uint8_t> buffer;
+        BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+        BOOST_CHECK(gst.renegotiate(320, 240));
+        std::cout << (software ? "Software" : "Camera") << " renegotiation gap " << 
+                gst.getRenegotiationGap() << " usec" << std::endl;
+        gst.skipBuffer();
+        BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+        BOOST_CHECK_EQUAL(buffer.size(), 320 * 240 * 3);
+
+        // Nothing changes: no new caps arrive, no waiting for them.
+        BOOST_CHECK(gst.renegotiate(320, 240, 0, 10000));
+        BOOST_CHECK_EQUAL(gst.getRenegotiationGap(), 0);
+        gst.deletePipeline();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(buffer_pool_test) {
+    using base::samples::frame::MODE_RGB;
+    GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB",
+            "width", G_TYPE_INT, 321, "height", G_TYPE_INT, 240, (void*)NULL);
+    // Rows are padded to 4 bytes.
+    BOOST_CHECK_EQUAL(camera::CamGst::getPoolBufferSize(caps), 964u * 240);
+    gst_caps_unref(caps);
+    caps = gst_caps_new_simple("image/jpeg", "width", G_TYPE_INT, 320, 
+            "height", G_TYPE_INT, 240, (void*)NULL);
+    BOOST_CHECK_EQUAL(camera::CamGst::getPoolBufferSize(caps), 0u);
+    gst_caps_unref(caps);
+
+    // The videoconvert output is written into the pool of the appsink.
+    camera::CamGst gst("/dev/video0");
+    gst.setBufferPoolSize(8);
+    try {
+        gst.createCustomPipeline("videotestsrc ! video/x-raw,format=I420 ! videoconvert ! ${caps}", 
+                321, 240, 30, MODE_RGB);
+    } catch (std::runtime_error &e) {
+        BOOST_FAIL(e.what());
+    }
+    BOOST_CHECK(gst.startPipeline());
+    // Held handles keep their buffers, the others return to the pool.
+    camera::GstFrameHandle handles[3];
+    for(int i=0; i<30; ++i) {
+        BOOST_CHECK(gst.getFrame(handles[i % 3], true, 2000));
+    }
+    BOOST_CHECK_GT(gst.getNumPoolFrames(), 0u);
+    for(int i=0; i<3; ++i) {
+        GstBuffer* buffer = gst_sample_get_buffer(handles[i].sample());
+        BOOST_CHECK(buffer->pool != NULL);
+        BOOST_CHECK_EQUAL(handles[i].size(), 964u * 240);
+        BOOST_CHECK_EQUAL(handles[i].stride(), 964u);
+        BOOST_CHECK_EQUAL(handles[i].offset(), 0u);
+        BOOST_CHECK_EQUAL((size_t)handles[i].data() % camera::CamGst::POOL_ALIGNMENT, 0u);
+    }
+    gst.deletePipeline();
+    BOOST_CHECK_EQUAL(gst.getNumPoolFrames(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(source_queue_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("test://1280x720@30/YUY2");
+    gst.setSourceQueue(2);
+    try {
+        gst.createDefaultPipeline(true, 1280, 720, 30, camera::CamGst::DEFAULT_BPP, MODE_RGB);
+    } catch (std::runtime_error &e) {
+        BOOST_FAIL(e.what());
+    }
+    BOOST_CHECK(gst.startPipeline());
+    std::vector<uint8_t> buffer;
+    for(int i=0; i<10; ++i) {
+        BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+    }
+    camera::CamGst::Statistics statistics = gst.getStatistics();
+    std::cout << "Received " << statistics.mNumFrames << " frames, dropped " << 
+            statistics.mNumQueueDrops << " in the source queue and " << 
+            statistics.mNumSinkDrops << " in the sink" << std::endl;
+    BOOST_CHECK_GE(statistics.mNumFrames, 10u);
+    gst.deletePipeline();
+    BOOST_CHECK_EQUAL(gst.getStatistics().mNumFrames, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(latency_tracing_test) {
+    using base::samples::frame::MODE_RGB;
+    camera::CamGst gst("/dev/video0");
+    gst.setLatencyTracing(true);
+    try {
+        gst.createCustomPipeline("videotestsrc is-live=true name=src ! "
+                "video/x-raw,format=YUY2 ! videoconvert name=convert ! ${caps}", 
+                320, 240, 30, MODE_RGB);
+    } catch (std::runtime_error &e) {
+        BOOST_FAIL(e.what());
+    }
+    BOOST_CHECK(gst.startPipeline());
+    camera::GstFrameHandle handle;
+    for(int i=0; i<20; ++i) {
+        BOOST_CHECK(gst.getFrame(handle, true, 2000));
+    }
+    std::vector<camera::LatencyTracer::Stage> stages = gst.getLatencyStages();
+    // src, capsfilter, convert, capsfilter, appsink and handoff.
+    BOOST_REQUIRE_EQUAL(stages.size(), 6u);
+    BOOST_CHECK_EQUAL(stages[0].mName, "src");
+    BOOST_CHECK_EQUAL(stages[2].mName, "convert");
+    BOOST_CHECK_EQUAL(stages[5].mName, "handoff");
+    for(unsigned int i=0; i<stages.size(); ++i) {
+        std::cout << stages[i].mName << ": " << stages[i].mHistogram.toString() << std::endl;
+        BOOST_CHECK_GT(stages[i].mHistogram.getCount(), 0u);
+    }
+    gst.deletePipeline();
+    BOOST_CHECK(gst.getLatencyStages().empty());
+}
+
+BOOST_AUTO_TEST_CASE(output_pipeline_test) {
+    using namespace base::samples::frame;
+    camera::CamGst gst("/dev/video0");
+    gst.addOutput("preview", "videoscale ! video/x-raw,width=160,height=120", 2);
+    gst.addOutput("gray", "videoconvert ! video/x-raw,format=GRAY8");
+    try {
+        gst.createCustomPipeline("videotestsrc ! ${caps}", 320, 240, 30, MODE_RGB);
+    } catch (std::runtime_error &e) {
+        BOOST_FAIL(e.what());
+    }
+    BOOST_CHECK(gst.startPipeline() == true);
+
+    // The default sink still receives the full resolution images.
+    std::vector<uint8_t> buffer;
+    BOOST_CHECK(gst.getBuffer(buffer, true, 2000));
+    BOOST_CHECK_EQUAL(buffer.size(), 320 * 240 * 3);
+
+    camera::GstFrameHandle handle;
+    uint32_t width = 0, height = 0;
+    frame_mode_t mode = MODE_UNDEFINED;
+    BOOST_CHECK(gst.getOutputFrame("preview", handle, 2000));
+    BOOST_CHECK(handle.getFormat(&width, &height, &mode));
+    BOOST_CHECK_EQUAL(width, 160u);
+    BOOST_CHECK_EQUAL(height, 120u);
+    BOOST_CHECK_EQUAL(mode, MODE_RGB);
+    BOOST_CHECK_EQUAL(handle.size(), 160u * 120 * 3);
+
+    BOOST_CHECK(gst.getOutputFrame("gray", handle, 2000));
+    BOOST_CHECK(handle.getFormat(&width, &height, &mode));
+    BOOST_CHECK_EQUAL(width, 320u);
+    BOOST_CHECK_EQUAL(mode, MODE_GRAYSCALE);
+    BOOST_CHECK_EQUAL(handle.size(), 320u * 240);
+    BOOST_CHECK_EQUAL(handle.stride(), 320u);
+
+    BOOST_CHECK(!gst.getOutputFrame("no_such_output", handle));
+    gst.deletePipeline();
+}
+
 #endif
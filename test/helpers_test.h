@@ -0,0 +1,226 @@
+/*
+ * \file    helpers_test.h
+ *  
+ * \brief   Boost tests for the image conversions, no camera required.
+ */
+
+#ifndef _HELPERS_TEST_H_
+#define _HELPERS_TEST_H_
+
+#include <camera_usb/helpers.h>
+#include <camera_usb/worker_pool.h>
+
+BOOST_AUTO_TEST_CASE(parallel_yuyv_conversion_test) {
+    const uint32_t width = 642, height = 483; // Bands of different size.
+    std::vector<uint8_t> yuyv(width * height * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 31 + i / 7);
+    }
+    camera::Helpers helpers;
+
+    std::vector<uint8_t> rgb_serial;
+    helpers.convertYUYV2RGB(yuyv.data(), yuyv.size(), rgb_serial);
+    BOOST_REQUIRE_EQUAL(rgb_serial.size(), width * height * 3);
+
+    for(unsigned int threads=1; threads<=4; ++threads) {
+        camera::WorkerPool pool(threads);
+        BOOST_CHECK_EQUAL(pool.getNumThreads(), threads);
+        std::vector<uint8_t> rgb_parallel;
+        helpers.convertYUYV2RGB(yuyv.data(), width, height, rgb_parallel, &pool);
+        BOOST_CHECK(rgb_parallel == rgb_serial);
+    }
+}
+
+/**
+ * Converts a single YUV pixel (one YUYV pair with equal Y values).
+ */
+static void convertYUV(camera::Helpers const& helpers, uint8_t y, uint8_t u, uint8_t v,
+        int& r, int& g, int& b) {
+    uint8_t yuyv[4] = {y, u, y, v};
+    uint8_t rgb[6];
+    helpers.convertYUYV2RGBPixels(yuyv, rgb, 2);
+    r = rgb[0]; g = rgb[1]; b = rgb[2];
+}
+
+BOOST_AUTO_TEST_CASE(yuv_tables_test) {
+    using camera::Helpers;
+    // Shared by all instances.
+    BOOST_CHECK_EQUAL(&Helpers::getYuvTables(Helpers::YUV_BT709, Helpers::YUV_RANGE_FULL), 
+            &Helpers::getYuvTables(Helpers::YUV_BT709, Helpers::YUV_RANGE_FULL));
+
+    Helpers helpers;
+    int r, g, b;
+    // Limited range black and white.
+    convertYUV(helpers, 16, 128, 128, r, g, b);
+    BOOST_CHECK(r == 0 && g == 0 && b == 0);
+    convertYUV(helpers, 235, 128, 128, r, g, b);
+    BOOST_CHECK(r == 255 && g == 255 && b == 255);
+    // BT.601 limited red.
+    convertYUV(helpers, 81, 90, 240, r, g, b);
+    BOOST_CHECK(r >= 253 && g <= 2 && b <= 2);
+
+    helpers.setColorspace(V4L2_COLORSPACE_REC709);
+    // BT.709 limited red and blue.
+    convertYUV(helpers, 63, 102, 240, r, g, b);
+    BOOST_CHECK(r >= 253 && g <= 2 && b <= 2);
+    convertYUV(helpers, 32, 240, 118, r, g, b);
+    BOOST_CHECK(r <= 2 && g <= 2 && b >= 253);
+
+    helpers.setColorspace(V4L2_COLORSPACE_JPEG);
+    // Full range keeps the luma, BT.601 green.
+    convertYUV(helpers, 128, 128, 128, r, g, b);
+    BOOST_CHECK(r == 128 && g == 128 && b == 128);
+    convertYUV(helpers, 150, 44, 21, r, g, b);
+    BOOST_CHECK(r <= 2 && g >= 253 && b <= 2);
+}
+
+BOOST_AUTO_TEST_CASE(yuyv_conversions_test) {
+    using camera::Helpers;
+    const uint32_t width = 322, height = 41;
+    const size_t num_pixels = width * height;
+    std::vector<uint8_t> yuyv(num_pixels * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 13 + i / 5);
+    }
+    Helpers helpers;
+    camera::WorkerPool pool(2);
+
+    std::vector<uint8_t> rgb, bgr, rgb32, gray, uyvy;
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_RGB, rgb, NULL);
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_BGR, bgr, &pool);
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_RGB32, rgb32, &pool);
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_GRAY, gray, &pool);
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_UYVY, uyvy, &pool);
+    BOOST_REQUIRE_EQUAL(bgr.size(), num_pixels * 3);
+    BOOST_REQUIRE_EQUAL(rgb32.size(), num_pixels * 4);
+    BOOST_REQUIRE_EQUAL(gray.size(), num_pixels);
+    BOOST_REQUIRE_EQUAL(uyvy.size(), num_pixels * 2);
+
+    bool equal = true;
+    for(size_t i=0; i<num_pixels; ++i) {
+        equal &= bgr[i*3] == rgb[i*3+2] && bgr[i*3+1] == rgb[i*3+1] && bgr[i*3+2] == rgb[i*3];
+        equal &= rgb32[i*4] == rgb[i*3] && rgb32[i*4+1] == rgb[i*3+1] && 
+                rgb32[i*4+2] == rgb[i*3+2] && rgb32[i*4+3] == 255;
+        equal &= gray[i] == yuyv[i*2];
+        equal &= uyvy[i*2] == yuyv[i*2+1] && uyvy[i*2+1] == yuyv[i*2];
+    }
+    BOOST_CHECK(equal);
+
+    BOOST_CHECK_EQUAL(Helpers::getYUYVConversion(base::samples::frame::MODE_GRAYSCALE), 
+            Helpers::YUYV_TO_GRAY);
+    BOOST_CHECK_EQUAL(Helpers::getYUYVConversion(base::samples::frame::MODE_JPEG), 
+            Helpers::YUYV_NO_CONVERSION);
+}
+
+BOOST_AUTO_TEST_CASE(yuyv_downscale_test) {
+    using camera::Helpers;
+    // Neither width nor height are multiples of 4.
+    const uint32_t width = 38, height = 23;
+    std::vector<uint8_t> yuyv(width * height * 2);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 29 + i / 7);
+    }
+    Helpers helpers;
+    camera::WorkerPool pool(3);
+    std::vector<uint8_t> expected_full;
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_BGR, expected_full, NULL);
+
+    unsigned int factors[] = {2, 4};
+    for(int f=0; f<2; ++f) {
+        unsigned int factor = factors[f];
+        uint32_t preview_width = width / factor, preview_height = height / factor;
+
+        // Reference: mean of the YUV values of each block, rounded.
+        std::vector<uint8_t> expected_rgb, expected_gray;
+        for(uint32_t py=0; py<preview_height; ++py) {
+            for(uint32_t px=0; px<preview_width; ++px) {
+                int y = 0, u = 0, v = 0;
+                for(uint32_t row=py*factor; row<(py+1)*factor; ++row) {
+                    for(uint32_t x=px*factor; x<(px+1)*factor; x+=2) {
+                        const uint8_t* pixel = &yuyv[(row * width + x) * 2];
+                        y += pixel[0] + pixel[2];
+                        u += pixel[1];
+                        v += pixel[3];
+                    }
+                }
+                int n = factor * factor;
+                uint8_t r, g, b;
+                helpers.convertYUYVPixel((y + n/2) / n, (u + n/4) / (n/2), (v + n/4) / (n/2), 
+                        r, g, b);
+                expected_rgb.push_back(r);
+                expected_rgb.push_back(g);
+                expected_rgb.push_back(b);
+                expected_gray.push_back((uint8_t)((y + n/2) / n));
+            }
+        }
+
+        std::vector<uint8_t> rgb, gray, full, preview;
+        helpers.convertYUYVDownscaled(yuyv.data(), width, height, factor, Helpers::YUYV_TO_RGB,
+                rgb, NULL);
+        BOOST_CHECK(rgb == expected_rgb);
+        helpers.convertYUYVDownscaled(yuyv.data(), width, height, factor, Helpers::YUYV_TO_GRAY,
+                gray, &pool);
+        BOOST_CHECK(gray == expected_gray);
+
+        // Full image and preview in one pass, serial and in row bands.
+        for(int use_pool=0; use_pool<2; ++use_pool) {
+            helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_BGR, full, 
+                    factor, Helpers::YUYV_TO_RGB, preview, use_pool ? &pool : NULL);
+            BOOST_CHECK(full == expected_full);
+            BOOST_CHECK(preview == expected_rgb);
+        }
+    }
+
+    BOOST_CHECK(Helpers::isDownscaleSupported(4, Helpers::YUYV_TO_RGB32));
+    BOOST_CHECK(!Helpers::isDownscaleSupported(3, Helpers::YUYV_TO_RGB));
+    BOOST_CHECK(!Helpers::isDownscaleSupported(2, Helpers::YUYV_TO_UYVY));
+}
+
+BOOST_AUTO_TEST_CASE(yuyv_stride_test) {
+    using camera::Helpers;
+    const uint32_t width = 38, height = 23;
+    const uint32_t yuyv_row_size = width * 2 + 12;
+    std::vector<uint8_t> yuyv(width * height * 2), padded(yuyv_row_size * height, 0xAB);
+    for(size_t i=0; i<yuyv.size(); ++i) {
+        yuyv[i] = (uint8_t)(i * 13 + i / 5);
+    }
+    Helpers::copyRows(yuyv.data(), width * 2, padded.data(), yuyv_row_size, width * 2, height);
+    BOOST_CHECK_EQUAL(Helpers::getPaddedRowSize(width * 3, 64), 128u);
+    BOOST_CHECK_EQUAL(Helpers::getPaddedRowSize(width * 3, 1), width * 3);
+
+    Helpers helpers;
+    camera::WorkerPool pool(3);
+    Helpers::YUYVConversion conversions[] = {Helpers::YUYV_TO_RGB, Helpers::YUYV_TO_RGB32, 
+            Helpers::YUYV_TO_GRAY, Helpers::YUYV_TO_UYVY};
+    for(int c=0; c<4; ++c) {
+        uint32_t row_bytes = width * Helpers::getYUYVConversionPixelSize(conversions[c]);
+        uint32_t row_size = Helpers::getPaddedRowSize(row_bytes, Helpers::DEFAULT_ROW_PADDING);
+        std::vector<uint8_t> expected, aligned;
+        helpers.convertYUYV(yuyv.data(), width, height, conversions[c], expected, NULL);
+        for(int use_pool=0; use_pool<2; ++use_pool) {
+            helpers.convertYUYV(padded.data(), width, height, conversions[c], aligned, 
+                    use_pool ? &pool : NULL, yuyv_row_size, row_size);
+            BOOST_REQUIRE_EQUAL(aligned.size(), row_size * height);
+            for(uint32_t y=0; y<height; ++y) {
+                BOOST_CHECK(memcmp(&aligned[y * row_size], &expected[y * row_bytes], 
+                        row_bytes) == 0);
+            }
+        }
+    }
+
+    // Preview with padded rows.
+    std::vector<uint8_t> expected, expected_preview, full, preview;
+    helpers.convertYUYV(yuyv.data(), width, height, Helpers::YUYV_TO_BGR, expected, 
+            2, Helpers::YUYV_TO_GRAY, expected_preview, NULL);
+    helpers.convertYUYV(padded.data(), width, height, Helpers::YUYV_TO_BGR, full, 
+            2, Helpers::YUYV_TO_GRAY, preview, &pool, yuyv_row_size, 128, 64);
+    BOOST_REQUIRE_EQUAL(preview.size(), 64u * (height / 2));
+    for(uint32_t y=0; y<height; ++y) {
+        BOOST_CHECK(memcmp(&full[y * 128], &expected[y * width * 3], width * 3) == 0);
+    }
+    for(uint32_t y=0; y<height/2; ++y) {
+        BOOST_CHECK(memcmp(&preview[y * 64], &expected_preview[y * (width / 2)], width / 2) == 0);
+    }
+}
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * \file    jpeg_test.h
+ *
+ * \brief   Boost tests for the JPEG decoding and encoding, no camera required.
+ */
+
+#ifndef _JPEG_TEST_H_
+#define _JPEG_TEST_H_
+
+#include <camera_usb/helpers.h>
+#include <camera_usb/jpeg_codec.h>
+#include <camera_usb/worker_pool.h>
+
+/**
+ * Compresses an RGB test image (standard huffman tables).
+ */
+static std::vector<uint8_t> createTestJpeg(uint32_t width, uint32_t height, int seed) {
+    std::vector<uint8_t> rgb(width * height * 3);
+    for(uint32_t y=0; y<height; ++y) {
+        for(uint32_t x=0; x<width; ++x) {
+            uint8_t* pixel = &rgb[(y * width + x) * 3];
+            pixel[0] = (uint8_t)(x * 255 / width + seed);
+            pixel[1] = (uint8_t)(y * 255 / height);
+            pixel[2] = (uint8_t)((x + y) * 4);
+        }
+    }
+
+    struct jpeg_compress_struct info;
+    struct jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_compress(&info);
+    unsigned char* data = NULL;
+    unsigned long size = 0;
+    jpeg_mem_dest(&info, &data, &size);
+    info.image_width = width;
+    info.image_height = height;
+    info.input_components = 3;
+    info.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, 90, TRUE);
+    jpeg_start_compress(&info, TRUE);
+    while(info.next_scanline < info.image_height) {
+        JSAMPROW row = &rgb[info.next_scanline * width * 3];
+        jpeg_write_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_compress(&info);
+    std::vector<uint8_t> jpeg(data, data + size);
+    jpeg_destroy_compress(&info);
+    free(data);
+    return jpeg;
+}
+
+/**
+ * Removes all DHT segments like many UVC cameras do.
+ */
+static std::vector<uint8_t> removeHuffmanTables(std::vector<uint8_t> const& jpeg) {
+    std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + 2);
+    size_t pos = 2;
+    while(pos + 4 <= jpeg.size() && jpeg[pos+1] != 0xDA) {
+        size_t length = 2 + (jpeg[pos+2] << 8 | jpeg[pos+3]);
+        if(jpeg[pos+1] != 0xC4) {
+            out.insert(out.end(), jpeg.begin() + pos, jpeg.begin() + pos + length);
+        }
+        pos += length;
+    }
+    out.insert(out.end(), jpeg.begin() + pos, jpeg.end());
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_huffman_tables_test) {
+    using camera::JpegDecoder;
+    std::vector<uint8_t> jpeg = createTestJpeg(96, 64, 0);
+    BOOST_CHECK(JpegDecoder::hasHuffmanTables(jpeg.data(), jpeg.size()));
+
+    std::vector<uint8_t> stripped = removeHuffmanTables(jpeg);
+    BOOST_REQUIRE(stripped.size() < jpeg.size());
+    BOOST_CHECK(!JpegDecoder::hasHuffmanTables(stripped.data(), stripped.size()));
+
+    std::vector<uint8_t> repaired;
+    JpegDecoder::insertHuffmanTables(stripped.data(), stripped.size(), repaired);
+    BOOST_CHECK(JpegDecoder::hasHuffmanTables(repaired.data(), repaired.size()));
+
+    // The inserted standard tables have to decode to the same image.
+    JpegDecoder decoder;
+    std::vector<uint8_t> image, image_repaired;
+    uint32_t width = 0, height = 0;
+    BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), base::samples::frame::MODE_RGB, 1,
+            image, &width, &height));
+    BOOST_REQUIRE(decoder.decode(repaired.data(), repaired.size(), base::samples::frame::MODE_RGB, 1,
+            image_repaired, &width, &height));
+    BOOST_CHECK(image == image_repaired);
+
+    // Corrupt images are reported, the decoder stays usable.
+    std::vector<uint8_t> corrupt(jpeg.begin(), jpeg.begin() + 100);
+    BOOST_CHECK(!decoder.decode(corrupt.data(), 20, base::samples::frame::MODE_RGB, 1,
+            image, &width, &height));
+    BOOST_CHECK(decoder.decode(jpeg.data(), jpeg.size(), base::samples::frame::MODE_RGB, 1,
+            image, &width, &height));
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_decode_modes_test) {
+    using camera::JpegDecoder;
+    using namespace base::samples::frame;
+    std::vector<uint8_t> jpeg = createTestJpeg(160, 120, 0);
+    JpegDecoder decoder;
+    std::vector<uint8_t> rgb, bgr, gray, scaled;
+    uint32_t width = 0, height = 0;
+
+    BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), MODE_RGB, 1, rgb, &width, &height));
+    BOOST_CHECK(width == 160 && height == 120);
+    BOOST_CHECK_EQUAL(rgb.size(), 160 * 120 * 3);
+    BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), MODE_BGR, 1, bgr, &width, &height));
+    BOOST_REQUIRE_EQUAL(bgr.size(), rgb.size());
+    bool swapped = true;
+    for(size_t i=0; i<rgb.size(); i+=3) {
+        swapped &= bgr[i] == rgb[i+2] && bgr[i+1] == rgb[i+1] && bgr[i+2] == rgb[i];
+    }
+    BOOST_CHECK(swapped);
+    BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), MODE_GRAYSCALE, 1, gray, &width, &height));
+    BOOST_CHECK_EQUAL(gray.size(), 160 * 120);
+    BOOST_CHECK(!decoder.decode(jpeg.data(), jpeg.size(), MODE_UYVY, 1, gray, &width, &height));
+
+    BOOST_CHECK_EQUAL(JpegDecoder::getScaleDenom(1920, 1080, 480, 270), 4u);
+    BOOST_CHECK_EQUAL(JpegDecoder::getScaleDenom(1920, 1080, 481, 270), 2u);
+    BOOST_CHECK_EQUAL(JpegDecoder::getScaleDenom(1920, 1080, 1920, 1080), 1u);
+    BOOST_CHECK_EQUAL(JpegDecoder::getScaleDenom(1920, 1080, 0, 0), 1u);
+    BOOST_CHECK_EQUAL(JpegDecoder::getScaleDenom(160, 120, 20, 15), 8u);
+
+    for(unsigned int denom=2; denom<=8; denom*=2) {
+        BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), MODE_RGB, denom, scaled,
+                &width, &height));
+        uint32_t expected_width = 0, expected_height = 0;
+        JpegDecoder::getScaledSize(160, 120, denom, &expected_width, &expected_height);
+        BOOST_CHECK(width == expected_width && height == expected_height);
+        BOOST_CHECK_EQUAL(scaled.size(), width * height * 3);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_decode_pipeline_test) {
+    using namespace base::samples::frame;
+    std::vector<std::vector<uint8_t> > jpegs, expected;
+    camera::JpegDecoder decoder;
+    for(int i=0; i<7; ++i) {
+        jpegs.push_back(removeHuffmanTables(createTestJpeg(320, 240, i * 30)));
+        std::vector<uint8_t> image;
+        uint32_t width = 0, height = 0;
+        decoder.decode(jpegs[i].data(), jpegs[i].size(), MODE_RGB, 2, image, &width, &height);
+        expected.push_back(image);
+    }
+
+    camera::WorkerPool pool(3);
+    camera::JpegDecodePipeline pipeline(&pool, MODE_RGB, 2);
+    BOOST_REQUIRE_EQUAL(pipeline.getDepth(), 3u);
+
+    // Keeps the pipeline full like CamConfig::getBuffer(), the order is preserved.
+    size_t next_push = 0, next_pop = 0;
+    std::vector<uint8_t> image;
+    uint32_t width = 0, height = 0;
+    while(next_pop < jpegs.size()) {
+        while(next_push < jpegs.size() && pipeline.getNumPending() < pipeline.getDepth()) {
+            BOOST_CHECK(pipeline.push(jpegs[next_push].data(), jpegs[next_push].size()));
+            next_push++;
+        }
+        if(next_push < jpegs.size()) {
+            BOOST_CHECK(!pipeline.push(jpegs[0].data(), jpegs[0].size()));
+        }
+        BOOST_REQUIRE(pipeline.pop(image, &width, &height));
+        BOOST_CHECK(width == 160 && height == 120);
+        BOOST_CHECK(image == expected[next_pop]);
+        next_pop++;
+    }
+    BOOST_CHECK(!pipeline.pop(image, &width, &height));
+}
+
+/**
+ * Smooth limited range YUYV test image.
+ */
+static std::vector<uint8_t> createTestYUYV(uint32_t width, uint32_t height, int seed) {
+    std::vector<uint8_t> yuyv(width * height * 2);
+    for(uint32_t y=0; y<height; ++y) {
+        for(uint32_t x=0; x<width; x+=2) {
+            uint8_t* pixel = &yuyv[(y * width + x) * 2];
+            pixel[0] = (uint8_t)(16 + (x * 219 / width + seed) % 220);
+            pixel[1] = (uint8_t)(16 + y * 224 / height);
+            pixel[2] = (uint8_t)(16 + ((x+1) * 219 / width + seed) % 220);
+            pixel[3] = (uint8_t)(240 - x * 224 / width);
+        }
+    }
+    return yuyv;
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_encode_yuyv_test) {
+    using namespace base::samples::frame;
+    // Not a multiple of the MCU size.
+    const uint32_t width = 202, height = 99;
+    std::vector<uint8_t> yuyv = createTestYUYV(width, height, 0);
+    camera::JpegEncoder encoder;
+    std::vector<uint8_t> jpeg;
+    BOOST_REQUIRE(encoder.encodeYUYV(yuyv.data(), width, height, 95, true, jpeg));
+    BOOST_CHECK(jpeg.size() > 0 && jpeg[0] == 0xFF && jpeg[1] == 0xD8);
+
+    // The decoded image has to match the RGB conversion of the YUYV image.
+    camera::JpegDecoder decoder;
+    std::vector<uint8_t> decoded, converted;
+    uint32_t decoded_width = 0, decoded_height = 0;
+    BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), MODE_RGB, 1, decoded,
+            &decoded_width, &decoded_height));
+    BOOST_CHECK(decoded_width == width && decoded_height == height);
+    camera::Helpers helpers;
+    helpers.convertYUYV2RGB(yuyv.data(), width, height, converted, NULL);
+    BOOST_REQUIRE_EQUAL(decoded.size(), converted.size());
+    double error_sum = 0;
+    for(size_t i=0; i<decoded.size(); ++i) {
+        error_sum += abs((int)decoded[i] - (int)converted[i]);
+    }
+    BOOST_CHECK_LT(error_sum / decoded.size(), 3.0);
+
+    // Quality is honoured, the output buffer is reused.
+    std::vector<uint8_t> jpeg_low;
+    BOOST_REQUIRE(encoder.encodeYUYV(yuyv.data(), width, height, 20, true, jpeg_low));
+    BOOST_CHECK_LT(jpeg_low.size(), jpeg.size());
+    BOOST_CHECK(!encoder.encodeYUYV(yuyv.data(), width - 1, height, 20, true, jpeg_low));
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_encode_pipeline_test) {
+    const uint32_t width = 320, height = 240;
+    std::vector<std::vector<uint8_t> > images, expected;
+    camera::JpegEncoder encoder;
+    for(int i=0; i<5; ++i) {
+        images.push_back(createTestYUYV(width, height, i * 40));
+        std::vector<uint8_t> jpeg;
+        encoder.encodeYUYV(images[i].data(), width, height, 80, true, jpeg);
+        expected.push_back(jpeg);
+    }
+
+    camera::WorkerPool pool(2);
+    camera::JpegEncodePipeline pipeline(&pool, width, height, 80, true);
+    size_t next_push = 0, next_pop = 0;
+    std::vector<uint8_t> jpeg;
+    uint32_t out_width = 0, out_height = 0;
+    while(next_pop < images.size()) {
+        while(next_push < images.size() && pipeline.getNumPending() < pipeline.getDepth()) {
+            BOOST_CHECK(pipeline.push(images[next_push].data(), images[next_push].size()));
+            next_push++;
+        }
+        BOOST_REQUIRE(pipeline.pop(jpeg, &out_width, &out_height));
+        BOOST_CHECK(out_width == width && out_height == height);
+        BOOST_CHECK(jpeg == expected[next_pop]);
+        next_pop++;
+    }
+
+    // Truncated images are rejected.
+    BOOST_CHECK(pipeline.push(images[0].data(), images[0].size() / 2));
+    BOOST_CHECK(!pipeline.pop(jpeg, &out_width, &out_height));
+}
+
+BOOST_AUTO_TEST_CASE(jpeg_stride_test) {
+    using namespace base::samples::frame;
+    const uint32_t width = 202, height = 99;
+    camera::JpegDecoder decoder;
+    camera::JpegEncoder encoder;
+
+    // Decoding into padded rows, the BGR swap has to skip the padding.
+    std::vector<uint8_t> jpeg = createTestJpeg(160, 120, 0);
+    frame_mode_t modes[] = {MODE_RGB, MODE_BGR, MODE_GRAYSCALE};
+    for(int m=0; m<3; ++m) {
+        std::vector<uint8_t> packed, aligned;
+        uint32_t w = 0, h = 0;
+        BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), modes[m], 1, packed, &w, &h));
+        BOOST_REQUIRE(decoder.decode(jpeg.data(), jpeg.size(), modes[m], 1, aligned, &w, &h, 64));
+        uint32_t row_bytes = packed.size() / h;
+        uint32_t row_size = camera::Helpers::getPaddedRowSize(row_bytes, 64);
+        BOOST_REQUIRE_EQUAL(aligned.size(), row_size * h);
+        for(uint32_t y=0; y<h; ++y) {
+            BOOST_CHECK(memcmp(&aligned[y * row_size], &packed[y * row_bytes], row_bytes) == 0);
+        }
+    }
+
+    // Encoding from padded rows gives the same image.
+    std::vector<uint8_t> yuyv = createTestYUYV(width, height, 0);
+    const uint32_t yuyv_row_size = width * 2 + 20;
+    std::vector<uint8_t> padded(yuyv_row_size * height, 0);
+    camera::Helpers::copyRows(yuyv.data(), width * 2, padded.data(), yuyv_row_size, width * 2, 
+            height);
+    std::vector<uint8_t> expected, encoded;
+    BOOST_REQUIRE(encoder.encodeYUYV(yuyv.data(), width, height, 90, true, expected));
+    BOOST_REQUIRE(encoder.encodeYUYV(padded.data(), width, height, 90, true, encoded, 
+            yuyv_row_size));
+    BOOST_CHECK(encoded == expected);
+
+    camera::JpegEncodePipeline pipeline(NULL, width, height, 90, true, yuyv_row_size);
+    uint32_t out_width = 0, out_height = 0;
+    BOOST_CHECK(pipeline.push(padded.data(), padded.size() - 20));
+    BOOST_REQUIRE(pipeline.pop(encoded, &out_width, &out_height));
+    BOOST_CHECK(encoded == expected);
+}
+
+#endif
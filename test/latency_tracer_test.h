@@ -0,0 +1,71 @@
+/*
+ * \file    latency_tracer_test.h
+ *
+ * \brief   Boost tests for the latency histograms, no camera required.
+ */
+
+#ifndef _LATENCY_TRACER_TEST_H_
+#define _LATENCY_TRACER_TEST_H_
+
+#include <camera_usb/latency_tracer.h>
+
+BOOST_AUTO_TEST_CASE(latency_histogram_test) {
+    using camera::LatencyHistogram;
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucket(0), 0u);
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucket(1), 1u);
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucket(3), 2u);
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucket(1000), 10u);
+    BOOST_CHECK_EQUAL(LatencyHistogram::getBucket((int64_t)1 << 40), 
+            LatencyHistogram::NUM_BUCKETS - 1);
+
+    LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.getPercentile(0.5), 0);
+    for(int i=0; i<99; ++i) {
+        histogram.add(100);
+    }
+    histogram.add(5000);
+    histogram.add(-3); // Counted as 0.
+    BOOST_CHECK_EQUAL(histogram.getCount(), 101u);
+    BOOST_CHECK_EQUAL(histogram.getMin(), 0);
+    BOOST_CHECK_EQUAL(histogram.getMax(), 5000);
+    BOOST_CHECK_EQUAL(histogram.getMean(), (99 * 100 + 5000) / 101);
+    BOOST_CHECK_EQUAL(histogram.getPercentile(0.5), 128);
+    BOOST_CHECK_EQUAL(histogram.getPercentile(1.0), 5000);
+    histogram.clear();
+    BOOST_CHECK_EQUAL(histogram.getCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(latency_tracer_test) {
+    camera::LatencyTracer tracer;
+    unsigned int source = tracer.addStage("source");
+    unsigned int convert = tracer.addStage("convert");
+    unsigned int sink = tracer.addStage("sink");
+    for(uint64_t id=0; id<100; ++id) {
+        int64_t time = 1000000 + id * 33333;
+        tracer.record(source, id, time + 500, time);
+        if(id % 10 == 0) {
+            continue; // Dropped by the converter.
+        }
+        tracer.record(convert, id, time + 2500);
+        tracer.record(sink, id, time + 2600);
+    }
+    // Unknown images without a start time only enter the chain.
+    tracer.record(sink, 1000, 5000000);
+
+    std::vector<camera::LatencyTracer::Stage> stages = tracer.getStages();
+    BOOST_REQUIRE_EQUAL(stages.size(), 3u);
+    BOOST_CHECK_EQUAL(stages[0].mName, "source");
+    BOOST_CHECK_EQUAL(stages[0].mHistogram.getCount(), 100u);
+    BOOST_CHECK_EQUAL(stages[0].mHistogram.getMean(), 500);
+    BOOST_CHECK_EQUAL(stages[1].mHistogram.getCount(), 90u);
+    BOOST_CHECK_EQUAL(stages[1].mHistogram.getMean(), 2000);
+    BOOST_CHECK_EQUAL(stages[2].mHistogram.getCount(), 90u);
+    BOOST_CHECK_EQUAL(stages[2].mHistogram.getMax(), 100);
+
+    tracer.reset();
+    BOOST_CHECK_EQUAL(tracer.getStages()[1].mHistogram.getCount(), 0u);
+    tracer.clear();
+    BOOST_CHECK(tracer.getStages().empty());
+}
+
+#endif
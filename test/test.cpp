@@ -7,6 +7,13 @@
 #include "gst_test.h"
 #include "restart_test.h"
 #include "usb_test.h"
+#include "helpers_test.h"
+#include "jpeg_test.h"
+#include "bayer_test.h"
+#include "frame_pool_test.h"
+#include "latency_tracer_test.h"
+#include "test_device_test.h"
+#include "fake_v4l2_test.h"
 
 // You can use the following setups: 
 // BOOST_CHECK_MESSAGE(1 == 1, "Send test sucessfully");
@@ -0,0 +1,74 @@
+/*
+ * \file    test_device_test.h
+ *
+ * \brief   Boost tests for the hardware-free test devices ("test://...").
+ */
+
+#ifndef _TEST_DEVICE_TEST_H_
+#define _TEST_DEVICE_TEST_H_
+
+#include <camera_usb/test_device.h>
+
+BOOST_AUTO_TEST_CASE(test_device_uri_test) {
+    using camera::TestDevice;
+    BOOST_CHECK(TestDevice::isTestDevice("test://640x480@30/YUY2"));
+    BOOST_CHECK(!TestDevice::isTestDevice("/dev/video0"));
+
+    TestDevice device;
+    BOOST_CHECK(device.parse("test://320x240@15/GRAY8"));
+    BOOST_CHECK_EQUAL(device.mWidth, 320u);
+    BOOST_CHECK_EQUAL(device.mHeight, 240u);
+    BOOST_CHECK_EQUAL(device.mFps, 15u);
+    BOOST_CHECK_EQUAL(device.mFormat, "GRAY8");
+    BOOST_CHECK_EQUAL(device.getSourceDescription(), 
+            "videotestsrc is-live=true ! video/x-raw,format=GRAY8");
+
+    TestDevice defaults;
+    BOOST_CHECK(defaults.parse("test://"));
+    BOOST_CHECK_EQUAL(defaults.mWidth, 640u);
+    BOOST_CHECK_EQUAL(defaults.mHeight, 480u);
+    BOOST_CHECK_EQUAL(defaults.mFps, 30u);
+    BOOST_CHECK_EQUAL(defaults.mFormat, "YUY2");
+
+    TestDevice jpeg;
+    BOOST_CHECK(jpeg.parse("test:///MJPG"));
+    BOOST_CHECK_EQUAL(jpeg.getSourceDescription(), "videotestsrc is-live=true ! jpegenc");
+
+    TestDevice malformed;
+    BOOST_CHECK(!malformed.parse("test://640x"));
+    BOOST_CHECK(!malformed.parse("test://640x480@0"));
+    BOOST_CHECK(!malformed.parse("test://640x480/"));
+    BOOST_CHECK(!malformed.parse("/dev/video0"));
+}
+
+BOOST_AUTO_TEST_CASE(test_device_controls_test) {
+    camera::TestControls controls;
+    int32_t value = 0;
+    BOOST_CHECK(controls.isControlIdValid(V4L2_CID_BRIGHTNESS));
+    BOOST_CHECK(controls.isControlIdWritable(V4L2_CID_BRIGHTNESS));
+    BOOST_CHECK(!controls.isControlIdValid(V4L2_CID_IRIS_ABSOLUTE));
+    BOOST_CHECK(controls.getControlValue(V4L2_CID_BRIGHTNESS, &value));
+    BOOST_CHECK_EQUAL(value, 128);
+
+    // Values are clamped to the range of the control.
+    controls.writeControlValue(V4L2_CID_BRIGHTNESS, 1000);
+    BOOST_CHECK(controls.getControlValue(V4L2_CID_BRIGHTNESS, &value));
+    BOOST_CHECK_EQUAL(value, 255);
+    BOOST_REQUIRE_THROW(controls.writeControlValue(V4L2_CID_IRIS_ABSOLUTE, 1), 
+            std::runtime_error);
+
+    std::string name;
+    int32_t minimum = -1, maximum = -1;
+    BOOST_CHECK(controls.getControlName(V4L2_CID_EXPOSURE_ABSOLUTE, &name));
+    BOOST_CHECK_EQUAL(name, "Exposure (Absolute)");
+    BOOST_CHECK(controls.getControlMinimum(V4L2_CID_EXPOSURE_ABSOLUTE, &minimum));
+    BOOST_CHECK(controls.getControlMaximum(V4L2_CID_EXPOSURE_ABSOLUTE, &maximum));
+    BOOST_CHECK_EQUAL(minimum, 3);
+    BOOST_CHECK_EQUAL(maximum, 2047);
+
+    controls.setControlValuesToDefault();
+    BOOST_CHECK(controls.getControlValue(V4L2_CID_BRIGHTNESS, &value));
+    BOOST_CHECK_EQUAL(value, 128);
+}
+
+#endif
@@ -151,5 +151,38 @@ BOOST_AUTO_TEST_CASE(work_with_v4l2_controls_directly) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(test_device_usb_test) {
+    std::cout << "TEST DEVICE" << std::endl;
+    using namespace base::samples::frame;
+    camera::CamUsb test_usb("test://320x240@30/YUY2");
+    std::vector<camera::CamInfo> test_infos;
+    BOOST_CHECK(test_usb.listCameras(test_infos) == 1);
+    BOOST_CHECK(test_usb.open(test_infos[0]) == true);
+
+    // Emulated controls.
+    BOOST_CHECK(test_usb.isV4L2AttribAvail(V4L2_CID_BRIGHTNESS));
+    BOOST_CHECK(test_usb.setV4L2Attrib(V4L2_CID_BRIGHTNESS, 100));
+    BOOST_CHECK_EQUAL(test_usb.getV4L2Attrib(V4L2_CID_BRIGHTNESS), 100);
+    int min = 0, max = 0;
+    BOOST_REQUIRE_NO_THROW(test_usb.getRange(camera::int_attrib::BrightnessValue, min, max));
+    BOOST_CHECK_EQUAL(max, 255);
+    BOOST_CHECK_EQUAL(test_usb.getAttrib(camera::double_attrib::FrameRate), 30);
+
+    BOOST_CHECK(test_usb.setFrameSettings(frame_size_t(320, 240), MODE_RGB, 3));
+    BOOST_REQUIRE_THROW(test_usb.grab(camera::SingleFrame), std::runtime_error);
+    BOOST_CHECK(test_usb.grab(camera::Continuously) == true);
+    Frame frame;
+    for(int i=0; i<10; i++) {
+        BOOST_CHECK(test_usb.retrieveFrame(frame, 2000) == true);
+    }
+    BOOST_CHECK_EQUAL(frame.getWidth(), 320);
+    BOOST_CHECK_EQUAL(frame.getHeight(), 240);
+    BOOST_CHECK_EQUAL(frame.getFrameMode(), MODE_RGB);
+    BOOST_CHECK(test_usb.grab(camera::Stop) == true);
+
+    // The controls survive the pipeline.
+    BOOST_CHECK_EQUAL(test_usb.getV4L2Attrib(V4L2_CID_BRIGHTNESS), 100);
+}
+
 
 #endif